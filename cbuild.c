@@ -6,6 +6,9 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
+#include <string.h>
+
 
 
 
@@ -16,11 +19,21 @@
 #include "package/package.h"
 #include "package/import.h"
 #include "makefile.h"
+#include "manifest.h"
+#include "pipeline.h"
 #include "cli.h"
+#include "utils/stats.h"
+#include "package/atomic-stream.h"
+#include "utils/uring.h"
+#include "utils/jobserver.h"
+#include "profile.h"
+#include "pgo.h"
+#include "package/fs.h"
+#include "package/context.h"
 
-package_t * generate(const char * filename, bool force, bool no_output) {
+package_t * generate(cbuild_ctx_t * ctx, const char * filename) {
   char * error = NULL;
-  package_t * pkg = index_new(filename, &error, force, no_output);
+  package_t * pkg = index_new(ctx, filename, &error);
   lex_item_unfreed();
 
   /*if (pkg == NULL || pkg->errors > 0) return NULL;*/
@@ -32,12 +45,85 @@ package_t * generate(const char * filename, bool force, bool no_output) {
   return pkg;
 }
 
+static void write_manifest(package_t * root, const char * filename) {
+  char * target = makefile_target_name(root);
+  manifest_write(root, filename, target);
+  free(target);
+}
+
 typedef struct {
-  bool force;
+  bool         force;
+  bool         stats;
+  bool         io_uring;
+  bool         window;
+  bool         coarse;
+  bool         use_pgo;
+  bool         shared;
+  bool         internal;
+  long         lex_threads;
+  long         jobs;
+  const char * fsync;
+  const char * profile_name;
+  const char * train;
+  const profile_t * profile;
+  cbuild_ctx_t * ctx;
 } options_t;
 
+/* the context whose ring still has to be drained, exit(-1) on an error mustn't lose what it queued */
+static cbuild_ctx_t * writing = NULL;
+
+static void drain_writes() {
+  if (writing) uring_drain(writing->disk.writes.ring);
+}
+
+static int set_options(options_t * opts) {
+  opts->ctx->force  = opts->force;
+  opts->ctx->window = opts->window;
+  opts->ctx->coarse = opts->coarse;
+  opts->ctx->shared = opts->shared;
+  opts->ctx->internal = opts->internal;
+  opts->ctx->lex_threads = opts->lex_threads;
+  opts->ctx->jobserver   = jobserver_join();
+  if (opts->stats)    opts->ctx->stats = stats_start();
+  if (opts->io_uring) {
+    opts->ctx->disk.writes.ring = uring_new();
+    if (opts->ctx->disk.writes.ring == NULL) {
+      fprintf(stderr, "warning: io_uring is unavailable, using plain syscalls\n");
+    } else {
+      writing = opts->ctx;
+      atexit(drain_writes);
+    }
+  }
+
+  if (opts->fsync) {
+    int policy = atomic_stream_sync_from_string(opts->fsync);
+    if (policy < 0) {
+      fprintf(stderr, "unknown fsync policy '%s', expected none, file or dir\n", opts->fsync);
+      return -1;
+    }
+    opts->ctx->disk.writes.sync = policy;
+  }
+
+  if (opts->profile_name) {
+    opts->profile = profile_find(opts->profile_name);
+    if (opts->profile == NULL) {
+      char * names = profile_names();
+      fprintf(stderr, "unknown profile '%s', expected %s\n", opts->profile_name, names);
+      free(names);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* sources generated with the other linkage look up to date, so they are all generated again */
+static void check_linkage(options_t * opts, manifest_t * last) {
+  if (last != NULL && last->internal != opts->ctx->internal) opts->ctx->force = true;
+}
+
 int do_generate(cli_t * cli, char * cmd, void * arg) {
   options_t * opts = (options_t*) arg;
+  if (set_options(opts) != 0) return -1;
 
   if (cli->argc < 1) {
     fprintf(stderr, "no root module specified\n");
@@ -45,23 +131,108 @@ int do_generate(cli_t * cli, char * cmd, void * arg) {
   }
   if (opts->force) printf("FORCED REBUILD\n");
 
-  package_t * root = generate(cli->argv[0], opts->force, false);
+  manifest_t * last = manifest_load(opts->ctx, cli->argv[0]);
+  check_linkage(opts, last);
+  manifest_free(last);
+
+  package_t * root = generate(opts->ctx, cli->argv[0]);
   if (root == NULL) exit(-1);
+  write_manifest(root, cli->argv[0]);
+  if (atomic_stream_finish(&opts->ctx->disk.writes) != 0) exit(-1);
   return 0;
 }
 
+/* builds `module` with `prof`, returns make's status and the target and makefile it used */
+static int build(options_t * opts, const char * module, const profile_t * prof, char ** target, char ** mk) {
+  // nothing changed since the last generation, so there is nothing to parse, unless it
+  // made the other kind of library
+  manifest_t * last = opts->force ? NULL : manifest_load(opts->ctx, module);
+  check_linkage(opts, last);
+  if (last != NULL && !opts->ctx->force && manifest_fresh(last) && makefile_same_kind(last->target, opts->ctx)) {
+    *target = strdup(last->target);
+    *mk     = strdup(last->makefile);
+    int result = makefile_make_target(opts->ctx, last->target, prof, strdup(last->makefile));
+    manifest_free(last);
+    return result;
+  }
+  manifest_free(last);
+
+  // objects are compiled as their packages are generated, make links them and catches up.
+  // Run from a `make -j`, that make's jobserver decides how many at once, otherwise this
+  // is the jobserver for the compiles and the make it runs
+  long jobs = opts->jobs > 0 ? opts->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+  if (opts->ctx->jobserver == NULL) {
+    opts->ctx->jobserver = jobserver_new(jobs);
+  } else if (opts->jobs <= 0) {
+    jobs = LONG_MAX;
+  }
+  pipeline_t * compiling = pipeline_new(opts->ctx, module, prof, jobs);
+
+  package_t * root = generate(opts->ctx, module);
+  if (root == NULL) {
+    pipeline_free(compiling);
+    exit(-1);
+  }
+
+  char * mkfile_name = makefile_write(root, module);
+  write_manifest(root, module);
+  if (atomic_stream_finish(&opts->ctx->disk.writes) != 0) exit(-1);
+  pipeline_finish(compiling);
+  pipeline_free(compiling);
+
+  *target = makefile_target_name(root);
+  *mk     = strdup(mkfile_name);
+  return makefile_make(root, prof, mkfile_name);
+}
+
+/*
+ * With --train the instrumented build is made and trained first, and the optimized one
+ * is made from the same makefile after it, without parsing a second time
+ */
+static int build_pgo(options_t * opts, const char * module) {
+  const profile_t * base = opts->profile ? opts->profile : profile_find("release");
+  pgo_t * guided = pgo_new(base, module);
+  if (guided == NULL) {
+    fprintf(stderr, "cannot find '%s'\n", module);
+    return -1;
+  }
+
+  char * target = NULL, * mk = NULL;
+  int result = 0;
+  if (opts->train) {
+    result = build(opts, module, &guided->instrumented, &target, &mk);
+    if (result == 0) result = pgo_train(guided, target, opts->train) == 0 ? 0 : -1;
+    if (result == 0) result = makefile_make_target(opts->ctx, target, &guided->optimized, strdup(mk));
+  } else {
+    if (!pgo_trained(guided)) {
+      fprintf(stderr, "warning: no profiles for --pgo yet, build with --train \"<command>\" first\n");
+    }
+    result = build(opts, module, &guided->optimized, &target, &mk);
+  }
+
+  free(target);
+  free(mk);
+  pgo_free(guided);
+  return result;
+}
+
 int do_build(cli_t * cli, char * cmd, void * arg) {
   options_t * opts = (options_t*) arg;
+  if (set_options(opts) != 0) return -1;
   if (cli->argc < 1) {
     fprintf(stderr, "no root module specified\n");
     return -1;
   }
 
-  package_t * root = generate(cli->argv[0], opts->force, false);
-  if (root == NULL) exit(-1);
-
-  char * mkfile_name = makefile_write(root, cli->argv[0]);
-  int result = makefile_make(root, mkfile_name);
+  int result;
+  if (opts->use_pgo || opts->train) {
+    result = build_pgo(opts, cli->argv[0]);
+  } else {
+    char * target = NULL, * mk = NULL;
+    result = build(opts, cli->argv[0], opts->profile, &target, &mk);
+    free(target);
+    free(mk);
+  }
   if (result != 0) exit(result);
   return 0;
 }
@@ -72,11 +243,11 @@ void clean_generated(package_t * pkg) {
 
   if (pkg->generated) {
     printf("unlink: %s\n", pkg->generated);
-    unlink(pkg->generated);
+    fs_unlink(pkg->ctx->fs, pkg->generated);
   }
   if (pkg->header) {
     printf("unlink: %s\n", pkg->header);
-    unlink(pkg->header);
+    fs_unlink(pkg->ctx->fs, pkg->header);
   }
 
   hash_each_val(pkg->deps, {
@@ -87,24 +258,39 @@ void clean_generated(package_t * pkg) {
 
 int do_clean(cli_t * cli, char * cmd, void * arg) {
   options_t * opts = (options_t*) arg;
+  if (set_options(opts) != 0) return -1;
 
   if (cli->argc < 1) {
     fprintf(stderr, "no root module specified\n");
     return -1;
   }
 
-  package_t * root = generate(cli->argv[0], opts->force, true);
+  // the last generation's outputs are listed, so the graph doesn't have to be parsed again
+  manifest_t * last = manifest_load(opts->ctx, cli->argv[0]);
+  if (last != NULL && last->makefile != NULL && last->target != NULL) {
+    int result = makefile_clean_target(last->target, opts->profile, strdup(last->makefile));
+    manifest_clean(last);
+    manifest_free(last);
+    if (result != 0) exit(result);
+    return 0;
+  }
+  manifest_free(last);
+
+  opts->ctx->silent = true;
+  package_t * root = generate(opts->ctx, cli->argv[0]);
   if (root == NULL) exit(-1);
 
   char * mkfile_name = makefile_write(root, cli->argv[0]);
-  int result = makefile_clean(root, mkfile_name);
+  if (atomic_stream_finish(&opts->ctx->disk.writes) != 0) exit(-1);
+  int result = makefile_clean(root, opts->profile, mkfile_name);
   clean_generated(root);
+  manifest_discard(opts->ctx, cli->argv[0]);
   if (result != 0) exit(result);
   return 0;
 }
 
 int main(int argc, const char ** argv){
-  options_t options = {0};
+  options_t options = { .ctx = cbuild_ctx_new() };
 
   cli_t * c = cli_new("<root module>");
   cli_flag_bool(c, &options.force, (cli_flag_options) {
@@ -112,6 +298,64 @@ int main(int argc, const char ** argv){
       .short_name  = "f",
       .description = "force rebuilding assets",
   });
+  cli_flag_bool(c, &options.stats, (cli_flag_options) {
+      .long_name   = "stats",
+      .description = "print lexer, parser and package graph counters",
+  });
+  cli_flag_string(c, &options.fsync, (cli_flag_options) {
+      .long_name   = "fsync",
+      .description = "durability of generated files: none (default), file or dir",
+  });
+  cli_flag_bool(c, &options.io_uring, (cli_flag_options) {
+      .long_name   = "io-uring",
+      .description = "write generated files through io_uring (Linux)",
+  });
+
+  cli_flag_bool(c, &options.window, (cli_flag_options) {
+      .long_name   = "window",
+      .description = "only keep the part of each source being lexed in memory, for very large modules",
+  });
+
+  cli_flag_bool(c, &options.coarse, (cli_flag_options) {
+      .long_name   = "coarse",
+      .description = "lex the C between modular C constructs as a few large tokens",
+  });
+
+  cli_flag_int(c, &options.lex_threads, (cli_flag_options) {
+      .long_name   = "lex-threads",
+      .description = "lex modules of a megabyte or more on up to this many threads",
+  });
+
+  cli_flag_int(c, &options.jobs, (cli_flag_options) {
+      .long_name   = "jobs",
+      .short_name  = "j",
+      .description = "compile up to this many objects at once while generating (default: one per CPU)",
+  });
+
+  cli_flag_string(c, &options.profile_name, (cli_flag_options) {
+      .long_name   = "profile",
+      .description = "build under .cbuild/<profile> with its flags: debug or release (LTO, unused sections dropped)",
+  });
+
+  cli_flag_bool(c, &options.shared, (cli_flag_options) {
+      .long_name   = "shared",
+      .description = "link a library as a shared object, with only its exports dynamic",
+  });
+
+  cli_flag_bool(c, &options.internal, (cli_flag_options) {
+      .long_name   = "internal-linkage",
+      .description = "make what modules define without exporting static, warning about names that collide",
+  });
+
+  cli_flag_bool(c, &options.use_pgo, (cli_flag_options) {
+      .long_name   = "pgo",
+      .description = "build optimized with the profiles the last --train collected",
+  });
+
+  cli_flag_string(c, &options.train, (cli_flag_options) {
+      .long_name   = "train",
+      .description = "with --pgo, build instrumented and run this command, with $CBUILD_TARGET, to collect profiles first",
+  });
 
   cli_command(c, "build",    do_build,    "generate code and build",      true,  &options);
   cli_command(c, "generate", do_generate, "generate .c .h and .mk files", false, &options);
@@ -119,5 +363,10 @@ int main(int argc, const char ** argv){
 
   int result = cli_parse(c, argc, argv);
   cli_free(c);
+  jobserver_free(options.ctx->jobserver);
+
+  stats_report(options.ctx->stats, stderr);
+  writing = NULL;
+  cbuild_ctx_free(options.ctx);
   return result;
 }
\ No newline at end of file
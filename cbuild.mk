@@ -1,86 +1,169 @@
+OBJECTS_cbuild := \
+	$(PROFILE_DIR)cbuild.o \
+	$(PROFILE_DIR)cli.o \
+	$(PROFILE_DIR)deps/hash/hash.o \
+	$(PROFILE_DIR)lexer/item.o \
+	$(PROFILE_DIR)utils/strings.o \
+	$(PROFILE_DIR)makefile.o \
+	$(PROFILE_DIR)deps/stream/stream.o \
+	$(PROFILE_DIR)package/context.o \
+	$(PROFILE_DIR)package/fs.o \
+	$(PROFILE_DIR)deps/stream/file.o \
+	$(PROFILE_DIR)package/atomic-stream.o \
+	$(PROFILE_DIR)utils/uring.o \
+	$(PROFILE_DIR)package/paths.o \
+	$(PROFILE_DIR)utils/stats.o \
+	$(PROFILE_DIR)utils/utils.o \
+	$(PROFILE_DIR)utils/jobserver.o \
+	$(PROFILE_DIR)package/export.o \
+	$(PROFILE_DIR)package/package.o \
+	$(PROFILE_DIR)package/import.o \
+	$(PROFILE_DIR)profile.o \
+	$(PROFILE_DIR)manifest.o \
+	$(PROFILE_DIR)package/index.o \
+	$(PROFILE_DIR)parser/grammer.o \
+	$(PROFILE_DIR)lexer/lex.o \
+	$(PROFILE_DIR)lexer/buffer.o \
+	$(PROFILE_DIR)lexer/parallel.o \
+	$(PROFILE_DIR)lexer/syntax.o \
+	$(PROFILE_DIR)parser/build.o \
+	$(PROFILE_DIR)parser/parser.o \
+	$(PROFILE_DIR)lexer/stack.o \
+	$(PROFILE_DIR)parser/string.o \
+	$(PROFILE_DIR)parser/export.o \
+	$(PROFILE_DIR)parser/identifier.o \
+	$(PROFILE_DIR)parser/linkage.o \
+	$(PROFILE_DIR)parser/import.o \
+	$(PROFILE_DIR)parser/package.o \
+	$(PROFILE_DIR)pgo.o \
+	$(PROFILE_DIR)pipeline.o
+
+$(PROFILE_DIR)cbuild: $(OBJECTS_cbuild)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(LDFLAGS) $(PROFILE_LDFLAGS) $(OBJECTS_cbuild) -o $@ $(LDLIBS)
+
+CLEAN_cbuild:
+	rm -rf $(PROFILE_DIR)cbuild $(OBJECTS_cbuild)
+
+$(PROFILE_DIR)%.o: %.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
 #dependencies for package 'cbuild.c'
 CFLAGS += -std=c99
 CFLAGS += -D_DEFAULT_SOURCE
 CFLAGS += -D_GNU_SOURCE
-cbuild.o: cbuild.c package/import.h cli.h makefile.h lexer/item.h package/index.h package/package.h
+CFLAGS += -DCBUILD_STATS
+$(PROFILE_DIR)cbuild.o: cbuild.c cli.h lexer/item.h makefile.h manifest.h package/atomic-stream.h package/context.h package/fs.h package/import.h package/index.h package/package.h pgo.h pipeline.h profile.h utils/jobserver.h utils/stats.h utils/uring.h
 
-#dependencies for package 'package/import.c'
-package/import.o: package/import.c package/package.h package/export.h
+#dependencies for package 'cli.c'
+$(PROFILE_DIR)cli.o: cli.c
 
 #dependencies for package 'deps/hash/hash.c'
-deps/hash/hash.o: deps/hash/hash.c
+$(PROFILE_DIR)deps/hash/hash.o: deps/hash/hash.c
 
-#dependencies for package 'package/package.c'
-package/package.o: package/package.c deps/stream/stream.h
+#dependencies for package 'lexer/item.c'
+$(PROFILE_DIR)lexer/item.o: lexer/item.c utils/strings.h
+
+#dependencies for package 'utils/strings.c'
+$(PROFILE_DIR)utils/strings.o: utils/strings.c
+
+#dependencies for package 'makefile.c'
+$(PROFILE_DIR)makefile.o: makefile.c deps/stream/stream.h package/context.h package/export.h package/fs.h package/import.h package/package.h profile.h utils/stats.h utils/utils.h
 
 #dependencies for package 'deps/stream/stream.c'
-deps/stream/stream.o: deps/stream/stream.c
+$(PROFILE_DIR)deps/stream/stream.o: deps/stream/stream.c
 
-#dependencies for package 'package/export.c'
-package/export.o: package/export.c deps/stream/stream.h utils/utils.h utils/strings.h package/atomic-stream.h package/package.h
+#dependencies for package 'package/context.c'
+$(PROFILE_DIR)package/context.o: package/context.c package/fs.h package/paths.h utils/jobserver.h utils/stats.h utils/uring.h
 
-#dependencies for package 'utils/utils.c'
-utils/utils.o: utils/utils.c
+#dependencies for package 'package/fs.c'
+$(PROFILE_DIR)package/fs.o: package/fs.c deps/stream/file.h deps/stream/stream.h package/atomic-stream.h
 
-#dependencies for package 'utils/strings.c'
-utils/strings.o: utils/strings.c
+#dependencies for package 'deps/stream/file.c'
+$(PROFILE_DIR)deps/stream/file.o: deps/stream/file.c deps/stream/stream.h
 
 #dependencies for package 'package/atomic-stream.c'
-package/atomic-stream.o: package/atomic-stream.c deps/stream/stream.h
+$(PROFILE_DIR)package/atomic-stream.o: package/atomic-stream.c deps/stream/stream.h utils/uring.h
 
-#dependencies for package 'cli.c'
-cli.o: cli.c
+#dependencies for package 'utils/uring.c'
+$(PROFILE_DIR)utils/uring.o: utils/uring.c
 
-#dependencies for package 'makefile.c'
-makefile.o: makefile.c deps/stream/stream.h utils/utils.h package/package.h package/export.h package/import.h package/atomic-stream.h
+#dependencies for package 'package/paths.c'
+$(PROFILE_DIR)package/paths.o: package/paths.c deps/stream/stream.h package/fs.h utils/stats.h utils/utils.h
 
-#dependencies for package 'lexer/item.c'
-lexer/item.o: lexer/item.c utils/strings.h
+#dependencies for package 'utils/stats.c'
+$(PROFILE_DIR)utils/stats.o: utils/stats.c lexer/item.h utils/utils.h
 
-#dependencies for package 'package/index.c'
-package/index.o: package/index.c deps/stream/stream.h utils/utils.h parser/grammer.h package/export.h package/import.h package/package.h package/atomic-stream.h deps/stream/file.h parser/parser.h
+#dependencies for package 'utils/utils.c'
+$(PROFILE_DIR)utils/utils.o: utils/utils.c
 
-#dependencies for package 'parser/grammer.c'
-parser/grammer.o: parser/grammer.c deps/stream/stream.h parser/parser.h lexer/item.h lexer/syntax.h parser/import.h package/package.h parser/package.h parser/export.h parser/identifier.h parser/build.h lexer/lex.h
+#dependencies for package 'utils/jobserver.c'
+$(PROFILE_DIR)utils/jobserver.o: utils/jobserver.c
 
-#dependencies for package 'parser/parser.c'
-parser/parser.o: parser/parser.c lexer/stack.h lexer/item.h package/package.h lexer/lex.h
+#dependencies for package 'package/export.c'
+$(PROFILE_DIR)package/export.o: package/export.c deps/stream/stream.h package/context.h package/package.h package/paths.h utils/stats.h utils/strings.h
 
-#dependencies for package 'lexer/stack.c'
-lexer/stack.o: lexer/stack.c lexer/item.h
+#dependencies for package 'package/package.c'
+$(PROFILE_DIR)package/package.o: package/package.c deps/stream/stream.h package/context.h utils/stats.h
+
+#dependencies for package 'package/import.c'
+$(PROFILE_DIR)package/import.o: package/import.c package/export.h package/package.h package/paths.h
+
+#dependencies for package 'profile.c'
+$(PROFILE_DIR)profile.o: profile.c
+
+#dependencies for package 'manifest.c'
+$(PROFILE_DIR)manifest.o: manifest.c deps/stream/stream.h package/context.h package/fs.h package/import.h package/package.h package/paths.h utils/stats.h utils/utils.h
+
+#dependencies for package 'package/index.c'
+$(PROFILE_DIR)package/index.o: package/index.c deps/stream/stream.h package/context.h package/export.h package/fs.h package/import.h package/package.h package/paths.h parser/grammer.h parser/linkage.h parser/parser.h utils/stats.h
+
+#dependencies for package 'parser/grammer.c'
+$(PROFILE_DIR)parser/grammer.o: parser/grammer.c deps/stream/stream.h lexer/item.h lexer/lex.h lexer/parallel.h lexer/syntax.h package/context.h package/package.h parser/build.h parser/export.h parser/identifier.h parser/import.h parser/linkage.h parser/package.h parser/parser.h utils/jobserver.h
 
 #dependencies for package 'lexer/lex.c'
-lexer/lex.o: lexer/lex.c deps/stream/stream.h lexer/buffer.h lexer/item.h
+$(PROFILE_DIR)lexer/lex.o: lexer/lex.c deps/stream/stream.h lexer/buffer.h lexer/item.h utils/stats.h
 
 #dependencies for package 'lexer/buffer.c'
-lexer/buffer.o: lexer/buffer.c lexer/item.h
+$(PROFILE_DIR)lexer/buffer.o: lexer/buffer.c lexer/item.h utils/stats.h
+
+#dependencies for package 'lexer/parallel.c'
+LDLIBS += -lpthread
+$(PROFILE_DIR)lexer/parallel.o: lexer/parallel.c deps/stream/stream.h lexer/buffer.h lexer/item.h lexer/lex.h utils/stats.h
 
 #dependencies for package 'lexer/syntax.c'
-lexer/syntax.o: lexer/syntax.c lexer/lex.h deps/stream/stream.h
+$(PROFILE_DIR)lexer/syntax.o: lexer/syntax.c deps/stream/stream.h lexer/item.h lexer/lex.h
 
-#dependencies for package 'parser/import.c'
-parser/import.o: parser/import.c parser/string.h utils/utils.h lexer/item.h utils/strings.h package/package.h package/import.h parser/parser.h
+#dependencies for package 'parser/build.c'
+$(PROFILE_DIR)parser/build.o: parser/build.c lexer/item.h package/context.h package/import.h package/package.h parser/parser.h parser/string.h utils/strings.h
 
-#dependencies for package 'parser/string.c'
-parser/string.o: parser/string.c
+#dependencies for package 'parser/parser.c'
+$(PROFILE_DIR)parser/parser.o: parser/parser.c deps/stream/stream.h lexer/item.h lexer/lex.h lexer/stack.h package/fs.h package/package.h utils/stats.h
 
-#dependencies for package 'parser/package.c'
-parser/package.o: parser/package.c parser/string.h utils/strings.h lexer/item.h parser/parser.h
+#dependencies for package 'lexer/stack.c'
+$(PROFILE_DIR)lexer/stack.o: lexer/stack.c lexer/item.h utils/stats.h
+
+#dependencies for package 'parser/string.c'
+$(PROFILE_DIR)parser/string.o: parser/string.c
 
 #dependencies for package 'parser/export.c'
-parser/export.o: parser/export.c parser/string.h utils/utils.h lexer/item.h utils/strings.h package/package.h package/export.h parser/identifier.h package/import.h parser/parser.h
+$(PROFILE_DIR)parser/export.o: parser/export.c lexer/item.h package/context.h package/export.h package/import.h package/package.h package/paths.h parser/identifier.h parser/linkage.h parser/parser.h parser/string.h utils/strings.h
 
 #dependencies for package 'parser/identifier.c'
-parser/identifier.o: parser/identifier.c lexer/item.h package/package.h package/export.h lexer/stack.h package/import.h parser/parser.h
+$(PROFILE_DIR)parser/identifier.o: parser/identifier.c lexer/item.h package/context.h package/export.h package/import.h package/package.h parser/parser.h utils/stats.h
 
-#dependencies for package 'parser/build.c'
-parser/build.o: parser/build.c parser/string.h utils/strings.h lexer/item.h package/package.h package/import.h parser/parser.h
+#dependencies for package 'parser/linkage.c'
+$(PROFILE_DIR)parser/linkage.o: parser/linkage.c deps/stream/stream.h lexer/item.h package/context.h package/export.h package/package.h package/paths.h parser/parser.h
 
-#dependencies for package 'deps/stream/file.c'
-deps/stream/file.o: deps/stream/file.c deps/stream/stream.h
+#dependencies for package 'parser/import.c'
+$(PROFILE_DIR)parser/import.o: parser/import.c lexer/item.h package/export.h package/import.h package/package.h package/paths.h parser/parser.h parser/string.h utils/strings.h
+
+#dependencies for package 'parser/package.c'
+$(PROFILE_DIR)parser/package.o: parser/package.c lexer/item.h parser/parser.h parser/string.h utils/strings.h
 
-cbuild: cbuild.o package/import.o deps/hash/hash.o package/package.o deps/stream/stream.o package/export.o utils/utils.o utils/strings.o package/atomic-stream.o cli.o makefile.o lexer/item.o package/index.o parser/grammer.o parser/parser.o lexer/stack.o lexer/lex.o lexer/buffer.o lexer/syntax.o parser/import.o parser/string.o parser/package.o parser/export.o parser/identifier.o parser/build.o deps/stream/file.o
-	$(CC) $(CFLAGS) $(LDFLAGS)  cbuild.o package/import.o deps/hash/hash.o package/package.o deps/stream/stream.o package/export.o utils/utils.o utils/strings.o package/atomic-stream.o cli.o makefile.o lexer/item.o package/index.o parser/grammer.o parser/parser.o lexer/stack.o lexer/lex.o lexer/buffer.o lexer/syntax.o parser/import.o parser/string.o parser/package.o parser/export.o parser/identifier.o parser/build.o deps/stream/file.o -o cbuild $(LDLIBS)
+#dependencies for package 'pgo.c'
+$(PROFILE_DIR)pgo.o: pgo.c profile.h
+
+#dependencies for package 'pipeline.c'
+$(PROFILE_DIR)pipeline.o: pipeline.c makefile.h package/context.h package/package.h package/paths.h profile.h utils/jobserver.h utils/uring.h utils/utils.h
 
-CLEAN_cbuild:
-	rm -rf cbuild cbuild.o package/import.o deps/hash/hash.o package/package.o deps/stream/stream.o package/export.o utils/utils.o utils/strings.o package/atomic-stream.o cli.o makefile.o lexer/item.o package/index.o parser/grammer.o parser/parser.o lexer/stack.o lexer/lex.o lexer/buffer.o lexer/syntax.o parser/import.o parser/string.o parser/package.o parser/export.o parser/identifier.o parser/build.o deps/stream/file.o
@@ -6,21 +6,34 @@ package "main";
 #include <stdbool.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
+#include <string.h>
 
 build append CFLAGS "-std=c99";
 build append CFLAGS "-D_DEFAULT_SOURCE";
 build append CFLAGS "-D_GNU_SOURCE";
+build append CFLAGS "-DCBUILD_STATS";
 
 import Pkg        from "package/index.module.c";
 import lex_item   from "lexer/item.module.c";
 import Package    from "package/package.module.c";
 import pkg_import from "package/import.module.c";
 import makefile   from "makefile.module.c";
+import manifest   from "manifest.module.c";
+import pipeline   from "pipeline.module.c";
 import cli        from "cli.module.c";
+import stats      from "utils/stats.module.c";
+import atomic     from "package/atomic-stream.module.c";
+import uring      from "utils/uring.module.c";
+import jobserver  from "utils/jobserver.module.c";
+import profile    from "profile.module.c";
+import pgo        from "pgo.module.c";
+import fs         from "package/fs.module.c";
+import cbuild_ctx from "package/context.module.c";
 
-Package.t * generate(const char * filename, bool force, bool no_output) {
+Package.t * generate(cbuild_ctx.t * ctx, const char * filename) {
   char * error = NULL;
-  Package.t * pkg = Pkg.new(filename, &error, force, no_output);
+  Package.t * pkg = Pkg.new(ctx, filename, &error);
   lex_item.unfreed();
 
   /*if (pkg == NULL || pkg->errors > 0) return NULL;*/
@@ -32,12 +45,85 @@ Package.t * generate(const char * filename, bool force, bool no_output) {
   return pkg;
 }
 
+static void write_manifest(Package.t * root, const char * filename) {
+  char * target = makefile.target_name(root);
+  manifest.write(root, filename, target);
+  free(target);
+}
+
 typedef struct {
-  bool force;
+  bool         force;
+  bool         stats;
+  bool         io_uring;
+  bool         window;
+  bool         coarse;
+  bool         use_pgo;
+  bool         shared;
+  bool         internal;
+  long         lex_threads;
+  long         jobs;
+  const char * fsync;
+  const char * profile_name;
+  const char * train;
+  const profile.t * profile;
+  cbuild_ctx.t * ctx;
 } options_t;
 
+/* the context whose ring still has to be drained, exit(-1) on an error mustn't lose what it queued */
+static cbuild_ctx.t * writing = NULL;
+
+static void drain_writes() {
+  if (writing) uring.drain(writing->disk.writes.ring);
+}
+
+static int set_options(options_t * opts) {
+  opts->ctx->force  = opts->force;
+  opts->ctx->window = opts->window;
+  opts->ctx->coarse = opts->coarse;
+  opts->ctx->shared = opts->shared;
+  opts->ctx->internal = opts->internal;
+  opts->ctx->lex_threads = opts->lex_threads;
+  opts->ctx->jobserver   = jobserver.join();
+  if (opts->stats)    opts->ctx->stats = stats.start();
+  if (opts->io_uring) {
+    opts->ctx->disk.writes.ring = uring.new();
+    if (opts->ctx->disk.writes.ring == NULL) {
+      fprintf(stderr, "warning: io_uring is unavailable, using plain syscalls\n");
+    } else {
+      writing = opts->ctx;
+      atexit(drain_writes);
+    }
+  }
+
+  if (opts->fsync) {
+    int policy = atomic.sync_from_string(opts->fsync);
+    if (policy < 0) {
+      fprintf(stderr, "unknown fsync policy '%s', expected none, file or dir\n", opts->fsync);
+      return -1;
+    }
+    opts->ctx->disk.writes.sync = policy;
+  }
+
+  if (opts->profile_name) {
+    opts->profile = profile.find(opts->profile_name);
+    if (opts->profile == NULL) {
+      char * names = profile.names();
+      fprintf(stderr, "unknown profile '%s', expected %s\n", opts->profile_name, names);
+      free(names);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* sources generated with the other linkage look up to date, so they are all generated again */
+static void check_linkage(options_t * opts, manifest.t * last) {
+  if (last != NULL && last->internal != opts->ctx->internal) opts->ctx->force = true;
+}
+
 int do_generate(cli_t * cli, char * cmd, void * arg) {
   options_t * opts = (options_t*) arg;
+  if (set_options(opts) != 0) return -1;
 
   if (cli->argc < 1) {
     fprintf(stderr, "no root module specified\n");
@@ -45,23 +131,108 @@ int do_generate(cli_t * cli, char * cmd, void * arg) {
   }
   if (opts->force) printf("FORCED REBUILD\n");
 
-  Package.t * root = generate(cli->argv[0], opts->force, false);
+  manifest.t * last = manifest.load(opts->ctx, cli->argv[0]);
+  check_linkage(opts, last);
+  manifest.free(last);
+
+  Package.t * root = generate(opts->ctx, cli->argv[0]);
   if (root == NULL) exit(-1);
+  write_manifest(root, cli->argv[0]);
+  if (atomic.finish(&opts->ctx->disk.writes) != 0) exit(-1);
   return 0;
 }
 
+/* builds `module` with `prof`, returns make's status and the target and makefile it used */
+static int build(options_t * opts, const char * module, const profile.t * prof, char ** target, char ** mk) {
+  // nothing changed since the last generation, so there is nothing to parse, unless it
+  // made the other kind of library
+  manifest.t * last = opts->force ? NULL : manifest.load(opts->ctx, module);
+  check_linkage(opts, last);
+  if (last != NULL && !opts->ctx->force && manifest.fresh(last) && makefile.same_kind(last->target, opts->ctx)) {
+    *target = strdup(last->target);
+    *mk     = strdup(last->makefile);
+    int result = makefile.make_target(opts->ctx, last->target, prof, strdup(last->makefile));
+    manifest.free(last);
+    return result;
+  }
+  manifest.free(last);
+
+  // objects are compiled as their packages are generated, make links them and catches up.
+  // Run from a `make -j`, that make's jobserver decides how many at once, otherwise this
+  // is the jobserver for the compiles and the make it runs
+  long jobs = opts->jobs > 0 ? opts->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+  if (opts->ctx->jobserver == NULL) {
+    opts->ctx->jobserver = jobserver.new(jobs);
+  } else if (opts->jobs <= 0) {
+    jobs = LONG_MAX;
+  }
+  pipeline.t * compiling = pipeline.new(opts->ctx, module, prof, jobs);
+
+  Package.t * root = generate(opts->ctx, module);
+  if (root == NULL) {
+    pipeline.free(compiling);
+    exit(-1);
+  }
+
+  char * mkfile_name = makefile.write(root, module);
+  write_manifest(root, module);
+  if (atomic.finish(&opts->ctx->disk.writes) != 0) exit(-1);
+  pipeline.finish(compiling);
+  pipeline.free(compiling);
+
+  *target = makefile.target_name(root);
+  *mk     = strdup(mkfile_name);
+  return makefile.make(root, prof, mkfile_name);
+}
+
+/*
+ * With --train the instrumented build is made and trained first, and the optimized one
+ * is made from the same makefile after it, without parsing a second time
+ */
+static int build_pgo(options_t * opts, const char * module) {
+  const profile.t * base = opts->profile ? opts->profile : profile.find("release");
+  pgo.t * guided = pgo.new(base, module);
+  if (guided == NULL) {
+    fprintf(stderr, "cannot find '%s'\n", module);
+    return -1;
+  }
+
+  char * target = NULL, * mk = NULL;
+  int result = 0;
+  if (opts->train) {
+    result = build(opts, module, &guided->instrumented, &target, &mk);
+    if (result == 0) result = pgo.train(guided, target, opts->train) == 0 ? 0 : -1;
+    if (result == 0) result = makefile.make_target(opts->ctx, target, &guided->optimized, strdup(mk));
+  } else {
+    if (!pgo.trained(guided)) {
+      fprintf(stderr, "warning: no profiles for --pgo yet, build with --train \"<command>\" first\n");
+    }
+    result = build(opts, module, &guided->optimized, &target, &mk);
+  }
+
+  free(target);
+  free(mk);
+  pgo.free(guided);
+  return result;
+}
+
 int do_build(cli_t * cli, char * cmd, void * arg) {
   options_t * opts = (options_t*) arg;
+  if (set_options(opts) != 0) return -1;
   if (cli->argc < 1) {
     fprintf(stderr, "no root module specified\n");
     return -1;
   }
 
-  Package.t * root = generate(cli->argv[0], opts->force, false);
-  if (root == NULL) exit(-1);
-
-  char * mkfile_name = makefile.write(root, cli->argv[0]);
-  int result = makefile.make(root, mkfile_name);
+  int result;
+  if (opts->use_pgo || opts->train) {
+    result = build_pgo(opts, cli->argv[0]);
+  } else {
+    char * target = NULL, * mk = NULL;
+    result = build(opts, cli->argv[0], opts->profile, &target, &mk);
+    free(target);
+    free(mk);
+  }
   if (result != 0) exit(result);
   return 0;
 }
@@ -72,11 +243,11 @@ void clean_generated(Package.t * pkg) {
 
   if (pkg->generated) {
     printf("unlink: %s\n", pkg->generated);
-    global.unlink(pkg->generated);
+    fs.unlink(pkg->ctx->fs, pkg->generated);
   }
   if (pkg->header) {
     printf("unlink: %s\n", pkg->header);
-    global.unlink(pkg->header);
+    fs.unlink(pkg->ctx->fs, pkg->header);
   }
 
   hash_each_val(pkg->deps, {
@@ -87,24 +258,39 @@ void clean_generated(Package.t * pkg) {
 
 int do_clean(cli_t * cli, char * cmd, void * arg) {
   options_t * opts = (options_t*) arg;
+  if (set_options(opts) != 0) return -1;
 
   if (cli->argc < 1) {
     fprintf(stderr, "no root module specified\n");
     return -1;
   }
 
-  Package.t * root = generate(cli->argv[0], opts->force, true);
+  // the last generation's outputs are listed, so the graph doesn't have to be parsed again
+  manifest.t * last = manifest.load(opts->ctx, cli->argv[0]);
+  if (last != NULL && last->makefile != NULL && last->target != NULL) {
+    int result = makefile.clean_target(last->target, opts->profile, strdup(last->makefile));
+    manifest.clean(last);
+    manifest.free(last);
+    if (result != 0) exit(result);
+    return 0;
+  }
+  manifest.free(last);
+
+  opts->ctx->silent = true;
+  Package.t * root = generate(opts->ctx, cli->argv[0]);
   if (root == NULL) exit(-1);
 
   char * mkfile_name = makefile.write(root, cli->argv[0]);
-  int result = makefile.clean(root, mkfile_name);
+  if (atomic.finish(&opts->ctx->disk.writes) != 0) exit(-1);
+  int result = makefile.clean(root, opts->profile, mkfile_name);
   clean_generated(root);
+  manifest.discard(opts->ctx, cli->argv[0]);
   if (result != 0) exit(result);
   return 0;
 }
 
 int main(int argc, const char ** argv){
-  options_t options = {0};
+  options_t options = { .ctx = cbuild_ctx.new() };
 
   cli.t * c = cli.new("<root module>");
   cli.flag_bool(c, &options.force, (cli.flag_options) {
@@ -112,6 +298,64 @@ int main(int argc, const char ** argv){
       .short_name  = "f",
       .description = "force rebuilding assets",
   });
+  cli.flag_bool(c, &options.stats, (cli.flag_options) {
+      .long_name   = "stats",
+      .description = "print lexer, parser and package graph counters",
+  });
+  cli.flag_string(c, &options.fsync, (cli.flag_options) {
+      .long_name   = "fsync",
+      .description = "durability of generated files: none (default), file or dir",
+  });
+  cli.flag_bool(c, &options.io_uring, (cli.flag_options) {
+      .long_name   = "io-uring",
+      .description = "write generated files through io_uring (Linux)",
+  });
+
+  cli.flag_bool(c, &options.window, (cli.flag_options) {
+      .long_name   = "window",
+      .description = "only keep the part of each source being lexed in memory, for very large modules",
+  });
+
+  cli.flag_bool(c, &options.coarse, (cli.flag_options) {
+      .long_name   = "coarse",
+      .description = "lex the C between modular C constructs as a few large tokens",
+  });
+
+  cli.flag_int(c, &options.lex_threads, (cli.flag_options) {
+      .long_name   = "lex-threads",
+      .description = "lex modules of a megabyte or more on up to this many threads",
+  });
+
+  cli.flag_int(c, &options.jobs, (cli.flag_options) {
+      .long_name   = "jobs",
+      .short_name  = "j",
+      .description = "compile up to this many objects at once while generating (default: one per CPU)",
+  });
+
+  cli.flag_string(c, &options.profile_name, (cli.flag_options) {
+      .long_name   = "profile",
+      .description = "build under .cbuild/<profile> with its flags: debug or release (LTO, unused sections dropped)",
+  });
+
+  cli.flag_bool(c, &options.shared, (cli.flag_options) {
+      .long_name   = "shared",
+      .description = "link a library as a shared object, with only its exports dynamic",
+  });
+
+  cli.flag_bool(c, &options.internal, (cli.flag_options) {
+      .long_name   = "internal-linkage",
+      .description = "make what modules define without exporting static, warning about names that collide",
+  });
+
+  cli.flag_bool(c, &options.use_pgo, (cli.flag_options) {
+      .long_name   = "pgo",
+      .description = "build optimized with the profiles the last --train collected",
+  });
+
+  cli.flag_string(c, &options.train, (cli.flag_options) {
+      .long_name   = "train",
+      .description = "with --pgo, build instrumented and run this command, with $CBUILD_TARGET, to collect profiles first",
+  });
 
   cli.command(c, "build",    do_build,    "generate code and build",      true,  &options);
   cli.command(c, "generate", do_generate, "generate .c .h and .mk files", false, &options);
@@ -119,5 +363,10 @@ int main(int argc, const char ** argv){
 
   int result = cli.parse(c, argc, argv);
   cli.free(c);
+  jobserver.free(options.ctx->jobserver);
+
+  stats.report(options.ctx->stats, stderr);
+  writing = NULL;
+  cbuild_ctx.free(options.ctx);
   return result;
 }
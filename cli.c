@@ -105,7 +105,7 @@ void cli_flag_bool(cli_t * cli, bool * out, cli_flag_options options) {
 }
 
 void cli_flag_int(cli_t * cli, long * out, cli_flag_options options) {
-	flag(cli, out, flag_type_string, options);
+	flag(cli, out, flag_type_int, options);
 }
 
 void cli_flag_string(cli_t * cli, const char ** out, cli_flag_options options) {
@@ -197,9 +197,25 @@ int cli_parse(cli_t * cli, int argc, const char ** argv) {
 
 		char * arg_allocated = strdup(arg);
 
+		// --name=value
+		char * value = NULL;
+		if (arg[0] == '-' && arg[1] == '-' && (value = strchr(arg_allocated, '=')) != NULL) {
+			*value = 0;
+			value  = (char *) arg + (value - arg_allocated) + 1;
+		}
+
 		flag_t * flag = (flag_t *) hash_get(cli->flags, arg_allocated);
 		if (flag != NULL) {
-			parse_flag(flag, arg);
+			// --name value
+			if (value == NULL && flag->type != flag_type_bool) {
+				if (i + 1 >= argc) {
+					fprintf(stderr, "Flag '%s' requires a value\n\n", arg);
+					free(arg_allocated);
+					return cli_usage(cli);
+				}
+				value = (char *) argv[++i];
+			}
+			parse_flag(flag, value);
 			free(arg_allocated);
 			continue;
 		}
@@ -105,7 +105,7 @@ export void flag_bool(cli_t * cli, bool * out, flag_options options) {
 }
 
 export void flag_int(cli_t * cli, long * out, flag_options options) {
-	flag(cli, out, flag_type_string, options);
+	flag(cli, out, flag_type_int, options);
 }
 
 export void flag_string(cli_t * cli, const char ** out, flag_options options) {
@@ -197,9 +197,25 @@ export int parse(cli_t * cli, int argc, const char ** argv) {
 
 		char * arg_allocated = strdup(arg);
 
+		// --name=value
+		char * value = NULL;
+		if (arg[0] == '-' && arg[1] == '-' && (value = strchr(arg_allocated, '=')) != NULL) {
+			*value = 0;
+			value  = (char *) arg + (value - arg_allocated) + 1;
+		}
+
 		flag_t * flag = (flag_t *) hash_get(cli->flags, arg_allocated);
 		if (flag != NULL) {
-			parse_flag(flag, arg);
+			// --name value
+			if (value == NULL && flag->type != flag_type_bool) {
+				if (i + 1 >= argc) {
+					fprintf(stderr, "Flag '%s' requires a value\n\n", arg);
+					global.free(arg_allocated);
+					return usage(cli);
+				}
+				value = (char *) argv[++i];
+			}
+			parse_flag(flag, value);
 			global.free(arg_allocated);
 			continue;
 		}
@@ -0,0 +1,158 @@
+//
+// bench.c
+//
+// Compares the string hashes in hash.h on the identifiers of real
+// sources, in the order they appear. Build it once with the default
+// hash and once with -DHASH_X31 (see `make bench-hash`):
+//
+//   cc -O2 -o bench bench.c hash.c && ./bench $(find ../.. -name '*.module.c')
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "hash.h"
+
+#define ROUNDS 20
+
+typedef struct {
+	char   ** words;
+	size_t  * lengths;
+	size_t    count;
+	size_t    cap;
+} words_t;
+
+static void
+add(words_t *w, const char *s, size_t len) {
+	if (w->count == w->cap) {
+		w->cap     = w->cap ? w->cap * 2 : 1024;
+		w->words   = realloc(w->words, w->cap * sizeof(char *));
+		w->lengths = realloc(w->lengths, w->cap * sizeof(size_t));
+	}
+	w->words[w->count]   = strndup(s, len);
+	w->lengths[w->count] = len;
+	w->count++;
+}
+
+static void
+read_identifiers(words_t *w, const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return;
+	}
+
+	char line[4096];
+	while (fgets(line, sizeof(line), f)) {
+		char *c = line;
+		while (*c) {
+			if (isalpha((unsigned char) *c) || *c == '_') {
+				char *start = c;
+				while (isalnum((unsigned char) *c) || *c == '_') c++;
+				add(w, start, c - start);
+			} else {
+				c++;
+			}
+		}
+	}
+	fclose(f);
+}
+
+static double
+now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*
+ * Keys that don't land in their home bucket of a khash sized for
+ * `distinct` keys, which is what a lookup pays extra strcmp()s for.
+ */
+static size_t
+displaced(hash_t *set, int x31) {
+	khint_t buckets = kh_n_buckets(set);
+	char *used = calloc(buckets, 1);
+	size_t collisions = 0;
+
+	hash_each_key(set, {
+		size_t len = strlen(key);
+		khint_t h = x31 ? hash_x31(key, len) : hash_wy(key, len);
+		if (used[h & (buckets - 1)]++) collisions++;
+	});
+
+	free(used);
+	return collisions;
+}
+
+int
+main(int argc, char **argv) {
+	words_t w = { 0 };
+	int i;
+	for (i = 1; i < argc; i++) read_identifiers(&w, argv[i]);
+	if (w.count == 0) {
+		fprintf(stderr, "usage: %s <source files>\n", argv[0]);
+		return 1;
+	}
+
+	hash_t *set = hash_new();
+	size_t j, bytes = 0;
+	for (j = 0; j < w.count; j++) {
+		hash_set(set, w.words[j], w.words[j]);
+		bytes += w.lengths[j];
+	}
+
+	printf("%zu identifiers (%zu distinct, %.1f bytes on average) from %d files\n",
+			w.count, (size_t) hash_size(set), (double) bytes / w.count, argc - 1);
+	printf("%-8s %10s %10s\n", "", "ns/key", "displaced");
+
+	khint_t sink = 0;
+	int r;
+	double start = now();
+	for (r = 0; r < ROUNDS; r++) {
+		for (j = 0; j < w.count; j++) sink += hash_x31(w.words[j], w.lengths[j]);
+	}
+	printf("%-8s %10.2f %10zu\n", "x31", (now() - start) / ROUNDS / w.count, displaced(set, 1));
+
+	start = now();
+	for (r = 0; r < ROUNDS; r++) {
+		for (j = 0; j < w.count; j++) sink += hash_wy(w.words[j], w.lengths[j]);
+	}
+	printf("%-8s %10.2f %10zu\n", "wy", (now() - start) / ROUNDS / w.count, displaced(set, 0));
+
+	// the table itself, with whichever hash this was built with
+	khint_t *hashes = malloc(w.count * sizeof(khint_t));
+	for (j = 0; j < w.count; j++) hashes[j] = hash_bytes(w.words[j], w.lengths[j]);
+
+	size_t found = 0;
+	start = now();
+	for (r = 0; r < ROUNDS; r++) {
+		for (j = 0; j < w.count; j++) found += hash_has(set, w.words[j]);
+	}
+	double get = (now() - start) / ROUNDS / w.count;
+
+	start = now();
+	for (r = 0; r < ROUNDS; r++) {
+		for (j = 0; j < w.count; j++) found += hash_has_hashed(set, w.words[j], hashes[j]);
+	}
+	double hashed = (now() - start) / ROUNDS / w.count;
+
+#ifdef HASH_X31
+	const char *name = "x31";
+#else
+	const char *name = "wy";
+#endif
+	printf("hash_has (%s): %.2f ns/key, hash_has_hashed: %.2f ns/key\n", name, get, hashed);
+
+	if (found != 2 * ROUNDS * w.count) fprintf(stderr, "lookups failed\n");
+	free(hashes);
+	hash_free(set);
+	for (j = 0; j < w.count; j++) free(w.words[j]);
+	free(w.words);
+	free(w.lengths);
+	return sink == 0xdeadbeef;
+}
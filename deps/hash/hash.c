@@ -48,6 +48,29 @@ hash_del(hash_t *self, char *key) {
 	kh_del(ptr, self, k);
 }
 
+/*
+ * The same, for a key whose hash_string() is already known.
+ */
+
+inline void
+hash_set_hashed(hash_t *self, char *key, khint_t hash, void *val) {
+	int ret;
+	khiter_t k = kh_put_hashed(ptr, self, key, hash, &ret);
+	kh_value(self, k) = val;
+}
+
+inline void *
+hash_get_hashed(hash_t *self, char *key, khint_t hash) {
+	khiter_t k = kh_get_hashed(ptr, self, key, hash);
+	return k == kh_end(self) ? NULL : kh_value(self, k);
+}
+
+inline int
+hash_has_hashed(hash_t *self, char *key, khint_t hash) {
+	khiter_t k = kh_get_hashed(ptr, self, key, hash);
+	return k != kh_end(self);
+}
+
 // tests
 
 #ifdef TEST_HASH
@@ -173,6 +196,18 @@ test_hash_each_val() {
 	assert(0 == strcmp("25", vals[1]) || 0 == strcmp("tj", vals[1]));
 }
 
+void
+test_hash_hashed() {
+	hash_t *hash = hash_new();
+	hash_set_hashed(hash, "name", hash_string("name"), "tobi");
+	hash_set(hash, "species", "ferret");
+	assert(hash_bytes("name", 4) == hash_string("name"));
+	assert(0 == strcmp("tobi", hash_get(hash, "name")));
+	assert(0 == strcmp("ferret", hash_get_hashed(hash, "species", hash_string("species"))));
+	assert(1 == hash_has_hashed(hash, "name", hash_bytes("name", 4)));
+	assert(0 == hash_has_hashed(hash, "bar", hash_string("bar")));
+}
+
 int
 main(){
 	test_hash_set();
@@ -184,6 +219,7 @@ main(){
 	test_hash_each();
 	test_hash_each_key();
 	test_hash_each_val();
+	test_hash_hashed();
 	printf("\n  \e[32m\u2713 \e[90mok\e[0m\n\n");
 	return 0;
 }
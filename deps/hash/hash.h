@@ -8,11 +8,95 @@
 #ifndef HASH
 #define HASH
 
+#include <stdint.h>
+#include <string.h>
 #include "khash.h"
 
+/*
+ * String hashes. The default mixes 8 bytes at a time with a
+ * 64x64->128 bit multiply, in the style of wyhash; define HASH_X31
+ * to get khash's original `h * 31 + c` instead. Both hash_string()
+ * and hash_bytes() always agree with the table's hash function, so
+ * callers may compute a key's hash once and pass it to the *_hashed
+ * functions below.
+ */
+
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+
+static kh_inline uint64_t
+hash_mix(uint64_t a, uint64_t b) {
+	__uint128_t r = (__uint128_t) a * b;
+	return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static kh_inline uint64_t
+hash_read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static kh_inline uint64_t
+hash_read32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static kh_inline khint_t
+hash_wy(const char *s, size_t len) {
+	const unsigned char *p = (const unsigned char *) s;
+	uint64_t seed = HASH_P0 ^ len;
+	uint64_t a, b;
+
+	if (len <= 16) {
+		if (len >= 4) {
+			// two overlapping reads from each end cover 4..16 bytes
+			size_t half = (len >> 3) << 2;
+			a = (hash_read32(p) << 32) | hash_read32(p + half);
+			b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - half);
+		} else if (len > 0) {
+			a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t n = len;
+		while (n > 16) {
+			seed = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+			p += 16;
+			n -= 16;
+		}
+		a = hash_read64(p + n - 16);
+		b = hash_read64(p + n - 8);
+	}
+
+	uint64_t h = hash_mix(a ^ HASH_P1, b ^ seed);
+	h = hash_mix(h ^ HASH_P0, len ^ HASH_P1);
+	return (khint_t) (h ^ (h >> 32));
+}
+
+static kh_inline khint_t
+hash_x31(const char *s, size_t len) {
+	khint_t h = 0;
+	size_t i;
+	for (i = 0; i < len; i++) h = (h << 5) - h + (khint_t) s[i];
+	return h;
+}
+
+#ifdef HASH_X31
+#define hash_bytes(s, len) hash_x31(s, len)
+#define hash_string(s) __ac_X31_hash_string(s)
+#else
+#define hash_bytes(s, len) hash_wy(s, len)
+#define hash_string(s) hash_wy(s, strlen(s))
+#endif
+
 // pointer hash
 
-KHASH_MAP_INIT_STR(ptr, void *)
+KHASH_INIT(ptr, kh_cstr_t, void *, 1, hash_string, kh_str_hash_equal)
 
 /*
  * Hash type.
@@ -100,6 +184,19 @@ hash_has(hash_t *self, char *key);
 void
 hash_del(hash_t *self, char *key);
 
+/*
+ * The same, for a key whose hash_string() is already known.
+ */
+
+void
+hash_set_hashed(hash_t *self, char *key, khint_t hash, void *val);
+
+void *
+hash_get_hashed(hash_t *self, char *key, khint_t hash);
+
+int
+hash_has_hashed(hash_t *self, char *key, khint_t hash);
+
 void
 hash_clear(hash_t *self);
 
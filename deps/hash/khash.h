@@ -204,8 +204,10 @@ static const double __ac_HASH_UPPER = 0.77;
 	extern void kh_destroy_##name(kh_##name##_t *h);					\
 	extern void kh_clear_##name(kh_##name##_t *h);						\
 	extern khint_t kh_get_##name(const kh_##name##_t *h, khkey_t key); 	\
+	extern khint_t kh_get_hashed_##name(const kh_##name##_t *h, khkey_t key, khint_t k); \
 	extern int kh_resize_##name(kh_##name##_t *h, khint_t new_n_buckets); \
 	extern khint_t kh_put_##name(kh_##name##_t *h, khkey_t key, int *ret); \
+	extern khint_t kh_put_hashed_##name(kh_##name##_t *h, khkey_t key, khint_t k, int *ret); \
 	extern void kh_del_##name(kh_##name##_t *h, khint_t x);
 
 #define __KHASH_IMPL(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
@@ -227,12 +229,12 @@ static const double __ac_HASH_UPPER = 0.77;
 			h->size = h->n_occupied = 0;								\
 		}																\
 	}																	\
-	SCOPE khint_t kh_get_##name(const kh_##name##_t *h, khkey_t key) 	\
+	SCOPE khint_t kh_get_hashed_##name(const kh_##name##_t *h, khkey_t key, khint_t k) \
 	{																	\
 		if (h->n_buckets) {												\
-			khint_t k, i, last, mask, step = 0; \
+			khint_t i, last, mask, step = 0; \
 			mask = h->n_buckets - 1;									\
-			k = __hash_func(key); i = k & mask;							\
+			i = k & mask;												\
 			last = i; \
 			while (!__ac_isempty(h->flags, i) && (__ac_isdel(h->flags, i) || !__hash_equal(h->keys[i], key))) { \
 				i = (i + (++step)) & mask; \
@@ -241,6 +243,10 @@ static const double __ac_HASH_UPPER = 0.77;
 			return __ac_iseither(h->flags, i)? h->n_buckets : i;		\
 		} else return 0;												\
 	}																	\
+	SCOPE khint_t kh_get_##name(const kh_##name##_t *h, khkey_t key) 	\
+	{																	\
+		return kh_get_hashed_##name(h, key, h->n_buckets ? __hash_func(key) : 0); \
+	}																	\
 	SCOPE int kh_resize_##name(kh_##name##_t *h, khint_t new_n_buckets) \
 	{ /* This function uses 0.25*n_buckets bytes of working space instead of [sizeof(key_t+val_t)+.25]*n_buckets. */ \
 		khint32_t *new_flags = 0;										\
@@ -304,7 +310,7 @@ static const double __ac_HASH_UPPER = 0.77;
 		}																\
 		return 0;														\
 	}																	\
-	SCOPE khint_t kh_put_##name(kh_##name##_t *h, khkey_t key, int *ret) \
+	SCOPE khint_t kh_put_hashed_##name(kh_##name##_t *h, khkey_t key, khint_t k, int *ret) \
 	{																	\
 		khint_t x;														\
 		if (h->n_occupied >= h->upper_bound) { /* update the hash table */ \
@@ -317,8 +323,8 @@ static const double __ac_HASH_UPPER = 0.77;
 			}															\
 		} /* TODO: to implement automatically shrinking; resize() already support shrinking */ \
 		{																\
-			khint_t k, i, site, last, mask = h->n_buckets - 1, step = 0; \
-			x = site = h->n_buckets; k = __hash_func(key); i = k & mask; \
+			khint_t i, site, last, mask = h->n_buckets - 1, step = 0; \
+			x = site = h->n_buckets; i = k & mask; \
 			if (__ac_isempty(h->flags, i)) x = i; /* for speed up */	\
 			else {														\
 				last = i; \
@@ -346,6 +352,10 @@ static const double __ac_HASH_UPPER = 0.77;
 		} else *ret = 0; /* Don't touch h->keys[x] if present and not deleted */ \
 		return x;														\
 	}																	\
+	SCOPE khint_t kh_put_##name(kh_##name##_t *h, khkey_t key, int *ret) \
+	{																	\
+		return kh_put_hashed_##name(h, key, __hash_func(key), ret);		\
+	}																	\
 	SCOPE void kh_del_##name(kh_##name##_t *h, khint_t x)				\
 	{																	\
 		if (x != h->n_buckets && !__ac_iseither(h->flags, x)) {			\
@@ -473,6 +483,13 @@ static kh_inline khint_t __ac_Wang_hash(khint_t key)
  */
 #define kh_put(name, h, k, r) kh_put_##name(h, k, r)
 
+/*! @function
+  @abstract     Insert a key whose hash has already been computed.
+  @param  hash  The key's hash, as __hash_func would compute it [khint_t]
+  @discussion   Otherwise the same as kh_put().
+ */
+#define kh_put_hashed(name, h, k, hash, r) kh_put_hashed_##name(h, k, hash, r)
+
 /*! @function
   @abstract     Retrieve a key from the hash table.
   @param  name  Name of the hash table [symbol]
@@ -482,6 +499,13 @@ static kh_inline khint_t __ac_Wang_hash(khint_t key)
  */
 #define kh_get(name, h, k) kh_get_##name(h, k)
 
+/*! @function
+  @abstract     Retrieve a key whose hash has already been computed.
+  @param  hash  The key's hash, as __hash_func would compute it [khint_t]
+  @discussion   Otherwise the same as kh_get().
+ */
+#define kh_get_hashed(name, h, k, hash) kh_get_hashed_##name(h, k, hash)
+
 /*! @function
   @abstract     Remove a key from the hash table.
   @param  name  Name of the hash table [symbol]
@@ -1,6 +1,7 @@
 
 
 #include "item.h"
+#include "../utils/stats.h"
 #include <string.h>
 
 #include <stdlib.h>
@@ -30,7 +31,7 @@ lex_buffer_t * lex_buffer_resize(lex_buffer_t * b, size_t count) {
 	}
 
 	lex_item_t * items = malloc(count * sizeof(lex_item_t));
-
+	STATS_BUFFER(count * sizeof(lex_item_t));
 
 	int i;
 	if (count > b->length) {
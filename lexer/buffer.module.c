@@ -1,6 +1,7 @@
 package "lex_buffer";
 
 import lex_item from "./item.module.c";
+import stats    from "../utils/stats.module.c";
 #include <string.h>
 export {
 #include <stdlib.h>
@@ -30,7 +31,7 @@ export item_buffer_t * resize(item_buffer_t * b, size_t count) {
 	}
 
 	lex_item.t * items = malloc(count * sizeof(lex_item.t));
-
+	STATS_BUFFER(count * sizeof(lex_item.t));
 
 	int i;
 	if (count > b->length) {
@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include "../deps/hash/hash.h"
 
 enum lex_item_type {
 	item_error = 0,
@@ -58,10 +59,12 @@ typedef struct {
 	size_t         line_pos;
 	size_t         start;
 	size_t         index;
+	unsigned int   hash;     // hash_bytes() of the value for identifiers, 0 if not computed yet
+	bool           borrowed; // the value belongs to someone else, free() leaves it alone
 } lex_item_t;
 
 #ifdef MEM_DEBUG
-static lex_item_t cache[64000];
+static lex_item_t cache[256000];
 static size_t item_index;
 #endif
 
@@ -77,7 +80,7 @@ lex_item_t lex_item_new(char * value, enum lex_item_type type, size_t line, size
 		.line_pos = line_pos,
 		.start    = start,
 #ifdef MEM_DEBUG
-		.index    = ++item_index,
+		.index    = __sync_add_and_fetch(&item_index, 1), // lex_parallel makes items on several threads
 #endif
 	};
 #ifdef MEM_DEBUG
@@ -120,13 +123,27 @@ bool lex_item_equals(lex_item_t a, lex_item_t b) {
 }
 
 lex_item_t lex_item_dup(lex_item_t a) {
-	return lex_item_new(
+	lex_item_t d = lex_item_new(
 		strings_dup(a.value),
 		a.type,
 		a.line,
 		a.line_pos,
 		a.start
 	);
+	d.hash = a.hash;
+	return d;
+}
+
+/* an item in the same place as `at` whose value is `value`, which must outlive the item */
+lex_item_t lex_item_borrow(lex_item_t at, const char * value) {
+	lex_item_t b = lex_item_new((char *) value, at.type, at.line, at.line_pos, at.start);
+	b.borrowed = true;
+	return b;
+}
+
+/* the value's hash for the *_hashed lookups in deps/hash, computed once by the lexer for identifiers */
+unsigned int lex_item_hash_of(lex_item_t item) {
+	return item.hash ? item.hash : hash_bytes(item.value, item.length);
 }
 
 void lex_item_free(lex_item_t item) {
@@ -156,7 +173,7 @@ void lex_item_free(lex_item_t item) {
 		}
 	}
 #endif
-	free(item.value);
+	if (!item.borrowed) free(item.value);
 }
 
 lex_item_t lex_item_replace_value(lex_item_t a, char * value) {
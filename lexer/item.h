@@ -25,7 +25,7 @@ enum lex_item_type {
 	item_total_symbols
 };
 
-extern const char ** lex_item_type_names;
+extern const char * lex_item_type_names[];
 
 typedef struct {
 	enum lex_item_type type;
@@ -35,6 +35,8 @@ typedef struct {
 	size_t         line_pos;
 	size_t         start;
 	size_t         index;
+	unsigned int   hash;     // hash_bytes() of the value for identifiers, 0 if not computed yet
+	bool           borrowed; // the value belongs to someone else, free() leaves it alone
 } lex_item_t;
 
 extern const lex_item_t lex_item_empty;
@@ -42,6 +44,8 @@ lex_item_t lex_item_new(char * value, enum lex_item_type type, size_t line, size
 char * lex_item_to_string(lex_item_t item);
 bool lex_item_equals(lex_item_t a, lex_item_t b);
 lex_item_t lex_item_dup(lex_item_t a);
+lex_item_t lex_item_borrow(lex_item_t at, const char * value);
+unsigned int lex_item_hash_of(lex_item_t item);
 void lex_item_free(lex_item_t item);
 lex_item_t lex_item_replace_value(lex_item_t a, char * value);
 void lex_item_unfreed();
@@ -8,6 +8,7 @@ export {
 }
 #include <stdio.h>
 #include <string.h>
+#include "../deps/hash/hash.h"
 
 export enum item_type {
 	item_error = 0,
@@ -32,7 +33,7 @@ export enum item_type {
 
 
 
-export extern const char ** type_names;
+export extern const char * type_names[];
 const char * type_names[item_total_symbols] = {
 	"Error",
 	"eof",
@@ -58,10 +59,12 @@ export typedef struct {
 	size_t         line_pos;
 	size_t         start;
 	size_t         index;
+	unsigned int   hash;     // hash_bytes() of the value for identifiers, 0 if not computed yet
+	bool           borrowed; // the value belongs to someone else, free() leaves it alone
 } item_t as t;
 
 #ifdef MEM_DEBUG
-static item_t cache[64000];
+static item_t cache[256000];
 static size_t item_index;
 #endif
 
@@ -77,7 +80,7 @@ export item_t new(char * value, enum item_type type, size_t line, size_t line_po
 		.line_pos = line_pos,
 		.start    = start,
 #ifdef MEM_DEBUG
-		.index    = ++item_index,
+		.index    = __sync_add_and_fetch(&item_index, 1), // lex_parallel makes items on several threads
 #endif
 	};
 #ifdef MEM_DEBUG
@@ -120,13 +123,27 @@ export bool equals(item_t a, item_t b) {
 }
 
 export item_t dup(item_t a) {
-	return new(
+	item_t d = new(
 		str.dup(a.value),
 		a.type,
 		a.line,
 		a.line_pos,
 		a.start
 	);
+	d.hash = a.hash;
+	return d;
+}
+
+/* an item in the same place as `at` whose value is `value`, which must outlive the item */
+export item_t borrow(item_t at, const char * value) {
+	item_t b = new((char *) value, at.type, at.line, at.line_pos, at.start);
+	b.borrowed = true;
+	return b;
+}
+
+/* the value's hash for the *_hashed lookups in deps/hash, computed once by the lexer for identifiers */
+export unsigned int hash_of(item_t item) {
+	return item.hash ? item.hash : hash_bytes(item.value, item.length);
 }
 
 export void free(item_t item) {
@@ -156,7 +173,7 @@ export void free(item_t item) {
 		}
 	}
 #endif
-	global.free(item.value);
+	if (!item.borrowed) global.free(item.value);
 }
 
 export item_t replace_value(item_t a, char * value) {
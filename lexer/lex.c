@@ -1,6 +1,7 @@
 #include "../deps/stream/stream.h"
 #include "item.h"
 #include "buffer.h"
+#include "../utils/stats.h"
 
 
 #include <stdlib.h>
@@ -8,17 +9,44 @@
 
 
 #include <string.h>
+#include <ctype.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include "../deps/hash/hash.h"
 
 struct lex_lexer_s;
 typedef void * (*lex_state_fn)(struct lex_lexer_s * lex);
-
+typedef bool   (*lex_keep_fn) (void * ctx, const char * id, unsigned int hash);
+
+/*
+ * Offsets (start, pos, line_pos and those of the items) count from the beginning of the
+ * input. `input` holds `length` bytes of it starting at offset `base`, which stays 0
+ * unless `window` is set. With a window, whatever is behind the current token is dropped
+ * before reading more, so memory follows the longest token rather than the input.
+ *
+ * Setting `keep` makes tokens coarse: whatever goes through pass() is held back from
+ * `span` on and comes out as one item ahead of the next emitted token, and only the
+ * identifiers `keep` accepts are emitted at all. With `scan` set as well, what pass()
+ * gets is dropped instead, and an identifier after a dropped token is only looked at
+ * when that token ends a line, which is all the grammar needs to find its keywords.
+ *
+ * An `ahead` lexer lexes part of another's input on its behalf, which counts the tokens
+ * for --stats once it knows which of them it keeps.
+ */
 typedef struct lex_lexer_s{
 	stream_t * in;
 	char     * input;
 	char     * filename;
+	size_t     base;
 	size_t     length;
+	bool       window;
+	lex_keep_fn    keep;
+	void     * keep_ctx;
+	bool       scan;
+	bool       dropped;
+	bool       ahead;
+	size_t     span;
+	size_t     last;
 	size_t     start;
 	size_t     pos;
 	size_t     width;
@@ -30,6 +58,7 @@ typedef struct lex_lexer_s{
 
 static char * substring(const char * input, size_t start, size_t end);
 static void count_newlines(lex_t * lex);
+static void flush(lex_t * lex);
 
 
 lex_t * lex_new(lex_state_fn start, stream_t * in, const char * filename) {
@@ -38,7 +67,14 @@ lex_t * lex_new(lex_state_fn start, stream_t * in, const char * filename) {
 	lex->in       = in;
 	lex->filename = strdup(filename);
 	lex->input    = NULL;
+	lex->base     = 0;
 	lex->length   = 0;
+	lex->window   = false;
+	lex->keep     = NULL;
+	lex->scan     = false;
+	lex->dropped  = false;
+	lex->ahead    = false;
+	lex->span     = 0;
 	lex->items    = lex_buffer_new(2);
 	lex->state    = start;
 	lex->line     = 0;
@@ -46,6 +82,23 @@ lex_t * lex_new(lex_state_fn start, stream_t * in, const char * filename) {
 	return lex;
 }
 
+/*
+ * A lexer for `whole`'s input from `from` on, at the start state. It has no stream of its
+ * own and only borrows the input, so `whole` has to have read all of it and has to
+ * outlive the lexer. Lines count from 0 and `from` is taken to start one.
+ */
+lex_t * lex_over(lex_t * whole, lex_state_fn start, size_t from) {
+	lex_t * lex = lex_new(start, NULL, whole->filename);
+
+	lex->input    = whole->input;
+	lex->length   = whole->length;
+	lex->start    = lex->pos = lex->span = from;
+	lex->line_pos = from;
+	lex->ahead    = true;
+
+	return lex;
+}
+
 lex_state_fn lex_errorf(lex_t * lex, const char * fmt, ...) {
 	va_list args;
 	va_start(args, fmt);
@@ -59,15 +112,37 @@ lex_state_fn lex_errorf(lex_t * lex, const char * fmt, ...) {
 	return NULL;
 }
 
+/* the input at `offset`, or NULL if it has been dropped or not read yet */
+const char * lex_at(lex_t * lex, size_t offset) {
+	if (offset < lex->base || offset > lex->base + lex->length) return NULL;
+	return lex->input + (offset - lex->base);
+}
+
+/* drops the input before the current token, keeping one byte for lookbehind */
+static void slide(lex_t * lex) {
+	if (lex->span < lex->base + 1) return;
+
+	size_t drop = lex->span - 1 - lex->base;
+	if (drop == 0) return;
+
+	memmove(lex->input, lex->input + drop, lex->length - drop + 1);
+	lex->base   += drop;
+	lex->length -= drop;
+}
+
 char lex_next(lex_t * lex) {
-	if (lex->pos + 1 > lex->length) {
+	if (lex->pos + 1 > lex->base + lex->length) {
+		if (lex->in == NULL) return 0;
 		if (lex->in->error.code != 0) {
 			lex_errorf(lex, "Error reading input: %s", lex->in->error.message);
 			return 0;
 		}
 
+		if (lex->window) slide(lex);
+
 		size_t next_length = lex->length + 4096 + 1;
 		lex->input = realloc(lex->input, next_length);
+		STATS_BUFFER(next_length);
 		ssize_t len = stream_read(lex->in, lex->input + lex->length, 4096);
 
 		if (len < 0) {
@@ -77,12 +152,13 @@ char lex_next(lex_t * lex) {
 
 		if (len == 0) return 0;
 
+		STATS_ADD(stat_bytes_read, len);
 		lex->length += len;
 		lex->input[lex->length] = 0;
 	}
 
 	lex->width = 1;
-	return lex->input[lex->pos++];
+	return lex->input[lex->pos++ - lex->base];
 }
 
 void lex_backup(lex_t * lex) {
@@ -111,33 +187,112 @@ void lex_accept_run(lex_t * lex, const char * matching) {
 }
 
 void lex_ignore(lex_t * lex) {
-	lex->start  = lex->pos;
+	flush(lex);
+	lex->start = lex->span = lex->pos;
 }
 
-void lex_emit(lex_t * lex, enum lex_item_type it) {
-	count_newlines(lex);
+/* the input in [from, to) as one item */
+static void push(lex_t * lex, enum lex_item_type it, size_t from, size_t to) {
+	if (!lex->ahead) STATS_TOKEN(it);
+	STATS_BUFFER(to - from + 1);
 	lex_item_t i = lex_item_new (
-			substring(lex->input, lex->start, lex->pos),
-			it, lex->line, lex->line_pos, lex->start
+			substring(lex_at(lex, from), 0, to - from),
+			it, lex->line, lex->line_pos, from
 	);
+	if (it == item_id) i.hash = hash_bytes(i.value, i.length);
 
 	lex->items = lex_buffer_push(lex->items, i);
+}
+
+static enum lex_item_type span_type(lex_t * lex, size_t from, size_t to) {
+	const char * input = lex_at(lex, from);
+	size_t i;
+	for (i = 0; i < to - from; i++) {
+		if (!isspace(input[i])) return item_c_code;
+	}
+	return item_whitespace;
+}
+
+/*
+ * Emits what pass() held back. The grammar takes an identifier for a keyword when the
+ * token before it has a newline, so if only the held back tokens before the last one
+ * do, the last one goes out on its own.
+ */
+static void flush(lex_t * lex) {
+	if (lex->span == lex->start) return;
+
+	if (lex->span < lex->line_pos && lex->last >= lex->line_pos) {
+		push(lex, span_type(lex, lex->span, lex->last), lex->span, lex->last);
+		push(lex, span_type(lex, lex->last, lex->start), lex->last, lex->start);
+	} else {
+		push(lex, span_type(lex, lex->span, lex->start), lex->span, lex->start);
+	}
+	lex->span = lex->start;
+}
+
+void lex_emit(lex_t * lex, enum lex_item_type it) {
+	flush(lex);
+	count_newlines(lex);
+	push(lex, it, lex->start, lex->pos);
+	lex->last    = lex->start;
+	lex->dropped = false;
+	lex->start   = lex->span = lex->pos;
+}
+
+/*
+ * Emits a token the grammar only copies to the output. With coarse tokens it is
+ * held back instead, to go out with its neighbours as one item_c_code, or as one
+ * item_whitespace if that is all they were.
+ */
+void lex_pass(lex_t * lex, enum lex_item_type it) {
+	if (lex->keep == NULL) return lex_emit(lex, it);
+
+	count_newlines(lex);
+	lex->last  = lex->start;
 	lex->start = lex->pos;
+
+	if (lex->scan) {
+		lex->span    = lex->pos;
+		lex->dropped = true;
+	}
+}
+
+/* whether the identifier in [start, pos) is emitted rather than passed */
+bool lex_wanted(lex_t * lex) {
+	if (lex->keep == NULL) return true;
+	if (lex->scan && lex->dropped && lex->last >= lex->line_pos) return false;
+
+	// ids are looked up where they are, the byte after one stands in for its terminator
+	char * end  = lex->input + (lex->pos - lex->base);
+	char   lex_next = *end;
+	*end = '\0';
+
+	const char * id = lex_at(lex, lex->start);
+	bool keep = lex->keep(lex->keep_ctx, id, hash_bytes(id, lex->pos - lex->start));
+
+	*end = lex_next;
+	return keep;
 }
 
 lex_item_t lex_next_item(lex_t * lex) {
 	while(lex->items->length == 0 && lex->state != NULL) {
 		lex->state = (lex_state_fn) lex->state(lex);
 	}
-	return lex_buffer_next(lex->items);
+	lex_item_t it = lex_buffer_next(lex->items);
+
+	// lexed ahead of time, `line` is kept where lexing lazily would have it
+	if (lex->state == NULL) lex->line = it.line;
+	return it;
 }
 
 void lex_free(lex_t * lex) {
-	stream_close(lex->in);
-
 	lex_buffer_free(lex->items);
 	free(lex->filename);
-	free(lex->input);
+
+	if (lex->in != NULL) {
+		stream_close(lex->in);
+		free(lex->input);
+	}
 	free(lex);
 }
 
@@ -146,9 +301,10 @@ static char * substring(const char * input, size_t start, size_t end) {
 }
 
 static void count_newlines(lex_t * lex) {
+	const char * input = lex_at(lex, lex->start);
 	size_t i;
 	for (i = lex->start; i < lex->pos; i++) {
-		if (lex->input[i] == '\n') {
+		if (input[i - lex->start] == '\n') {
 			lex->line++;
 			lex->line_pos = i+1;
 		}
@@ -7,6 +7,7 @@
 struct lex_lexer_s;
 
 typedef void * (*lex_state_fn)(struct lex_lexer_s * lex);
+typedef bool   (*lex_keep_fn) (void * ctx, const char * id, unsigned int hash);
 
 #include "../deps/stream/stream.h"
 #include "buffer.h"
@@ -15,7 +16,16 @@ typedef struct lex_lexer_s{
 	stream_t * in;
 	char     * input;
 	char     * filename;
+	size_t     base;
 	size_t     length;
+	bool       window;
+	lex_keep_fn    keep;
+	void     * keep_ctx;
+	bool       scan;
+	bool       dropped;
+	bool       ahead;
+	size_t     span;
+	size_t     last;
 	size_t     start;
 	size_t     pos;
 	size_t     width;
@@ -26,7 +36,9 @@ typedef struct lex_lexer_s{
 } lex_t;
 
 lex_t * lex_new(lex_state_fn start, stream_t * in, const char * filename);
+lex_t * lex_over(lex_t * whole, lex_state_fn start, size_t from);
 lex_state_fn lex_errorf(lex_t * lex, const char * fmt, ...);
+const char * lex_at(lex_t * lex, size_t offset);
 char lex_next(lex_t * lex);
 void lex_backup(lex_t * lex);
 char lex_peek(lex_t * lex);
@@ -37,6 +49,8 @@ void lex_ignore(lex_t * lex);
 #include "item.h"
 
 void lex_emit(lex_t * lex, enum lex_item_type it);
+void lex_pass(lex_t * lex, enum lex_item_type it);
+bool lex_wanted(lex_t * lex);
 lex_item_t lex_next_item(lex_t * lex);
 void lex_free(lex_t * lex);
 
@@ -1,6 +1,7 @@
 import stream from "../deps/stream/stream.module.c";
 import item   from "./item.module.c";
 import buffer from "./buffer.module.c";
+import stats  from "../utils/stats.module.c";
 
 export {
 #include <stdlib.h>
@@ -8,17 +9,44 @@ export {
 }
 
 #include <string.h>
+#include <ctype.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include "../deps/hash/hash.h"
 
 export struct lexer_s;
 export typedef void * (*state_fn)(struct lexer_s * lex);
+export typedef bool   (*keep_fn) (void * ctx, const char * id, unsigned int hash);
 
+/*
+ * Offsets (start, pos, line_pos and those of the items) count from the beginning of the
+ * input. `input` holds `length` bytes of it starting at offset `base`, which stays 0
+ * unless `window` is set. With a window, whatever is behind the current token is dropped
+ * before reading more, so memory follows the longest token rather than the input.
+ *
+ * Setting `keep` makes tokens coarse: whatever goes through pass() is held back from
+ * `span` on and comes out as one item ahead of the next emitted token, and only the
+ * identifiers `keep` accepts are emitted at all. With `scan` set as well, what pass()
+ * gets is dropped instead, and an identifier after a dropped token is only looked at
+ * when that token ends a line, which is all the grammar needs to find its keywords.
+ *
+ * An `ahead` lexer lexes part of another's input on its behalf, which counts the tokens
+ * for --stats once it knows which of them it keeps.
+ */
 export typedef struct lexer_s{
 	stream.t * in;
 	char     * input;
 	char     * filename;
+	size_t     base;
 	size_t     length;
+	bool       window;
+	keep_fn    keep;
+	void     * keep_ctx;
+	bool       scan;
+	bool       dropped;
+	bool       ahead;
+	size_t     span;
+	size_t     last;
 	size_t     start;
 	size_t     pos;
 	size_t     width;
@@ -30,6 +58,7 @@ export typedef struct lexer_s{
 
 static char * substring(const char * input, size_t start, size_t end);
 static void count_newlines(lexer_t * lex);
+static void flush(lexer_t * lex);
 
 
 export lexer_t * new(state_fn start, stream.t * in, const char * filename) {
@@ -38,7 +67,14 @@ export lexer_t * new(state_fn start, stream.t * in, const char * filename) {
 	lex->in       = in;
 	lex->filename = strdup(filename);
 	lex->input    = NULL;
+	lex->base     = 0;
 	lex->length   = 0;
+	lex->window   = false;
+	lex->keep     = NULL;
+	lex->scan     = false;
+	lex->dropped  = false;
+	lex->ahead    = false;
+	lex->span     = 0;
 	lex->items    = buffer.new(2);
 	lex->state    = start;
 	lex->line     = 0;
@@ -46,6 +82,23 @@ export lexer_t * new(state_fn start, stream.t * in, const char * filename) {
 	return lex;
 }
 
+/*
+ * A lexer for `whole`'s input from `from` on, at the start state. It has no stream of its
+ * own and only borrows the input, so `whole` has to have read all of it and has to
+ * outlive the lexer. Lines count from 0 and `from` is taken to start one.
+ */
+export lexer_t * over(lexer_t * whole, state_fn start, size_t from) {
+	lexer_t * lex = new(start, NULL, whole->filename);
+
+	lex->input    = whole->input;
+	lex->length   = whole->length;
+	lex->start    = lex->pos = lex->span = from;
+	lex->line_pos = from;
+	lex->ahead    = true;
+
+	return lex;
+}
+
 export state_fn errorf(lexer_t * lex, const char * fmt, ...) {
 	va_list args;
 	va_start(args, fmt);
@@ -59,15 +112,37 @@ export state_fn errorf(lexer_t * lex, const char * fmt, ...) {
 	return NULL;
 }
 
+/* the input at `offset`, or NULL if it has been dropped or not read yet */
+export const char * at(lexer_t * lex, size_t offset) {
+	if (offset < lex->base || offset > lex->base + lex->length) return NULL;
+	return lex->input + (offset - lex->base);
+}
+
+/* drops the input before the current token, keeping one byte for lookbehind */
+static void slide(lexer_t * lex) {
+	if (lex->span < lex->base + 1) return;
+
+	size_t drop = lex->span - 1 - lex->base;
+	if (drop == 0) return;
+
+	memmove(lex->input, lex->input + drop, lex->length - drop + 1);
+	lex->base   += drop;
+	lex->length -= drop;
+}
+
 export char next(lexer_t * lex) {
-	if (lex->pos + 1 > lex->length) {
+	if (lex->pos + 1 > lex->base + lex->length) {
+		if (lex->in == NULL) return 0;
 		if (lex->in->error.code != 0) {
 			errorf(lex, "Error reading input: %s", lex->in->error.message);
 			return 0;
 		}
 
+		if (lex->window) slide(lex);
+
 		size_t next_length = lex->length + 4096 + 1;
 		lex->input = realloc(lex->input, next_length);
+		STATS_BUFFER(next_length);
 		ssize_t len = stream.read(lex->in, lex->input + lex->length, 4096);
 
 		if (len < 0) {
@@ -77,12 +152,13 @@ export char next(lexer_t * lex) {
 
 		if (len == 0) return 0;
 
+		STATS_ADD(stat_bytes_read, len);
 		lex->length += len;
 		lex->input[lex->length] = 0;
 	}
 
 	lex->width = 1;
-	return lex->input[lex->pos++];
+	return lex->input[lex->pos++ - lex->base];
 }
 
 export void backup(lexer_t * lex) {
@@ -111,33 +187,112 @@ export void accept_run(lexer_t * lex, const char * matching) {
 }
 
 export void ignore(lexer_t * lex) {
-	lex->start  = lex->pos;
+	flush(lex);
+	lex->start = lex->span = lex->pos;
 }
 
-export void emit(lexer_t * lex, enum item.type it) {
-	count_newlines(lex);
+/* the input in [from, to) as one item */
+static void push(lexer_t * lex, enum item.type it, size_t from, size_t to) {
+	if (!lex->ahead) STATS_TOKEN(it);
+	STATS_BUFFER(to - from + 1);
 	item.t i = item.new (
-			substring(lex->input, lex->start, lex->pos),
-			it, lex->line, lex->line_pos, lex->start
+			substring(at(lex, from), 0, to - from),
+			it, lex->line, lex->line_pos, from
 	);
+	if (it == item_id) i.hash = hash_bytes(i.value, i.length);
 
 	lex->items = buffer.push(lex->items, i);
+}
+
+static enum item.type span_type(lexer_t * lex, size_t from, size_t to) {
+	const char * input = at(lex, from);
+	size_t i;
+	for (i = 0; i < to - from; i++) {
+		if (!isspace(input[i])) return item_c_code;
+	}
+	return item_whitespace;
+}
+
+/*
+ * Emits what pass() held back. The grammar takes an identifier for a keyword when the
+ * token before it has a newline, so if only the held back tokens before the last one
+ * do, the last one goes out on its own.
+ */
+static void flush(lexer_t * lex) {
+	if (lex->span == lex->start) return;
+
+	if (lex->span < lex->line_pos && lex->last >= lex->line_pos) {
+		push(lex, span_type(lex, lex->span, lex->last), lex->span, lex->last);
+		push(lex, span_type(lex, lex->last, lex->start), lex->last, lex->start);
+	} else {
+		push(lex, span_type(lex, lex->span, lex->start), lex->span, lex->start);
+	}
+	lex->span = lex->start;
+}
+
+export void emit(lexer_t * lex, enum item.type it) {
+	flush(lex);
+	count_newlines(lex);
+	push(lex, it, lex->start, lex->pos);
+	lex->last    = lex->start;
+	lex->dropped = false;
+	lex->start   = lex->span = lex->pos;
+}
+
+/*
+ * Emits a token the grammar only copies to the output. With coarse tokens it is
+ * held back instead, to go out with its neighbours as one item_c_code, or as one
+ * item_whitespace if that is all they were.
+ */
+export void pass(lexer_t * lex, enum item.type it) {
+	if (lex->keep == NULL) return emit(lex, it);
+
+	count_newlines(lex);
+	lex->last  = lex->start;
 	lex->start = lex->pos;
+
+	if (lex->scan) {
+		lex->span    = lex->pos;
+		lex->dropped = true;
+	}
+}
+
+/* whether the identifier in [start, pos) is emitted rather than passed */
+export bool wanted(lexer_t * lex) {
+	if (lex->keep == NULL) return true;
+	if (lex->scan && lex->dropped && lex->last >= lex->line_pos) return false;
+
+	// ids are looked up where they are, the byte after one stands in for its terminator
+	char * end  = lex->input + (lex->pos - lex->base);
+	char   next = *end;
+	*end = '\0';
+
+	const char * id = at(lex, lex->start);
+	bool keep = lex->keep(lex->keep_ctx, id, hash_bytes(id, lex->pos - lex->start));
+
+	*end = next;
+	return keep;
 }
 
 export item.t next_item(lexer_t * lex) {
 	while(lex->items->length == 0 && lex->state != NULL) {
 		lex->state = (state_fn) lex->state(lex);
 	}
-	return buffer.next(lex->items);
+	item.t it = buffer.next(lex->items);
+
+	// lexed ahead of time, `line` is kept where lexing lazily would have it
+	if (lex->state == NULL) lex->line = it.line;
+	return it;
 }
 
 export void free(lexer_t * lex) {
-	stream.close(lex->in);
-
 	buffer.free(lex->items);
 	global.free(lex->filename);
-	global.free(lex->input);
+
+	if (lex->in != NULL) {
+		stream.close(lex->in);
+		global.free(lex->input);
+	}
 	global.free(lex);
 }
 
@@ -146,9 +301,10 @@ static char * substring(const char * input, size_t start, size_t end) {
 }
 
 static void count_newlines(lexer_t * lex) {
+	const char * input = at(lex, lex->start);
 	size_t i;
 	for (i = lex->start; i < lex->pos; i++) {
-		if (lex->input[i] == '\n') {
+		if (input[i - lex->start] == '\n') {
 			lex->line++;
 			lex->line_pos = i+1;
 		}
@@ -0,0 +1,283 @@
+
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "lex.h"
+#include "item.h"
+#include "buffer.h"
+#include "../deps/stream/stream.h"
+#include "../utils/stats.h"
+
+/*
+ * Lexing one big input on several threads. The input is cut into chunks at line breaks
+ * and every chunk is lexed as if it started outside of any token, which is a guess: a
+ * comment can run across the cut. The lexer only depends on where it is when it is back
+ * in its start state with nothing pending, so each chunk notes those points, and the
+ * tokens of a chunk are used from the first point the lexer before it ends on. When
+ * there is no such point the stretch is lexed again from where the previous chunk
+ * really ended, until it runs into one or past the chunk.
+ */
+
+#define DONE ((size_t) -1)
+
+typedef struct {
+	size_t pos;
+	size_t item; // the number of items lexed before `pos`
+} mark_t;
+
+typedef struct {
+	lex_t     * lex;
+	size_t        from;
+	size_t        to;
+	size_t        end;    // the point at or after `to` lexing stopped at, DONE at the end of the input
+	size_t        lines;  // line breaks before `from`
+	lex_item_t  * items;
+	size_t        length;
+	size_t        capacity;
+	mark_t      * marks;
+	size_t        n_marks;
+	size_t        c_marks;
+} chunk_t;
+
+static void add_item(chunk_t * c, lex_item_t item) {
+	if (c->length == c->capacity) {
+		c->capacity = c->capacity ? c->capacity * 2 : 1024;
+		c->items    = realloc(c->items, c->capacity * sizeof(lex_item_t));
+	}
+	c->items[c->length++] = item;
+}
+
+static void add_mark(chunk_t * c, size_t pos) {
+	if (c->n_marks == c->c_marks) {
+		c->c_marks = c->c_marks ? c->c_marks * 2 : 256;
+		c->marks   = realloc(c->marks, c->c_marks * sizeof(mark_t));
+	}
+	c->marks[c->n_marks++] = (mark_t) { .pos = pos, .item = c->length };
+}
+
+/* the index of the mark at `pos` in `c`, or DONE */
+static size_t find(chunk_t * c, size_t pos) {
+	size_t low = 0, high = c->n_marks;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if      (c->marks[mid].pos < pos) low  = mid + 1;
+		else if (c->marks[mid].pos > pos) high = mid;
+		else return mid;
+	}
+	return DONE;
+}
+
+/*
+ * Lexes until a point at or after `stop`, or the end. With `sync` it stops early at a
+ * point `sync` has as well and returns that mark's index, DONE otherwise.
+ */
+static size_t run(chunk_t * c, lex_state_fn start, size_t stop, chunk_t * sync) {
+	lex_t * lex = c->lex;
+	add_mark(c, lex->pos);
+
+	while (lex->state != NULL) {
+		lex->state = (lex_state_fn) lex->state(lex);
+		while (lex->items->length) add_item(c, lex_buffer_next(lex->items));
+
+		if (lex->state != start || lex->start != lex->pos) continue;
+
+		add_mark(c, lex->pos);
+		if (sync) {
+			size_t m = find(sync, lex->pos);
+			if (m != DONE) {
+				c->end = sync->end;
+				return m;
+			}
+		}
+		if (lex->pos >= stop) {
+			c->end = lex->pos;
+			return DONE;
+		}
+	}
+
+	c->end = DONE;
+	return DONE;
+}
+
+typedef struct {
+	chunk_t        * chunk;
+	lex_state_fn   start;
+	stats_t        * into;    // the stats of the thread that started the job, NULL without --stats
+	stats_t          counted; // the job's own, added to `into` once it is joined
+} job_t;
+
+static void * work(void * arg) {
+	job_t * job = (job_t *) arg;
+	chunk_t * c = job->chunk;
+	stats_current = job->into ? &job->counted : NULL;
+	// the last chunk goes on to the end, where eof is emitted
+	run(c, job->start, c->to < c->lex->length ? c->to : DONE, NULL);
+	return NULL;
+}
+
+static size_t count_lines(const char * input, size_t from, size_t to) {
+	size_t lines = 0;
+	const char * c = input + from;
+	const char * end = input + to;
+	while ((c = memchr(c, '\n', end - c)) != NULL) {
+		lines++;
+		c++;
+	}
+	return lines;
+}
+
+/* moves the items of `c` from mark `m` on to `out`, with their lines counted from the start */
+static void take(chunk_t * out, chunk_t * c, size_t m) {
+	size_t i;
+	size_t first = m == DONE ? c->length : c->marks[m].item;
+	for (i = 0; i < c->length; i++) {
+		if (i < first) {
+			lex_item_free(c->items[i]);
+			continue;
+		}
+		c->items[i].line += c->lines;
+		add_item(out, c->items[i]);
+	}
+	c->length = 0;
+}
+
+static void free_chunk(chunk_t * c) {
+	size_t i;
+	for (i = 0; i < c->length; i++) lex_item_free(c->items[i]);
+	free(c->items);
+	free(c->marks);
+	if (c->lex) lex_free(c->lex);
+}
+
+/* reads what is left of the input, so that lexer.over() can share it */
+static bool read_all(lex_t * lex) {
+	size_t capacity = lex->length + 65536;
+	lex->input = realloc(lex->input, capacity + 1);
+
+	while (true) {
+		if (lex->length == capacity) {
+			capacity *= 2;
+			lex->input = realloc(lex->input, capacity + 1);
+		}
+
+		ssize_t len = stream_read(lex->in, lex->input + lex->length, capacity - lex->length);
+		if (len < 0) return false;
+		if (len == 0) break;
+
+		STATS_ADD(stat_bytes_read, len);
+		lex->length += len;
+	}
+
+	lex->input[lex->length] = 0;
+	return true;
+}
+
+/*
+ * Lexes all of `lex`'s input up front, in up to `threads` chunks of at least `min_chunk`
+ * bytes, and leaves the items in its buffer for next_item(). The items are the same the
+ * lexer would have made by itself. Returns false, with nothing lexed yet, if the input is
+ * too small to split or couldn't be read, and the lexer carries on by itself.
+ */
+bool lex_parallel_split(lex_t * lex, size_t threads, size_t min_chunk) {
+	if (lex->base != 0 || lex->pos != 0 || lex->window || lex->keep) return false;
+	if (!read_all(lex)) return false;
+
+	size_t length = lex->length;
+	size_t n = threads;
+	if (min_chunk > 0 && length / min_chunk < n) n = length / min_chunk;
+	if (n < 2) return false;
+
+	lex_state_fn start = lex->state;
+	chunk_t * chunks = calloc(n, sizeof(chunk_t));
+
+	// chunks start after a line break
+	size_t i, from = 0, lines = 0;
+	for (i = 0; i < n; i++) {
+		size_t to = i == n - 1 ? length : (length / n) * (i + 1);
+		const char * nl = to < length ? memchr(lex->input + to, '\n', length - to) : NULL;
+		to = nl ? (size_t) (nl - lex->input) + 1 : length;
+		if (to < from) to = from;
+
+		chunks[i].from  = from;
+		chunks[i].to    = to;
+		chunks[i].lines = lines;
+		chunks[i].lex   = lex_over(lex, start, from);
+
+		lines += count_lines(lex->input, from, to);
+		from = to;
+	}
+
+	pthread_t * tids = calloc(n, sizeof(pthread_t));
+	job_t     * jobs = calloc(n, sizeof(job_t));
+	bool      * started = calloc(n, sizeof(bool));
+	for (i = 1; i < n; i++) {
+		jobs[i] = (job_t) { .chunk = &chunks[i], .start = start, .into = stats_current };
+		if (chunks[i].from < chunks[i].to) {
+			started[i] = pthread_create(&tids[i], NULL, work, &jobs[i]) == 0;
+		}
+		// not lexed ahead, so never agreed with and lexed again from scratch
+		if (!started[i]) chunks[i].end = DONE;
+	}
+
+	chunk_t out = {0};
+	run(&chunks[0], start, chunks[0].to, NULL);
+	take(&out, &chunks[0], 0);
+	size_t end = chunks[0].end;
+
+	for (i = 1; i < n; i++) {
+		if (started[i]) pthread_join(tids[i], NULL);
+		if (started[i] && jobs[i].into) stats_add(jobs[i].into, &jobs[i].counted);
+		chunk_t * c = &chunks[i];
+
+		if (end == DONE || (end >= c->to && i < n - 1)) {
+			take(&out, c, DONE);
+			continue;
+		}
+
+		size_t m = find(c, end);
+		if (m == DONE) {
+			// the guess was wrong, lex from where the lexer really is until it agrees
+			chunk_t fix = {
+				.lex   = lex_over(lex, start, end),
+				.lines = 0,
+			};
+			fix.lex->line     = count_lines(lex->input, 0, end);
+			fix.lex->line_pos = end;
+			while (fix.lex->line_pos > 0 && lex->input[fix.lex->line_pos - 1] != '\n') fix.lex->line_pos--;
+
+			m = run(&fix, start, i == n - 1 ? DONE : c->to, c);
+			take(&out, &fix, 0);
+			end = fix.end;
+			free_chunk(&fix);
+			if (m == DONE) {
+				take(&out, c, DONE);
+				continue;
+			}
+		}
+
+		take(&out, c, m);
+		end = c->end;
+	}
+
+	for (i = 0; i < out.length; i++) STATS_TOKEN(out.items[i].type);
+
+	lex_buffer_free(lex->items);
+	lex->items  = lex_buffer_new(out.length ? out.length : 1);
+	memcpy(lex->items->items, out.items, out.length * sizeof(lex_item_t));
+	lex->items->length = out.length;
+	lex->state  = NULL;
+	lex->start  = lex->pos = lex->span = length;
+
+	for (i = 0; i < n; i++) free_chunk(&chunks[i]);
+	free(out.items);
+	free(out.marks);
+	free(chunks);
+	free(tids);
+	free(jobs);
+	free(started);
+	return true;
+}
\ No newline at end of file
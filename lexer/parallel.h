@@ -0,0 +1,8 @@
+#ifndef _package_lex_parallel_
+#define _package_lex_parallel_
+
+#include "lex.h"
+
+bool lex_parallel_split(lex_t * lex, size_t threads, size_t min_chunk);
+
+#endif
@@ -1,5 +1,6 @@
 
 #include "item.h"
+#include "../utils/stats.h"
 #include <string.h>
 
 #include <stdlib.h>
@@ -13,6 +14,7 @@ typedef struct {
 
 lex_item_stack_t * lex_item_stack_new(size_t count) {
 	lex_item_stack_t * s = malloc(sizeof(lex_item_stack_t));
+	STATS_BUFFER(sizeof(lex_item_stack_t) + count * sizeof(lex_item_t));
 
 	s->items    = malloc(count * sizeof(lex_item_t));
 	s->capacity = count;
@@ -27,6 +29,7 @@ lex_item_stack_t * lex_item_stack_resize(lex_item_stack_t * s, size_t count) {
 	}
 
 	s->items = realloc(s->items, count * sizeof(lex_item_t));
+	STATS_BUFFER(count * sizeof(lex_item_t));
 
 	s->capacity = count;
 	return s;
@@ -1,5 +1,6 @@
 package "lex_item_stack";
 import lex_item from "./item.module.c";
+import stats    from "../utils/stats.module.c";
 #include <string.h>
 export {
 #include <stdlib.h>
@@ -13,6 +14,7 @@ export typedef struct {
 
 export item_stack_t * new(size_t count) {
 	item_stack_t * s = malloc(sizeof(item_stack_t));
+	STATS_BUFFER(sizeof(item_stack_t) + count * sizeof(lex_item.t));
 
 	s->items    = malloc(count * sizeof(lex_item.t));
 	s->capacity = count;
@@ -27,6 +29,7 @@ export item_stack_t * resize(item_stack_t * s, size_t count) {
 	}
 
 	s->items = realloc(s->items, count * sizeof(lex_item.t));
+	STATS_BUFFER(count * sizeof(lex_item.t));
 
 	s->capacity = count;
 	return s;
@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include "lex.h"
+#include "item.h"
 #include "../deps/stream/stream.h"
 
 /* declaration for state functions */
@@ -27,7 +28,7 @@ static void * emit_c_code(lex_t * lex, lex_state_fn fn){
 	lex_backup(lex);
 
 	if (lex->pos > lex->start) {
-			lex_emit(lex, item_c_code);
+			lex_pass(lex, item_c_code);
 	}
 
 	if (fn == NULL) lex_next(lex);
@@ -39,7 +40,7 @@ static void * eof(lex_t * lex) {
 	lex_backup(lex);
 
 	if (lex->pos > lex->start) {
-			lex_emit(lex, item_c_code);
+			lex_pass(lex, item_c_code);
 	}
 	lex_emit(lex, item_eof);
 
@@ -71,7 +72,7 @@ static void * lex_c(lex_t * lex) {
 			case '=':
 			case '*':
 				emit_c_code(lex, NULL);
-				lex_emit(lex, item_symbol);
+				lex_pass(lex, item_symbol);
 				break;
 
 			case '-':
@@ -82,7 +83,7 @@ static void * lex_c(lex_t * lex) {
 				break;
 
 			case '#':
-				if (lex->pos > 2 && lex->input[lex->pos - 2] == '\n')
+				if (lex->pos > 2 && *lex_at(lex, lex->pos - 2) == '\n')
 					return emit_c_code(lex, lex_preprocessor);
 				break;
 
@@ -99,14 +100,14 @@ static void * lex_c(lex_t * lex) {
 			case '[':
 			case '{':
 				emit_c_code(lex, NULL);
-				lex_emit(lex, item_open_symbol);
+				lex_pass(lex, item_open_symbol);
 				break;
 
 			case ')':
 			case ']':
 			case '}':
 				emit_c_code(lex, NULL);
-				lex_emit(lex, item_close_symbol);
+				lex_pass(lex, item_close_symbol);
 				break;
 
 		}
@@ -118,7 +119,7 @@ static void * lex_whitespace(lex_t * lex) {
 	char c;
 	while ((c = lex_next(lex)) != 0 && isspace(c));
 	lex_backup(lex);
-	lex_emit(lex, item_whitespace);
+	lex_pass(lex, item_whitespace);
 
 	if (c == 0) return eof(lex);
 	return lex_c;
@@ -127,7 +128,7 @@ static void * lex_whitespace(lex_t * lex) {
 static void * lex_oneline_comment(lex_t * lex) {
 	char c;
 	while ((c = lex_next(lex)) != 0 && c != '\n');
-	lex_emit(lex, item_comment);
+	lex_pass(lex, item_comment);
 	if (c == 0) return eof(lex);
 	return lex_c;
 }
@@ -138,14 +139,14 @@ static void * lex_multiline_comment(lex_t * lex) {
 		while ((c = lex_next(lex)) != 0 && c != '*');
 
 		if (c == 0) {
-			lex_errorf(lex, "Unterminated multiline comment\n %*s", lex->input + lex->start);
+			lex_errorf(lex, "Unterminated multiline comment\n %*s", lex_at(lex, lex->start));
 			return eof(lex);
 		}
 
 	} while (lex_peek(lex) != '/');
 
 	lex_next(lex);
-	lex_emit(lex, item_comment);
+	lex_pass(lex, item_comment);
 	return lex_c;
 }
 
@@ -161,17 +162,48 @@ static void * lex_number(lex_t * lex) {
 	char c;
 	while ((c = lex_next(lex)) != 0 && isdigit(c));
 	lex_backup(lex);
-	lex_emit(lex, item_number);
+	lex_pass(lex, item_number);
 
 	if (c == 0) return eof(lex);
 	return lex_c;
 }
 
-static void * lex_id(lex_t * lex) {
+static char scan_id(lex_t * lex) {
 	char c;
 	while ((c = lex_next(lex)) != 0 && (isalnum(c) || c == '_'));
 	lex_backup(lex);
-	lex_emit(lex, item_id);
+	return c;
+}
+
+static void token(lex_t * lex, enum lex_item_type it, bool keep) {
+	if (keep) lex_emit(lex, it);
+	else      lex_pass(lex, it);
+}
+
+static void * lex_id(lex_t * lex) {
+	char c = scan_id(lex);
+	bool keep = lex_wanted(lex);
+	token(lex, item_id, keep);
+
+	if (c == 0) return eof(lex);
+	if (lex->keep == NULL || c != '.') return lex_c;
+
+	/*
+	 * `name.field` is resolved as a whole, so with coarse tokens the field goes out
+	 * with the name whether or not it would have been wanted by itself.
+	 */
+	lex_next(lex);
+	token(lex, item_symbol, keep);
+
+	c = lex_next(lex);
+	if (c == 0) return eof(lex);
+	if (!isalpha(c) && c != '_') {
+		lex_backup(lex);
+		return lex_c;
+	}
+
+	c = scan_id(lex);
+	token(lex, item_id, keep);
 
 	if (c == 0) return eof(lex);
 	return lex_c;
@@ -194,7 +226,7 @@ static void * lex_quote(lex_t * lex) {
 		return lex_errorf(lex, "Missing terminating '\"' character\n");
 	}
 
-	lex_emit(lex, item_quoted_string);
+	lex_pass(lex, item_quoted_string);
 	return lex_c;
 }
 
@@ -213,13 +245,13 @@ static void * lex_squote(lex_t * lex) {
 	if (c == 0) {
 		size_t length = lex->pos - lex->start;
 		if (length > 10) {
-			return lex_errorf(lex, "Missing terminating ' character\n%.*s...", 10, lex->input + lex->start);
+			return lex_errorf(lex, "Missing terminating ' character\n%.*s...", 10, lex_at(lex, lex->start));
 		} else {
-			return lex_errorf(lex, "Missing terminating ' character\n%s", lex->input + lex->start);
+			return lex_errorf(lex, "Missing terminating ' character\n%s", lex_at(lex, lex->start));
 		}
 	}
 
-	lex_emit(lex, item_char_literal);
+	lex_pass(lex, item_char_literal);
 	return lex_c;
 }
 
@@ -229,6 +261,6 @@ static void * lex_preprocessor(lex_t * lex) {
 		c = lex_next(lex);
 	}
 	lex_backup(lex);
-	lex_emit(lex, item_preprocessor);
+	lex_pass(lex, item_preprocessor);
 	return lex_c;
 }
\ No newline at end of file
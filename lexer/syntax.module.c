@@ -3,8 +3,9 @@ package "lex_syntax";
 #include <ctype.h>
 #include <string.h>
 
-import lexer  from "./lex.module.c";
-import stream from "../deps/stream/stream.module.c";
+import lexer    from "./lex.module.c";
+import lex_item from "./item.module.c";
+import stream   from "../deps/stream/stream.module.c";
 
 /* declaration for state functions */
 static void * lex_c(lexer.t * lex);
@@ -27,7 +28,7 @@ static void * emit_c_code(lexer.t * lex, lexer.state_fn fn){
 	lexer.backup(lex);
 
 	if (lex->pos > lex->start) {
-			lexer.emit(lex, item_c_code);
+			lexer.pass(lex, item_c_code);
 	}
 
 	if (fn == NULL) lexer.next(lex);
@@ -39,7 +40,7 @@ static void * eof(lexer.t * lex) {
 	lexer.backup(lex);
 
 	if (lex->pos > lex->start) {
-			lexer.emit(lex, item_c_code);
+			lexer.pass(lex, item_c_code);
 	}
 	lexer.emit(lex, item_eof);
 
@@ -71,7 +72,7 @@ static void * lex_c(lexer.t * lex) {
 			case '=':
 			case '*':
 				emit_c_code(lex, NULL);
-				lexer.emit(lex, item_symbol);
+				lexer.pass(lex, item_symbol);
 				break;
 
 			case '-':
@@ -82,7 +83,7 @@ static void * lex_c(lexer.t * lex) {
 				break;
 
 			case '#':
-				if (lex->pos > 2 && lex->input[lex->pos - 2] == '\n')
+				if (lex->pos > 2 && *lexer.at(lex, lex->pos - 2) == '\n')
 					return emit_c_code(lex, lex_preprocessor);
 				break;
 
@@ -99,14 +100,14 @@ static void * lex_c(lexer.t * lex) {
 			case '[':
 			case '{':
 				emit_c_code(lex, NULL);
-				lexer.emit(lex, item_open_symbol);
+				lexer.pass(lex, item_open_symbol);
 				break;
 
 			case ')':
 			case ']':
 			case '}':
 				emit_c_code(lex, NULL);
-				lexer.emit(lex, item_close_symbol);
+				lexer.pass(lex, item_close_symbol);
 				break;
 
 		}
@@ -118,7 +119,7 @@ static void * lex_whitespace(lexer.t * lex) {
 	char c;
 	while ((c = lexer.next(lex)) != 0 && isspace(c));
 	lexer.backup(lex);
-	lexer.emit(lex, item_whitespace);
+	lexer.pass(lex, item_whitespace);
 
 	if (c == 0) return eof(lex);
 	return lex_c;
@@ -127,7 +128,7 @@ static void * lex_whitespace(lexer.t * lex) {
 static void * lex_oneline_comment(lexer.t * lex) {
 	char c;
 	while ((c = lexer.next(lex)) != 0 && c != '\n');
-	lexer.emit(lex, item_comment);
+	lexer.pass(lex, item_comment);
 	if (c == 0) return eof(lex);
 	return lex_c;
 }
@@ -138,14 +139,14 @@ static void * lex_multiline_comment(lexer.t * lex) {
 		while ((c = lexer.next(lex)) != 0 && c != '*');
 
 		if (c == 0) {
-			lexer.errorf(lex, "Unterminated multiline comment\n %*s", lex->input + lex->start);
+			lexer.errorf(lex, "Unterminated multiline comment\n %*s", lexer.at(lex, lex->start));
 			return eof(lex);
 		}
 
 	} while (lexer.peek(lex) != '/');
 
 	lexer.next(lex);
-	lexer.emit(lex, item_comment);
+	lexer.pass(lex, item_comment);
 	return lex_c;
 }
 
@@ -161,17 +162,48 @@ static void * lex_number(lexer.t * lex) {
 	char c;
 	while ((c = lexer.next(lex)) != 0 && isdigit(c));
 	lexer.backup(lex);
-	lexer.emit(lex, item_number);
+	lexer.pass(lex, item_number);
 
 	if (c == 0) return eof(lex);
 	return lex_c;
 }
 
-static void * lex_id(lexer.t * lex) {
+static char scan_id(lexer.t * lex) {
 	char c;
 	while ((c = lexer.next(lex)) != 0 && (isalnum(c) || c == '_'));
 	lexer.backup(lex);
-	lexer.emit(lex, item_id);
+	return c;
+}
+
+static void token(lexer.t * lex, enum lex_item.type it, bool keep) {
+	if (keep) lexer.emit(lex, it);
+	else      lexer.pass(lex, it);
+}
+
+static void * lex_id(lexer.t * lex) {
+	char c = scan_id(lex);
+	bool keep = lexer.wanted(lex);
+	token(lex, item_id, keep);
+
+	if (c == 0) return eof(lex);
+	if (lex->keep == NULL || c != '.') return lex_c;
+
+	/*
+	 * `name.field` is resolved as a whole, so with coarse tokens the field goes out
+	 * with the name whether or not it would have been wanted by itself.
+	 */
+	lexer.next(lex);
+	token(lex, item_symbol, keep);
+
+	c = lexer.next(lex);
+	if (c == 0) return eof(lex);
+	if (!isalpha(c) && c != '_') {
+		lexer.backup(lex);
+		return lex_c;
+	}
+
+	c = scan_id(lex);
+	token(lex, item_id, keep);
 
 	if (c == 0) return eof(lex);
 	return lex_c;
@@ -194,7 +226,7 @@ static void * lex_quote(lexer.t * lex) {
 		return lexer.errorf(lex, "Missing terminating '\"' character\n");
 	}
 
-	lexer.emit(lex, item_quoted_string);
+	lexer.pass(lex, item_quoted_string);
 	return lex_c;
 }
 
@@ -213,13 +245,13 @@ static void * lex_squote(lexer.t * lex) {
 	if (c == 0) {
 		size_t length = lex->pos - lex->start;
 		if (length > 10) {
-			return lexer.errorf(lex, "Missing terminating ' character\n%.*s...", 10, lex->input + lex->start);
+			return lexer.errorf(lex, "Missing terminating ' character\n%.*s...", 10, lexer.at(lex, lex->start));
 		} else {
-			return lexer.errorf(lex, "Missing terminating ' character\n%s", lex->input + lex->start);
+			return lexer.errorf(lex, "Missing terminating ' character\n%s", lexer.at(lex, lex->start));
 		}
 	}
 
-	lexer.emit(lex, item_char_literal);
+	lexer.pass(lex, item_char_literal);
 	return lex_c;
 }
 
@@ -229,6 +261,6 @@ static void * lex_preprocessor(lexer.t * lex) {
 		c = lexer.next(lex);
 	}
 	lexer.backup(lex);
-	lexer.emit(lex, item_preprocessor);
+	lexer.pass(lex, item_preprocessor);
 	return lex_c;
 }
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <sys/wait.h>
@@ -12,9 +13,12 @@
 #include "package/package.h"
 #include "package/export.h"
 #include "package/import.h"
-#include "package/atomic-stream.h"
+#include "package/fs.h"
 #include "utils/utils.h"
 #include "deps/stream/stream.h"
+#include "utils/stats.h"
+#include "profile.h"
+#include "package/context.h"
 
 static const char * ops[] = {
 	":=",
@@ -30,21 +34,43 @@ typedef struct {
 	char * cwd;
 } makevars;
 
-makevars get_makevars(package_t * pkg, char * makefile) {
-	makevars v = {
-		.makefile      = makefile,
-		.makefile_base = strdup(basename(makefile)),
-		.makefile_dir  = strdup(dirname(makefile)),
-		.target        = strdup(basename(pkg->generated)),
-		.cwd           = getcwd(NULL, 0),
-	};
+/* the file `make` builds for `pkg` */
+char * makefile_target_name(package_t * pkg) {
+	char * target = strdup(basename(pkg->generated));
 
-	char * ext = strrchr(v.target, '.');
+	char * ext = strrchr(target, '.');
 	if (strcmp(pkg->name, "main") == 0){
 		*ext = 0;
+	} else if (pkg->ctx->shared) {
+		target = realloc(target, strlen(target) + 2);
+		strcpy(strrchr(target, '.'), ".so");
 	} else {
 		ext[1] = 'a';
 	}
+	return target;
+}
+
+static bool ends_with(const char * s, const char * suffix) {
+	size_t length = strlen(s), n = strlen(suffix);
+	return length >= n && strcmp(s + length - n, suffix) == 0;
+}
+
+/* whether `target`, written down by an earlier generation, is the kind of file this one builds */
+bool makefile_same_kind(const char * target, cbuild_ctx_t * ctx) {
+	if (ctx->shared) return !ends_with(target, ".a");
+	return !ends_with(target, ".so");
+}
+
+makevars get_makevars(const char * target, char * makefile) {
+	// dirname() may write into `makefile`, so the base has to be taken first
+	char * base = strdup(basename(makefile));
+	makevars v = {
+		.makefile      = makefile,
+		.makefile_base = base,
+		.makefile_dir  = strdup(dirname(makefile)),
+		.target        = strdup(target),
+		.cwd           = getcwd(NULL, 0),
+	};
 
 	chdir(v.makefile_dir);
 	return v;
@@ -65,73 +91,411 @@ int clear_makevars(makevars v, int result, char * cmd) {
 	return WEXITSTATUS(result);
 }
 
-int makefile_make(package_t * pkg, char * makefile) {
-	if (pkg == NULL) return -1;
-	makevars v = get_makevars(pkg, makefile);
+/* builds `target` of `prof`, or the plain one for NULL, with `makefile`, which is freed */
+int makefile_make_target(cbuild_ctx_t * ctx, const char * target, const profile_t * prof, char * makefile) {
+	makevars v = get_makevars(target, makefile);
 
+	char * args = profile_make_args(prof);
 	char * cmd;
-	asprintf(&cmd, "make -f %s %s", v.makefile_base,  v.target);
+	asprintf(&cmd, "make -f %s %s %s%s", v.makefile_base, args, profile_dir(prof), v.target);
+	free(args);
 
-	return clear_makevars(v, system(cmd), cmd);
+	stats_frame_t frame = stats_enter(ctx->stats, NULL, phase_build);
+	int result = system(cmd);
+	stats_leave(frame);
+
+	return clear_makevars(v, result, cmd);
 }
 
-int makefile_clean(package_t * pkg, char * makefile) {
-	if (pkg == NULL) return -1;
-	makevars v = get_makevars(pkg, makefile);
+/* removes what `makefile`, which is freed, built for `target` of `prof` */
+int makefile_clean_target(const char * target, const profile_t * prof, char * makefile) {
+	makevars v = get_makevars(target, makefile);
 
+	char * args = profile_make_args(prof);
 	char * cmd;
-	asprintf(&cmd, "make -f %s CLEAN_%s", v.makefile_base,  v.target);
+	asprintf(&cmd, "make -f %s %s CLEAN_%s", v.makefile_base, args, v.target);
+	free(args);
 
 	return clear_makevars(v, system(cmd), cmd);
 }
 
-char * write_deps(package_t * pkg, package_t * root, stream_t * out, char * deps) {
-	if (pkg == NULL || pkg->exported) return deps;
+int makefile_make(package_t * pkg, const profile_t * prof, char * makefile) {
+	if (pkg == NULL) return -1;
+
+	char * target = makefile_target_name(pkg);
+	int result = makefile_make_target(pkg->ctx, target, prof, makefile);
+	free(target);
+	return result;
+}
+
+int makefile_clean(package_t * pkg, const profile_t * prof, char * makefile) {
+	if (pkg == NULL) return -1;
+
+	char * target = makefile_target_name(pkg);
+	int result = makefile_clean_target(target, prof, makefile);
+	free(target);
+	return result;
+}
+
+typedef struct {
+	package_t  * pkg;
+	package_t ** deps;   // imported packages, each once and sorted by path
+	size_t       n_deps;
+	char       * source; // the generated .c relative to the makefile
+	char       * object; // its object under $(PROFILE_DIR)
+} entry_t;
+
+typedef struct {
+	entry_t * items;
+	size_t    length;
+	size_t    cap;
+} order_t;
+
+static entry_t * append(order_t * o, package_t * pkg) {
+	if (o->length == o->cap) {
+		o->cap   = o->cap ? o->cap * 2 : 64;
+		o->items = realloc(o->items, o->cap * sizeof(entry_t));
+	}
+	entry_t * e = &o->items[o->length++];
+	e->pkg = pkg;
+	return e;
+}
+
+static int by_source(const void * a, const void * b) {
+	return strcmp((*(package_t **) a)->source_abs, (*(package_t **) b)->source_abs);
+}
+
+/* the packages `pkg` imports, each once and sorted, so nothing depends on the hash layout */
+static size_t sorted_deps(package_t * pkg, package_t *** out) {
+	*out = NULL;
+	if (pkg->deps == NULL || hash_size(pkg->deps) == 0) return 0;
+
+	package_t ** deps = malloc(hash_size(pkg->deps) * sizeof(package_t *));
+	size_t n = 0;
+	hash_each_val(pkg->deps, {
+		package_import_t * dep = (package_import_t *) val;
+		if (dep && dep->pkg) deps[n++] = dep->pkg;
+	});
+	qsort(deps, n, sizeof(package_t *), by_source);
+
+	size_t i, unique = 0;
+	for (i = 0; i < n; i++) {
+		if (unique == 0 || deps[unique - 1] != deps[i]) deps[unique++] = deps[i];
+	}
+
+	*out = deps;
+	return unique;
+}
+
+/* depth first, every package before the ones it imports so its build variables come first */
+static void collect(package_t * pkg, package_t * root, order_t * o) {
+	if (pkg == NULL || pkg->exported) return;
 	pkg->exported = true;
 
-	char * source = utils_relative(root->generated, pkg->generated);
-	char * object = strdup(source);
-	object[strlen(source) - 1] = 'o';
+	entry_t * e = append(o, pkg);
+	e->source = utils_relative(root->generated, pkg->generated);
+	e->n_deps = sorted_deps(pkg, &e->deps);
 
-	size_t len = deps == NULL ? 0 : strlen(deps);
-	deps = realloc(deps, len + strlen(object) + 2);
-	sprintf(deps + len, " %s", object);
+	// append() may move the entries, so the dependencies are read back by index
+	size_t index = o->length - 1;
+	size_t i;
+	for (i = 0; i < o->items[index].n_deps; i++) collect(o->items[index].deps[i], root, o);
+}
 
-	char * package_rel = utils_relative(root->source_abs, pkg->generated);
-	stream_printf(out, "#dependencies for package '%s'\n", package_rel);
-	free(package_rel);
+typedef struct {
+	const char * name;
+	char       * value;   // NULL while undefined
+	bool         unknown; // set by a value only make can expand
+} variable_t;
+
+/* what make starts `v` with: the environment's value, or its own default for CC */
+static void initial(variable_t * v) {
+	const char * env = getenv(v->name);
+	if (env != NULL) {
+		v->value = strdup(env);
+	} else if (strcmp(v->name, "CC") == 0) {
+		v->value = strdup("cc");
+	}
+}
+
+static void assign(variable_t * v, package_var_t var) {
+	if (strchr(var.value, '$') != NULL) v->unknown = true;
+
+	char * value = NULL;
+	switch (var.operation) {
+		case build_var_set:
+			value = strdup(var.value);
+			break;
+		case build_var_set_default:
+			if (v->value != NULL) return;
+			value = strdup(var.value);
+			break;
+		case build_var_append:
+			if (v->value == NULL || v->value[0] == 0) {
+				value = strdup(var.value);
+			} else {
+				asprintf(&value, "%s %s", v->value, var.value);
+			}
+			break;
+	}
+	free(v->value);
+	v->value = value;
+}
+
+/* the values the packages' assignments add up to, for every variable they assign */
+typedef struct {
+	hash_t * values; // name -> variable_t
+} makefile_assignment_t;
+
+/* what collect() would visit, without marking the packages */
+static void assign_all(package_t * pkg, makefile_assignment_t * vars, hash_t * seen) {
+	if (pkg == NULL || hash_has(seen, (char *) pkg->source_abs)) return;
+	hash_set(seen, (char *) pkg->source_abs, pkg);
 
 	int i;
 	for (i = 0; i < pkg->n_variables; i++) {
-		package_var_t v = pkg->variables[i];
-		stream_printf(out, "%s %s %s\n", v.name, ops[v.operation], v.value);
+		package_var_t var = pkg->variables[i];
+		if (var.local) continue;
+
+		variable_t * v = hash_get(vars->values, var.name);
+		if (v == NULL) {
+			v = calloc(1, sizeof(variable_t));
+			v->name = strdup(var.name);
+			initial(v);
+			hash_set(vars->values, (char *) v->name, v);
+		}
+		assign(v, var);
 	}
 
-	stream_printf(out, "%s: %s", object, source);
-	free(source);
-	free(object);
+	package_t ** deps;
+	size_t j, n_deps = sorted_deps(pkg, &deps);
+	for (j = 0; j < n_deps; j++) assign_all(deps[j], vars, seen);
+	free(deps);
+}
+
+/*
+ * Every variable's value in the makefile written for `root`, worked out in one walk over
+ * the graph: make's starting value, with the packages' assignments applied in the order
+ * they are written. Works on a graph that is still being parsed, with what has been
+ * parsed so far.
+ */
+makefile_assignment_t * makefile_assignment(package_t * root) {
+	makefile_assignment_t * vars = malloc(sizeof(makefile_assignment_t));
+	vars->values = hash_new();
+
+	hash_t * seen = hash_new();
+	assign_all(root, vars, seen);
+	hash_free(seen);
+	return vars;
+}
+
+void makefile_free_assignment(makefile_assignment_t * vars) {
+	if (vars == NULL) return;
+	hash_each_val(vars->values, {
+		variable_t * v = (variable_t *) val;
+		free((char *) v->name);
+		free(v->value);
+		free(v);
+	});
+	hash_free(vars->values);
+	free(vars);
+}
 
-	if (pkg->deps == NULL) {
-	stream_printf(out,"\n\n");
-		return deps;
+/*
+ * The value make will give `name` with the assignment `vars`, and then `object`'s own
+ * `build local` assignments if it isn't NULL. "" if it stays undefined, NULL if one of
+ * them needs make to expand it.
+ */
+char * makefile_lookup(makefile_assignment_t * vars, package_t * object, const char * name) {
+	variable_t v = { .name = name };
+
+	variable_t * shared = hash_get(vars->values, (char *) name);
+	if (shared != NULL) {
+		v.value   = shared->value ? strdup(shared->value) : NULL;
+		v.unknown = shared->unknown;
+	} else {
+		initial(&v);
 	}
 
-	hash_each_val(pkg->deps, {
-			package_import_t * dep = (package_import_t *) val;
-			if (dep && dep->pkg && dep->pkg->header) {
-				char * path = utils_relative(root->source_abs, dep->pkg->header);
-				stream_printf(out, " %s", path);
-				free(path);
-			}
+	int i;
+	for (i = 0; object && i < object->n_variables; i++) {
+		package_var_t var = object->variables[i];
+		if (var.local && strcmp(var.name, name) == 0) assign(&v, var);
+	}
+
+	if (v.unknown || (v.value && strchr(v.value, '$'))) {
+		free(v.value);
+		return NULL;
+	}
+	return v.value ? v.value : strdup("");
+}
+
+/* lookup() for a single variable, walking the graph for it */
+char * makefile_variable(package_t * root, package_t * object, const char * name) {
+	makefile_assignment_t * vars = makefile_assignment(root);
+	char * result = makefile_lookup(vars, object, name);
+	makefile_free_assignment(vars);
+	return result;
+}
+
+/*
+ * A shared library's dynamic symbols are the functions and variables the root exports,
+ * its own and those it passes through from its imports with `export * from`. The packages
+ * defining them keep the default visibility, every other object is compiled with
+ * -fvisibility=hidden so that its symbols are bound inside the library, and the version
+ * script makes whatever else the public packages define local.
+ */
+static bool shared(package_t * root) {
+	return root->ctx->shared && strcmp(root->name, "main") != 0;
+}
+
+static bool dynamic(package_export_t * exp) {
+	return exp->symbol && exp->symbol[0] && (exp->type == type_function || exp->type == type_block);
+}
+
+/*
+ * the dynamic symbols `root` exports by local name, made once and again only when the
+ * root, still being parsed, has exported more since
+ */
+static hash_t * dynamic_exports(package_t * root) {
+	cbuild_ctx_t * ctx = root->ctx;
+	if (ctx->dynamic_exports && ctx->n_root_exports == hash_size(root->exports)) return ctx->dynamic_exports;
+
+	if (ctx->dynamic_exports) hash_free(ctx->dynamic_exports);
+	ctx->dynamic_exports = hash_new();
+	ctx->n_root_exports  = hash_size(root->exports);
+	hash_each_val(root->exports, {
+		package_export_t * exp = (package_export_t *) val;
+		if (dynamic(exp)) hash_set(ctx->dynamic_exports, exp->local_name, exp);
 	});
-	stream_printf(out,"\n\n");
+	return ctx->dynamic_exports;
+}
 
-	hash_each_val(pkg->deps, {
-			package_import_t * dep = (package_import_t *)val;
-			deps = write_deps(dep->pkg, root, out, deps);
+/* whether `pkg` defines one of the dynamic symbols of the library built from `root` */
+static bool public(package_t * root, package_t * pkg) {
+	if (pkg == root) return true;
+
+	// whichever of the two tables is smaller is walked
+	hash_t * exported = dynamic_exports(root);
+	bool found = false;
+	if (hash_size(pkg->symbols) < hash_size(exported)) {
+		hash_each(pkg->symbols, {
+			if (val && val == hash_get(exported, (char *) key)) found = true;
+		});
+	} else {
+		hash_each(exported, {
+			if (hash_get(pkg->symbols, (char *) key) == val) found = true;
+		});
+	}
+	return found;
+}
+
+/* where the objects of `root`'s target go under $(PROFILE_DIR): "pic/" for a shared library */
+static const char * objects_dir(package_t * root) {
+	return shared(root) ? "pic/" : "";
+}
+
+/*
+ * The object of `pkg` in the build of `root`, relative to $(PROFILE_DIR). It follows the
+ * generated .c's path from the makefile, except that each leading "../" becomes "__/", so
+ * the objects of sources outside the makefile's directory stay under the profile's too.
+ */
+char * makefile_object_name(package_t * root, package_t * pkg) {
+	char * source = utils_relative(root->generated, pkg->generated);
+	const char * dir = objects_dir(root);
+
+	char * object = malloc(strlen(dir) + strlen(source) + 1);
+	strcpy(object, dir);
+	char * rest = source;
+	while (strncmp(rest, "../", 3) == 0) {
+		strcat(object, "__/");
+		rest += 3;
+	}
+	strcat(object, rest);
+	object[strlen(object) - 1] = 'o';
+
+	free(source);
+	return object;
+}
+
+/* the flags `pkg`'s object, or a hidden one's for NULL, gets in the shared library built from `root`, NULL if it isn't one */
+const char * makefile_shared_flags(package_t * root, package_t * pkg) {
+	if (!shared(root)) return NULL;
+	return pkg && public(root, pkg) ? "-fPIC" : "-fPIC -fvisibility=hidden";
+}
+
+static int by_string(const void * a, const void * b) {
+	return strcmp(*(const char **) a, *(const char **) b);
+}
+
+/* writes the version script of `root`'s shared library next to the makefile, as <root>.map */
+static char * write_version_script(package_t * root, const char * name) {
+	char * map_name = strdup(name);
+	map_name[strlen(map_name) - strlen("module.c")] = 0;
+	strcat(map_name, "map");
+
+	const char ** symbols = malloc((hash_size(root->exports) + 1) * sizeof(char *));
+	size_t i, n = 0;
+	hash_each_val(root->exports, {
+		package_export_t * exp = (package_export_t *) val;
+		if (dynamic(exp)) symbols[n++] = exp->symbol;
 	});
+	qsort(symbols, n, sizeof(char *), by_string);
 
-	return deps;
+	stream_t * out = fs_open_write(root->ctx->fs, map_name);
+	stream_printf(out, "{\n");
+	if (n > 0) stream_printf(out, "\tglobal:\n");
+	for (i = 0; i < n; i++) {
+		if (i == 0 || strcmp(symbols[i], symbols[i - 1]) != 0) stream_printf(out, "\t\t%s;\n", symbols[i]);
+	}
+	stream_printf(out, "\tlocal:\n\t\t*;\n};\n");
+	stream_close(out);
+
+	free(symbols);
+	return map_name;
+}
+
+static void write_recipe(package_t * root, stream_t * out) {
+	stream_printf(out, "\t@mkdir -p $(@D)\n");
+	stream_printf(out, "\t$(CC) $(CFLAGS) $(PROFILE_CFLAGS) %s$(CPPFLAGS) -c -o $@ $<\n",
+			shared(root) ? "$(SHARED_CFLAGS) " : "");
+}
+
+static void write_package(entry_t * e, package_t * root, stream_t * out) {
+	package_t * pkg = e->pkg;
+
+	stream_printf(out, "#dependencies for package '%s'\n", e->source);
+
+	int i;
+	for (i = 0; i < pkg->n_variables; i++) {
+		package_var_t v = pkg->variables[i];
+		if (!v.local) stream_printf(out, "%s %s %s\n", v.name, ops[v.operation], v.value);
+	}
+
+	stream_printf(out, "$(PROFILE_DIR)%s: %s", e->object, e->source);
+
+	size_t j;
+	for (j = 0; j < e->n_deps; j++) {
+		if (e->deps[j]->header == NULL) continue;
+
+		char * header = utils_relative(root->generated, e->deps[j]->header);
+		stream_printf(out, " %s", header);
+		free(header);
+	}
+	stream_printf(out, "\n");
+	// the pattern rule only matches objects named after their source
+	if (strncmp(e->source, "../", 3) == 0) write_recipe(root, out);
+
+	// target-specific, so only this object is compiled with them
+	for (i = 0; i < pkg->n_variables; i++) {
+		package_var_t v = pkg->variables[i];
+		if (v.local) stream_printf(out, "$(PROFILE_DIR)%s: %s %s %s\n", e->object, v.name, ops[v.operation], v.value);
+	}
+	if (shared(root) && public(root, pkg)) {
+		stream_printf(out, "$(PROFILE_DIR)%s: SHARED_CFLAGS := %s\n", e->object, makefile_shared_flags(root, pkg));
+	}
+
+	stream_printf(out, "\n");
 }
 
 char * get_makefile_name(const char * path) {
@@ -141,35 +505,80 @@ char * get_makefile_name(const char * path) {
 	return name;
 }
 
+/*
+ * Packages are written in a stable depth first order, imports sorted by path, so an
+ * unchanged graph always produces the same file. The objects are listed once, in
+ * OBJECTS_<target>, and compiled by a single pattern rule. Objects and the target are
+ * named under $(PROFILE_DIR), which only a build profile sets. A shared library's objects
+ * are compiled position independent, under pic/ so they never mix with a static build's.
+ */
 char * makefile_write(package_t * pkg, const char * name) {
 	char * target = NULL;
 	char * mkfile_name = get_makefile_name(name);
-	stream_t * mkfile = atomic_stream_open(mkfile_name);
-	char * deps = write_deps(pkg, pkg, mkfile, NULL);
+	stats_frame_t frame = stats_enter(pkg->ctx->stats, NULL, phase_makefile);
+	STATS_ADD(stat_files_written, 1);
+	stream_t * mkfile = fs_open_write(pkg->ctx->fs, mkfile_name);
 
-	if (strcmp(pkg->name, "main") == 0) {
+	order_t order = {0};
+	collect(pkg, pkg, &order);
+
+	bool executable = strcmp(pkg->name, "main") == 0;
+	char * version_script = NULL;
+	if (executable) {
 		char * buf = strdup(pkg->generated);
 		char * base = basename(buf);
 		asprintf(&target, "%.*s", (int)strlen(base) - 2, base);
 		free(buf);
-
-		stream_printf(mkfile, "%s:%s\n",target, deps);
-		stream_printf(mkfile, "\t$(CC) $(CFLAGS) $(LDFLAGS) %s -o %s $(LDLIBS)\n\n", deps, target);
 	} else {
-		target = malloc(strlen(pkg->name) + 3);
-		strcpy(target, pkg->name);
-		strcat(target, ".a");
+		asprintf(&target, "%s.%s", pkg->name, shared(pkg) ? "so" : "a");
+		if (shared(pkg)) version_script = write_version_script(pkg, name);
+	}
 
-		stream_printf(mkfile, "%s:%s\n",target, deps);
-		stream_printf(mkfile, "\tar rcs $@ $^\n\n", deps, target);
+	size_t i;
+	stream_printf(mkfile, "OBJECTS_%s :=", target);
+	for (i = 0; i < order.length; i++) {
+		order.items[i].object = makefile_object_name(pkg, order.items[i].pkg);
+		stream_printf(mkfile, " \\\n\t$(PROFILE_DIR)%s", order.items[i].object);
+	}
+	stream_printf(mkfile, "\n\n");
+
+	if (version_script) {
+		char * buf = strdup(version_script);
+		char * map = basename(buf);
+		stream_printf(mkfile, "SHARED_CFLAGS := %s\n\n", makefile_shared_flags(pkg, NULL));
+		stream_printf(mkfile, "$(PROFILE_DIR)%s: $(OBJECTS_%s) %s\n", target, target, map);
+		stream_printf(mkfile, "\t$(CC) -shared $(CFLAGS) $(PROFILE_CFLAGS) $(LDFLAGS) $(PROFILE_LDFLAGS) "
+				"-Wl,--version-script=%s $(OBJECTS_%s) -o $@ $(LDLIBS)\n\n", map, target);
+		free(buf);
+	} else {
+		stream_printf(mkfile, "$(PROFILE_DIR)%s: $(OBJECTS_%s)\n", target, target);
+	}
+	if (executable) {
+		stream_printf(mkfile, "\t$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(LDFLAGS) $(PROFILE_LDFLAGS) $(OBJECTS_%s) -o $@ $(LDLIBS)\n\n", target);
+	} else if (version_script == NULL) {
+		stream_printf(mkfile, "\t$(AR) rcs $@ $^\n\n");
 	}
 
 	stream_printf(mkfile, "CLEAN_%s:\n", target);
-	stream_printf(mkfile, "\trm -rf %s%s\n", target, deps);
+	stream_printf(mkfile, "\trm -rf $(PROFILE_DIR)%s $(OBJECTS_%s)\n\n", target, target);
+
+	stream_printf(mkfile, "$(PROFILE_DIR)%s%%.o: %%.c\n", objects_dir(pkg));
+	write_recipe(pkg, mkfile);
+	stream_printf(mkfile, "\n");
+
+	for (i = 0; i < order.length; i++) {
+		write_package(&order.items[i], pkg, mkfile);
+		free(order.items[i].source);
+		free(order.items[i].object);
+		free(order.items[i].deps);
+	}
+
 	free(target);
+	free(version_script);
+	free(order.items);
 
 	stream_close(mkfile);
-	free(deps);
+	stats_leave(frame);
 
 	return mkfile_name;
 }
\ No newline at end of file
@@ -3,8 +3,29 @@
 
 #include "package/package.h"
 
-int makefile_make(package_t * pkg, char * makefile);
-int makefile_clean(package_t * pkg, char * makefile);
+char * makefile_target_name(package_t * pkg);
+
+#include "package/context.h"
+
+bool makefile_same_kind(const char * target, cbuild_ctx_t * ctx);
+
+#include "profile.h"
+
+int makefile_make_target(cbuild_ctx_t * ctx, const char * target, const profile_t * prof, char * makefile);
+int makefile_clean_target(const char * target, const profile_t * prof, char * makefile);
+int makefile_make(package_t * pkg, const profile_t * prof, char * makefile);
+int makefile_clean(package_t * pkg, const profile_t * prof, char * makefile);
+
+typedef struct {
+	hash_t * values; // name -> variable_t
+} makefile_assignment_t;
+
+makefile_assignment_t * makefile_assignment(package_t * root);
+void makefile_free_assignment(makefile_assignment_t * vars);
+char * makefile_lookup(makefile_assignment_t * vars, package_t * object, const char * name);
+char * makefile_variable(package_t * root, package_t * object, const char * name);
+char * makefile_object_name(package_t * root, package_t * pkg);
+const char * makefile_shared_flags(package_t * root, package_t * pkg);
 char * makefile_write(package_t * pkg, const char * name);
 
 #endif
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <libgen.h>
+
+#include <stdbool.h>
+#include <time.h>
+
+
+
+#include "deps/hash/hash.h"
+
+#include "package/package.h"
+#include "package/import.h"
+#include "package/context.h"
+#include "package/fs.h"
+#include "package/paths.h"
+#include "utils/utils.h"
+#include "deps/stream/stream.h"
+#include "utils/stats.h"
+
+/*
+ * What the last generation read and wrote, next to the makefile as <root>.manifest:
+ *
+ *   cbuild manifest 1
+ *   target   <what the makefile builds>
+ *   makefile <the makefile>
+ *   linkage  internal, if what modules don't export was made static
+ *   package  <source> <mtime> <generated .c> <header, or nothing>
+ *   import   <source of a package the one above imports>
+ *
+ * one tab between the fields and every path relative to the manifest. `clean` unlinks
+ * what it lists instead of parsing the graph again to find out, and `build` goes straight
+ * to make when none of the sources changed since.
+ */
+
+#define MAGIC "cbuild manifest 1"
+
+typedef struct {
+	char            * source;
+	struct timespec   mtime;
+	char            * generated;
+	char            * header;     // NULL if nothing imports the package
+} manifest_entry;
+
+typedef struct {
+	cbuild_ctx_t * ctx;
+	char         * path;
+	char         * target;
+	char         * makefile;      // NULL if it has been removed since
+	bool           internal;      // generated with --internal-linkage
+	manifest_entry      * entries;
+	size_t         length;
+} manifest_t;
+
+static char * manifest_name(const char * root) {
+	char * name = malloc(strlen(root) + strlen("manifest") + 1);
+	strcpy(name, root);
+	name[strlen(name) - strlen("module.c")] = 0;
+	strcat(name, "manifest");
+	return name;
+}
+
+static int by_source(const void * a, const void * b) {
+	return strcmp((*(package_t **) a)->source_abs, (*(package_t **) b)->source_abs);
+}
+
+/* the packages `pkg` imports, each once and sorted by path */
+static size_t sorted_deps(package_t * pkg, package_t *** out) {
+	package_t ** deps = malloc((hash_size(pkg->deps) + 1) * sizeof(package_t *));
+	size_t n = 0;
+	hash_each_val(pkg->deps, {
+		package_import_t * dep = (package_import_t *) val;
+		if (dep && dep->pkg) deps[n++] = dep->pkg;
+	});
+	qsort(deps, n, sizeof(package_t *), by_source);
+
+	size_t i, unique = 0;
+	for (i = 0; i < n; i++) {
+		if (unique == 0 || deps[unique - 1] != deps[i]) deps[unique++] = deps[i];
+	}
+
+	*out = deps;
+	return unique;
+}
+
+/* removes the manifest of `root`, if there is one */
+void manifest_discard(cbuild_ctx_t * ctx, const char * root) {
+	char * name = manifest_name(root);
+	fs_unlink(ctx->fs, name);
+	free(name);
+}
+
+/*
+ * Writes the manifest for the graph under `root`, whose module is `name`, with the
+ * mtimes the sources had when they were read. A generation with errors leaves none, so
+ * that the next build parses again and reports them.
+ */
+void manifest_write(package_t * root, const char * name, const char * target) {
+	cbuild_ctx_t * ctx = root->ctx;
+
+	package_t ** packages = malloc(hash_size(ctx->path_cache) * sizeof(package_t *));
+	size_t n = 0, errors = 0;
+	hash_each_val(ctx->path_cache, {
+		package_t * pkg = (package_t *) val;
+		if (pkg->c_file) continue;
+		errors += pkg->errors;
+		packages[n++] = pkg;
+	});
+
+	if (errors > 0) {
+		free(packages);
+		manifest_discard(ctx, name);
+		return;
+	}
+	qsort(packages, n, sizeof(package_t *), by_source);
+
+	stats_frame_t frame = stats_enter(ctx->stats, NULL, phase_makefile);
+	STATS_ADD(stat_files_written, 1);
+
+	char * manifest = manifest_name(name);
+	char * makefile = strdup(manifest);
+	strcpy(makefile + strlen(makefile) - strlen("manifest"), "mk");
+
+	stream_t * out = fs_open_write(ctx->fs, manifest);
+	stream_printf(out, MAGIC "\n");
+	stream_printf(out, "target\t%s\n", target);
+	stream_printf(out, "makefile\t%s\n", basename(makefile));
+	if (ctx->internal) stream_printf(out, "linkage\tinternal\n");
+
+	size_t i, j;
+	for (i = 0; i < n; i++) {
+		package_t * pkg = packages[i];
+		struct timespec mtime = {0};
+		paths_modified(ctx->paths, pkg->source_abs, &mtime);
+
+		char * source    = utils_relative(root->generated, pkg->source_abs);
+		char * generated = utils_relative(root->generated, pkg->generated);
+		char * header    = pkg->header ? utils_relative(root->generated, pkg->header) : NULL;
+
+		stream_printf(out, "package\t%s\t%ld.%09ld\t%s\t%s\n",
+				source, (long) mtime.tv_sec, (long) mtime.tv_nsec, generated, header ? header : "");
+
+		package_t ** deps;
+		size_t n_deps = sorted_deps(pkg, &deps);
+		for (j = 0; j < n_deps; j++) {
+			char * dep = utils_relative(root->generated, deps[j]->source_abs);
+			stream_printf(out, "import\t%s\n", dep);
+			free(dep);
+		}
+
+		free(deps);
+		free(source);
+		free(generated);
+		free(header);
+	}
+
+	stream_close(out);
+	stats_leave(frame);
+
+	free(makefile);
+	free(manifest);
+	free(packages);
+}
+
+/* `rel` from the directory `dir`, with the `.` and `..` taken out */
+static char * join(const char * dir, const char * rel) {
+	char buf[PATH_MAX];
+	snprintf(buf, sizeof(buf), "%s", dir);
+	size_t length = strlen(buf);
+
+	const char * c = rel;
+	while (*c) {
+		const char * end = strchr(c, '/');
+		size_t part = end ? (size_t)(end - c) : strlen(c);
+
+		if (part == 2 && strncmp(c, "..", 2) == 0) {
+			while (length > 1 && buf[length - 1] != '/') length--;
+			if (length > 1) length--;
+			buf[length] = 0;
+		} else if (part > 0 && !(part == 1 && c[0] == '.')) {
+			snprintf(buf + length, sizeof(buf) - length, "%s%.*s", length > 1 ? "/" : "", (int) part, c);
+			length = strlen(buf);
+		}
+		c += part + (end ? 1 : 0);
+	}
+	return strdup(buf);
+}
+
+static char * read_all(cbuild_ctx_t * ctx, const char * path) {
+	stream_t * in = fs_open_read(ctx->fs, path);
+	if (in->error.code != 0) {
+		stream_close(in);
+		return NULL;
+	}
+
+	char * text   = NULL;
+	size_t length = 0;
+	char   buf[4096];
+	ssize_t n;
+	while ((n = stream_read(in, buf, sizeof(buf))) > 0) {
+		text = realloc(text, length + n + 1);
+		memcpy(text + length, buf, n);
+		length += n;
+	}
+	stream_close(in);
+
+	if (n < 0 || text == NULL) {
+		free(text);
+		return NULL;
+	}
+	text[length] = 0;
+	return text;
+}
+
+static bool exists(cbuild_ctx_t * ctx, const char * path) {
+	struct timespec mtime;
+	return paths_modified(ctx->paths, path, &mtime) == 0;
+}
+
+/* splits `line` at its tabs into up to `max` fields, returns how many there were */
+static size_t fields(char * line, char ** out, size_t max) {
+	size_t n = 0;
+	while (n < max) {
+		out[n++] = line;
+		line = strchr(line, '\t');
+		if (line == NULL) break;
+		*line++ = 0;
+	}
+	return n;
+}
+
+/* the manifest last written for the module `root`, or NULL if there is none to trust */
+manifest_t * manifest_load(cbuild_ctx_t * ctx, const char * root) {
+	char * name = manifest_name(root);
+	const char * path = paths_realpath(ctx->paths, name);
+	char * text = path ? read_all(ctx, path) : NULL;
+	free(name);
+
+	if (text == NULL || strncmp(text, MAGIC "\n", strlen(MAGIC) + 1) != 0) {
+		free(text);
+		return NULL;
+	}
+
+	manifest_t * m = calloc(1, sizeof(manifest_t));
+	m->ctx  = ctx;
+	m->path = strdup(path);
+
+	char * dir_buf = strdup(path);
+	char * dir     = dirname(dir_buf);
+
+	char * line = text + strlen(MAGIC) + 1;
+	while (*line) {
+		char * end = strchr(line, '\n');
+		if (end) *end = 0;
+
+		char * f[5];
+		size_t n = fields(line, f, 5);
+
+		if (n == 2 && strcmp(f[0], "target") == 0) {
+			m->target = strdup(f[1]);
+		} else if (n == 2 && strcmp(f[0], "makefile") == 0) {
+			m->makefile = join(dir, f[1]);
+		} else if (n == 2 && strcmp(f[0], "linkage") == 0) {
+			m->internal = strcmp(f[1], "internal") == 0;
+		} else if (n == 5 && strcmp(f[0], "package") == 0) {
+			m->entries = realloc(m->entries, (m->length + 1) * sizeof(manifest_entry));
+			manifest_entry * e = &m->entries[m->length++];
+
+			char * nsec = strchr(f[2], '.');
+			e->mtime.tv_sec  = strtol(f[2], NULL, 10);
+			e->mtime.tv_nsec = nsec ? strtol(nsec + 1, NULL, 10) : 0;
+			e->source        = join(dir, f[1]);
+			e->generated     = join(dir, f[3]);
+			e->header        = f[4][0] ? join(dir, f[4]) : NULL;
+		}
+		// the import lines are there for other tools, neither clean nor build needs them
+
+		if (end == NULL) break;
+		line = end + 1;
+	}
+
+	if (m->makefile && !exists(ctx, m->makefile)) {
+		free(m->makefile);
+		m->makefile = NULL;
+	}
+
+	free(dir_buf);
+	free(text);
+	return m;
+}
+
+/*
+ * whether every source is as it was when the manifest was written, and every output is
+ * there. `generate` writes the manifest but not the makefile, so the makefile also has to
+ * be newer than every source, or it may be one written for an older graph.
+ */
+bool manifest_fresh(manifest_t * m) {
+	if (m->makefile == NULL || m->target == NULL || m->length == 0) return false;
+
+	size_t i;
+	for (i = 0; i < m->length; i++) {
+		manifest_entry * e = &m->entries[i];
+		struct timespec mtime;
+
+		if (paths_modified(m->ctx->paths, e->source, &mtime) != 0) return false;
+		if (mtime.tv_sec != e->mtime.tv_sec || mtime.tv_nsec != e->mtime.tv_nsec) return false;
+		if (paths_newer(m->ctx->paths, e->source, m->makefile)) return false;
+		if (!exists(m->ctx, e->generated)) return false;
+		if (e->header && !exists(m->ctx, e->header)) return false;
+	}
+	return true;
+}
+
+/* unlinks the files the manifest lists, and the manifest itself */
+void manifest_clean(manifest_t * m) {
+	size_t i;
+	for (i = 0; i < m->length; i++) {
+		manifest_entry * e = &m->entries[i];
+		printf("unlink: %s\n", e->generated);
+		fs_unlink(m->ctx->fs, e->generated);
+
+		if (e->header) {
+			printf("unlink: %s\n", e->header);
+			fs_unlink(m->ctx->fs, e->header);
+		}
+	}
+	fs_unlink(m->ctx->fs, m->path);
+}
+
+void manifest_free(manifest_t * m) {
+	if (m == NULL) return;
+
+	size_t i;
+	for (i = 0; i < m->length; i++) {
+		free(m->entries[i].source);
+		free(m->entries[i].generated);
+		free(m->entries[i].header);
+	}
+	free(m->entries);
+	free(m->path);
+	free(m->target);
+	free(m->makefile);
+	free(m);
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef _package_manifest_
+#define _package_manifest_
+
+#include <stdbool.h>
+#include <time.h>
+
+typedef struct {
+	char            * source;
+	struct timespec   mtime;
+	char            * generated;
+	char            * header;     // NULL if nothing imports the package
+} manifest_entry;
+
+#include "package/context.h"
+
+typedef struct {
+	cbuild_ctx_t * ctx;
+	char         * path;
+	char         * target;
+	char         * makefile;      // NULL if it has been removed since
+	bool           internal;      // generated with --internal-linkage
+	manifest_entry      * entries;
+	size_t         length;
+} manifest_t;
+
+void manifest_discard(cbuild_ctx_t * ctx, const char * root);
+
+#include "package/package.h"
+
+void manifest_write(package_t * root, const char * name, const char * target);
+manifest_t * manifest_load(cbuild_ctx_t * ctx, const char * root);
+bool manifest_fresh(manifest_t * m);
+void manifest_clean(manifest_t * m);
+void manifest_free(manifest_t * m);
+
+#endif
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <libgen.h>
+export {
+#include <stdbool.h>
+#include <time.h>
+}
+
+build depends "deps/hash/hash.c";
+#include "deps/hash/hash.h"
+
+import Package    from "package/package.module.c";
+import pkg_import from "package/import.module.c";
+import cbuild_ctx from "package/context.module.c";
+import fs         from "package/fs.module.c";
+import paths      from "package/paths.module.c";
+import utils      from "utils/utils.module.c";
+import stream     from "deps/stream/stream.module.c";
+import stats      from "utils/stats.module.c";
+
+/*
+ * What the last generation read and wrote, next to the makefile as <root>.manifest:
+ *
+ *   cbuild manifest 1
+ *   target   <what the makefile builds>
+ *   makefile <the makefile>
+ *   linkage  internal, if what modules don't export was made static
+ *   package  <source> <mtime> <generated .c> <header, or nothing>
+ *   import   <source of a package the one above imports>
+ *
+ * one tab between the fields and every path relative to the manifest. `clean` unlinks
+ * what it lists instead of parsing the graph again to find out, and `build` goes straight
+ * to make when none of the sources changed since.
+ */
+
+#define MAGIC "cbuild manifest 1"
+
+export typedef struct {
+	char            * source;
+	struct timespec   mtime;
+	char            * generated;
+	char            * header;     // NULL if nothing imports the package
+} entry_t as entry;
+
+export typedef struct {
+	cbuild_ctx.t * ctx;
+	char         * path;
+	char         * target;
+	char         * makefile;      // NULL if it has been removed since
+	bool           internal;      // generated with --internal-linkage
+	entry_t      * entries;
+	size_t         length;
+} manifest_t as t;
+
+static char * manifest_name(const char * root) {
+	char * name = malloc(strlen(root) + strlen("manifest") + 1);
+	strcpy(name, root);
+	name[strlen(name) - strlen("module.c")] = 0;
+	strcat(name, "manifest");
+	return name;
+}
+
+static int by_source(const void * a, const void * b) {
+	return strcmp((*(Package.t **) a)->source_abs, (*(Package.t **) b)->source_abs);
+}
+
+/* the packages `pkg` imports, each once and sorted by path */
+static size_t sorted_deps(Package.t * pkg, Package.t *** out) {
+	Package.t ** deps = malloc((hash_size(pkg->deps) + 1) * sizeof(Package.t *));
+	size_t n = 0;
+	hash_each_val(pkg->deps, {
+		pkg_import.t * dep = (pkg_import.t *) val;
+		if (dep && dep->pkg) deps[n++] = dep->pkg;
+	});
+	qsort(deps, n, sizeof(Package.t *), by_source);
+
+	size_t i, unique = 0;
+	for (i = 0; i < n; i++) {
+		if (unique == 0 || deps[unique - 1] != deps[i]) deps[unique++] = deps[i];
+	}
+
+	*out = deps;
+	return unique;
+}
+
+/* removes the manifest of `root`, if there is one */
+export void discard(cbuild_ctx.t * ctx, const char * root) {
+	char * name = manifest_name(root);
+	fs.unlink(ctx->fs, name);
+	global.free(name);
+}
+
+/*
+ * Writes the manifest for the graph under `root`, whose module is `name`, with the
+ * mtimes the sources had when they were read. A generation with errors leaves none, so
+ * that the next build parses again and reports them.
+ */
+export void write(Package.t * root, const char * name, const char * target) {
+	cbuild_ctx.t * ctx = root->ctx;
+
+	Package.t ** packages = malloc(hash_size(ctx->path_cache) * sizeof(Package.t *));
+	size_t n = 0, errors = 0;
+	hash_each_val(ctx->path_cache, {
+		Package.t * pkg = (Package.t *) val;
+		if (pkg->c_file) continue;
+		errors += pkg->errors;
+		packages[n++] = pkg;
+	});
+
+	if (errors > 0) {
+		global.free(packages);
+		discard(ctx, name);
+		return;
+	}
+	qsort(packages, n, sizeof(Package.t *), by_source);
+
+	stats.frame_t frame = stats.enter(ctx->stats, NULL, phase_makefile);
+	STATS_ADD(stat_files_written, 1);
+
+	char * manifest = manifest_name(name);
+	char * makefile = strdup(manifest);
+	strcpy(makefile + strlen(makefile) - strlen("manifest"), "mk");
+
+	stream.t * out = fs.open_write(ctx->fs, manifest);
+	stream.printf(out, MAGIC "\n");
+	stream.printf(out, "target\t%s\n", target);
+	stream.printf(out, "makefile\t%s\n", basename(makefile));
+	if (ctx->internal) stream.printf(out, "linkage\tinternal\n");
+
+	size_t i, j;
+	for (i = 0; i < n; i++) {
+		Package.t * pkg = packages[i];
+		struct timespec mtime = {0};
+		paths.modified(ctx->paths, pkg->source_abs, &mtime);
+
+		char * source    = utils.relative(root->generated, pkg->source_abs);
+		char * generated = utils.relative(root->generated, pkg->generated);
+		char * header    = pkg->header ? utils.relative(root->generated, pkg->header) : NULL;
+
+		stream.printf(out, "package\t%s\t%ld.%09ld\t%s\t%s\n",
+				source, (long) mtime.tv_sec, (long) mtime.tv_nsec, generated, header ? header : "");
+
+		Package.t ** deps;
+		size_t n_deps = sorted_deps(pkg, &deps);
+		for (j = 0; j < n_deps; j++) {
+			char * dep = utils.relative(root->generated, deps[j]->source_abs);
+			stream.printf(out, "import\t%s\n", dep);
+			global.free(dep);
+		}
+
+		global.free(deps);
+		global.free(source);
+		global.free(generated);
+		global.free(header);
+	}
+
+	stream.close(out);
+	stats.leave(frame);
+
+	global.free(makefile);
+	global.free(manifest);
+	global.free(packages);
+}
+
+/* `rel` from the directory `dir`, with the `.` and `..` taken out */
+static char * join(const char * dir, const char * rel) {
+	char buf[PATH_MAX];
+	snprintf(buf, sizeof(buf), "%s", dir);
+	size_t length = strlen(buf);
+
+	const char * c = rel;
+	while (*c) {
+		const char * end = strchr(c, '/');
+		size_t part = end ? (size_t)(end - c) : strlen(c);
+
+		if (part == 2 && strncmp(c, "..", 2) == 0) {
+			while (length > 1 && buf[length - 1] != '/') length--;
+			if (length > 1) length--;
+			buf[length] = 0;
+		} else if (part > 0 && !(part == 1 && c[0] == '.')) {
+			snprintf(buf + length, sizeof(buf) - length, "%s%.*s", length > 1 ? "/" : "", (int) part, c);
+			length = strlen(buf);
+		}
+		c += part + (end ? 1 : 0);
+	}
+	return strdup(buf);
+}
+
+static char * read_all(cbuild_ctx.t * ctx, const char * path) {
+	stream.t * in = fs.open_read(ctx->fs, path);
+	if (in->error.code != 0) {
+		stream.close(in);
+		return NULL;
+	}
+
+	char * text   = NULL;
+	size_t length = 0;
+	char   buf[4096];
+	ssize_t n;
+	while ((n = stream.read(in, buf, sizeof(buf))) > 0) {
+		text = realloc(text, length + n + 1);
+		memcpy(text + length, buf, n);
+		length += n;
+	}
+	stream.close(in);
+
+	if (n < 0 || text == NULL) {
+		global.free(text);
+		return NULL;
+	}
+	text[length] = 0;
+	return text;
+}
+
+static bool exists(cbuild_ctx.t * ctx, const char * path) {
+	struct timespec mtime;
+	return paths.modified(ctx->paths, path, &mtime) == 0;
+}
+
+/* splits `line` at its tabs into up to `max` fields, returns how many there were */
+static size_t fields(char * line, char ** out, size_t max) {
+	size_t n = 0;
+	while (n < max) {
+		out[n++] = line;
+		line = strchr(line, '\t');
+		if (line == NULL) break;
+		*line++ = 0;
+	}
+	return n;
+}
+
+/* the manifest last written for the module `root`, or NULL if there is none to trust */
+export manifest_t * load(cbuild_ctx.t * ctx, const char * root) {
+	char * name = manifest_name(root);
+	const char * path = paths.realpath(ctx->paths, name);
+	char * text = path ? read_all(ctx, path) : NULL;
+	global.free(name);
+
+	if (text == NULL || strncmp(text, MAGIC "\n", strlen(MAGIC) + 1) != 0) {
+		global.free(text);
+		return NULL;
+	}
+
+	manifest_t * m = calloc(1, sizeof(manifest_t));
+	m->ctx  = ctx;
+	m->path = strdup(path);
+
+	char * dir_buf = strdup(path);
+	char * dir     = dirname(dir_buf);
+
+	char * line = text + strlen(MAGIC) + 1;
+	while (*line) {
+		char * end = strchr(line, '\n');
+		if (end) *end = 0;
+
+		char * f[5];
+		size_t n = fields(line, f, 5);
+
+		if (n == 2 && strcmp(f[0], "target") == 0) {
+			m->target = strdup(f[1]);
+		} else if (n == 2 && strcmp(f[0], "makefile") == 0) {
+			m->makefile = join(dir, f[1]);
+		} else if (n == 2 && strcmp(f[0], "linkage") == 0) {
+			m->internal = strcmp(f[1], "internal") == 0;
+		} else if (n == 5 && strcmp(f[0], "package") == 0) {
+			m->entries = realloc(m->entries, (m->length + 1) * sizeof(entry_t));
+			entry_t * e = &m->entries[m->length++];
+
+			char * nsec = strchr(f[2], '.');
+			e->mtime.tv_sec  = strtol(f[2], NULL, 10);
+			e->mtime.tv_nsec = nsec ? strtol(nsec + 1, NULL, 10) : 0;
+			e->source        = join(dir, f[1]);
+			e->generated     = join(dir, f[3]);
+			e->header        = f[4][0] ? join(dir, f[4]) : NULL;
+		}
+		// the import lines are there for other tools, neither clean nor build needs them
+
+		if (end == NULL) break;
+		line = end + 1;
+	}
+
+	if (m->makefile && !exists(ctx, m->makefile)) {
+		global.free(m->makefile);
+		m->makefile = NULL;
+	}
+
+	global.free(dir_buf);
+	global.free(text);
+	return m;
+}
+
+/*
+ * whether every source is as it was when the manifest was written, and every output is
+ * there. `generate` writes the manifest but not the makefile, so the makefile also has to
+ * be newer than every source, or it may be one written for an older graph.
+ */
+export bool fresh(manifest_t * m) {
+	if (m->makefile == NULL || m->target == NULL || m->length == 0) return false;
+
+	size_t i;
+	for (i = 0; i < m->length; i++) {
+		entry_t * e = &m->entries[i];
+		struct timespec mtime;
+
+		if (paths.modified(m->ctx->paths, e->source, &mtime) != 0) return false;
+		if (mtime.tv_sec != e->mtime.tv_sec || mtime.tv_nsec != e->mtime.tv_nsec) return false;
+		if (paths.newer(m->ctx->paths, e->source, m->makefile)) return false;
+		if (!exists(m->ctx, e->generated)) return false;
+		if (e->header && !exists(m->ctx, e->header)) return false;
+	}
+	return true;
+}
+
+/* unlinks the files the manifest lists, and the manifest itself */
+export void clean(manifest_t * m) {
+	size_t i;
+	for (i = 0; i < m->length; i++) {
+		entry_t * e = &m->entries[i];
+		printf("unlink: %s\n", e->generated);
+		fs.unlink(m->ctx->fs, e->generated);
+
+		if (e->header) {
+			printf("unlink: %s\n", e->header);
+			fs.unlink(m->ctx->fs, e->header);
+		}
+	}
+	fs.unlink(m->ctx->fs, m->path);
+}
+
+export void free(manifest_t * m) {
+	if (m == NULL) return;
+
+	size_t i;
+	for (i = 0; i < m->length; i++) {
+		global.free(m->entries[i].source);
+		global.free(m->entries[i].generated);
+		global.free(m->entries[i].header);
+	}
+	global.free(m->entries);
+	global.free(m->path);
+	global.free(m->target);
+	global.free(m->makefile);
+	global.free(m);
+}
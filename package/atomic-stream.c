@@ -6,8 +6,41 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <libgen.h>
 
 #include "../deps/stream/stream.h"
+#include "../utils/uring.h"
+
+#define BUFFER_SIZE (64 * 1024)
+
+/*
+ * How durable a file is once close() has returned:
+ *  none: the data only reaches the page cache (the default)
+ *  file: the data is fsynced before it is renamed into place
+ *  dir:  the containing directory is fsynced as well, so the rename itself survives a crash
+ */
+enum atomic_stream_atomic_sync {
+	atomic_sync_none = 0,
+	atomic_sync_file,
+	atomic_sync_dir,
+};
+
+/* where the streams of one build go: their policy, and the ring closes are queued on */
+typedef struct {
+	enum atomic_stream_atomic_sync sync;
+	uring_t        * ring;     // NULL: closes use plain syscalls
+	int              failures; // queued closes that failed since the last finish()
+} atomic_stream_writes_t;
+
+/* returns the policy named by `name` or -1 if it isn't one of none, file, dir */
+int atomic_stream_sync_from_string(const char * name) {
+	if (name == NULL)               return -1;
+	if (strcmp(name, "none") == 0)  return atomic_sync_none;
+	if (strcmp(name, "file") == 0)  return atomic_sync_file;
+	if (strcmp(name, "dir")  == 0)  return atomic_sync_dir;
+	return -1;
+}
 
 static int _type;
 
@@ -20,64 +53,272 @@ int atomic_stream_type() {
 }
 
 typedef struct {
-	int    fd;
-	char * temp;
-	char * dest;
+	int           fd;
+	char        * temp; // NULL while an O_TMPFILE inode has no name yet
+	char        * dest;
+	off_t         offset;
+	size_t        length;
+	char          buffer[BUFFER_SIZE];
+
+	// used when the close is queued on io_uring
+	uring_chain_t chain;
+	char          proc[32];
+	int           write_step;
+	int           link_step;
+	enum atomic_stream_atomic_sync policy;
+	atomic_stream_writes_t    * writes;
 } context_t;
 
-static ssize_t atomic_write(void * _ctx, const void * buf, size_t nbyte, stream_error_t * error) {
-	context_t * ctx = (context_t*) _ctx;
-	int e = write(ctx->fd, buf, nbyte);
-	if (e < 0 && error != NULL) {
-		error->code    = errno;
-		error->message = strerror(error->code);
+static void set_error(stream_error_t * error) {
+	if (error == NULL) return;
+	error->code    = errno;
+	error->message = strerror(error->code);
+}
+
+static ssize_t write_all(int fd, const char * buf, size_t nbyte) {
+	size_t written = 0;
+	while (written < nbyte) {
+		ssize_t e = write(fd, buf + written, nbyte - written);
+		if (e < 0 && errno == EINTR) continue;
+		if (e < 0) return e;
+		written += e;
 	}
-	return e;
+	return written;
 }
 
-static ssize_t atomic_close(void * _ctx, stream_error_t * error) {
+static ssize_t flush(context_t * ctx, stream_error_t * error) {
+	if (ctx->length == 0) return 0;
+
+	ssize_t e = write_all(ctx->fd, ctx->buffer, ctx->length);
+	if (e < 0) {
+		set_error(error);
+		return e;
+	}
+	ctx->offset += ctx->length;
+	ctx->length  = 0;
+	return 0;
+}
+
+static ssize_t atomic_write(void * _ctx, const void * buf, size_t nbyte, stream_error_t * error) {
 	context_t * ctx = (context_t*) _ctx;
 
-	int e = close(ctx->fd);
-	if (e < 0 && error != NULL) {
-		error->code    = errno;
-		error->message = strerror(error->code);
-		unlink(ctx->temp);
-		free(ctx->temp);
-		free(ctx->dest);
-		free(ctx);
+	if (ctx->length + nbyte > BUFFER_SIZE && flush(ctx, error) < 0) return -1;
+
+	if (nbyte >= BUFFER_SIZE) {
+		ssize_t e = write_all(ctx->fd, buf, nbyte);
+		if (e < 0) set_error(error);
+		else ctx->offset += e;
 		return e;
 	}
 
-	e = rename(ctx->temp, ctx->dest);
-	if (e < 0 && error != NULL) {
-		error->code    = errno;
-		error->message = strerror(error->code);
+	memcpy(ctx->buffer + ctx->length, buf, nbyte);
+	ctx->length += nbyte;
+	return nbyte;
+}
+
+/*
+ * Temporary names live next to the destination so the final rename never crosses
+ * a filesystem. The pid keeps concurrent cbuild processes apart and the counter
+ * keeps streams within one process apart; O_EXCL / EEXIST catch anything left over
+ * from a crashed run.
+ */
+static char * get_temp(const char * dest) {
+	static unsigned counter = 0;
+
+	const char * slash = strrchr(dest, '/');
+	const char * ext   = strrchr(dest, '.');
+	if (ext == NULL || (slash && ext < slash)) ext = dest + strlen(dest);
+
+	char * temp = NULL;
+	asprintf(&temp, "%.*s-%d-%u%s", (int)(ext - dest), dest, (int) getpid(), counter++, ext);
+	return temp;
+}
+
+/* gives an O_TMPFILE inode a temporary name, linkat(2) refuses to replace `dest` directly */
+static int link_anonymous(context_t * ctx) {
+	char proc[64];
+	int  e;
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", ctx->fd);
+
+	do {
+		free(ctx->temp);
+		ctx->temp = get_temp(ctx->dest);
+		e = linkat(AT_FDCWD, proc, AT_FDCWD, ctx->temp, AT_SYMLINK_FOLLOW);
+	} while (e < 0 && errno == EEXIST);
+
+	if (e < 0) {
+		free(ctx->temp);
+		ctx->temp = NULL;
 	}
+	return e;
+}
+
+static int sync_dir(const char * dest) {
+	char * buf = strdup(dest);
+	int fd = open(dirname(buf), O_RDONLY | O_DIRECTORY);
+	free(buf);
+	if (fd < 0) return fd;
+
+	int e = fsync(fd);
+	close(fd);
+	return e;
+}
+
+static void free_context(context_t * ctx) {
 	free(ctx->temp);
 	free(ctx->dest);
 	free(ctx);
-	return e;
 }
 
-static char * get_temp(char * base) {
-	int salt = rand();
-	char * temp = NULL;
-	char * ext  = strrchr(base, '.');
+#ifdef __linux__
+static void close_done(void * _ctx, int * results, int n) {
+	context_t * ctx = (context_t*) _ctx;
+	int failed = -1;
+	int e      = 0;
 
-	asprintf(&temp, "%.*s-%x%s", (int)(ext - base), base, salt, ext);
-	return temp;
+	int i;
+	for (i = 0; i < n && failed < 0; i++) {
+		int r = results[i];
+		if (i == ctx->write_step && r >= 0 && r != ctx->length) r = -EIO;
+		if (r < 0) {
+			failed = i;
+			e      = -r;
+		}
+	}
+
+	if (failed >= 0 && failed == ctx->link_step && e == EEXIST) {
+		// left behind by an earlier process with the same pid, the rest of the chain was cancelled
+		e = link_anonymous(ctx) < 0 ? errno : 0;
+		if (e == 0 && rename(ctx->temp, ctx->dest) < 0) e = errno;
+	}
+
+	if (results[n - 1] == -ECANCELED) close(ctx->fd);
+	if (e == 0 && ctx->policy >= atomic_sync_dir && sync_dir(ctx->dest) < 0) e = errno;
+
+	if (e != 0) {
+		fprintf(stderr, "ERROR: '%s': %s\n", ctx->dest, strerror(e));
+		if (ctx->temp) unlink(ctx->temp);
+		ctx->writes->failures++;
+	}
+	free_context(ctx);
+}
+
+/*
+ * queues write -> fsync -> linkat -> rename -> close as one linked chain, a failure
+ * cancels everything after it except the close, which is hard linked to the rename.
+ * Returns false, with nothing queued, if the ring went away while making room for it.
+ */
+static bool queue_close(context_t * ctx) {
+	uring_t     * ring = ctx->writes->ring;
+	uring_sqe_t * sqe;
+	if (!uring_begin(ring, &ctx->chain, 5, close_done, ctx)) return false;
+
+	ctx->write_step = -1;
+	ctx->link_step  = -1;
+
+	if (ctx->length) {
+		ctx->write_step = ctx->chain.n;
+		sqe = uring_push(ring, &ctx->chain, IORING_OP_WRITE, IOSQE_IO_LINK);
+		sqe->fd   = ctx->fd;
+		sqe->addr = (uintptr_t) ctx->buffer;
+		sqe->len  = ctx->length;
+		sqe->off  = ctx->offset;
+	}
+
+	if (ctx->policy >= atomic_sync_file) {
+		sqe = uring_push(ring, &ctx->chain, IORING_OP_FSYNC, IOSQE_IO_LINK);
+		sqe->fd = ctx->fd;
+	}
+
+	if (ctx->temp == NULL) {
+		ctx->temp = get_temp(ctx->dest);
+		snprintf(ctx->proc, sizeof(ctx->proc), "/proc/self/fd/%d", ctx->fd);
+
+		ctx->link_step = ctx->chain.n;
+		sqe = uring_push(ring, &ctx->chain, IORING_OP_LINKAT, IOSQE_IO_LINK);
+		sqe->fd             = AT_FDCWD;
+		sqe->addr           = (uintptr_t) ctx->proc;
+		sqe->len            = AT_FDCWD;
+		sqe->addr2          = (uintptr_t) ctx->temp;
+		sqe->hardlink_flags = AT_SYMLINK_FOLLOW;
+	}
+
+	sqe = uring_push(ring, &ctx->chain, IORING_OP_RENAMEAT, IOSQE_IO_HARDLINK);
+	sqe->fd    = AT_FDCWD;
+	sqe->addr  = (uintptr_t) ctx->temp;
+	sqe->len   = AT_FDCWD;
+	sqe->addr2 = (uintptr_t) ctx->dest;
+
+	sqe = uring_push(ring, &ctx->chain, IORING_OP_CLOSE, 0);
+	sqe->fd = ctx->fd;
+	return true;
 }
+#endif
 
-stream_t * atomic_stream_open(const char * _dest) {
-	int fd = 0;
+static ssize_t atomic_close(void * _ctx, stream_error_t * error) {
+	context_t * ctx = (context_t*) _ctx;
+
+#ifdef __linux__
+	if (uring_available(ctx->writes->ring) && queue_close(ctx)) return 0;
+#endif
+
+	int e = flush(ctx, error);
+
+	if (e == 0 && ctx->policy >= atomic_sync_file) {
+		e = fsync(ctx->fd);
+		if (e < 0) set_error(error);
+	}
+
+	if (e == 0 && ctx->temp == NULL) {
+		e = link_anonymous(ctx);
+		if (e < 0) set_error(error);
+	}
+
+	if (close(ctx->fd) < 0 && e == 0) {
+		e = -1;
+		set_error(error);
+	}
+
+	if (e == 0) {
+		e = rename(ctx->temp, ctx->dest);
+		if (e < 0) set_error(error);
+	}
+
+	if (e == 0 && ctx->policy >= atomic_sync_dir) {
+		e = sync_dir(ctx->dest);
+		if (e < 0) set_error(error);
+	}
+
+	if (e < 0 && ctx->temp) unlink(ctx->temp);
+	free_context(ctx);
+	return e;
+}
+
+static int open_anonymous(const char * dest) {
+#ifdef O_TMPFILE
+	char * buf = strdup(dest);
+	int fd = open(dirname(buf), O_WRONLY | O_TMPFILE, 0666);
+	free(buf);
+	return fd;
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+stream_t * atomic_stream_open(const char * _dest, atomic_stream_writes_t * writes) {
 	char * dest = strdup(_dest);
 	char * temp = NULL;
-	do {
-		temp = get_temp(dest);
-		fd   = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0666);
-		if (fd == -1 && errno == EEXIST) free(temp);
-	} while(fd == -1 && errno == EEXIST);
+
+	int fd = open_anonymous(dest);
+	if (fd < 0 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)) {
+		// the filesystem (or kernel) has no O_TMPFILE, fall back to a named temporary
+		do {
+			free(temp);
+			temp = get_temp(dest);
+			fd   = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+		} while(fd == -1 && errno == EEXIST);
+	}
 
 	if ( fd < 0 ) {
 		free(dest);
@@ -86,9 +327,13 @@ stream_t * atomic_stream_open(const char * _dest) {
 	}
 
 	context_t * ctx = malloc(sizeof(context_t));
-	ctx->fd   = fd;
-	ctx->temp = temp;
-	ctx->dest = dest;
+	ctx->fd     = fd;
+	ctx->temp   = temp;
+	ctx->dest   = dest;
+	ctx->offset = 0;
+	ctx->length = 0;
+	ctx->policy = writes->sync;
+	ctx->writes = writes;
 
 	stream_t * s = malloc(sizeof(stream_t));
 
@@ -105,19 +350,32 @@ stream_t * atomic_stream_open(const char * _dest) {
 	return s;
 }
 
+/*
+ * With io_uring, closing an atomic stream only queues the work. This waits for all of
+ * what was opened with `writes` and returns how many files could not be written, each
+ * failure has been reported on stderr.
+ */
+int atomic_stream_finish(atomic_stream_writes_t * writes) {
+	uring_drain(writes->ring);
+
+	int failed = writes->failures;
+	writes->failures = 0;
+	return failed;
+}
+
 ssize_t atomic_stream_abort(stream_t * s) {
 	if (s->type != atomic_stream_type()) return stream_close(s);
 
 	context_t * ctx = (context_t*) s->ctx;
+	int e = 0;
 
 	close(ctx->fd);
-	int e = unlink(ctx->temp);
+	// an anonymous file was never visible, closing it is enough
+	if (ctx->temp) e = unlink(ctx->temp);
 	if (e < 0) {
 		s->error.code    = errno;
 		s->error.message = strerror(s->error.code);
 	}
-	free(ctx->temp);
-	free(ctx->dest);
-	free(ctx);
+	free_context(ctx);
 	return e;
 }
\ No newline at end of file
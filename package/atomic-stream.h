@@ -1,11 +1,27 @@
 #ifndef _package_atomic_stream_
 #define _package_atomic_stream_
 
+enum atomic_stream_atomic_sync {
+	atomic_sync_none = 0,
+	atomic_sync_file,
+	atomic_sync_dir,
+};
+
+#include "../utils/uring.h"
+
+typedef struct {
+	enum atomic_stream_atomic_sync sync;
+	uring_t        * ring;     // NULL: closes use plain syscalls
+	int              failures; // queued closes that failed since the last finish()
+} atomic_stream_writes_t;
+
+int atomic_stream_sync_from_string(const char * name);
 int atomic_stream_type();
 
 #include "../deps/stream/stream.h"
 
-stream_t * atomic_stream_open(const char * _dest);
+stream_t * atomic_stream_open(const char * _dest, atomic_stream_writes_t * writes);
+int atomic_stream_finish(atomic_stream_writes_t * writes);
 ssize_t atomic_stream_abort(stream_t * s);
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef _package_cbuild_ctx_
+#define _package_cbuild_ctx_
+
+#include "../deps/hash/hash.h"
+#include <stdbool.h>
+
+struct cbuild_ctx_cbuild_ctx_s;
+
+typedef void * (*cbuild_ctx_load_fn)  (struct cbuild_ctx_cbuild_ctx_s * ctx, const char * relative_path, char ** error);
+typedef void   (*cbuild_ctx_wait_fn)  (struct cbuild_ctx_cbuild_ctx_s * ctx, void * pkg);
+typedef void   (*cbuild_ctx_unload_fn)(void * pkg);
+typedef void   (*cbuild_ctx_written_fn)(struct cbuild_ctx_cbuild_ctx_s * ctx, void * pkg);
+
+#include "paths.h"
+#include "../utils/jobserver.h"
+#include "fs.h"
+#include "../utils/stats.h"
+
+typedef struct cbuild_ctx_cbuild_ctx_s {
+	hash_t           * path_cache;    // absolute source path -> Package.t
+	paths_t          * paths;         // canonical paths, stat results and relative paths
+
+	// lookup tables, filled in by the modules using them on first use
+	hash_t           * keywords;      // parser/grammer
+	hash_t           * build_options; // parser/build
+	hash_t           * type_keywords; // parser/identifier
+	hash_t           * export_types;  // parser/export
+	hash_t           * header_types;  // package/export
+
+	bool               force;         // regenerate everything, even when up to date
+	bool               silent;        // parse only, write nothing
+	bool               window;        // lexers keep only the current token's input (--window)
+	bool               coarse;        // lexers merge what the grammar only copies (--coarse)
+	long               lex_threads;   // big modules are lexed in this many pieces at once (--lex-threads)
+	bool               shared;        // libraries are linked as shared objects (--shared)
+	bool               internal;      // what modules don't export is made static (--internal-linkage)
+	hash_t           * private_names; // parser/linkage, name -> the module that made it static
+	hash_t           * external_names;// parser/linkage, name -> a module declaring it without a definition
+	hash_t           * dynamic_exports;// makefile, local name -> what the root exports dynamically
+	size_t             n_root_exports;// makefile, the root's exports when dynamic_exports was made
+	jobserver_t      * jobserver;     // shared with make and the compilers, NULL without one
+	fs_t             * fs;            // &real_fs unless the embedder substitutes its own
+	fs_t               real_fs;
+	fs_disk_t          disk;          // real_fs's working directory, --fsync policy and --io-uring ring
+	stats_registry_t * stats;         // --stats, NULL without it
+
+	// set by package/index, which the modules that need these can't import
+	cbuild_ctx_load_fn            load;          // opens a package and queues it to be parsed
+	cbuild_ctx_wait_fn            wait;          // parses queued packages until the given one is done
+	cbuild_ctx_unload_fn          unload;
+	void            ** queue;         // package/index's tasks, the packages being parsed
+	size_t             n_queue;
+	size_t             n_variables;   // build variables parsed so far, so what they add up to can be cached
+
+	// set by the embedder, told about every package whose generated .c has been written
+	cbuild_ctx_written_fn         written;
+	void             * written_ctx;
+} cbuild_ctx_t;
+
+cbuild_ctx_t * cbuild_ctx_new();
+void cbuild_ctx_free(cbuild_ctx_t * ctx);
+
+#endif
@@ -0,0 +1,121 @@
+package "cbuild_ctx";
+
+build depends "../deps/hash/hash.c";
+export {
+#include "../deps/hash/hash.h"
+#include <stdbool.h>
+}
+#include <stdlib.h>
+
+import fs     from "./fs.module.c";
+import paths  from "./paths.module.c";
+import jobserver from "../utils/jobserver.module.c";
+import stats  from "../utils/stats.module.c";
+import uring  from "../utils/uring.module.c";
+
+/*
+ * Everything one generation needs that outlives a single package: the package cache,
+ * the parser's lookup tables and the configuration. Contexts share nothing, so a
+ * process can run several generations side by side and free() any of them to get all
+ * of its memory back.
+ */
+
+export struct cbuild_ctx_s;
+
+/* Package.t is built on top of this module, so packages are passed around as void * here */
+export typedef void * (*load_fn)  (struct cbuild_ctx_s * ctx, const char * relative_path, char ** error);
+export typedef void   (*wait_fn)  (struct cbuild_ctx_s * ctx, void * pkg);
+export typedef void   (*unload_fn)(void * pkg);
+export typedef void   (*written_fn)(struct cbuild_ctx_s * ctx, void * pkg);
+
+export typedef struct cbuild_ctx_s {
+	hash_t           * path_cache;    // absolute source path -> Package.t
+	paths.t          * paths;         // canonical paths, stat results and relative paths
+
+	// lookup tables, filled in by the modules using them on first use
+	hash_t           * keywords;      // parser/grammer
+	hash_t           * build_options; // parser/build
+	hash_t           * type_keywords; // parser/identifier
+	hash_t           * export_types;  // parser/export
+	hash_t           * header_types;  // package/export
+
+	bool               force;         // regenerate everything, even when up to date
+	bool               silent;        // parse only, write nothing
+	bool               window;        // lexers keep only the current token's input (--window)
+	bool               coarse;        // lexers merge what the grammar only copies (--coarse)
+	long               lex_threads;   // big modules are lexed in this many pieces at once (--lex-threads)
+	bool               shared;        // libraries are linked as shared objects (--shared)
+	bool               internal;      // what modules don't export is made static (--internal-linkage)
+	hash_t           * private_names; // parser/linkage, name -> the module that made it static
+	hash_t           * external_names;// parser/linkage, name -> a module declaring it without a definition
+	hash_t           * dynamic_exports;// makefile, local name -> what the root exports dynamically
+	size_t             n_root_exports;// makefile, the root's exports when dynamic_exports was made
+	jobserver.t      * jobserver;     // shared with make and the compilers, NULL without one
+	fs.t             * fs;            // &real_fs unless the embedder substitutes its own
+	fs.t               real_fs;
+	fs.disk_t          disk;          // real_fs's working directory, --fsync policy and --io-uring ring
+	stats.registry_t * stats;         // --stats, NULL without it
+
+	// set by package/index, which the modules that need these can't import
+	load_fn            load;          // opens a package and queues it to be parsed
+	wait_fn            wait;          // parses queued packages until the given one is done
+	unload_fn          unload;
+	void            ** queue;         // package/index's tasks, the packages being parsed
+	size_t             n_queue;
+	size_t             n_variables;   // build variables parsed so far, so what they add up to can be cached
+
+	// set by the embedder, told about every package whose generated .c has been written
+	written_fn         written;
+	void             * written_ctx;
+} cbuild_ctx_t as t;
+
+export cbuild_ctx_t * new() {
+	cbuild_ctx_t * ctx = calloc(1, sizeof(cbuild_ctx_t));
+
+	ctx->path_cache = hash_new();
+	ctx->paths      = paths.new(&ctx->fs);
+	ctx->real_fs    = fs.real(&ctx->disk);
+	ctx->fs         = &ctx->real_fs;
+
+	return ctx;
+}
+
+static void free_table(hash_t * table) {
+	if (table) hash_free(table);
+}
+
+static void free_names(hash_t * names) {
+	if (names == NULL) return;
+	hash_each_key(names, {
+		global.free((char *) key);
+	});
+	hash_free(names);
+}
+
+export void free(cbuild_ctx_t * ctx) {
+	if (ctx == NULL) return;
+
+	if (ctx->unload) {
+		hash_each_val(ctx->path_cache, {
+			ctx->unload(val);
+		});
+	}
+	hash_free(ctx->path_cache);
+	global.free(ctx->queue);
+	paths.free(ctx->paths);
+
+	free_table(ctx->keywords);
+	free_table(ctx->build_options);
+	free_table(ctx->type_keywords);
+	free_table(ctx->export_types);
+	free_table(ctx->header_types);
+	free_table(ctx->dynamic_exports);
+	free_names(ctx->private_names);
+	free_names(ctx->external_names);
+
+	global.free(ctx->disk.cwd);
+	uring.free(ctx->disk.writes.ring);
+	stats.free(ctx->stats);
+
+	global.free(ctx);
+}
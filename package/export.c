@@ -2,14 +2,16 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "../deps/hash/hash.h"
 #include <stdbool.h>
 
 #include "package.h"
+#include "context.h"
 #include "../deps/stream/stream.h"
-#include "atomic-stream.h"
-#include "../utils/utils.h"
+#include "paths.h"
 #include "../utils/strings.h"
+#include "../utils/stats.h"
 
 
 enum package_export_type {
@@ -20,6 +22,8 @@ enum package_export_type {
 	type_union,
 	type_struct,
 	type_header,
+	type_inline,
+	type_constant,
 };
 
 const char * type_names[] = {
@@ -30,6 +34,8 @@ const char * type_names[] = {
 	"union",
 	"struct",
 	"header",
+	"inline",
+	"constant",
 };
 
 typedef struct {
@@ -37,6 +43,7 @@ typedef struct {
 	char      * export_name;
 	char      * declaration;
 	char      * symbol;
+	char      * typed[3]; // "enum <symbol>", "union <symbol>" and "struct <symbol>", made on first use
 	enum package_export_type   type;
 } package_export_t;
 
@@ -52,12 +59,30 @@ void package_export_free(package_export_t * exp) {
 	free(exp->declaration);
 
 	free(exp->symbol);
+	int i;
+	for (i = 0; i < 3; i++) free(exp->typed[i]);
 	free(exp);
 }
 
-static hash_t * types = NULL;
-static void init_types() {
-	types = hash_new();
+static const char * prefixes[] = { "enum", "union", "struct" };
+
+/* `keyword` followed by the symbol, for `struct pkg.name` and friends. Owned by `exp`. */
+const char * package_export_prefixed(package_export_t * exp, const char * keyword) {
+	int i;
+	for (i = 0; i < 3; i++) {
+		if (strcmp(keyword, prefixes[i]) != 0) continue;
+
+		if (exp->typed[i] == NULL) {
+			asprintf(&exp->typed[i], "%s %s", keyword, exp->symbol);
+			STATS_BUFFER(strlen(exp->typed[i]) + 1);
+		}
+		return exp->typed[i];
+	}
+	return exp->symbol;
+}
+
+static hash_t * init_types(cbuild_ctx_t * ctx) {
+	hash_t * types = ctx->header_types = hash_new();
 
 	hash_set(types, "typedef",  (void*)type_type);
 	hash_set(types, "function", (void*)type_function);
@@ -65,6 +90,9 @@ static void init_types() {
 	hash_set(types, "union",    (void*)type_union);
 	hash_set(types, "struct",   (void*)type_struct);
 	hash_set(types, "header",   (void*)type_header);
+	hash_set(types, "inline",   (void*)type_inline);
+	hash_set(types, "constant", (void*)type_constant);
+	return types;
 }
 
 char * package_export_add(char * local, char * alias, char * symbol, char * type, char * declaration, package_t * parent) {
@@ -77,9 +105,10 @@ char * package_export_add(char * local, char * alias, char * symbol, char * type
 		return export_name;
 	}
 
-	if (types == NULL) init_types();
+	hash_t * types = parent->ctx->header_types;
+	if (types == NULL) types = init_types(parent->ctx);
 
-	package_export_t * exp = malloc(sizeof(package_export_t));
+	package_export_t * exp = calloc(1, sizeof(package_export_t));
 
 	exp->local_name  = local;
 	exp->export_name = export_name;
@@ -114,9 +143,15 @@ void package_export_write_headers(package_t * pkg) {
 
 	pkg->header = get_header_path(pkg->generated);
 
-	if (pkg->force == false && (pkg->silent || !utils_newer(pkg->source_abs, pkg->header))) return;
+	stats_frame_t frame = stats_enter(pkg->ctx->stats, pkg->stats, phase_headers);
+	if (pkg->ctx->force == false && (pkg->ctx->silent || !paths_newer(pkg->ctx->paths, pkg->source_abs, pkg->header))) {
+		STATS_ADD(stat_files_skipped, 1);
+		stats_leave(frame);
+		return;
+	}
 
-	stream_t * header = atomic_stream_open(pkg->header);
+	STATS_ADD(stat_files_written, 1);
+	stream_t * header = paths_open_write(pkg->ctx->paths, pkg->header);
 	stream_printf(header, "#ifndef _package_%s_\n" "#define _package_%s_\n\n", pkg->name, pkg->name);
 
 	enum package_export_type last_type;
@@ -139,16 +174,16 @@ void package_export_write_headers(package_t * pkg) {
 	}
 	stream_printf(header, "%s#endif\n", had_newline ? "" : "\n");
 	stream_close(header);
+	stats_leave(frame);
 }
 
 void package_export_export_headers(package_t * pkg, package_t * dep) {
 	if (pkg == NULL || dep == NULL) return;
 	package_export_write_headers(dep);
 
-	char * rel  = utils_relative(pkg->source_abs, dep->header);
-	char * decl = NULL;
+	const char * rel  = paths_relative(pkg->ctx->paths, pkg->source_abs, dep->header);
+	char       * decl = NULL;
 	asprintf(&decl, "#include \"%s\"", rel);
 
 	package_export_add(strings_dup(rel), NULL, strings_dup(""), "header", decl, pkg);
-	free(rel);
 }
\ No newline at end of file
@@ -9,6 +9,8 @@ enum package_export_type {
 	type_union,
 	type_struct,
 	type_header,
+	type_inline,
+	type_constant,
 };
 
 typedef struct {
@@ -16,10 +18,12 @@ typedef struct {
 	char      * export_name;
 	char      * declaration;
 	char      * symbol;
+	char      * typed[3]; // "enum <symbol>", "union <symbol>" and "struct <symbol>", made on first use
 	enum package_export_type   type;
 } package_export_t;
 
 void package_export_free(package_export_t * exp);
+const char * package_export_prefixed(package_export_t * exp, const char * keyword);
 
 #include "package.h"
 
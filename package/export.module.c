@@ -2,14 +2,16 @@ package "package_export";
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "../deps/hash/hash.h"
 #include <stdbool.h>
 
 import Package from "./package.module.c";
+import cbuild_ctx from "./context.module.c";
 import stream  from "../deps/stream/stream.module.c";
-import atomic  from "./atomic-stream.module.c";
-import utils   from "../utils/utils.module.c";
+import paths   from "./paths.module.c";
 import str     from "../utils/strings.module.c";
+import stats   from "../utils/stats.module.c";
 build  depends      "../deps/hash/hash.c";
 
 export enum export_type {
@@ -20,6 +22,8 @@ export enum export_type {
 	type_union,
 	type_struct,
 	type_header,
+	type_inline,
+	type_constant,
 } as type;
 
 const char * type_names[] = {
@@ -30,6 +34,8 @@ const char * type_names[] = {
 	"union",
 	"struct",
 	"header",
+	"inline",
+	"constant",
 };
 
 export typedef struct {
@@ -37,6 +43,7 @@ export typedef struct {
 	char      * export_name;
 	char      * declaration;
 	char      * symbol;
+	char      * typed[3]; // "enum <symbol>", "union <symbol>" and "struct <symbol>", made on first use
 	enum export_type   type;
 } Export_t as t;
 
@@ -52,12 +59,30 @@ export void free(Export_t * exp) {
 	global.free(exp->declaration);
 
 	global.free(exp->symbol);
+	int i;
+	for (i = 0; i < 3; i++) global.free(exp->typed[i]);
 	global.free(exp);
 }
 
-static hash_t * types = NULL;
-static void init_types() {
-	types = hash_new();
+static const char * prefixes[] = { "enum", "union", "struct" };
+
+/* `keyword` followed by the symbol, for `struct pkg.name` and friends. Owned by `exp`. */
+export const char * prefixed(Export_t * exp, const char * keyword) {
+	int i;
+	for (i = 0; i < 3; i++) {
+		if (strcmp(keyword, prefixes[i]) != 0) continue;
+
+		if (exp->typed[i] == NULL) {
+			asprintf(&exp->typed[i], "%s %s", keyword, exp->symbol);
+			STATS_BUFFER(strlen(exp->typed[i]) + 1);
+		}
+		return exp->typed[i];
+	}
+	return exp->symbol;
+}
+
+static hash_t * init_types(cbuild_ctx.t * ctx) {
+	hash_t * types = ctx->header_types = hash_new();
 
 	hash_set(types, "typedef",  (void*)type_type);
 	hash_set(types, "function", (void*)type_function);
@@ -65,6 +90,9 @@ static void init_types() {
 	hash_set(types, "union",    (void*)type_union);
 	hash_set(types, "struct",   (void*)type_struct);
 	hash_set(types, "header",   (void*)type_header);
+	hash_set(types, "inline",   (void*)type_inline);
+	hash_set(types, "constant", (void*)type_constant);
+	return types;
 }
 
 export char * add(char * local, char * alias, char * symbol, char * type, char * declaration, Package.t * parent) {
@@ -77,9 +105,10 @@ export char * add(char * local, char * alias, char * symbol, char * type, char *
 		return export_name;
 	}
 
-	if (types == NULL) init_types();
+	hash_t * types = parent->ctx->header_types;
+	if (types == NULL) types = init_types(parent->ctx);
 
-	Export_t * exp = malloc(sizeof(Export_t));
+	Export_t * exp = calloc(1, sizeof(Export_t));
 
 	exp->local_name  = local;
 	exp->export_name = export_name;
@@ -114,9 +143,15 @@ export void write_headers(Package.t * pkg) {
 
 	pkg->header = get_header_path(pkg->generated);
 
-	if (pkg->force == false && (pkg->silent || !utils.newer(pkg->source_abs, pkg->header))) return;
+	stats.frame_t frame = stats.enter(pkg->ctx->stats, pkg->stats, phase_headers);
+	if (pkg->ctx->force == false && (pkg->ctx->silent || !paths.newer(pkg->ctx->paths, pkg->source_abs, pkg->header))) {
+		STATS_ADD(stat_files_skipped, 1);
+		stats.leave(frame);
+		return;
+	}
 
-	stream.t * header = atomic.open(pkg->header);
+	STATS_ADD(stat_files_written, 1);
+	stream.t * header = paths.open_write(pkg->ctx->paths, pkg->header);
 	stream.printf(header, "#ifndef _package_%s_\n" "#define _package_%s_\n\n", pkg->name, pkg->name);
 
 	enum export_type last_type;
@@ -139,16 +174,16 @@ export void write_headers(Package.t * pkg) {
 	}
 	stream.printf(header, "%s#endif\n", had_newline ? "" : "\n");
 	stream.close(header);
+	stats.leave(frame);
 }
 
 export void export_headers(Package.t * pkg, Package.t * dep) {
 	if (pkg == NULL || dep == NULL) return;
 	write_headers(dep);
 
-	char * rel  = utils.relative(pkg->source_abs, dep->header);
-	char * decl = NULL;
+	const char * rel  = paths.relative(pkg->ctx->paths, pkg->source_abs, dep->header);
+	char       * decl = NULL;
 	asprintf(&decl, "#include \"%s\"", rel);
 
 	add(str.dup(rel), NULL, str.dup(""), "header", decl, pkg);
-	global.free(rel);
 }
@@ -0,0 +1,173 @@
+
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <limits.h>
+
+
+#include <stdbool.h>
+#include <time.h>
+
+
+#include "../deps/stream/stream.h"
+#include "atomic-stream.h"
+#include "../deps/stream/file.h"
+
+/*
+ * Everything the package layer needs from a filesystem. Paths are either absolute or
+ * relative to the backend's working directory, which the parser moves into the
+ * directory of each module while it parses it.
+ */
+typedef char       * (*fs_resolve_fn) (void * ctx, const char * path);
+typedef int          (*fs_modified_fn)(void * ctx, const char * path, struct timespec * mtime);
+typedef stream_t   * (*fs_open_fn)    (void * ctx, const char * path);
+typedef ssize_t      (*fs_discard_fn) (void * ctx, stream_t * s);
+typedef int          (*fs_path_fn)    (void * ctx, const char * path);
+typedef const char * (*fs_cwd_fn)     (void * ctx);
+
+typedef struct {
+	void        * ctx;
+	fs_resolve_fn    resolve;  // like realpath(3)
+	fs_modified_fn   modified; // like lstat(2), returning 1 instead of 0 for a symbolic link
+	fs_open_fn       reader;
+	fs_open_fn       writer;   // replaces the file atomically when the stream is closed
+	fs_discard_fn    discard;  // drops what was written to a writer
+	fs_path_fn       remove;
+	fs_cwd_fn        get_cwd;  // the backend's own copy, valid until set_cwd
+	fs_path_fn       set_cwd;
+} fs_t;
+
+/* the state behind one real backend, owned by whoever embeds it */
+typedef struct {
+	atomic_stream_writes_t writes; // the --fsync policy and the --io-uring ring of what is written
+	char          * cwd;    // relative paths are resolved against this instead of the process's
+} fs_disk_t;
+
+static const char * absolute(fs_disk_t * d, const char * path, char * buf) {
+	if (path[0] == '/') return path;
+	snprintf(buf, PATH_MAX, "%s/%s", d->cwd, path);
+	return buf;
+}
+
+static char * real_resolve(void * d, const char * path) {
+	char buf[PATH_MAX];
+	return realpath(absolute(d, path, buf), NULL);
+}
+
+static int real_modified(void * d, const char * path, struct timespec * mtime) {
+	char buf[PATH_MAX];
+	struct stat st;
+	if (lstat(absolute(d, path, buf), &st) < 0) return -1;
+
+#ifdef __MACH__
+	*mtime = st.st_mtimespec;
+#else
+	*mtime = st.st_mtim;
+#endif
+	return S_ISLNK(st.st_mode) ? 1 : 0;
+}
+
+static stream_t * real_reader(void * d, const char * path) {
+	char buf[PATH_MAX];
+	return file_open(absolute(d, path, buf), O_RDONLY);
+}
+
+static stream_t * real_writer(void * d, const char * path) {
+	char buf[PATH_MAX];
+	return atomic_stream_open(absolute(d, path, buf), &((fs_disk_t *) d)->writes);
+}
+
+static ssize_t real_discard(void * d, stream_t * s) {
+	return atomic_stream_abort(s);
+}
+
+static int real_remove(void * d, const char * path) {
+	char buf[PATH_MAX];
+	return unlink(absolute(d, path, buf));
+}
+
+static const char * real_get_cwd(void * d) {
+	return ((fs_disk_t *) d)->cwd;
+}
+
+static int real_set_cwd(void * _d, const char * path) {
+	fs_disk_t * d = (fs_disk_t *) _d;
+	char * cwd = NULL;
+
+	if (path[0] == '/') {
+		// taken as is, callers moving around a lot pass paths that are canonical already
+		struct stat st;
+		if (stat(path, &st) < 0) return -1;
+		if (!S_ISDIR(st.st_mode)) {
+			errno = ENOTDIR;
+			return -1;
+		}
+		cwd = strdup(path);
+	} else {
+		cwd = real_resolve(d, path);
+		if (cwd == NULL) return -1;
+	}
+
+	free(d->cwd);
+	d->cwd = cwd;
+	return 0;
+}
+
+/*
+ * The disk, starting out in the process's working directory. Moving around only
+ * changes `d`, so several backends can be used from different threads at once.
+ */
+fs_t fs_real(fs_disk_t * d) {
+	if (d->cwd == NULL) d->cwd = getcwd(NULL, 0);
+
+	fs_t f = {
+		.ctx      = d,
+		.resolve  = real_resolve,
+		.modified = real_modified,
+		.reader   = real_reader,
+		.writer   = real_writer,
+		.discard  = real_discard,
+		.remove   = real_remove,
+		.get_cwd  = real_get_cwd,
+		.set_cwd  = real_set_cwd,
+	};
+	return f;
+}
+
+char * fs_realpath(fs_t * f, const char * path) {
+	return f->resolve(f->ctx, path);
+}
+
+int fs_mtime(fs_t * f, const char * path, struct timespec * out) {
+	return f->modified(f->ctx, path, out);
+}
+
+stream_t * fs_open_read(fs_t * f, const char * path) {
+	return f->reader(f->ctx, path);
+}
+
+stream_t * fs_open_write(fs_t * f, const char * path) {
+	return f->writer(f->ctx, path);
+}
+
+ssize_t fs_abort(fs_t * f, stream_t * s) {
+	return f->discard(f->ctx, s);
+}
+
+int fs_unlink(fs_t * f, const char * path) {
+	return f->remove(f->ctx, path);
+}
+
+/* the working directory, which the next chdir() frees */
+const char * fs_getcwd(fs_t * f) {
+	return f->get_cwd(f->ctx);
+}
+
+int fs_chdir(fs_t * f, const char * path) {
+	return f->set_cwd(f->ctx, path);
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef _package_fs_
+#define _package_fs_
+
+#include <stdbool.h>
+#include <time.h>
+
+typedef char       * (*fs_resolve_fn) (void * ctx, const char * path);
+typedef int          (*fs_modified_fn)(void * ctx, const char * path, struct timespec * mtime);
+
+#include "../deps/stream/stream.h"
+
+typedef stream_t   * (*fs_open_fn)    (void * ctx, const char * path);
+typedef ssize_t      (*fs_discard_fn) (void * ctx, stream_t * s);
+typedef int          (*fs_path_fn)    (void * ctx, const char * path);
+typedef const char * (*fs_cwd_fn)     (void * ctx);
+
+typedef struct {
+	void        * ctx;
+	fs_resolve_fn    resolve;  // like realpath(3)
+	fs_modified_fn   modified; // like lstat(2), returning 1 instead of 0 for a symbolic link
+	fs_open_fn       reader;
+	fs_open_fn       writer;   // replaces the file atomically when the stream is closed
+	fs_discard_fn    discard;  // drops what was written to a writer
+	fs_path_fn       remove;
+	fs_cwd_fn        get_cwd;  // the backend's own copy, valid until set_cwd
+	fs_path_fn       set_cwd;
+} fs_t;
+
+#include "atomic-stream.h"
+
+typedef struct {
+	atomic_stream_writes_t writes; // the --fsync policy and the --io-uring ring of what is written
+	char          * cwd;    // relative paths are resolved against this instead of the process's
+} fs_disk_t;
+
+fs_t fs_real(fs_disk_t * d);
+char * fs_realpath(fs_t * f, const char * path);
+int fs_mtime(fs_t * f, const char * path, struct timespec * out);
+stream_t * fs_open_read(fs_t * f, const char * path);
+stream_t * fs_open_write(fs_t * f, const char * path);
+ssize_t fs_abort(fs_t * f, stream_t * s);
+int fs_unlink(fs_t * f, const char * path);
+const char * fs_getcwd(fs_t * f);
+int fs_chdir(fs_t * f, const char * path);
+
+#endif
@@ -0,0 +1,173 @@
+package "fs";
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <limits.h>
+
+export {
+#include <stdbool.h>
+#include <time.h>
+}
+
+import stream from "../deps/stream/stream.module.c";
+import atomic from "./atomic-stream.module.c";
+import file   from "../deps/stream/file.module.c";
+
+/*
+ * Everything the package layer needs from a filesystem. Paths are either absolute or
+ * relative to the backend's working directory, which the parser moves into the
+ * directory of each module while it parses it.
+ */
+export typedef char       * (*resolve_fn) (void * ctx, const char * path);
+export typedef int          (*modified_fn)(void * ctx, const char * path, struct timespec * mtime);
+export typedef stream.t   * (*open_fn)    (void * ctx, const char * path);
+export typedef ssize_t      (*discard_fn) (void * ctx, stream.t * s);
+export typedef int          (*path_fn)    (void * ctx, const char * path);
+export typedef const char * (*cwd_fn)     (void * ctx);
+
+export typedef struct {
+	void        * ctx;
+	resolve_fn    resolve;  // like realpath(3)
+	modified_fn   modified; // like lstat(2), returning 1 instead of 0 for a symbolic link
+	open_fn       reader;
+	open_fn       writer;   // replaces the file atomically when the stream is closed
+	discard_fn    discard;  // drops what was written to a writer
+	path_fn       remove;
+	cwd_fn        get_cwd;  // the backend's own copy, valid until set_cwd
+	path_fn       set_cwd;
+} fs_t as t;
+
+/* the state behind one real backend, owned by whoever embeds it */
+export typedef struct {
+	atomic.writes_t writes; // the --fsync policy and the --io-uring ring of what is written
+	char          * cwd;    // relative paths are resolved against this instead of the process's
+} disk_t;
+
+static const char * absolute(disk_t * d, const char * path, char * buf) {
+	if (path[0] == '/') return path;
+	snprintf(buf, PATH_MAX, "%s/%s", d->cwd, path);
+	return buf;
+}
+
+static char * real_resolve(void * d, const char * path) {
+	char buf[PATH_MAX];
+	return global.realpath(absolute(d, path, buf), NULL);
+}
+
+static int real_modified(void * d, const char * path, struct timespec * mtime) {
+	char buf[PATH_MAX];
+	struct stat st;
+	if (lstat(absolute(d, path, buf), &st) < 0) return -1;
+
+#ifdef __MACH__
+	*mtime = st.st_mtimespec;
+#else
+	*mtime = st.st_mtim;
+#endif
+	return S_ISLNK(st.st_mode) ? 1 : 0;
+}
+
+static stream.t * real_reader(void * d, const char * path) {
+	char buf[PATH_MAX];
+	return file.open(absolute(d, path, buf), O_RDONLY);
+}
+
+static stream.t * real_writer(void * d, const char * path) {
+	char buf[PATH_MAX];
+	return atomic.open(absolute(d, path, buf), &((disk_t *) d)->writes);
+}
+
+static ssize_t real_discard(void * d, stream.t * s) {
+	return atomic.abort(s);
+}
+
+static int real_remove(void * d, const char * path) {
+	char buf[PATH_MAX];
+	return global.unlink(absolute(d, path, buf));
+}
+
+static const char * real_get_cwd(void * d) {
+	return ((disk_t *) d)->cwd;
+}
+
+static int real_set_cwd(void * _d, const char * path) {
+	disk_t * d = (disk_t *) _d;
+	char * cwd = NULL;
+
+	if (path[0] == '/') {
+		// taken as is, callers moving around a lot pass paths that are canonical already
+		struct stat st;
+		if (stat(path, &st) < 0) return -1;
+		if (!S_ISDIR(st.st_mode)) {
+			errno = ENOTDIR;
+			return -1;
+		}
+		cwd = strdup(path);
+	} else {
+		cwd = real_resolve(d, path);
+		if (cwd == NULL) return -1;
+	}
+
+	global.free(d->cwd);
+	d->cwd = cwd;
+	return 0;
+}
+
+/*
+ * The disk, starting out in the process's working directory. Moving around only
+ * changes `d`, so several backends can be used from different threads at once.
+ */
+export fs_t real(disk_t * d) {
+	if (d->cwd == NULL) d->cwd = global.getcwd(NULL, 0);
+
+	fs_t f = {
+		.ctx      = d,
+		.resolve  = real_resolve,
+		.modified = real_modified,
+		.reader   = real_reader,
+		.writer   = real_writer,
+		.discard  = real_discard,
+		.remove   = real_remove,
+		.get_cwd  = real_get_cwd,
+		.set_cwd  = real_set_cwd,
+	};
+	return f;
+}
+
+export char * realpath(fs_t * f, const char * path) {
+	return f->resolve(f->ctx, path);
+}
+
+export int mtime(fs_t * f, const char * path, struct timespec * out) {
+	return f->modified(f->ctx, path, out);
+}
+
+export stream.t * open_read(fs_t * f, const char * path) {
+	return f->reader(f->ctx, path);
+}
+
+export stream.t * open_write(fs_t * f, const char * path) {
+	return f->writer(f->ctx, path);
+}
+
+export ssize_t abort(fs_t * f, stream.t * s) {
+	return f->discard(f->ctx, s);
+}
+
+export int unlink(fs_t * f, const char * path) {
+	return f->remove(f->ctx, path);
+}
+
+/* the working directory, which the next chdir() frees */
+export const char * getcwd(fs_t * f) {
+	return f->get_cwd(f->ctx);
+}
+
+export int chdir(fs_t * f, const char * path) {
+	return f->set_cwd(f->ctx, path);
+}
@@ -10,6 +10,7 @@
 
 #include "package.h"
 #include "export.h"
+#include "paths.h"
 
 
 typedef struct {
@@ -22,7 +23,9 @@ typedef struct {
 package_t * package_import_free(package_import_t * imp) {
 	if (imp == NULL) return NULL;
 	
-	if (imp->alias == imp->filename) {
+	if (imp->c_file) {
+		free(imp->filename); // the alias is interned in the path table
+	} else if (imp->alias == imp->filename) {
 		free(imp->alias);
 	} else {
 		free(imp->alias);
@@ -42,16 +45,14 @@ package_import_t * package_import_add(char * alias, char * filename, package_t *
 	imp->alias    = alias;
 	imp->filename = filename;
 	imp->c_file   = false;
-	imp->pkg      = package_new(filename, error, parent->force, parent->silent);
+	imp->pkg      = parent->ctx->load(parent->ctx, filename, error);
 
 	if (imp->pkg == NULL) return NULL;
-
-	package_export_write_headers(imp->pkg);
 	return imp;
 }
 
 package_import_t * package_import_add_c_file(package_t * parent, char * filename, char ** error) {
-	char * alias = realpath(filename, NULL);
+	char * alias = (char *) paths_realpath(parent->ctx->paths, filename);
 	if (alias == NULL) {
 	*error = strerror(errno);
 	return NULL;
@@ -64,7 +65,7 @@ package_import_t * package_import_add_c_file(package_t * parent, char * filename
 	imp->alias    = alias;
 	imp->filename = filename;
 	imp->c_file   = true;
-	imp->pkg      = package_c_file(alias, error);
+	imp->pkg      = package_c_file(parent->ctx, alias, error);
 
 	return imp;
 }
@@ -77,6 +78,9 @@ package_import_t * package_import_passthrough(package_t * parent, char * filenam
 		return NULL;
 	}
 
+	// the exports are needed right away
+	parent->ctx->wait(parent->ctx, imp->pkg);
+
 	hash_each_val(imp->pkg->exports, {
 		package_export_t * exp = (package_export_t *) val;
 		hash_set(parent->exports, exp->export_name, exp);
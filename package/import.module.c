@@ -10,6 +10,7 @@ export {
 
 import Package    from "./package.module.c";
 import pkg_export from "./export.module.c";
+import paths      from "./paths.module.c";
 build  depends         "../deps/hash/hash.c";
 
 export typedef struct {
@@ -22,7 +23,9 @@ export typedef struct {
 export Package.t * free(Import_t * imp) {
 	if (imp == NULL) return NULL;
 	
-	if (imp->alias == imp->filename) {
+	if (imp->c_file) {
+		global.free(imp->filename); // the alias is interned in the path table
+	} else if (imp->alias == imp->filename) {
 		global.free(imp->alias);
 	} else {
 		global.free(imp->alias);
@@ -42,16 +45,14 @@ export Import_t * add(char * alias, char * filename, Package.t * parent, char **
 	imp->alias    = alias;
 	imp->filename = filename;
 	imp->c_file   = false;
-	imp->pkg      = Package.new(filename, error, parent->force, parent->silent);
+	imp->pkg      = parent->ctx->load(parent->ctx, filename, error);
 
 	if (imp->pkg == NULL) return NULL;
-
-	pkg_export.write_headers(imp->pkg);
 	return imp;
 }
 
 export Import_t * add_c_file(Package.t * parent, char * filename, char ** error) {
-	char * alias = realpath(filename, NULL);
+	char * alias = (char *) paths.realpath(parent->ctx->paths, filename);
 	if (alias == NULL) {
 	*error = strerror(errno);
 	return NULL;
@@ -64,7 +65,7 @@ export Import_t * add_c_file(Package.t * parent, char * filename, char ** error)
 	imp->alias    = alias;
 	imp->filename = filename;
 	imp->c_file   = true;
-	imp->pkg      = Package.c_file(alias, error);
+	imp->pkg      = Package.c_file(parent->ctx, alias, error);
 
 	return imp;
 }
@@ -77,6 +78,9 @@ export Import_t * passthrough(Package.t * parent, char * filename, char ** error
 		return NULL;
 	}
 
+	// the exports are needed right away
+	parent->ctx->wait(parent->ctx, imp->pkg);
+
 	hash_each_val(imp->pkg->exports, {
 		pkg_export.t * exp = (pkg_export.t *) val;
 		hash_set(parent->exports, exp->export_name, exp);
@@ -9,23 +9,16 @@
 #include <libgen.h>
 
 #include "../deps/stream/stream.h"
-#include "../deps/stream/file.h"
 #include "../parser/grammer.h"
 #include "../parser/parser.h"
-#include "../utils/utils.h"
+#include "../parser/linkage.h"
 #include "package.h"
 #include "import.h"
 #include "export.h"
-#include "atomic-stream.h"
-
-static void init_cache() {
-	package_path_cache = hash_new();
-	package_id_cache   = hash_new();
-}
-
-static char * abs_path(const char * rel_path) {
-	return realpath(rel_path, NULL);
-}
+#include "fs.h"
+#include "../utils/stats.h"
+#include "context.h"
+#include "paths.h"
 
 static char * package_name(const char * rel_path) {
 	char * buffer   = strdup(rel_path);
@@ -71,20 +64,66 @@ char * index_generated_name(const char * path) {
 	return buffer;
 }
 
-package_t * index_new(const char * relative_path, char ** error, bool force, bool silent);
+package_t * index_new(cbuild_ctx_t * ctx, const char * relative_path, char ** error);
+static package_t * load(cbuild_ctx_t * ctx, const char * relative_path, char ** error);
+static void run(cbuild_ctx_t * ctx, package_t * pkg);
 
-package_t * index_parse(
-		stream_t   * input,
-		stream_t   * out,
-		const char * rel,
-		char       * key,
-		char       * generated,
-		char      ** error,
-		bool         force,
-		bool         silent
+/* a package being parsed, in ctx->queue */
+typedef struct {
+	package_t * pkg;
+	parser_t  * parser;
+	bool        close;  // its output was opened here, and is closed once it is parsed
+} task_t;
+
+/* packages are only ever freed together, by cbuild_ctx.free(), since they share their imports */
+static void unload(void * _pkg) {
+	package_t * pkg = (package_t *) _pkg;
+
+	if (pkg->c_file) {
+		free(pkg);
+		return;
+	}
+
+	// exports
+	int i;
+	for (i = 0; i < pkg->n_exports; i++) {
+		package_export_free((package_export_t *) pkg->ordered[i]);
+	}
+	free(pkg->ordered);
+
+	hash_free(pkg->exports);
+	hash_free(pkg->symbols);
+
+	free(pkg->name);
+	free(pkg->generated);
+	free(pkg->header);
+
+	// imports, the packages themselves are in the cache as well
+	hash_each_val(pkg->deps, {
+		package_import_free((package_import_t *) val);
+	});
+	hash_free(pkg->deps);
+	free(pkg);
+}
+
+static void init_hooks(cbuild_ctx_t * ctx) {
+	if (ctx->load   == NULL) ctx->load   = (cbuild_ctx_load_fn) load;
+	if (ctx->wait   == NULL) ctx->wait   = (cbuild_ctx_wait_fn) run;
+	if (ctx->unload == NULL) ctx->unload = unload;
+}
+
+/* sets up `p` to be parsed, and queues it */
+static package_t * start(
+		cbuild_ctx_t * ctx,
+		stream_t     * input,
+		stream_t     * out,
+		const char   * rel,
+		const char   * key,
+		char         * generated,
+		bool           close,
+		char        ** error
 ) {
-	if (package_path_cache == NULL) init_cache();
-	if (package_new        == NULL) package_new = index_new;
+	init_hooks(ctx);
 
 	package_t * p = calloc(1, sizeof(package_t));
 	p->deps       = hash_new();
@@ -92,95 +131,129 @@ package_t * index_parse(
 	p->ordered    = NULL;
 	p->n_exports  = 0;
 	p->symbols    = hash_new();
-	p->source_abs = key;
+	p->source_abs = paths_intern(ctx->paths, key);
 	p->generated  = generated;
 	p->out        = out;
 	p->name       = package_name(p->generated);
-	p->force      = force;
-	p->silent     = silent;
+	p->ctx        = ctx;
+	p->stats      = stats_new(ctx->stats, key);
+
+	hash_set(ctx->path_cache, (char *) p->source_abs, p);
 
+	stats_frame_t frame = stats_enter(ctx->stats, p->stats, phase_parse);
+	STATS_ADD(out ? stat_files_written : stat_files_skipped, 1);
+	parser_t * parsing = grammer_start(input, rel, p, error);
+	stats_leave(frame);
+
+	if (parsing == NULL) {
+		p->errors = -1;
+		return p;
+	}
 
-	hash_set(package_path_cache, key, p);
+	task_t * t = malloc(sizeof(task_t));
+	t->pkg     = p;
+	t->parser  = parsing;
+	t->close   = close;
 
-	p->errors = grammer_parse(input, rel, p, error);
+	ctx->queue = realloc(ctx->queue, sizeof(void *) * (ctx->n_queue + 1));
+	ctx->queue[ctx->n_queue++] = t;
 	return p;
 }
 
-package_t * index_new(const char * relative_path, char ** error, bool force, bool silent) {
-	if (package_path_cache == NULL) init_cache();
-	if (package_new        == NULL) package_new = index_new;
+static void step(cbuild_ctx_t * ctx, task_t * t) {
+	stats_frame_t frame = stats_enter(ctx->stats, t->pkg->stats, phase_parse);
+	bool done = parser_resume(t->parser);
+	stats_leave(frame);
+	if (!done) return;
+
+	// other tasks may have come and gone while this one ran
+	size_t i = 0;
+	while (ctx->queue[i] != t) i++;
+	memmove(ctx->queue + i, ctx->queue + i + 1, sizeof(void *) * (ctx->n_queue - i - 1));
+	ctx->n_queue--;
+
+	t->pkg->errors = parser_finish(t->parser);
+	parser_linkage_release(t->pkg);
+	if (t->close) stream_close(t->pkg->out);
+	if (t->close && ctx->written) ctx->written(ctx, t->pkg);
+	free(t);
+}
+
+/*
+ * Resumes the parser opened last that can go on, until `pkg` is parsed or none can. An
+ * import is opened when it is parsed and waited for right away, so this goes depth
+ * first like parsing imports in place did, with one parser on the C stack rather than
+ * one per level of imports. What is left waits for a parser that is running.
+ */
+static void run(cbuild_ctx_t * ctx, package_t * pkg) {
+	while (pkg->parser != NULL) {
+		size_t i = ctx->n_queue;
+		while (i > 0 && !parser_ready(((task_t *) ctx->queue[i - 1])->parser)) i--;
+		if (i == 0) return;
+
+		step(ctx, (task_t *) ctx->queue[i - 1]);
+	}
+}
+
+package_t * index_parse(
+		cbuild_ctx_t * ctx,
+		stream_t     * input,
+		stream_t     * out,
+		const char   * rel,
+		const char   * key,
+		char         * generated,
+		char        ** error
+) {
+	package_t * p = start(ctx, input, out, rel, key, generated, false, error);
+	run(ctx, p);
+	return p;
+}
+
+/* the package at `relative_path`, which is parsed once something waits for it */
+static package_t * load(cbuild_ctx_t * ctx, const char * relative_path, char ** error) {
+	init_hooks(ctx);
 
 	if (assert_name(relative_path, error)) return NULL;
-	char * key = abs_path(relative_path);
+	const char * key = paths_realpath(ctx->paths, relative_path);
 
 	if (key == NULL) {
 		*error = strerror(errno);
 		return NULL;
 	}
 
-	package_t * cached = hash_get(package_path_cache, key);
-	if (cached != NULL) {
-		free(key);
-		return cached;
-	}
+	package_t * cached = hash_get(ctx->path_cache, (char *) key);
+	if (cached != NULL) return cached;
 
-	stream_t * input = file_open(relative_path, O_RDONLY);
+	stream_t * input = fs_open_read(ctx->fs, key);
 	if (input->error.code != 0) {
 		*error = strdup(input->error.message);
-		free(key);
 		return NULL;
 	}
 
 	char * generated = index_generated_name(key);
 	stream_t * out = NULL;
-	if (force || (!silent && utils_newer(relative_path, generated))) {
-		out = atomic_stream_open(generated);
+	if (ctx->force || (!ctx->silent && paths_newer(ctx->paths, key, generated))) {
+		out = paths_open_write(ctx->paths, generated);
 		if (out->error.code != 0) {
-			free(key);
+			free(generated);
 			fprintf(stderr, "ERROR: '%s'\n", out->error.message);
 			if (error) *error = strdup(out->error.message);
-			atomic_stream_abort(out);
+			fs_abort(ctx->fs, out);
 			return NULL;
 		}
 	}
 
-	package_t * p = index_parse(input, out, relative_path, key, generated, error, force, silent);
+	package_t * p = start(ctx, input, out, relative_path, key, generated, out != NULL, error);
 
-	if (p == NULL || *error != NULL) {
-		free(key);
-		if (out) atomic_stream_abort(out);
+	if (*error != NULL) {
+		if (out) fs_abort(ctx->fs, out);
 		return NULL;
 	}
-
-	if (out) stream_close(out);
 	return p;
 }
 
-void index_free(package_t * pkg) {
-	if (pkg == NULL) return;
-	if (package_path_cache) {
-		hash_del(package_path_cache, pkg->source_abs); 
-	}
-
-	// exports
-	int i;
-	for (i = 0; i < pkg->n_exports; i++) {
-		package_export_free((package_export_t *) pkg->ordered[i]);
-	}
-	free(pkg->ordered);
-
-	hash_free(pkg->exports);
-	hash_free(pkg->symbols);
-
-	free(pkg->name);
-	free(pkg->source_abs);
-	free(pkg->generated);
-	free(pkg->header);
-
-	// imports
-	hash_each_val(pkg->deps, {
-		index_free(package_import_free((package_import_t *) val));
-	});
-	hash_free(pkg->deps);
-	free(pkg);
+package_t * index_new(cbuild_ctx_t * ctx, const char * relative_path, char ** error) {
+	package_t * p = load(ctx, relative_path, error);
+	if (p != NULL) run(ctx, p);
+	return p;
 }
\ No newline at end of file
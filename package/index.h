@@ -4,22 +4,20 @@
 char * index_generated_name(const char * path);
 
 #include "package.h"
+#include "context.h"
 
-package_t * index_new(const char * relative_path, char ** error, bool force, bool silent);
+package_t * index_new(cbuild_ctx_t * ctx, const char * relative_path, char ** error);
 
 #include "../deps/stream/stream.h"
 
 package_t * index_parse(
-		stream_t   * input,
-		stream_t   * out,
-		const char * rel,
-		char       * key,
-		char       * generated,
-		char      ** error,
-		bool         force,
-		bool         silent
+		cbuild_ctx_t * ctx,
+		stream_t     * input,
+		stream_t     * out,
+		const char   * rel,
+		const char   * key,
+		char         * generated,
+		char        ** error
 );
 
-void index_free(package_t * pkg);
-
 #endif
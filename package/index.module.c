@@ -9,23 +9,16 @@ build depends "../deps/hash/hash.c";
 #include <libgen.h>
 
 import stream  from "../deps/stream/stream.module.c";
-import file    from "../deps/stream/file.module.c";
 import grammer from "../parser/grammer.module.c";
 import parser  from "../parser/parser.module.c";
-import utils   from "../utils/utils.module.c";
+import Linkage from "../parser/linkage.module.c";
 import Package from "./package.module.c";
 import Import  from "./import.module.c";
 import Export  from "./export.module.c";
-import atomic  from "./atomic-stream.module.c";
-
-static void init_cache() {
-	Package.path_cache = hash_new();
-	Package.id_cache   = hash_new();
-}
-
-static char * abs_path(const char * rel_path) {
-	return realpath(rel_path, NULL);
-}
+import fs      from "./fs.module.c";
+import stats   from "../utils/stats.module.c";
+import cbuild_ctx from "./context.module.c";
+import paths   from "./paths.module.c";
 
 static char * package_name(const char * rel_path) {
 	char * buffer   = strdup(rel_path);
@@ -71,20 +64,66 @@ export char * generated_name(const char * path) {
 	return buffer;
 }
 
-export Package.t * new(const char * relative_path, char ** error, bool force, bool silent);
+export Package.t * new(cbuild_ctx.t * ctx, const char * relative_path, char ** error);
+static Package.t * load(cbuild_ctx.t * ctx, const char * relative_path, char ** error);
+static void run(cbuild_ctx.t * ctx, Package.t * pkg);
 
-export Package.t * parse(
-		stream.t   * input,
-		stream.t   * out,
-		const char * rel,
-		char       * key,
-		char       * generated,
-		char      ** error,
-		bool         force,
-		bool         silent
+/* a package being parsed, in ctx->queue */
+typedef struct {
+	Package.t * pkg;
+	parser.t  * parser;
+	bool        close;  // its output was opened here, and is closed once it is parsed
+} task_t;
+
+/* packages are only ever freed together, by cbuild_ctx.free(), since they share their imports */
+static void unload(void * _pkg) {
+	Package.t * pkg = (Package.t *) _pkg;
+
+	if (pkg->c_file) {
+		global.free(pkg);
+		return;
+	}
+
+	// exports
+	int i;
+	for (i = 0; i < pkg->n_exports; i++) {
+		Export.free((Export.t *) pkg->ordered[i]);
+	}
+	global.free(pkg->ordered);
+
+	hash_free(pkg->exports);
+	hash_free(pkg->symbols);
+
+	global.free(pkg->name);
+	global.free(pkg->generated);
+	global.free(pkg->header);
+
+	// imports, the packages themselves are in the cache as well
+	hash_each_val(pkg->deps, {
+		Import.free((Import.t *) val);
+	});
+	hash_free(pkg->deps);
+	global.free(pkg);
+}
+
+static void init_hooks(cbuild_ctx.t * ctx) {
+	if (ctx->load   == NULL) ctx->load   = (cbuild_ctx.load_fn) load;
+	if (ctx->wait   == NULL) ctx->wait   = (cbuild_ctx.wait_fn) run;
+	if (ctx->unload == NULL) ctx->unload = unload;
+}
+
+/* sets up `p` to be parsed, and queues it */
+static Package.t * start(
+		cbuild_ctx.t * ctx,
+		stream.t     * input,
+		stream.t     * out,
+		const char   * rel,
+		const char   * key,
+		char         * generated,
+		bool           close,
+		char        ** error
 ) {
-	if (Package.path_cache == NULL) init_cache();
-	if (Package.new        == NULL) Package.new = new;
+	init_hooks(ctx);
 
 	Package.t * p = calloc(1, sizeof(Package.t));
 	p->deps       = hash_new();
@@ -92,95 +131,129 @@ export Package.t * parse(
 	p->ordered    = NULL;
 	p->n_exports  = 0;
 	p->symbols    = hash_new();
-	p->source_abs = key;
+	p->source_abs = paths.intern(ctx->paths, key);
 	p->generated  = generated;
 	p->out        = out;
 	p->name       = package_name(p->generated);
-	p->force      = force;
-	p->silent     = silent;
+	p->ctx        = ctx;
+	p->stats      = stats.new(ctx->stats, key);
+
+	hash_set(ctx->path_cache, (char *) p->source_abs, p);
+
+	stats.frame_t frame = stats.enter(ctx->stats, p->stats, phase_parse);
+	STATS_ADD(out ? stat_files_written : stat_files_skipped, 1);
+	parser.t * parsing = grammer.start(input, rel, p, error);
+	stats.leave(frame);
+
+	if (parsing == NULL) {
+		p->errors = -1;
+		return p;
+	}
 
+	task_t * t = malloc(sizeof(task_t));
+	t->pkg     = p;
+	t->parser  = parsing;
+	t->close   = close;
 
-	hash_set(Package.path_cache, key, p);
+	ctx->queue = realloc(ctx->queue, sizeof(void *) * (ctx->n_queue + 1));
+	ctx->queue[ctx->n_queue++] = t;
+	return p;
+}
+
+static void step(cbuild_ctx.t * ctx, task_t * t) {
+	stats.frame_t frame = stats.enter(ctx->stats, t->pkg->stats, phase_parse);
+	bool done = parser.resume(t->parser);
+	stats.leave(frame);
+	if (!done) return;
+
+	// other tasks may have come and gone while this one ran
+	size_t i = 0;
+	while (ctx->queue[i] != t) i++;
+	memmove(ctx->queue + i, ctx->queue + i + 1, sizeof(void *) * (ctx->n_queue - i - 1));
+	ctx->n_queue--;
+
+	t->pkg->errors = parser.finish(t->parser);
+	Linkage.release(t->pkg);
+	if (t->close) stream.close(t->pkg->out);
+	if (t->close && ctx->written) ctx->written(ctx, t->pkg);
+	global.free(t);
+}
+
+/*
+ * Resumes the parser opened last that can go on, until `pkg` is parsed or none can. An
+ * import is opened when it is parsed and waited for right away, so this goes depth
+ * first like parsing imports in place did, with one parser on the C stack rather than
+ * one per level of imports. What is left waits for a parser that is running.
+ */
+static void run(cbuild_ctx.t * ctx, Package.t * pkg) {
+	while (pkg->parser != NULL) {
+		size_t i = ctx->n_queue;
+		while (i > 0 && !parser.ready(((task_t *) ctx->queue[i - 1])->parser)) i--;
+		if (i == 0) return;
+
+		step(ctx, (task_t *) ctx->queue[i - 1]);
+	}
+}
 
-	p->errors = grammer.parse(input, rel, p, error);
+export Package.t * parse(
+		cbuild_ctx.t * ctx,
+		stream.t     * input,
+		stream.t     * out,
+		const char   * rel,
+		const char   * key,
+		char         * generated,
+		char        ** error
+) {
+	Package.t * p = start(ctx, input, out, rel, key, generated, false, error);
+	run(ctx, p);
 	return p;
 }
 
-Package.t * new(const char * relative_path, char ** error, bool force, bool silent) {
-	if (Package.path_cache == NULL) init_cache();
-	if (Package.new        == NULL) Package.new = new;
+/* the package at `relative_path`, which is parsed once something waits for it */
+static Package.t * load(cbuild_ctx.t * ctx, const char * relative_path, char ** error) {
+	init_hooks(ctx);
 
 	if (assert_name(relative_path, error)) return NULL;
-	char * key = abs_path(relative_path);
+	const char * key = paths.realpath(ctx->paths, relative_path);
 
 	if (key == NULL) {
 		*error = strerror(errno);
 		return NULL;
 	}
 
-	Package.t * cached = hash_get(Package.path_cache, key);
-	if (cached != NULL) {
-		free(key);
-		return cached;
-	}
+	Package.t * cached = hash_get(ctx->path_cache, (char *) key);
+	if (cached != NULL) return cached;
 
-	stream.t * input = file.open(relative_path, O_RDONLY);
+	stream.t * input = fs.open_read(ctx->fs, key);
 	if (input->error.code != 0) {
 		*error = strdup(input->error.message);
-		free(key);
 		return NULL;
 	}
 
 	char * generated = generated_name(key);
 	stream.t * out = NULL;
-	if (force || (!silent && utils.newer(relative_path, generated))) {
-		out = atomic.open(generated);
+	if (ctx->force || (!ctx->silent && paths.newer(ctx->paths, key, generated))) {
+		out = paths.open_write(ctx->paths, generated);
 		if (out->error.code != 0) {
-			free(key);
+			free(generated);
 			fprintf(stderr, "ERROR: '%s'\n", out->error.message);
 			if (error) *error = strdup(out->error.message);
-			atomic.abort(out);
+			fs.abort(ctx->fs, out);
 			return NULL;
 		}
 	}
 
-	Package.t * p = parse(input, out, relative_path, key, generated, error, force, silent);
+	Package.t * p = start(ctx, input, out, relative_path, key, generated, out != NULL, error);
 
-	if (p == NULL || *error != NULL) {
-		free(key);
-		if (out) atomic.abort(out);
+	if (*error != NULL) {
+		if (out) fs.abort(ctx->fs, out);
 		return NULL;
 	}
-
-	if (out) stream.close(out);
 	return p;
 }
 
-export void free(Package.t * pkg) {
-	if (pkg == NULL) return;
-	if (Package.path_cache) {
-		hash_del(Package.path_cache, pkg->source_abs); 
-	}
-
-	// exports
-	int i;
-	for (i = 0; i < pkg->n_exports; i++) {
-		Export.free((Export.t *) pkg->ordered[i]);
-	}
-	global.free(pkg->ordered);
-
-	hash_free(pkg->exports);
-	hash_free(pkg->symbols);
-
-	global.free(pkg->name);
-	global.free(pkg->source_abs);
-	global.free(pkg->generated);
-	global.free(pkg->header);
-
-	// imports
-	hash_each_val(pkg->deps, {
-		free(Import.free((Import.t *) val));
-	});
-	hash_free(pkg->deps);
-	global.free(pkg);
+Package.t * new(cbuild_ctx.t * ctx, const char * relative_path, char ** error) {
+	Package.t * p = load(ctx, relative_path, error);
+	if (p != NULL) run(ctx, p);
+	return p;
 }
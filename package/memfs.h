@@ -0,0 +1,13 @@
+#ifndef _package_memfs_
+#define _package_memfs_
+
+int memfs_type();
+
+#include "fs.h"
+
+fs_t * memfs_new();
+void memfs_write(fs_t * f, const char * path, const char * data);
+const char * memfs_read(fs_t * f, const char * path);
+void memfs_free(fs_t * f);
+
+#endif
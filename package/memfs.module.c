@@ -0,0 +1,282 @@
+package "memfs";
+
+build depends "../deps/hash/hash.c";
+#include "../deps/hash/hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+import stream from "../deps/stream/stream.module.c";
+import fs     from "./fs.module.c";
+
+/*
+ * A filesystem that only exists in memory, for embedding cbuild and for benchmarking the
+ * parser without the disk. Directories are implied by the files in them and modification
+ * times come from a counter that ticks on every write.
+ */
+
+typedef struct {
+	char   * path;
+	char   * data;
+	size_t   length;
+	long     version;
+} file_t;
+
+typedef struct {
+	fs.t     fs;
+	hash_t * files;
+	char   * cwd;
+	long     clock;
+} memfs_t;
+
+typedef struct {
+	memfs_t * m;
+	char    * path;
+	char    * buf;
+	size_t    offset;
+	size_t    length;
+} stream_ctx_t;
+
+static int _type;
+
+export int type() {
+	if (_type == 0) _type = stream.register("memfs");
+	return _type;
+}
+
+/* joins `path` onto `cwd` and removes ".", ".." and repeated separators */
+static char * normalize(const char * cwd, const char * path) {
+	char * joined = NULL;
+	if (path[0] == '/') joined = strdup(path);
+	else asprintf(&joined, "%s/%s", cwd, path);
+
+	char * out = malloc(strlen(joined) + 2);
+	size_t len = 0;
+
+	char * save = NULL;
+	char * part;
+	for (part = strtok_r(joined, "/", &save); part != NULL; part = strtok_r(NULL, "/", &save)) {
+		if (strcmp(part, ".") == 0) continue;
+		if (strcmp(part, "..") == 0) {
+			while (len > 0 && out[--len] != '/');
+			continue;
+		}
+		out[len++] = '/';
+		strcpy(out + len, part);
+		len += strlen(part);
+	}
+	if (len == 0) out[len++] = '/';
+	out[len] = 0;
+
+	global.free(joined);
+	return out;
+}
+
+static file_t * lookup(memfs_t * m, const char * path) {
+	char * abs = normalize(m->cwd, path);
+	file_t * f = hash_get(m->files, abs);
+	global.free(abs);
+	return f;
+}
+
+static bool is_dir(memfs_t * m, const char * abs) {
+	size_t len = strlen(abs);
+	if (len == 1) return true;
+
+	hash_each_key(m->files, {
+		if (strncmp(key, abs, len) == 0 && key[len] == '/') return true;
+	});
+	return false;
+}
+
+static void store(memfs_t * m, const char * path, char * data, size_t length) {
+	char * abs = normalize(m->cwd, path);
+	file_t * f = hash_get(m->files, abs);
+
+	if (f == NULL) {
+		f = calloc(1, sizeof(file_t));
+		f->path = abs;
+		hash_set(m->files, f->path, f);
+	} else {
+		global.free(abs);
+		global.free(f->data);
+	}
+
+	f->data    = data;
+	f->length  = length;
+	f->version = ++m->clock;
+}
+
+static ssize_t file_read(void * _ctx, void * buf, size_t nbyte, stream.error_t * error) {
+	stream_ctx_t * ctx = (stream_ctx_t *) _ctx;
+	size_t len = nbyte > ctx->length - ctx->offset ? ctx->length - ctx->offset : nbyte;
+	memcpy(buf, ctx->buf + ctx->offset, len);
+	ctx->offset += len;
+	return len;
+}
+
+static ssize_t file_write(void * _ctx, const void * buf, size_t nbyte, stream.error_t * error) {
+	stream_ctx_t * ctx = (stream_ctx_t *) _ctx;
+	ctx->buf = realloc(ctx->buf, ctx->length + nbyte + 1);
+	memcpy(ctx->buf + ctx->length, buf, nbyte);
+	ctx->length += nbyte;
+	ctx->buf[ctx->length] = 0;
+	return nbyte;
+}
+
+static void free_stream_ctx(stream_ctx_t * ctx) {
+	global.free(ctx->path);
+	global.free(ctx->buf);
+	global.free(ctx);
+}
+
+static ssize_t file_close(void * _ctx, stream.error_t * error) {
+	stream_ctx_t * ctx = (stream_ctx_t *) _ctx;
+
+	if (ctx->path != NULL) {
+		// writers only replace the file once they are complete
+		store(ctx->m, ctx->path, ctx->buf ? ctx->buf : strdup(""), ctx->length);
+		ctx->buf = NULL;
+	}
+	free_stream_ctx(ctx);
+	return 0;
+}
+
+static stream.t * new_stream(stream_ctx_t * ctx) {
+	stream.t * s = calloc(1, sizeof(stream.t));
+	s->ctx   = ctx;
+	s->read  = ctx->path ? NULL : file_read;
+	s->write = ctx->path ? file_write : NULL;
+	s->close = file_close;
+	s->type  = type();
+	return s;
+}
+
+static char * memfs_resolve(void * _m, const char * path) {
+	memfs_t * m = (memfs_t *) _m;
+	char * abs = normalize(m->cwd, path);
+
+	if (hash_get(m->files, abs) == NULL && !is_dir(m, abs)) {
+		global.free(abs);
+		errno = ENOENT;
+		return NULL;
+	}
+	return abs;
+}
+
+static int memfs_modified(void * _m, const char * path, struct timespec * mtime) {
+	file_t * f = lookup((memfs_t *) _m, path);
+	if (f == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	mtime->tv_sec  = f->version;
+	mtime->tv_nsec = 0;
+	return 0;
+}
+
+static stream.t * memfs_reader(void * _m, const char * path) {
+	file_t * f = lookup((memfs_t *) _m, path);
+	if (f == NULL) return stream.error(NULL, ENOENT, strerror(ENOENT));
+
+	stream_ctx_t * ctx = calloc(1, sizeof(stream_ctx_t));
+	ctx->buf    = malloc(f->length + 1);
+	ctx->length = f->length;
+	memcpy(ctx->buf, f->data, f->length + 1);
+	return new_stream(ctx);
+}
+
+static stream.t * memfs_writer(void * _m, const char * path) {
+	memfs_t * m = (memfs_t *) _m;
+
+	stream_ctx_t * ctx = calloc(1, sizeof(stream_ctx_t));
+	ctx->m    = m;
+	ctx->path = normalize(m->cwd, path);
+	return new_stream(ctx);
+}
+
+static ssize_t memfs_discard(void * _m, stream.t * s) {
+	if (s->type != type()) return stream.close(s);
+
+	free_stream_ctx((stream_ctx_t *) s->ctx);
+	global.free(s);
+	return 0;
+}
+
+static int memfs_remove(void * _m, const char * path) {
+	memfs_t * m = (memfs_t *) _m;
+	char * abs = normalize(m->cwd, path);
+	file_t * f = hash_get(m->files, abs);
+	global.free(abs);
+
+	if (f == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	hash_del(m->files, f->path);
+	global.free(f->path);
+	global.free(f->data);
+	global.free(f);
+	return 0;
+}
+
+static const char * memfs_get_cwd(void * _m) {
+	return ((memfs_t *) _m)->cwd;
+}
+
+static int memfs_set_cwd(void * _m, const char * path) {
+	memfs_t * m = (memfs_t *) _m;
+	char * abs = normalize(m->cwd, path);
+
+	global.free(m->cwd);
+	m->cwd = abs;
+	return 0;
+}
+
+export fs.t * new() {
+	memfs_t * m = calloc(1, sizeof(memfs_t));
+	m->files = hash_new();
+	m->cwd   = strdup("/");
+
+	m->fs.ctx      = m;
+	m->fs.resolve  = memfs_resolve;
+	m->fs.modified = memfs_modified;
+	m->fs.reader   = memfs_reader;
+	m->fs.writer   = memfs_writer;
+	m->fs.discard  = memfs_discard;
+	m->fs.remove   = memfs_remove;
+	m->fs.get_cwd  = memfs_get_cwd;
+	m->fs.set_cwd  = memfs_set_cwd;
+
+	return &m->fs;
+}
+
+/* creates or replaces `path` with a copy of `data` */
+export void write(fs.t * f, const char * path, const char * data) {
+	store((memfs_t *) f->ctx, path, strdup(data), strlen(data));
+}
+
+/* the contents of `path`, or NULL if there is no such file */
+export const char * read(fs.t * f, const char * path) {
+	file_t * file = lookup((memfs_t *) f->ctx, path);
+	return file ? file->data : NULL;
+}
+
+export void free(fs.t * f) {
+	memfs_t * m = (memfs_t *) f->ctx;
+
+	hash_each_val(m->files, {
+		file_t * file = (file_t *) val;
+		global.free(file->path);
+		global.free(file->data);
+		global.free(file);
+	});
+	hash_free(m->files);
+
+	global.free(m->cwd);
+	global.free(m);
+}
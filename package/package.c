@@ -5,8 +5,11 @@
 #include <stdbool.h>
 
 #include <stdio.h>
+#include <string.h>
 
 #include "../deps/stream/stream.h"
+#include "../utils/stats.h"
+#include "context.h"
 
 enum package_var_type {
 	build_var_set = 0,
@@ -18,6 +21,7 @@ typedef struct {
 	char * name;
 	char * value;
 	enum package_var_type operation;
+	bool   local;     // only for the package's own object, as a target-specific variable
 } package_var_t;
 
 typedef struct {
@@ -29,41 +33,36 @@ typedef struct {
 	package_var_t    * variables;
 	size_t     n_variables;
 	char     * name;
-	char     * source_abs;
+	const char * source_abs; // interned in ctx->paths
 	char     * generated;
 	char     * header;
 	size_t     errors;
 	bool       exported;
 	bool       c_file;
-	bool       force;
-	bool       silent;
 	stream_t * out;
+	stats_t  * stats;
+	void     * parser;   // its parser.t while it is being parsed, which imports of it wait for
+	void     * linkage;  // parser/linkage's record of its declarations while it is being parsed
+	cbuild_ctx_t * ctx;  // the generation this package belongs to
 } package_t;
 
-
-
-hash_t * package_path_cache = NULL;
-hash_t * package_id_cache = NULL;
-
-/* TODO: fix the circrular dependency issue */
-
-package_t * (*package_new)(const char * relative_path, char ** error) = NULL;
-
 void package_emit(package_t * pkg, char * value) {
 	if (pkg->out) stream_write(pkg->out, value, strlen(value));
 }
 
-package_t * package_c_file(char * abs_path, char ** error) {
-	package_t * cached = hash_get(package_path_cache, abs_path);
+/* `abs_path` has to come from the context's path table, it isn't copied */
+package_t * package_c_file(cbuild_ctx_t * ctx, const char * abs_path, char ** error) {
+	package_t * cached = hash_get(ctx->path_cache, (char *) abs_path);
 	if (cached != NULL) return cached;
 
 	package_t * pkg = calloc(1, sizeof(package_t));
 
-	pkg->name       = abs_path;
+	pkg->name       = (char *) abs_path;
 	pkg->source_abs = abs_path;
-	pkg->generated  = abs_path;
+	pkg->generated  = (char *) abs_path;
 	pkg->c_file     = true;
+	pkg->ctx        = ctx;
 
-	hash_set(package_path_cache, abs_path, pkg);
+	hash_set(ctx->path_cache, (char *) abs_path, pkg);
 	return pkg;
 }
\ No newline at end of file
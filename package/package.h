@@ -15,9 +15,12 @@ typedef struct {
 	char * name;
 	char * value;
 	enum package_var_type operation;
+	bool   local;     // only for the package's own object, as a target-specific variable
 } package_var_t;
 
 #include "../deps/stream/stream.h"
+#include "../utils/stats.h"
+#include "context.h"
 
 typedef struct {
 	hash_t   * deps;
@@ -28,21 +31,20 @@ typedef struct {
 	package_var_t    * variables;
 	size_t     n_variables;
 	char     * name;
-	char     * source_abs;
+	const char * source_abs; // interned in ctx->paths
 	char     * generated;
 	char     * header;
 	size_t     errors;
 	bool       exported;
 	bool       c_file;
-	bool       force;
-	bool       silent;
 	stream_t * out;
+	stats_t  * stats;
+	void     * parser;   // its parser.t while it is being parsed, which imports of it wait for
+	void     * linkage;  // parser/linkage's record of its declarations while it is being parsed
+	cbuild_ctx_t * ctx;  // the generation this package belongs to
 } package_t;
 
-extern hash_t * package_path_cache;
-extern hash_t * package_id_cache;
-extern package_t * (*package_new)(const char * relative_path, char ** error, bool force, bool silent);
 void package_emit(package_t * pkg, char * value);
-package_t * package_c_file(char * abs_path, char ** error);
+package_t * package_c_file(cbuild_ctx_t * ctx, const char * abs_path, char ** error);
 
 #endif
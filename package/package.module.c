@@ -5,8 +5,11 @@ export {
 #include <stdbool.h>
 }
 #include <stdio.h>
+#include <string.h>
 
-import stream from "../deps/stream/stream.module.c";
+import stream     from "../deps/stream/stream.module.c";
+import stats      from "../utils/stats.module.c";
+import cbuild_ctx from "./context.module.c";
 
 export enum var_type {
 	build_var_set = 0,
@@ -18,6 +21,7 @@ export typedef struct {
 	char * name;
 	char * value;
 	enum var_type operation;
+	bool   local;     // only for the package's own object, as a target-specific variable
 } var_t;
 
 export typedef struct {
@@ -29,41 +33,36 @@ export typedef struct {
 	var_t    * variables;
 	size_t     n_variables;
 	char     * name;
-	char     * source_abs;
+	const char * source_abs; // interned in ctx->paths
 	char     * generated;
 	char     * header;
 	size_t     errors;
 	bool       exported;
 	bool       c_file;
-	bool       force;
-	bool       silent;
 	stream.t * out;
+	stats.t  * stats;
+	void     * parser;   // its parser.t while it is being parsed, which imports of it wait for
+	void     * linkage;  // parser/linkage's record of its declarations while it is being parsed
+	cbuild_ctx.t * ctx;  // the generation this package belongs to
 } package_t as t;
 
-export extern hash_t * path_cache;
-export extern hash_t * id_cache;
-hash_t * path_cache = NULL;
-hash_t * id_cache = NULL;
-
-/* TODO: fix the circrular dependency issue */
-export extern package_t * (*new)(const char * relative_path, char ** error, bool force, bool silent);
-package_t * (*package_new)(const char * relative_path, char ** error) = NULL;
-
 export void emit(package_t * pkg, char * value) {
 	if (pkg->out) stream.write(pkg->out, value, strlen(value));
 }
 
-export package_t * c_file(char * abs_path, char ** error) {
-	package_t * cached = hash_get(path_cache, abs_path);
+/* `abs_path` has to come from the context's path table, it isn't copied */
+export package_t * c_file(cbuild_ctx.t * ctx, const char * abs_path, char ** error) {
+	package_t * cached = hash_get(ctx->path_cache, (char *) abs_path);
 	if (cached != NULL) return cached;
 
 	package_t * pkg = calloc(1, sizeof(package_t));
 
-	pkg->name       = abs_path;
+	pkg->name       = (char *) abs_path;
 	pkg->source_abs = abs_path;
-	pkg->generated  = abs_path;
+	pkg->generated  = (char *) abs_path;
 	pkg->c_file     = true;
+	pkg->ctx        = ctx;
 
-	hash_set(path_cache, abs_path, pkg);
+	hash_set(ctx->path_cache, (char *) abs_path, pkg);
 	return pkg;
 }
@@ -0,0 +1,32 @@
+#ifndef _package_paths_
+#define _package_paths_
+
+#include "../deps/hash/hash.h"
+#include <stdbool.h>
+#include <time.h>
+
+#include "fs.h"
+
+typedef struct {
+	fs_t    ** fs;       // a pointer to the owner's backend, so it may be swapped after new()
+	hash_t   * strings;  // every string handed out, keyed by itself
+	hash_t   * resolved; // path as written, joined onto the working directory -> canonical path
+	hash_t   * dirs;     // directory as written -> canonical directory
+	hash_t   * files;    // path -> stat_t
+	hash_t   * between;  // "<from directory>\n<to>" -> relative path
+} paths_t;
+
+paths_t * paths_new(fs_t ** f);
+const char * paths_intern(paths_t * t, const char * s);
+const char * paths_realpath(paths_t * t, const char * path);
+bool paths_newer(paths_t * t, const char * a, const char * b);
+int paths_modified(paths_t * t, const char * path, struct timespec * mtime);
+void paths_forget(paths_t * t, const char * path);
+
+#include "../deps/stream/stream.h"
+
+stream_t * paths_open_write(paths_t * t, const char * path);
+const char * paths_relative(paths_t * t, const char * from, const char * to);
+void paths_free(paths_t * t);
+
+#endif
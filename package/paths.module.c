@@ -0,0 +1,216 @@
+package "paths";
+
+build depends "../deps/hash/hash.c";
+export {
+#include "../deps/hash/hash.h"
+#include <stdbool.h>
+#include <time.h>
+}
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+
+import stream from "../deps/stream/stream.module.c";
+import fs     from "./fs.module.c";
+import utils  from "../utils/utils.module.c";
+import stats  from "../utils/stats.module.c";
+
+/*
+ * The paths one build keeps asking about. Each spelling of a directory is canonicalized
+ * once, each file is stat'ed once and each relative path from a directory to a file is worked
+ * out once. The strings handed out are interned: they stay valid until the table is
+ * freed and callers must not free them.
+ *
+ * Nothing here notices changes made behind the table's back, files written during the
+ * build have to be opened through open_write() so their old mtime is forgotten.
+ */
+
+typedef struct {
+	int             error; // errno from the backend, 0 if the file exists
+	bool            link;
+	struct timespec mtime;
+} stat_t;
+
+export typedef struct {
+	fs.t    ** fs;       // a pointer to the owner's backend, so it may be swapped after new()
+	hash_t   * strings;  // every string handed out, keyed by itself
+	hash_t   * resolved; // path as written, joined onto the working directory -> canonical path
+	hash_t   * dirs;     // directory as written -> canonical directory
+	hash_t   * files;    // path -> stat_t
+	hash_t   * between;  // "<from directory>\n<to>" -> relative path
+} paths_t as t;
+
+export paths_t * new(fs.t ** f) {
+	paths_t * t = malloc(sizeof(paths_t));
+
+	t->fs       = f;
+	t->strings  = hash_new();
+	t->resolved = hash_new();
+	t->dirs     = hash_new();
+	t->files    = hash_new();
+	t->between  = hash_new();
+
+	return t;
+}
+
+/* the table's copy of `s` */
+export const char * intern(paths_t * t, const char * s) {
+	char * interned = hash_get(t->strings, (char *) s);
+	if (interned != NULL) return interned;
+
+	interned = strdup(s);
+	hash_set(t->strings, interned, interned);
+	return interned;
+}
+
+static stat_t * lookup(paths_t * t, const char * path) {
+	stat_t * s = hash_get(t->files, (char *) path);
+	STATS_LOOKUP(paths, s != NULL);
+	if (s != NULL) return s;
+
+	s = calloc(1, sizeof(stat_t));
+	int e = fs.mtime(*t->fs, path, &s->mtime);
+	if (e < 0) s->error = errno ? errno : ENOENT;
+	s->link = e == 1;
+
+	hash_set(t->files, (char *) intern(t, path), s);
+	return s;
+}
+
+/* caches `value` as what `key` resolves to in `table` */
+static const char * remember(paths_t * t, hash_t * table, const char * key, const char * value) {
+	value = intern(t, value);
+	hash_set(table, (char *) intern(t, key), (void *) value);
+	return value;
+}
+
+static const char * resolve_dir(paths_t * t, const char * dir) {
+	const char * canonical = hash_get(t->dirs, (char *) dir);
+	STATS_LOOKUP(paths, canonical != NULL);
+	if (canonical != NULL) return canonical;
+
+	char * resolved = fs.realpath(*t->fs, dir);
+	if (resolved == NULL) return NULL;
+
+	canonical = remember(t, t->dirs, dir, resolved);
+	global.free(resolved);
+	return canonical;
+}
+
+/*
+ * Like realpath(3), but resolving relative paths against the backend's working directory.
+ * Only the directory goes through the backend's realpath, once per spelling; the file
+ * itself is lstat'ed (which newer() needs anyway) and only followed if it is a link.
+ */
+export const char * realpath(paths_t * t, const char * path) {
+	char   buf[PATH_MAX];
+	char * key = (char *) path;
+
+	if (path[0] != '/') {
+		snprintf(buf, sizeof(buf), "%s/%s", fs.getcwd(*t->fs), path);
+		key = buf;
+	}
+
+	const char * canonical = hash_get(t->resolved, key);
+	STATS_LOOKUP(paths, canonical != NULL);
+	if (canonical != NULL) return canonical;
+
+	char * slash = strrchr(key, '/');
+	char   dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%.*s", slash == key ? 1 : (int)(slash - key), key);
+
+	const char * parent = resolve_dir(t, dir);
+	if (parent == NULL) return NULL;
+
+	char joined[PATH_MAX];
+	snprintf(joined, sizeof(joined), "%s%s%s", parent, strcmp(parent, "/") == 0 ? "" : "/", slash + 1);
+
+	stat_t * s = lookup(t, joined);
+	if (s->error) {
+		errno = s->error;
+		return NULL;
+	}
+	if (!s->link) return remember(t, t->resolved, key, joined);
+
+	char * resolved = fs.realpath(*t->fs, joined);
+	if (resolved == NULL) return NULL;
+
+	canonical = remember(t, t->resolved, key, resolved);
+	global.free(resolved);
+	return canonical;
+}
+
+/* true when `a` exists and was modified after `b`, or `b` doesn't exist */
+export bool newer(paths_t * t, const char * a, const char * b) {
+	stat_t * sa = lookup(t, a);
+	stat_t * sb = lookup(t, b);
+
+	if (sa->error) return false;
+	if (sb->error) return true;
+
+	if (sa->mtime.tv_sec == sb->mtime.tv_sec) return sa->mtime.tv_nsec > sb->mtime.tv_nsec;
+	return sa->mtime.tv_sec > sb->mtime.tv_sec;
+}
+
+/* `path`'s mtime as of when it was first looked at, or -1 if it doesn't exist */
+export int modified(paths_t * t, const char * path, struct timespec * mtime) {
+	stat_t * s = lookup(t, path);
+	if (s->error) return -1;
+
+	*mtime = s->mtime;
+	return 0;
+}
+
+/* drops what is known about `path`, after something other than open_write() changed it */
+export void forget(paths_t * t, const char * path) {
+	stat_t * s = hash_get(t->files, (char *) path);
+	if (s == NULL) return;
+
+	hash_del(t->files, (char *) path);
+	global.free(s);
+}
+
+export stream.t * open_write(paths_t * t, const char * path) {
+	forget(t, path);
+	return fs.open_write(*t->fs, path);
+}
+
+/* `to` relative to the directory holding `from` */
+export const char * relative(paths_t * t, const char * from, const char * to) {
+	char buf[2 * PATH_MAX + 2];
+	const char * slash = strrchr(from, '/');
+	int dir = slash ? (int)(slash - from + 1) : 0;
+
+	snprintf(buf, sizeof(buf), "%.*s\n%s", dir, from, to);
+
+	const char * rel = hash_get(t->between, buf);
+	STATS_LOOKUP(paths, rel != NULL);
+	if (rel != NULL) return rel;
+
+	char * computed = utils.relative(from, to);
+	rel = intern(t, computed);
+	global.free(computed);
+
+	hash_set(t->between, (char *) intern(t, buf), (void *) rel);
+	return rel;
+}
+
+export void free(paths_t * t) {
+	if (t == NULL) return;
+
+	hash_each_val(t->files, {
+		global.free(val);
+	});
+	hash_each_val(t->strings, {
+		global.free(val);
+	});
+
+	hash_free(t->strings);
+	hash_free(t->resolved);
+	hash_free(t->dirs);
+	hash_free(t->files);
+	hash_free(t->between);
+	global.free(t);
+}
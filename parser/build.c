@@ -2,6 +2,7 @@
 #include "string.h"
 #include "../lexer/item.h"
 #include "../package/package.h"
+#include "../package/context.h"
 #include "../package/import.h"
 #include "../utils/strings.h"
 
@@ -11,19 +12,20 @@
 #include <stdarg.h>
 #include <stdio.h>
 
-static hash_t * options = NULL;
-
 typedef int (*parse_fn)(parser_t * p);
 static int parse_depends (parser_t * p);
 static int parse_set     (parser_t * p);
 static int parse_append  (parser_t * p);
+static int parse_local   (parser_t * p);
 
-static void init_options(){
-	options = hash_new();
+static hash_t * init_options(cbuild_ctx_t * ctx){
+	hash_t * options = ctx->build_options = hash_new();
 
 	hash_set(options, "depends", parse_depends);
 	hash_set(options, "set",     parse_set    );
 	hash_set(options, "append",  parse_append );
+	hash_set(options, "local",   parse_local  );
+	return options;
 }
 
 static int errorf(parser_t * p, lex_item_t item, const char * fmt, ...) {
@@ -42,9 +44,11 @@ static int errorf(parser_t * p, lex_item_t item, const char * fmt, ...) {
  * - build set          <variable> "<value>";  # set the value of a makefile valiable         (:=)
  * - build set default  <variable> "<value>";  # set the default value of a makefile variable (?=)
  * - build append       <variable> "<value>";  # append to a makefile variable                (+=)
+ * - build local ...                            # any of the three above, for the package's object only
  **********************************************************************************************************************/
 int build_parse (parser_t * p) {
-	if (options == NULL) init_options();
+	hash_t * options = p->pkg->ctx->build_options;
+	if (options == NULL) options = init_options(p->pkg->ctx);
 
 	lex_item_t item = parser_skip(p, item_whitespace, 0);
 	parse_fn fn = (parse_fn) hash_get(options, item.value);
@@ -83,7 +87,7 @@ static int parse_depends(parser_t * p) {
 	return 1;
 }
 
-static int parse_set(parser_t * p) {
+static int set(parser_t * p, bool local) {
 	bool is_default = false;
 	bool have_name = false;
 	lex_item_t name;
@@ -118,10 +122,12 @@ static int parse_set(parser_t * p) {
 	v.name      = strings_dup(name.value);
 	v.value     = strings_dup(string_parse(value.value));
 	v.operation = is_default ? build_var_set_default : build_var_set;
+	v.local     = local;
 
 	p->pkg->variables = realloc(p->pkg->variables, sizeof(package_var_t) * (p->pkg->n_variables + 1));
 	p->pkg->variables[p->pkg->n_variables] = v;
 	p->pkg->n_variables++;
+	p->pkg->ctx->n_variables++;
 
 	lex_item_free(name);
 	lex_item_free(value);
@@ -129,7 +135,7 @@ static int parse_set(parser_t * p) {
 	return 1;
 }
 
-static int parse_append(parser_t * p) {
+static int append(parser_t * p, bool local) {
 	lex_item_t name = parser_skip(p, item_whitespace, 0);
 
 	if (name.type != item_id) {
@@ -153,11 +159,36 @@ static int parse_append(parser_t * p) {
 	v.name      = strings_dup(name.value);
 	v.value     = strings_dup(string_parse(value.value));
 	v.operation = build_var_append;
+	v.local     = local;
 
 	p->pkg->variables = realloc(p->pkg->variables, sizeof(package_var_t) * (p->pkg->n_variables + 1));
 	p->pkg->variables[p->pkg->n_variables] = v;
 	p->pkg->n_variables++;
+	p->pkg->ctx->n_variables++;
 	lex_item_free(name);
 	lex_item_free(value);
 	return 1;
+}
+
+static int parse_set(parser_t * p) {
+	return set(p, false);
+}
+
+static int parse_append(parser_t * p) {
+	return append(p, false);
+}
+
+/* a target-specific variable, set on the package's object rather than the whole makefile */
+static int parse_local(parser_t * p) {
+	lex_item_t item = parser_skip(p, item_whitespace, 0);
+	bool is_set    = item.type == item_id && strcmp(item.value, "set")    == 0;
+	bool is_append = item.type == item_id && strcmp(item.value, "append") == 0;
+
+	if (!is_set && !is_append) {
+		return errorf(p, item, "Expecting 'set', 'set default' or 'append' after 'local', but got %s",
+				lex_item_to_string(item));
+	}
+	lex_item_free(item);
+
+	return is_set ? set(p, true) : append(p, true);
 }
\ No newline at end of file
@@ -6,13 +6,15 @@ build depends "../deps/hash/hash.c";
 
 import parser     from "./parser.module.c";
 import string     from "string.module.c";
-import utils      from "../utils/utils.module.c";
 import str        from "../utils/strings.module.c";
 import identifier from "./identifier.module.c";
 import lex_item   from "../lexer/item.module.c";
 import Package    from "../package/package.module.c";
+import cbuild_ctx from "../package/context.module.c";
+import paths      from "../package/paths.module.c";
 import pkg_export from "../package/export.module.c";
 import pkg_import from "../package/import.module.c";
+import Linkage    from "./linkage.module.c";
 
 const lex_item.t enum_i   = { .value = "enum",   .length = 4, .type = item_id };
 const lex_item.t union_i  = { .value = "union",  .length = 5, .type = item_id };
@@ -121,6 +123,107 @@ static char * emit(parser.t * p, decl_t * decl, bool is_function, bool is_extern
 	return output;
 }
 
+/* the declaration with its leading and trailing whitespace left out */
+static char * trimmed(decl_t * decl) {
+	int start = 0;
+	int end = decl->length;
+	int i;
+	while (start < end && decl->items[start  ].type == item_whitespace) start++;
+	while (end > start && decl->items[end - 1].type == item_whitespace) end--;
+
+	size_t length = 0;
+	for (i = start; i < end; i++) length += decl->items[i].length;
+
+	char * output = malloc(length + 1);
+	length = 0;
+	for (i = start; i < end; i++) {
+		memcpy(output + length, decl->items[i].value, decl->items[i].length);
+		length += decl->items[i].length;
+	}
+	output[length] = 0;
+	return output;
+}
+
+/*
+ * A definition importers compile from the header, which is written here as well for the
+ * module's own uses. Both are guarded, for a module whose imports include its header back.
+ */
+static char * emit_guarded(parser.t * p, const char * guard, const char * symbol, char * definition) {
+	char * output = NULL;
+	asprintf(&output, "#ifndef _%s_%s_\n#define _%s_%s_\n%s\n#endif", guard, symbol, guard, symbol, definition);
+	global.free(definition);
+
+	Package.emit(p->pkg, output);
+	return output;
+}
+
+/* a function exported inline, defined in the header */
+static char * emit_inline(parser.t * p, decl_t * decl, const char * symbol) {
+	char * function   = trimmed(decl);
+	char * definition = NULL;
+	asprintf(&definition, "static inline %s", function);
+	global.free(function);
+
+	return emit_guarded(p, "inline", symbol, definition);
+}
+
+/* whether the constant `symbol` is an int, declared as nothing more than `int name = value` */
+static bool int_constant(decl_t * decl, const char * symbol) {
+	static const char * words[] = { "const", "signed", "short", "int", NULL };
+	int i, j;
+	bool typed = false;
+	for (i = 0; i < decl->length; i++) {
+		lex_item.t item = decl->items[i];
+		if (item.type == item_whitespace || item.type == item_comment) continue;
+		if (item.type != item_id) return false;
+		if (strcmp(item.value, symbol) == 0) break;
+
+		for (j = 0; words[j] && strcmp(item.value, words[j]) != 0; j++);
+		if (words[j] == NULL) return false;
+		typed = true;
+	}
+
+	for (i++; i < decl->length && decl->items[i].type == item_whitespace; i++);
+	return typed && i < decl->length && decl->items[i].type == item_symbol && decl->items[i].value[0] == '=';
+}
+
+/*
+ * A constant exported with its value, which importers can fold: an enum constant for an
+ * int, so that it can size an array or label a case, and a static const for the rest.
+ */
+static char * emit_constant(parser.t * p, decl_t * decl, const char * symbol) {
+	char * constant   = trimmed(decl);
+	char * definition = NULL;
+
+	if (int_constant(decl, symbol)) {
+		char * value = strstr(constant, symbol);
+		size_t length = strlen(value);
+		while (length > 0 && (value[length - 1] == ';' || value[length - 1] == ' ')) length--;
+		asprintf(&definition, "enum { %.*s };", (int) length, value);
+	} else {
+		asprintf(&definition, "static const %s", constant);
+	}
+
+	global.free(constant);
+	return emit_guarded(p, "const", symbol, definition);
+}
+
+/* whether the declaration has `c` in it, outside of what it nests */
+static bool has_symbol(decl_t * decl, char c) {
+	int i;
+	for (i = 0; i < decl->length; i++) {
+		if (decl->items[i].type == item_symbol && decl->items[i].value[0] == c) return true;
+	}
+	return false;
+}
+
+/* whether the declaration ends in a function's parameters */
+static bool function_declarator(decl_t * decl) {
+	int last = decl->length - 1;
+	while (last >= 0 && decl->items[last].type == item_whitespace) last--;
+	return last >= 0 && decl->items[last].type == item_close_symbol && decl->items[last].value[0] == ')';
+}
+
 static lex_item.t collect_newlines(parser.t * p, decl_t * decl) {
 	size_t line     = p->lexer->line;
 	lex_item.t item = parser.next(p);
@@ -161,17 +264,22 @@ static lex_item.t parse_as            (parser.t * p, decl_t * decl);
 static lex_item.t parse_variable      (parser.t * p, decl_t * decl);
 static lex_item.t parse_function      (parser.t * p, decl_t * decl);
 static lex_item.t parse_function_args (parser.t * p, decl_t * decl);
+static void       parse_inline_body   (parser.t * p, decl_t * decl);
+static void       parse_initializer   (parser.t * p, decl_t * decl);
 
 static int parse_passthrough (parser.t * p);
 
-static hash_t * export_types = NULL;
-static void init_export_types(){
-	export_types = hash_new();
+static hash_t * export_types(parser.t * p){
+	cbuild_ctx.t * ctx = p->pkg->ctx;
+	if (ctx->export_types != NULL) return ctx->export_types;
 
-	hash_set(export_types, "typedef", parse_typedef);
-	hash_set(export_types, "struct",  parse_struct );
-	hash_set(export_types, "enum",    parse_enum   );
-	hash_set(export_types, "union",   parse_union  );
+	hash_t * types = ctx->export_types = hash_new();
+
+	hash_set(types, "typedef", parse_typedef);
+	hash_set(types, "struct",  parse_struct );
+	hash_set(types, "enum",    parse_enum   );
+	hash_set(types, "union",   parse_union  );
+	return types;
 }
 
 typedef lex_item.t (*export_fn)(parser.t * p, decl_t * decl);
@@ -189,14 +297,14 @@ void parse_semicolon(parser.t * p, decl_t * decl) {
 }
 
 export int parse(parser.t * p) {
-	if (export_types == NULL) init_export_types();
-
 	decl_t decl  = {0};
 	export_fn fn = NULL;
 	lex_item.t name  = {0};
 	lex_item.t alias = {0};
 	bool has_semicolon = false;
 	bool is_extern     = false;
+	bool is_inline     = false;
+	bool is_constexpr  = false;
 	int t = 0;
 
 	lex_item.t type = collect_newlines(p, &decl);
@@ -207,9 +315,19 @@ export int parse(parser.t * p) {
 				append(&decl, type);
 				is_extern = true;
 				type = collect(p, &decl);
+			} else if (strcmp("inline", type.value) == 0) {
+				// `static inline` takes its place, in the header and here
+				lex_item.free(type);
+				is_inline = true;
+				type = collect(p, &decl);
+			} else if (strcmp("constexpr", type.value) == 0) {
+				// an enum or `static const` takes its place, with the value
+				lex_item.free(type);
+				is_constexpr = true;
+				type = collect(p, &decl);
 			}
-			fn = (export_fn) hash_get(export_types, type.value);
-			has_semicolon = is_extern || fn != NULL;
+			fn = (export_fn) hash_get(export_types(p), type.value);
+			has_semicolon = is_extern || fn != NULL || is_constexpr;
 			t = 1;
 			break;
 		case item_symbol:
@@ -243,7 +361,24 @@ export int parse(parser.t * p) {
 	}
 
 	alias = parse_as(p, &decl);
+	if (is_constexpr && t == 2 && !decl.error && !has_symbol(&decl, '=')) {
+		// the value comes after the alias
+		lex_item.t item = collect(p, &decl);
+		if (item.type == item_symbol && item.value[0] == '=') {
+			append(&decl, item);
+			parse_initializer(p, &decl);
+		} else {
+			parser.backup(p, item);
+		}
+	}
+	if (is_constexpr && !decl.error && (t != 2 || !has_symbol(&decl, '='))) {
+		errorf(p, type, &decl, "only variables with a value can be exported constexpr");
+	}
 	if (has_semicolon) parse_semicolon(p, &decl);
+	if (is_inline && (t != 2 || !function_declarator(&decl))) {
+		errorf(p, type, &decl, "only functions can be exported inline");
+	}
+	if (is_inline) parse_inline_body(p, &decl);
 	if (decl.error) {
 		free_decl(&decl);
 		return -1;
@@ -268,10 +403,12 @@ export int parse(parser.t * p) {
 		str.dup(original_name.value),
 		str.dup(alias.value),
 		str.dup(symbol.value),
-		type.value, 
-		emit(p, &decl, t==2, is_extern),
+		is_inline ? "inline" : is_constexpr ? "constant" : type.value,
+		is_inline    ? emit_inline  (p, &decl, symbol.value) :
+		is_constexpr ? emit_constant(p, &decl, symbol.value) : emit(p, &decl, t==2, is_extern),
 		p->pkg
 	);
+	if (fn == parse_export_block) Linkage.exported(p, decl.items, decl.length);
 	lex_item.free(original_name);
 	lex_item.free(alias);
 	free_decl(&decl);
@@ -311,12 +448,11 @@ static int parse_passthrough(parser.t * p) {
 	lex_item.free(filename);
 
 	char * header = NULL;
-	char * rel =  utils.relative(p->pkg->source_abs, imp->pkg->header);
+	const char * rel = paths.relative(p->pkg->ctx->paths, p->pkg->source_abs, imp->pkg->header);
 	asprintf(&header, "#include \"%s\"", rel);
 	Package.emit(p->pkg, header);
 
 	free_decl(&decl);
-	global.free(rel);
 	global.free(header);
 	return 1;
 }
@@ -394,7 +530,7 @@ static lex_item.t parse_declaration(parser.t * p, decl_t * decl) {
 	if (strcmp("as", type.value) == 0) return type;
 	type = identifier.parse(p, type, true);
 
-	export_fn fn = (export_fn) hash_get(export_types, type.value);
+	export_fn fn = (export_fn) hash_get(export_types(p), type.value);
 
 	if (fn == parse_typedef) {
 		return errorf(p, type, decl, "in declaration: unexpected identifier 'typedef'");
@@ -428,9 +564,10 @@ static lex_item.t parse_typedef (parser.t * p, decl_t * decl) {
 		return errorf(p, type, decl, "in typedef: expected identifier");
 	}
 
-	export_fn fn = (export_fn) hash_get(export_types, type.value);
+	export_fn fn = (export_fn) hash_get(export_types(p), type.value);
 
 	/*if (fn != parse_struct && fn != parse_enum && fn != parse_union) append(decl, type);*/
+	if (fn == NULL) type = identifier.parse(p, type, true);
 	append(decl, type);
 
 	if (fn != NULL) {
@@ -687,13 +824,8 @@ static lex_item.t parse_variable (parser.t * p, decl_t * decl) {
 	lex_item.t item;
 	lex_item.t name = {0};
 	bool escaped_id = 0;
-	bool escape_till_semicolon = false;
 	do {
 		item = collect(p, decl);
-		if (escape_till_semicolon && (item.type != item_symbol || item.value[0] != ';')) {
-			append(decl, item);
-			continue;
-		}
 		switch(item.type) {
 			case item_arrow:
 				escaped_id = true;
@@ -710,8 +842,9 @@ static lex_item.t parse_variable (parser.t * p, decl_t * decl) {
 			case item_symbol:
 				if (item.value[0] == '*') break;
 				if (item.value[0] == '=') {
-					escape_till_semicolon = true;
-					break;
+					append(decl, item);
+					parse_initializer(p, decl);
+					return name;
 				}
 				if (item.value[0] == ';') {
 					parser.backup(p, item);
@@ -732,7 +865,8 @@ static lex_item.t parse_variable (parser.t * p, decl_t * decl) {
 				if (item.value[0] == '[') {
 					append(decl, item);
 					item = parser.next(p);
-					if (item.type == item_number) {
+					if (item.type == item_id) item = identifier.parse(p, item, true);
+					if (item.type == item_number || item.type == item_id) {
 						append(decl, item);
 						item = parser.next(p);
 					}
@@ -752,6 +886,48 @@ static lex_item.t parse_variable (parser.t * p, decl_t * decl) {
 	return name;
 }
 
+/* a variable's value, up to the ';' after it, with what it uses from imports resolved */
+static void parse_initializer(parser.t * p, decl_t * decl) {
+	int escaped_id = 0;
+	lex_item.t item;
+	while (true) {
+		item = collect(p, decl);
+		switch(item.type) {
+			case item_symbol:
+				if (item.value[0] == ';') {
+					parser.backup(p, item);
+					return;
+				}
+				// a member, or a designated initializer's field
+				if (item.value[0] == '.') {
+					escaped_id = 1;
+					append(decl, item);
+					continue;
+				}
+				break;
+			case item_arrow:
+				escaped_id = 1;
+				append(decl, item);
+				continue;
+			case item_id:
+				if (escaped_id == 0) item = identifier.parse(p, item, true);
+				break;
+			case item_eof:
+				errorf(p, item, decl, "expecting ';' but got %s", lex_item.to_string(item));
+				return;
+			case item_error:
+				parser.backup(p, item);
+				decl->error = true;
+				return;
+			default:
+				break;
+		}
+
+		escaped_id = 0;
+		append(decl, item);
+	}
+}
+
 static lex_item.t parse_function_args(parser.t * p, decl_t * decl) {
 	int level = 1;
 	int escaped_id = 0;
@@ -784,6 +960,114 @@ static lex_item.t parse_function_args(parser.t * p, decl_t * decl) {
 	return item;
 }
 
+/* whether an identifier after `item` can be followed by a name it declares, as a type can */
+static bool types(lex_item.t item, bool typed) {
+	static const char * statements[] = {
+		"return", "sizeof", "case", "goto", "else", "do", "_Alignof", "alignof", NULL,
+	};
+	int i;
+	switch (item.type) {
+		case item_whitespace:
+		case item_comment:
+			return typed;
+		case item_symbol:
+			// a pointer's
+			return typed && item.value[0] == '*';
+		case item_id:
+			for (i = 0; statements[i] && strcmp(item.value, statements[i]) != 0; i++);
+			return statements[i] == NULL;
+		default:
+			return false;
+	}
+}
+
+static void free_names(hash_t * names) {
+	hash_each_key(names, global.free((char *) key));
+	hash_free(names);
+}
+
+/*
+ * The body of a function exported inline, which goes to the header with it. Importers
+ * only see what the module exports, so the body can't use the module's other names,
+ * unless a parameter or a local of the same name hides them.
+ */
+static void parse_inline_body(parser.t * p, decl_t * decl) {
+	if (decl->error) return;
+
+	hash_t * locals = hash_new();
+	bool typed = false;
+	int i;
+	for (i = 0; i < decl->length; i++) {
+		lex_item.t item = decl->items[i];
+		if (item.type == item_id && typed && !hash_has(locals, item.value)) hash_set(locals, strdup(item.value), NULL);
+		typed = types(item, typed);
+	}
+
+	lex_item.t item = collect(p, decl);
+	if (item.type != item_open_symbol || item.value[0] != '{') {
+		errorf(p, item, decl, "expecting the body of an inline function but got %s", lex_item.to_string(item));
+		free_names(locals);
+		return;
+	}
+	append(decl, item);
+
+	int level = 1;
+	int escaped_id = 0;
+	typed = false;
+	do {
+		item = collect(p, decl);
+		switch(item.type) {
+			case item_arrow:
+				escaped_id = 1;
+				typed = false;
+				append(decl, item);
+				continue;
+			case item_symbol:
+				// a member, not one of the module's symbols
+				if (item.value[0] == '.') {
+					escaped_id = 1;
+					typed = false;
+					append(decl, item);
+					continue;
+				}
+				break;
+			case item_id:
+				if (escaped_id || hash_has(locals, item.value)) break;
+				if (typed) {
+					hash_set(locals, strdup(item.value), NULL);
+				} else if (Linkage.private(p, item.value)) {
+					errorf(p, item, decl, "'%s' is not exported, so the header can't use it in an inline function",
+							item.value);
+				}
+				// what it uses from imports is included in the header
+				item = identifier.parse(p, item, true);
+				break;
+			case item_open_symbol:
+				if (item.value[0] == '{') level++;
+				break;
+			case item_close_symbol:
+				if (item.value[0] == '}') level--;
+				break;
+			case item_eof:
+				errorf(p, item, decl, "in inline function: unmatched '{'");
+				free_names(locals);
+				return;
+			case item_error:
+				parser.backup(p, item);
+				decl->error = true;
+				free_names(locals);
+				return;
+			default:
+				break;
+		}
+
+		typed = types(item, typed);
+		escaped_id = 0;
+		append(decl, item);
+	} while (level > 0);
+	free_names(locals);
+}
+
 static lex_item.t parse_function (parser.t * p, decl_t * decl) {
 	lex_item.t name = parse_type(p, decl);
 
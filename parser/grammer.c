@@ -2,6 +2,7 @@
 #include "../deps/hash/hash.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 
 #include "../deps/stream/stream.h"
@@ -9,19 +10,32 @@
 #include "../lexer/item.h"
 #include "../lexer/lex.h"
 #include "../lexer/syntax.h"
+#include "../lexer/parallel.h"
 #include "../package/package.h"
+#include "../package/context.h"
 #include "parser.h"
+#include "../utils/jobserver.h"
 
 #include "package.h"
 #include "import.h"
 #include "export.h"
 #include "build.h"
 #include "identifier.h"
+#include "linkage.h"
 
 typedef int (*keyword_fn)(parser_t * p);
 
+/* the smallest piece of a module worth lexing on a thread of its own */
+#define SPLIT_MIN (1 << 20)
+
 static void * parse_id      (parser_t * p, lex_item_t item);
 static void * parse_keyword (parser_t * p, lex_item_t item);
+static void * imported      (parser_t * p);
+
+static void emit(parser_t * p, lex_item_t item) {
+	parser_linkage_see(p, item);
+	package_emit(p->pkg, item.value);
+}
 
 static void * parse_c(parser_t * p) {
 	lex_item_t item = {0};
@@ -35,7 +49,7 @@ static void * parse_c(parser_t * p) {
 		switch(item.type) {
 			case item_arrow:
 				escaped_id = 1;
-				package_emit(p->pkg, item.value);
+				emit(p, item);
 				continue;
 
 			case item_eof:
@@ -47,7 +61,9 @@ static void * parse_c(parser_t * p) {
 				return NULL;
 
 			case item_id:
-				if (last.type == 0 || last.start < last.line_pos) {
+				// a gap means the lexer dropped what came between, which it only does
+				// for an identifier at the start of a line
+				if (last.type == 0 || last.start < last.line_pos || last.start + last.length < item.start) {
 					lex_item_free(last);
 					return parse_keyword(p, item);
 				}
@@ -57,7 +73,7 @@ static void * parse_c(parser_t * p) {
 				}
 			case item_c_code:
 			default:
-				package_emit(p->pkg, item.value);
+				emit(p, item);
 		}
 
 		escaped_id = 0;
@@ -68,39 +84,106 @@ static void * parse_c(parser_t * p) {
 	return NULL;
 }
 
-static hash_t * keywords = NULL;
-static void init_keywords(){
-	keywords = hash_new();
+static hash_t * init_keywords(cbuild_ctx_t * ctx){
+	hash_t * keywords = ctx->keywords = hash_new();
 
 	hash_set(keywords, "package", parser_package_parse);
 	hash_set(keywords, "import",  import_parse );
 	hash_set(keywords, "export",  export_parse );
 	hash_set(keywords, "build",   build_parse  );
+	return keywords;
 }
 
 static void * parse_keyword(parser_t * p, lex_item_t item) {
-	if (keywords == NULL) init_keywords();
-	keyword_fn fn = (keyword_fn) hash_get(keywords, item.value);
+	hash_t * keywords = p->pkg->ctx->keywords;
+	if (keywords == NULL) keywords = init_keywords(p->pkg->ctx);
+	keyword_fn fn = (keyword_fn) hash_get_hashed(keywords, item.value, lex_item_hash_of(item));
 
 	if (fn != NULL) {
 		lex_item_free(item);
-		if (fn(p)) return parse_c;
-		return NULL;
+
+		// keywords read their declarations token by token
+		lex_keep_fn keep = p->lexer->keep;
+		p->lexer->keep = NULL;
+		parser_linkage_keyword(p);
+		int ok = fn(p);
+		p->lexer->keep = keep;
+
+		if (!ok) return NULL;
+		return p->waiting ? imported : parse_c;
 	}
 
 	return parse_id(p, item);
 }
 
+/* the only identifiers a package that is up to date is parsed for */
+static bool keyword(void * pkg, const char * id, unsigned int hash) {
+	package_t * p = (package_t *) pkg;
+	hash_t * keywords = p->ctx->keywords;
+	if (keywords == NULL) keywords = init_keywords(p->ctx);
+
+	return hash_has_hashed(keywords, (char *) id, hash);
+}
+
+/* the identifiers that are not just copied to the output, for coarse tokens */
+static bool inspected(void * pkg, const char * id, unsigned int hash) {
+	return keyword(pkg, id, hash) || parser_identifier_inspects((package_t *) pkg, id, hash);
+}
+
+/* where an import that had to wait for its package is finished */
+static void * imported(parser_t * p) {
+	package_t * dep = p->waiting;
+	p->waiting = NULL;
+
+	import_included(p, dep);
+	return parse_c;
+}
+
 static void * parse_id(parser_t * p, lex_item_t item) {
 	item = parser_identifier_parse(p, item, false);
-	package_emit(p->pkg, item.value);
+	emit(p, item);
 	lex_item_free(item);
 	return parse_c;
 }
 
-int grammer_parse(stream_t * in, const char * filename, package_t * p, char ** error) {
+/* with a jobserver, every thread past this one's needs a token from it */
+static void lex_split(lex_t * lexer, cbuild_ctx_t * ctx) {
+	jobserver_t * js = ctx->jobserver;
+	if (js == NULL) {
+		lex_parallel_split(lexer, ctx->lex_threads, SPLIT_MIN);
+		return;
+	}
+
+	int * tokens = malloc((ctx->lex_threads - 1) * sizeof(int));
+	long i, threads = 1;
+	while (threads < ctx->lex_threads && jobserver_acquire(js, &tokens[threads - 1])) threads++;
+
+	lex_parallel_split(lexer, threads, SPLIT_MIN);
+
+	for (i = 0; i < threads - 1; i++) jobserver_release(js, tokens[i]);
+	free(tokens);
+}
+
+/* a parser for `in`, for package/index to resume() until it is done */
+parser_t * grammer_start(stream_t * in, const char * filename, package_t * p, char ** error) {
 	lex_t * lexer = lex_syntax_new(in, filename, error);
-	if (lexer == NULL) return -1;
+	if (lexer == NULL) return NULL;
+	lexer->window = p->ctx->window;
+	// with nothing to write only the declarations matter, everything else is skipped
+	if (p->out == NULL) {
+		lexer->keep     = keyword;
+		lexer->keep_ctx = p;
+		lexer->scan     = true;
+	} else if (p->ctx->coarse && !p->ctx->internal) {
+		// coarse tokens would hide the declarations from parser/linkage
+		lexer->keep     = inspected;
+		lexer->keep_ctx = p;
+	} else if (p->ctx->lex_threads > 1) {
+		lex_split(lexer, p->ctx);
+	}
 
-	return parser_parse(lexer, parse_c, p);
+	parser_t * parsing = parser_new(lexer, parse_c, p);
+	// coarse tokens hide them, so inline exports go unchecked with them
+	if (p->out && lexer->keep == NULL) parser_linkage_follow(parsing, p->ctx->internal);
+	return parsing;
 }
\ No newline at end of file
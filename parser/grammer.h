@@ -1,9 +1,10 @@
 #ifndef _package_grammer_
 #define _package_grammer_
 
+#include "parser.h"
 #include "../deps/stream/stream.h"
 #include "../package/package.h"
 
-int grammer_parse(stream_t * in, const char * filename, package_t * p, char ** error);
+parser_t * grammer_start(stream_t * in, const char * filename, package_t * p, char ** error);
 
 #endif
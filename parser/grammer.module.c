@@ -2,6 +2,7 @@ build depends "../deps/hash/hash.c";
 #include "../deps/hash/hash.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 
 import stream     from "../deps/stream/stream.module.c";
@@ -9,19 +10,32 @@ import stream     from "../deps/stream/stream.module.c";
 import lex_item   from "../lexer/item.module.c";
 import lex        from "../lexer/lex.module.c";
 import syntax     from "../lexer/syntax.module.c";
+import parallel   from "../lexer/parallel.module.c";
 import Package    from "../package/package.module.c";
+import cbuild_ctx from "../package/context.module.c";
 import parser     from "./parser.module.c";
+import jobserver  from "../utils/jobserver.module.c";
 
 import ParsePackage from "./package.module.c";
 import Import       from "./import.module.c";
 import Export       from "./export.module.c";
 import Build        from "./build.module.c";
 import Identifier   from "./identifier.module.c";
+import Linkage      from "./linkage.module.c";
 
 typedef int (*keyword_fn)(parser.t * p);
 
+/* the smallest piece of a module worth lexing on a thread of its own */
+#define SPLIT_MIN (1 << 20)
+
 static void * parse_id      (parser.t * p, lex_item.t item);
 static void * parse_keyword (parser.t * p, lex_item.t item);
+static void * imported      (parser.t * p);
+
+static void emit(parser.t * p, lex_item.t item) {
+	Linkage.see(p, item);
+	Package.emit(p->pkg, item.value);
+}
 
 static void * parse_c(parser.t * p) {
 	lex_item.t item = {0};
@@ -35,7 +49,7 @@ static void * parse_c(parser.t * p) {
 		switch(item.type) {
 			case item_arrow:
 				escaped_id = 1;
-				Package.emit(p->pkg, item.value);
+				emit(p, item);
 				continue;
 
 			case item_eof:
@@ -47,7 +61,9 @@ static void * parse_c(parser.t * p) {
 				return NULL;
 
 			case item_id:
-				if (last.type == 0 || last.start < last.line_pos) {
+				// a gap means the lexer dropped what came between, which it only does
+				// for an identifier at the start of a line
+				if (last.type == 0 || last.start < last.line_pos || last.start + last.length < item.start) {
 					lex_item.free(last);
 					return parse_keyword(p, item);
 				}
@@ -57,7 +73,7 @@ static void * parse_c(parser.t * p) {
 				}
 			case item_c_code:
 			default:
-				Package.emit(p->pkg, item.value);
+				emit(p, item);
 		}
 
 		escaped_id = 0;
@@ -68,39 +84,106 @@ static void * parse_c(parser.t * p) {
 	return NULL;
 }
 
-static hash_t * keywords = NULL;
-static void init_keywords(){
-	keywords = hash_new();
+static hash_t * init_keywords(cbuild_ctx.t * ctx){
+	hash_t * keywords = ctx->keywords = hash_new();
 
 	hash_set(keywords, "package", ParsePackage.parse);
 	hash_set(keywords, "import",  Import.parse );
 	hash_set(keywords, "export",  Export.parse );
 	hash_set(keywords, "build",   Build.parse  );
+	return keywords;
 }
 
 static void * parse_keyword(parser.t * p, lex_item.t item) {
-	if (keywords == NULL) init_keywords();
-	keyword_fn fn = (keyword_fn) hash_get(keywords, item.value);
+	hash_t * keywords = p->pkg->ctx->keywords;
+	if (keywords == NULL) keywords = init_keywords(p->pkg->ctx);
+	keyword_fn fn = (keyword_fn) hash_get_hashed(keywords, item.value, lex_item.hash_of(item));
 
 	if (fn != NULL) {
 		lex_item.free(item);
-		if (fn(p)) return parse_c;
-		return NULL;
+
+		// keywords read their declarations token by token
+		lex.keep_fn keep = p->lexer->keep;
+		p->lexer->keep = NULL;
+		Linkage.keyword(p);
+		int ok = fn(p);
+		p->lexer->keep = keep;
+
+		if (!ok) return NULL;
+		return p->waiting ? imported : parse_c;
 	}
 
 	return parse_id(p, item);
 }
 
+/* the only identifiers a package that is up to date is parsed for */
+static bool keyword(void * pkg, const char * id, unsigned int hash) {
+	Package.t * p = (Package.t *) pkg;
+	hash_t * keywords = p->ctx->keywords;
+	if (keywords == NULL) keywords = init_keywords(p->ctx);
+
+	return hash_has_hashed(keywords, (char *) id, hash);
+}
+
+/* the identifiers that are not just copied to the output, for coarse tokens */
+static bool inspected(void * pkg, const char * id, unsigned int hash) {
+	return keyword(pkg, id, hash) || Identifier.inspects((Package.t *) pkg, id, hash);
+}
+
+/* where an import that had to wait for its package is finished */
+static void * imported(parser.t * p) {
+	Package.t * dep = p->waiting;
+	p->waiting = NULL;
+
+	Import.included(p, dep);
+	return parse_c;
+}
+
 static void * parse_id(parser.t * p, lex_item.t item) {
 	item = Identifier.parse(p, item, false);
-	Package.emit(p->pkg, item.value);
+	emit(p, item);
 	lex_item.free(item);
 	return parse_c;
 }
 
-export int parse(stream.t * in, const char * filename, Package.t * p, char ** error) {
+/* with a jobserver, every thread past this one's needs a token from it */
+static void lex_split(lex.t * lexer, cbuild_ctx.t * ctx) {
+	jobserver.t * js = ctx->jobserver;
+	if (js == NULL) {
+		parallel.split(lexer, ctx->lex_threads, SPLIT_MIN);
+		return;
+	}
+
+	int * tokens = malloc((ctx->lex_threads - 1) * sizeof(int));
+	long i, threads = 1;
+	while (threads < ctx->lex_threads && jobserver.acquire(js, &tokens[threads - 1])) threads++;
+
+	parallel.split(lexer, threads, SPLIT_MIN);
+
+	for (i = 0; i < threads - 1; i++) jobserver.release(js, tokens[i]);
+	free(tokens);
+}
+
+/* a parser for `in`, for package/index to resume() until it is done */
+export parser.t * start(stream.t * in, const char * filename, Package.t * p, char ** error) {
 	lex.t * lexer = syntax.new(in, filename, error);
-	if (lexer == NULL) return -1;
+	if (lexer == NULL) return NULL;
+	lexer->window = p->ctx->window;
+	// with nothing to write only the declarations matter, everything else is skipped
+	if (p->out == NULL) {
+		lexer->keep     = keyword;
+		lexer->keep_ctx = p;
+		lexer->scan     = true;
+	} else if (p->ctx->coarse && !p->ctx->internal) {
+		// coarse tokens would hide the declarations from parser/linkage
+		lexer->keep     = inspected;
+		lexer->keep_ctx = p;
+	} else if (p->ctx->lex_threads > 1) {
+		lex_split(lexer, p->ctx);
+	}
 
-	return parser.parse(lexer, parse_c, p);
+	parser.t * parsing = parser.new(lexer, parse_c, p);
+	// coarse tokens hide them, so inline exports go unchecked with them
+	if (p->out && lexer->keep == NULL) Linkage.follow(parsing, p->ctx->internal);
+	return parsing;
 }
@@ -4,88 +4,128 @@
 #include "../deps/hash/hash.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdbool.h>
 
 
 #include "../lexer/item.h"
-#include "../lexer/stack.h"
 #include "parser.h"
 #include "../package/package.h"
+#include "../package/context.h"
 #include "../package/export.h"
 #include "../package/import.h"
+#include "../utils/stats.h"
 
-hash_t * options = NULL;
-static void init_options(){
-	options = hash_new();
+static hash_t * init_options(cbuild_ctx_t * ctx){
+	hash_t * options = ctx->type_keywords = hash_new();
 
 	hash_set(options, "enum",   (void *) 1);
 	hash_set(options, "union",  (void *) 2);
 	hash_set(options, "struct", (void *) 3);
+	return options;
 }
 
-static lex_item_t token(parser_t * p, lex_item_stack_t * s) {
+/*
+ * Whether parse() could do anything with `id`: the name of a type, an import (or
+ * `global`) in front of a `.`, or one of the package's own symbols. Every other
+ * identifier is copied as it is.
+ */
+bool parser_identifier_inspects(package_t * pkg, const char * id, unsigned int hash) {
+	hash_t * options = pkg->ctx->type_keywords;
+	if (options == NULL) options = init_options(pkg->ctx);
+
+	return hash_has_hashed(options, (char *) id, hash)
+		|| hash_has_hashed(pkg->deps, (char *) id, hash)
+		|| hash_has_hashed(pkg->symbols, (char *) id, hash)
+		|| strcmp(id, "global") == 0;
+}
+
+/*
+ * The items looked at while resolving one identifier. Lookahead never goes further than
+ * `struct pkg.name`, so this lives on the C stack and resolving allocates nothing.
+ */
+#define WINDOW 16
+
+typedef struct {
+	lex_item_t items[WINDOW];
+	size_t     length;
+} window_t;
+
+static void push(window_t * w, lex_item_t item) {
+	w->items[w->length++] = item;
+}
+
+static lex_item_t pop(window_t * w) {
+	return w->items[--w->length];
+}
+
+static void drop(window_t * w) {
+	while (w->length) lex_item_free(pop(w));
+}
+
+static lex_item_t token(parser_t * p, window_t * w) {
 	lex_item_t item = parser_next(p);
-	while(item.type == item_whitespace){
-		lex_item_stack_push(s, item);
+	// leaves room for parse_import, a run this long of whitespace items is given up on
+	while(item.type == item_whitespace && w->length < WINDOW - 4){
+		push(w, item);
 		item = parser_next(p);
 	}
 	return item;
 }
 
-static lex_item_t cleanup(parser_t * p, lex_item_stack_t * s) {
-	while(s->length > 1) {
-		parser_backup(p, lex_item_stack_pop(s));
+static lex_item_t cleanup(parser_t * p, window_t * w) {
+	while(w->length > 1) {
+		parser_backup(p, pop(w));
 	}
-	lex_item_t out = lex_item_stack_pop(s);
-	lex_item_stack_free(s);
-	return out;
+	return pop(w);
 }
 
-static void rewind_until(parser_t * p, lex_item_stack_t * s, lex_item_t item) {
+static void rewind_until(parser_t * p, window_t * w, lex_item_t item) {
 	lex_item_t i;
-	while(s->length > 0 && (i = lex_item_stack_pop(s)).type != 0 && !lex_item_equals(i, item)) {
+	while(w->length > 0 && (i = pop(w)).type != 0 && !lex_item_equals(i, item)) {
 		parser_backup(p, i);
 	}
 }
 
-static lex_item_t emit(parser_t * p, lex_item_stack_t * s) {
+static lex_item_t emit(parser_t * p, window_t * w) {
 	int i;
-	for (i = 0; i < s->length -1; i++) {
-		package_emit(p->pkg, s->items[i].value);
+	for (i = 0; i < w->length -1; i++) {
+		package_emit(p->pkg, w->items[i].value);
 	}
 
-	lex_item_t out = lex_item_stack_pop(s); 
+	lex_item_t out = pop(w);
 
-	lex_item_stack_free(s);
+	drop(w);
 	return out;
 }
 
 
-static lex_item_t parse_type(parser_t * p, lex_item_stack_t * s, lex_item_t item, lex_item_t *type) {
-	if (options == NULL) init_options();
-	if (!hash_has(options, item.value)) return item;
+static lex_item_t parse_type(parser_t * p, window_t * w, lex_item_t item, lex_item_t *type) {
+	hash_t * options = p->pkg->ctx->type_keywords;
+	if (options == NULL) options = init_options(p->pkg->ctx);
+	if (!hash_has_hashed(options, item.value, lex_item_hash_of(item))) return item;
 
 	*type = item;
-	lex_item_stack_push(s, item);
-	return token(p, s);
+	push(w, item);
+	return token(p, w);
 }
 
-static lex_item_t parse_import( parser_t *p, lex_item_stack_t * s,
+static lex_item_t parse_import( parser_t *p, window_t * w,
 		lex_item_t item, lex_item_t *pkg, lex_item_t *name ) {
 	lex_item_t temp;
 
-	lex_item_stack_push(s, item);
+	push(w, item);
 	if (item.type != item_id) return lex_item_empty;
 	temp = item;
 
 	item = parser_next(p);
-	lex_item_stack_push(s, item);
+	push(w, item);
 
 	if (item.type != item_symbol || item.value[0] != '.') return temp;
 
 	item = parser_next(p);
-	lex_item_stack_push(s, item);
+	push(w, item);
 	if (item.type != item_id) return lex_item_empty;
 
 	*pkg  = temp;
@@ -93,109 +133,98 @@ static lex_item_t parse_import( parser_t *p, lex_item_stack_t * s,
 	return item;
 }
 
-static lex_item_t parse_symbol(parser_t *p, lex_item_stack_t * s, lex_item_t type, lex_item_t item) {
-	package_export_t * symbol = (package_export_t *) hash_get(p->pkg->symbols, item.value);
-	if (symbol == NULL) return cleanup(p, s);
+/* `exp`'s symbol, with `type` in front if there is one. Owned by `exp`. */
+static const char * symbol_name(package_export_t * exp, lex_item_t type) {
+	if (type.type == 0) return exp->symbol;
+	return package_export_prefixed(exp, type.value);
+}
 
-	bool has_type = type.type != 0;
+static lex_item_t parse_symbol(parser_t *p, window_t * w, lex_item_t type, lex_item_t item) {
+	package_export_t * symbol = (package_export_t *) hash_get_hashed(p->pkg->symbols, item.value, lex_item_hash_of(item));
+	STATS_LOOKUP(symbols, symbol != NULL);
+	if (symbol == NULL) return cleanup(p, w);
 
-	rewind_until(p, s, item);
-	char * symbol_name = NULL;
-	asprintf(&symbol_name, "%s%s%s",
-			has_type ? type.value : "", has_type ? " " : "", symbol->symbol);
-	item = lex_item_replace_value(item, symbol_name);
+	rewind_until(p, w, item);
+	lex_item_t ident = lex_item_borrow(item, symbol_name(symbol, type));
+	lex_item_free(item);
 
-	lex_item_stack_free(s);
-	return item;
+	drop(w);
+	return ident;
 }
 
 lex_item_t parser_identifier_parse_typed(parser_t * p, lex_item_t type, lex_item_t item, bool is_export) {
-	lex_item_t ident = {0};
 	lex_item_t from  = {0};
 	lex_item_t name  = {0};
-	lex_item_stack_t * s      = lex_item_stack_new(8);
+	window_t   w     = { .length = 0 };
 
-	item = parse_import(p, s, item, &from, &name);
-	if (item.type == 0) return cleanup(p, s);
-	if (name.type == 0) return parse_symbol(p, s, lex_item_empty, item);
+	item = parse_import(p, &w, item, &from, &name);
+	if (item.type == 0) return cleanup(p, &w);
+	if (name.type == 0) return parse_symbol(p, &w, lex_item_empty, item);
 
 	if (strcmp(from.value, "global") == 0) {
-		lex_item_stack_free(s);
+		name = pop(&w);
+		drop(&w);
 		return name;
 	}
 
-	package_import_t * imp = (package_import_t *) hash_get(p->pkg->deps, from.value);
-	if (imp == NULL || imp->pkg == NULL) return emit(p, s);
+	package_import_t * imp = (package_import_t *) hash_get_hashed(p->pkg->deps, from.value, lex_item_hash_of(from));
+	STATS_LOOKUP(deps, imp != NULL);
+	// an export collects what it reads instead of writing it out
+	if (imp == NULL || imp->pkg == NULL) return is_export ? cleanup(p, &w) : emit(p, &w);
 
-	package_export_t * exp = (package_export_t *) hash_get(imp->pkg->exports, name.value);
+	package_export_t * exp = (package_export_t *) hash_get_hashed(imp->pkg->exports, name.value, lex_item_hash_of(name));
+	STATS_LOOKUP(exports, exp != NULL);
 	if (exp == NULL) {
 		parser_errorf(p, name, "", "Package '%s' does not export the symbol '%s'",
 				from.value, name.value
 		);
-		return cleanup(p, s);
+		return cleanup(p, &w);
 	}
 
 	if (is_export) package_export_export_headers(p->pkg, imp->pkg);
 
-	char * typed_name = NULL;
-	asprintf(&typed_name, "%s %s", type.value, exp->symbol);
+	lex_item_t ident = lex_item_borrow(type, package_export_prefixed(exp, type.value));
 
-	ident = lex_item_replace_value(type, typed_name);
-
-	lex_item_stack_free(s);
+	drop(&w);
 	return ident;
 }
 
 lex_item_t parser_identifier_parse (parser_t * p, lex_item_t item, bool is_export) {
-	lex_item_t ident = {0};
 	lex_item_t type  = {0};
 	lex_item_t from  = {0};
 	lex_item_t name  = {0};
-	lex_item_stack_t * s      = lex_item_stack_new(8);
+	window_t   w     = { .length = 0 };
 
 
-	item = parse_type(p, s, item, &type);
-	item = parse_import(p, s, item, &from, &name);
-	if (item.type == 0) return cleanup(p, s);
-	if (name.type == 0) return parse_symbol(p, s, type, item);
+	item = parse_type(p, &w, item, &type);
+	item = parse_import(p, &w, item, &from, &name);
+	if (item.type == 0) return cleanup(p, &w);
+	if (name.type == 0) return parse_symbol(p, &w, type, item);
 
 	if (strcmp(from.value, "global") == 0) {
-		name = lex_item_dup(name);
-		lex_item_stack_free(s);
+		name = pop(&w);
+		drop(&w);
 		return name;
 	}
 
-	package_import_t * imp = (package_import_t *) hash_get(p->pkg->deps, from.value);
-	if (imp == NULL || imp->pkg == NULL) return emit(p, s);
+	package_import_t * imp = (package_import_t *) hash_get_hashed(p->pkg->deps, from.value, lex_item_hash_of(from));
+	STATS_LOOKUP(deps, imp != NULL);
+	// an export collects what it reads instead of writing it out
+	if (imp == NULL || imp->pkg == NULL) return is_export ? cleanup(p, &w) : emit(p, &w);
 
-	package_export_t * exp = (package_export_t *) hash_get(imp->pkg->exports, name.value);
+	package_export_t * exp = (package_export_t *) hash_get_hashed(imp->pkg->exports, name.value, lex_item_hash_of(name));
+	STATS_LOOKUP(exports, exp != NULL);
 	if (exp == NULL) {
 		parser_errorf(p, name, "", "Package '%s' does not export the symbol '%s'",
 				from.value, name.value
 		);
-		lex_item_stack_free(s);
-		return cleanup(p, s);
+		return cleanup(p, &w);
 	}
 
-	bool has_type = type.type != 0;
 	if (is_export) package_export_export_headers(p->pkg, imp->pkg);
 
-	char * symbol_name = NULL;
-	asprintf(&symbol_name, "%s%s%s",
-		has_type ? type.value : "",
-		has_type ? " " : "",
-		exp->symbol
-	);
-	lex_item_t start = (has_type) ? type : from;
-
-	ident = lex_item_new(
-		symbol_name,
-		start.type, 
-		start.line,
-		start.line_pos,
-		start.start
-	);
-
-	lex_item_stack_free(s);
+	lex_item_t ident = lex_item_borrow(type.type != 0 ? type : from, symbol_name(exp, type));
+
+	drop(&w);
 	return ident;
 }
\ No newline at end of file
@@ -3,6 +3,10 @@
 
 #include <stdbool.h>
 
+#include "../package/package.h"
+
+bool parser_identifier_inspects(package_t * pkg, const char * id, unsigned int hash);
+
 #include "../lexer/item.h"
 #include "parser.h"
 
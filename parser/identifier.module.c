@@ -4,88 +4,128 @@ build depends "../deps/hash/hash.c";
 #include "../deps/hash/hash.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 export {
 #include <stdbool.h>
 }
 
 import lex_item   from "../lexer/item.module.c";
-import stack      from "../lexer/stack.module.c";
 import parser     from "./parser.module.c";
 import Package    from "../package/package.module.c";
+import cbuild_ctx from "../package/context.module.c";
 import pkg_export from "../package/export.module.c";
 import pkg_import from "../package/import.module.c";
+import stats      from "../utils/stats.module.c";
 
-hash_t * options = NULL;
-static void init_options(){
-	options = hash_new();
+static hash_t * init_options(cbuild_ctx.t * ctx){
+	hash_t * options = ctx->type_keywords = hash_new();
 
 	hash_set(options, "enum",   (void *) 1);
 	hash_set(options, "union",  (void *) 2);
 	hash_set(options, "struct", (void *) 3);
+	return options;
 }
 
-static lex_item.t token(parser.t * p, stack.t * s) {
+/*
+ * Whether parse() could do anything with `id`: the name of a type, an import (or
+ * `global`) in front of a `.`, or one of the package's own symbols. Every other
+ * identifier is copied as it is.
+ */
+export bool inspects(Package.t * pkg, const char * id, unsigned int hash) {
+	hash_t * options = pkg->ctx->type_keywords;
+	if (options == NULL) options = init_options(pkg->ctx);
+
+	return hash_has_hashed(options, (char *) id, hash)
+		|| hash_has_hashed(pkg->deps, (char *) id, hash)
+		|| hash_has_hashed(pkg->symbols, (char *) id, hash)
+		|| strcmp(id, "global") == 0;
+}
+
+/*
+ * The items looked at while resolving one identifier. Lookahead never goes further than
+ * `struct pkg.name`, so this lives on the C stack and resolving allocates nothing.
+ */
+#define WINDOW 16
+
+typedef struct {
+	lex_item.t items[WINDOW];
+	size_t     length;
+} window_t;
+
+static void push(window_t * w, lex_item.t item) {
+	w->items[w->length++] = item;
+}
+
+static lex_item.t pop(window_t * w) {
+	return w->items[--w->length];
+}
+
+static void drop(window_t * w) {
+	while (w->length) lex_item.free(pop(w));
+}
+
+static lex_item.t token(parser.t * p, window_t * w) {
 	lex_item.t item = parser.next(p);
-	while(item.type == item_whitespace){
-		stack.push(s, item);
+	// leaves room for parse_import, a run this long of whitespace items is given up on
+	while(item.type == item_whitespace && w->length < WINDOW - 4){
+		push(w, item);
 		item = parser.next(p);
 	}
 	return item;
 }
 
-static lex_item.t cleanup(parser.t * p, stack.t * s) {
-	while(s->length > 1) {
-		parser.backup(p, stack.pop(s));
+static lex_item.t cleanup(parser.t * p, window_t * w) {
+	while(w->length > 1) {
+		parser.backup(p, pop(w));
 	}
-	lex_item.t out = stack.pop(s);
-	stack.free(s);
-	return out;
+	return pop(w);
 }
 
-static void rewind_until(parser.t * p, stack.t * s, lex_item.t item) {
+static void rewind_until(parser.t * p, window_t * w, lex_item.t item) {
 	lex_item.t i;
-	while(s->length > 0 && (i = stack.pop(s)).type != 0 && !lex_item.equals(i, item)) {
+	while(w->length > 0 && (i = pop(w)).type != 0 && !lex_item.equals(i, item)) {
 		parser.backup(p, i);
 	}
 }
 
-static lex_item.t emit(parser.t * p, stack.t * s) {
+static lex_item.t emit(parser.t * p, window_t * w) {
 	int i;
-	for (i = 0; i < s->length -1; i++) {
-		Package.emit(p->pkg, s->items[i].value);
+	for (i = 0; i < w->length -1; i++) {
+		Package.emit(p->pkg, w->items[i].value);
 	}
 
-	lex_item.t out = stack.pop(s); 
+	lex_item.t out = pop(w);
 
-	stack.free(s);
+	drop(w);
 	return out;
 }
 
 
-static lex_item.t parse_type(parser.t * p, stack.t * s, lex_item.t item, lex_item.t *type) {
-	if (options == NULL) init_options();
-	if (!hash_has(options, item.value)) return item;
+static lex_item.t parse_type(parser.t * p, window_t * w, lex_item.t item, lex_item.t *type) {
+	hash_t * options = p->pkg->ctx->type_keywords;
+	if (options == NULL) options = init_options(p->pkg->ctx);
+	if (!hash_has_hashed(options, item.value, lex_item.hash_of(item))) return item;
 
 	*type = item;
-	stack.push(s, item);
-	return token(p, s);
+	push(w, item);
+	return token(p, w);
 }
 
-static lex_item.t parse_import( parser.t *p, stack.t * s,
+static lex_item.t parse_import( parser.t *p, window_t * w,
 		lex_item.t item, lex_item.t *pkg, lex_item.t *name ) {
 	lex_item.t temp;
 
-	stack.push(s, item);
+	push(w, item);
 	if (item.type != item_id) return lex_item.empty;
 	temp = item;
 
 	item = parser.next(p);
-	stack.push(s, item);
+	push(w, item);
 
 	if (item.type != item_symbol || item.value[0] != '.') return temp;
 
 	item = parser.next(p);
-	stack.push(s, item);
+	push(w, item);
 	if (item.type != item_id) return lex_item.empty;
 
 	*pkg  = temp;
@@ -93,109 +133,98 @@ static lex_item.t parse_import( parser.t *p, stack.t * s,
 	return item;
 }
 
-static lex_item.t parse_symbol(parser.t *p, stack.t * s, lex_item.t type, lex_item.t item) {
-	pkg_export.t * symbol = (pkg_export.t *) hash_get(p->pkg->symbols, item.value);
-	if (symbol == NULL) return cleanup(p, s);
+/* `exp`'s symbol, with `type` in front if there is one. Owned by `exp`. */
+static const char * symbol_name(pkg_export.t * exp, lex_item.t type) {
+	if (type.type == 0) return exp->symbol;
+	return pkg_export.prefixed(exp, type.value);
+}
 
-	bool has_type = type.type != 0;
+static lex_item.t parse_symbol(parser.t *p, window_t * w, lex_item.t type, lex_item.t item) {
+	pkg_export.t * symbol = (pkg_export.t *) hash_get_hashed(p->pkg->symbols, item.value, lex_item.hash_of(item));
+	STATS_LOOKUP(symbols, symbol != NULL);
+	if (symbol == NULL) return cleanup(p, w);
 
-	rewind_until(p, s, item);
-	char * symbol_name = NULL;
-	asprintf(&symbol_name, "%s%s%s",
-			has_type ? type.value : "", has_type ? " " : "", symbol->symbol);
-	item = lex_item.replace_value(item, symbol_name);
+	rewind_until(p, w, item);
+	lex_item.t ident = lex_item.borrow(item, symbol_name(symbol, type));
+	lex_item.free(item);
 
-	stack.free(s);
-	return item;
+	drop(w);
+	return ident;
 }
 
 export lex_item.t parse_typed(parser.t * p, lex_item.t type, lex_item.t item, bool is_export) {
-	lex_item.t ident = {0};
 	lex_item.t from  = {0};
 	lex_item.t name  = {0};
-	stack.t * s      = stack.new(8);
+	window_t   w     = { .length = 0 };
 
-	item = parse_import(p, s, item, &from, &name);
-	if (item.type == 0) return cleanup(p, s);
-	if (name.type == 0) return parse_symbol(p, s, lex_item.empty, item);
+	item = parse_import(p, &w, item, &from, &name);
+	if (item.type == 0) return cleanup(p, &w);
+	if (name.type == 0) return parse_symbol(p, &w, lex_item.empty, item);
 
 	if (strcmp(from.value, "global") == 0) {
-		stack.free(s);
+		name = pop(&w);
+		drop(&w);
 		return name;
 	}
 
-	pkg_import.t * imp = (pkg_import.t *) hash_get(p->pkg->deps, from.value);
-	if (imp == NULL || imp->pkg == NULL) return emit(p, s);
+	pkg_import.t * imp = (pkg_import.t *) hash_get_hashed(p->pkg->deps, from.value, lex_item.hash_of(from));
+	STATS_LOOKUP(deps, imp != NULL);
+	// an export collects what it reads instead of writing it out
+	if (imp == NULL || imp->pkg == NULL) return is_export ? cleanup(p, &w) : emit(p, &w);
 
-	pkg_export.t * exp = (pkg_export.t *) hash_get(imp->pkg->exports, name.value);
+	pkg_export.t * exp = (pkg_export.t *) hash_get_hashed(imp->pkg->exports, name.value, lex_item.hash_of(name));
+	STATS_LOOKUP(exports, exp != NULL);
 	if (exp == NULL) {
 		parser.errorf(p, name, "", "Package '%s' does not export the symbol '%s'",
 				from.value, name.value
 		);
-		return cleanup(p, s);
+		return cleanup(p, &w);
 	}
 
 	if (is_export) pkg_export.export_headers(p->pkg, imp->pkg);
 
-	char * typed_name = NULL;
-	asprintf(&typed_name, "%s %s", type.value, exp->symbol);
+	lex_item.t ident = lex_item.borrow(type, pkg_export.prefixed(exp, type.value));
 
-	ident = lex_item.replace_value(type, typed_name);
-
-	stack.free(s);
+	drop(&w);
 	return ident;
 }
 
 export lex_item.t parse (parser.t * p, lex_item.t item, bool is_export) {
-	lex_item.t ident = {0};
 	lex_item.t type  = {0};
 	lex_item.t from  = {0};
 	lex_item.t name  = {0};
-	stack.t * s      = stack.new(8);
+	window_t   w     = { .length = 0 };
 
 
-	item = parse_type(p, s, item, &type);
-	item = parse_import(p, s, item, &from, &name);
-	if (item.type == 0) return cleanup(p, s);
-	if (name.type == 0) return parse_symbol(p, s, type, item);
+	item = parse_type(p, &w, item, &type);
+	item = parse_import(p, &w, item, &from, &name);
+	if (item.type == 0) return cleanup(p, &w);
+	if (name.type == 0) return parse_symbol(p, &w, type, item);
 
 	if (strcmp(from.value, "global") == 0) {
-		name = lex_item.dup(name);
-		stack.free(s);
+		name = pop(&w);
+		drop(&w);
 		return name;
 	}
 
-	pkg_import.t * imp = (pkg_import.t *) hash_get(p->pkg->deps, from.value);
-	if (imp == NULL || imp->pkg == NULL) return emit(p, s);
+	pkg_import.t * imp = (pkg_import.t *) hash_get_hashed(p->pkg->deps, from.value, lex_item.hash_of(from));
+	STATS_LOOKUP(deps, imp != NULL);
+	// an export collects what it reads instead of writing it out
+	if (imp == NULL || imp->pkg == NULL) return is_export ? cleanup(p, &w) : emit(p, &w);
 
-	pkg_export.t * exp = (pkg_export.t *) hash_get(imp->pkg->exports, name.value);
+	pkg_export.t * exp = (pkg_export.t *) hash_get_hashed(imp->pkg->exports, name.value, lex_item.hash_of(name));
+	STATS_LOOKUP(exports, exp != NULL);
 	if (exp == NULL) {
 		parser.errorf(p, name, "", "Package '%s' does not export the symbol '%s'",
 				from.value, name.value
 		);
-		stack.free(s);
-		return cleanup(p, s);
+		return cleanup(p, &w);
 	}
 
-	bool has_type = type.type != 0;
 	if (is_export) pkg_export.export_headers(p->pkg, imp->pkg);
 
-	char * symbol_name = NULL;
-	asprintf(&symbol_name, "%s%s%s",
-		has_type ? type.value : "",
-		has_type ? " " : "",
-		exp->symbol
-	);
-	lex_item.t start = (has_type) ? type : from;
-
-	ident = lex_item.new(
-		symbol_name,
-		start.type, 
-		start.line,
-		start.line_pos,
-		start.start
-	);
-
-	stack.free(s);
+	lex_item.t ident = lex_item.borrow(type.type != 0 ? type : from, symbol_name(exp, type));
+
+	drop(&w);
 	return ident;
 }
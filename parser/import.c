@@ -7,7 +7,8 @@
 #include "../lexer/item.h"
 #include "../package/import.h"
 #include "../package/package.h"
-#include "../utils/utils.h"
+#include "../package/export.h"
+#include "../package/paths.h"
 #include "../utils/strings.h"
 
 static int errorf(parser_t * p, lex_item_t item, const char * fmt, ...) {
@@ -19,6 +20,19 @@ static int errorf(parser_t * p, lex_item_t item, const char * fmt, ...) {
 	return -1;
 }
 
+/* writes the header of `dep`, which is parsed, and includes it */
+int import_included(parser_t * p, package_t * dep) {
+	package_export_write_headers(dep);
+
+	char * include;
+	const char * rel = paths_relative(p->pkg->ctx->paths, p->pkg->source_abs, dep->header);
+	asprintf(&include, "#include \"%s\"", rel);
+	package_emit(p->pkg, include);
+	free(include);
+
+	return 1;
+}
+
 int import_parse(parser_t * p) {
 	lex_item_t alias = parser_skip(p, item_whitespace, 0);
 	if (alias.type != item_id) {
@@ -54,12 +68,7 @@ int import_parse(parser_t * p) {
 	if (imp == NULL) return -1;
 	if (error != NULL) return errorf(p, filename, error);
 
-	char * include;
-	char * rel = utils_relative(p->pkg->source_abs, imp->pkg->header);
-	asprintf(&include, "#include \"%s\"", rel);
-	package_emit(p->pkg, include);
-	free(include);
-	free(rel);
-
-	return 1;
+	// the header needs the package parsed, the grammar calls included() once it is
+	if (parser_await(p, imp->pkg)) return 1;
+	return import_included(p, imp->pkg);
 }
\ No newline at end of file
@@ -2,7 +2,9 @@
 #define _package_import_
 
 #include "parser.h"
+#include "../package/package.h"
 
+int import_included(parser_t * p, package_t * dep);
 int import_parse(parser_t * p);
 
 #endif
@@ -7,7 +7,8 @@ import string     from "./string.module.c";
 import lex_item   from "../lexer/item.module.c";
 import pkg_import from "../package/import.module.c";
 import Package    from "../package/package.module.c";
-import utils      from "../utils/utils.module.c";
+import pkg_export from "../package/export.module.c";
+import paths      from "../package/paths.module.c";
 import str        from "../utils/strings.module.c";
 
 static int errorf(parser.t * p, lex_item.t item, const char * fmt, ...) {
@@ -19,6 +20,19 @@ static int errorf(parser.t * p, lex_item.t item, const char * fmt, ...) {
 	return -1;
 }
 
+/* writes the header of `dep`, which is parsed, and includes it */
+export int included(parser.t * p, Package.t * dep) {
+	pkg_export.write_headers(dep);
+
+	char * include;
+	const char * rel = paths.relative(p->pkg->ctx->paths, p->pkg->source_abs, dep->header);
+	asprintf(&include, "#include \"%s\"", rel);
+	Package.emit(p->pkg, include);
+	global.free(include);
+
+	return 1;
+}
+
 export int parse(parser.t * p) {
 	lex_item.t alias = parser.skip(p, item_whitespace, 0);
 	if (alias.type != item_id) {
@@ -54,12 +68,7 @@ export int parse(parser.t * p) {
 	if (imp == NULL) return -1;
 	if (error != NULL) return errorf(p, filename, error);
 
-	char * include;
-	char * rel = utils.relative(p->pkg->source_abs, imp->pkg->header);
-	asprintf(&include, "#include \"%s\"", rel);
-	Package.emit(p->pkg, include);
-	global.free(include);
-	global.free(rel);
-
-	return 1;
+	// the header needs the package parsed, the grammar calls included() once it is
+	if (parser.await(p, imp->pkg)) return 1;
+	return included(p, imp->pkg);
 }
@@ -0,0 +1,21 @@
+#ifndef _package_parser_linkage_
+#define _package_parser_linkage_
+
+#include <stdbool.h>
+
+#include "parser.h"
+
+void parser_linkage_follow(parser_t * p, bool hold);
+
+#include "../lexer/item.h"
+
+void parser_linkage_see(parser_t * p, lex_item_t item);
+void parser_linkage_keyword(parser_t * p);
+void parser_linkage_exported(parser_t * p, lex_item_t * items, size_t n);
+bool parser_linkage_private(parser_t * p, const char * name);
+
+#include "../package/package.h"
+
+void parser_linkage_release(package_t * pkg);
+
+#endif
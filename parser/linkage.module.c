@@ -0,0 +1,525 @@
+package "parser_linkage";
+
+build depends "../deps/hash/hash.c";
+#include "../deps/hash/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+export {
+#include <stdbool.h>
+}
+
+import lex_item   from "../lexer/item.module.c";
+import parser     from "./parser.module.c";
+import Package    from "../package/package.module.c";
+import cbuild_ctx from "../package/context.module.c";
+import paths      from "../package/paths.module.c";
+import pkg_export from "../package/export.module.c";
+import stream     from "../deps/stream/stream.module.c";
+
+/*
+ * --internal-linkage: the functions and variables a module defines at file scope
+ * without exporting them are made static in its generated .c, so the compiler may
+ * inline, clone or drop them like any other static.
+ *
+ * While the module is parsed, its output is held here and the declarations at file
+ * scope are followed token by token, with where each one starts. Once it is parsed,
+ * `static` goes in front of every declaration of the names the module defines, unless
+ * one of them is
+ *   - `main`, or the symbol of an export whose definition comes without `export`
+ *   - declared `extern`, `static`, `inline` or as a typedef anywhere in the module
+ *   - declared in an export block, which importers include as it is
+ *   - in a declaration that can't be followed: a macro or attribute in it, a function
+ *     pointer, a preprocessor line in the middle
+ *   - declared next to any name that can't be made static
+ * so every declaration of a name is made static, or none is.
+ *
+ * Exports are only ever reached by their prefixed names, but C code can still reach a
+ * plain name by declaring it itself. A name one module makes static that another
+ * declares without defining, or that two modules both define, gets a warning: the
+ * first no longer links, and the second used to fail to.
+ *
+ * The declarations are followed without --internal-linkage too, for private(): an
+ * inline export's body is copied to the header, where the module's own names are
+ * missing.
+ */
+
+typedef struct {
+	size_t offset;    // where the declaration starts in the held output
+	size_t first;     // its names are names[first] up to names[first + n]
+	size_t n;
+	bool   keep;      // none of its names can be made static
+	bool   external;  // declared extern, the names are defined somewhere else
+	bool   type;      // a typedef, its names are types
+	bool   exported;  // in an export block, importers see its names
+} decl_t;
+
+typedef struct {
+	bool        holding;     // for --internal-linkage, the output is held until release()
+	stream.t  * out;         // the package's own output, written once it is parsed
+	const char * filename;
+	char      * buf;
+	size_t      length;
+	size_t      capacity;
+
+	decl_t    * decls;
+	size_t      n_decls;
+	char     ** names;
+	size_t      n_names;
+	hash_t    * defined;     // names given storage or a body here
+	hash_t    * declared;    // names declared outside export blocks
+	hash_t    * shared;      // names declared in export blocks
+
+	// the declaration being read
+	bool        open;
+	bool        rest;        // what an export statement left, skipped
+	bool        after;       // an export statement just ended
+	bool        exporting;   // in an export block, nothing is made static
+	size_t      offset;
+	size_t      first;
+	int         depth;
+	char      * name;        // the identifier that is a declarator's name if one follows
+	bool        typed;       // something came before it that can be its type
+	bool        keep;
+	bool        external;
+	bool        type;
+	bool        initializer; // after '=', until the next ',' or ';'
+	bool        parameters;  // the '(' open at depth 1 is a function declarator's
+	bool        declarator;  // a function declarator's ')' was the last token
+	bool        body;        // a function body is open
+} linkage_t;
+
+static int _type;
+
+static int type() {
+	if (_type == 0) _type = stream.register("linkage");
+	return _type;
+}
+
+static ssize_t held_write(void * ctx, const void * buf, size_t nbyte, stream.error_t * error) {
+	linkage_t * l = (linkage_t *) ctx;
+	if (l->length + nbyte > l->capacity) {
+		l->capacity = (l->length + nbyte) * 2;
+		l->buf      = realloc(l->buf, l->capacity);
+	}
+	memcpy(l->buf + l->length, buf, nbyte);
+	l->length += nbyte;
+	return nbyte;
+}
+
+static linkage_t * held(Package.t * pkg) {
+	return (linkage_t *) pkg->linkage;
+}
+
+/* follows the declarations of `p`'s package, and with `hold` holds what is written for it, until release() */
+export void follow(parser.t * p, bool hold) {
+	Package.t * pkg = p->pkg;
+	if (pkg->out == NULL || held(pkg)) return;
+
+	linkage_t * l = calloc(1, sizeof(linkage_t));
+	l->filename = paths.intern(pkg->ctx->paths, p->lexer->filename);
+	l->defined  = hash_new();
+	l->declared = hash_new();
+	l->shared   = hash_new();
+	pkg->linkage = l;
+	if (!hold) return;
+
+	l->holding = true;
+	l->out     = pkg->out;
+	stream.t * s = calloc(1, sizeof(stream.t));
+	s->ctx   = l;
+	s->write = held_write;
+	s->type  = type();
+	pkg->out = s;
+}
+
+static bool is(lex_item.t item, char c) {
+	return item.value[0] == c && item.value[1] == 0;
+}
+
+/* storage classes and the like that keep a declaration as it is */
+static bool reserved(const char * id) {
+	static const char * words[] = {
+		"static", "typedef", "inline", "_Static_assert", "static_assert",
+		"asm", "_Thread_local", "thread_local", NULL,
+	};
+	size_t i;
+	// __attribute__, __extension__, __inline__, __asm__ and the like
+	if (id[0] == '_' && id[1] == '_') return true;
+	for (i = 0; words[i]; i++) {
+		if (strcmp(id, words[i]) == 0) return true;
+	}
+	return false;
+}
+
+static void add_name(linkage_t * l, char * name, bool defines) {
+	l->names = realloc(l->names, sizeof(char *) * (l->n_names + 1));
+	l->names[l->n_names++] = name;
+	if (defines && !l->external && !hash_has(l->defined, name)) hash_set(l->defined, name, name);
+}
+
+/* the name before the current token, a variable's unless `function` */
+static void declare(linkage_t * l, bool function) {
+	if (l->name == NULL) return;
+	if (reserved(l->name)) l->keep = true;
+	add_name(l, l->name, !function);
+	l->name = NULL;
+}
+
+static void begin(linkage_t * l) {
+	l->open  = true;
+	l->first = l->n_names;
+	// the whitespace before it is left where it is
+	l->offset = l->length;
+}
+
+static void end(linkage_t * l) {
+	if (l->name) global.free(l->name);
+
+	size_t n = l->n_names - l->first;
+	size_t i;
+	for (i = l->first; !l->rest && i < l->n_names; i++) {
+		hash_set(l->exporting ? l->shared : l->declared, l->names[i], NULL);
+	}
+	if (!l->rest && n > 0) {
+		l->decls = realloc(l->decls, sizeof(decl_t) * (l->n_decls + 1));
+		l->decls[l->n_decls++] = (decl_t) {
+			.offset   = l->offset,
+			.first    = l->first,
+			.n        = n,
+			.keep     = l->keep || l->exporting,
+			.external = l->external,
+			.type     = l->type,
+			.exported = l->exporting,
+		};
+	}
+
+	l->open = l->rest = l->typed = l->keep = l->external = l->type = false;
+	l->initializer = l->parameters = l->declarator = l->body = false;
+	l->name  = NULL;
+	l->depth = 0;
+}
+
+static void opened(linkage_t * l, lex_item.t item) {
+	l->depth++;
+	if (l->depth > 1 || l->initializer || l->rest) return;
+
+	bool was_declarator = l->declarator;
+	l->declarator = false;
+
+	switch (item.value[0]) {
+		case '(':
+			// anything but a name with a type before it: a macro, a function pointer, an attribute
+			if (l->name == NULL || !l->typed || was_declarator) l->keep = true;
+			l->parameters = true;
+			declare(l, true);
+			break;
+		case '[':
+			if (l->name == NULL) l->keep = true;
+			declare(l, false);
+			break;
+		case '{':
+			if (was_declarator) {
+				// the last name is the function this is the body of
+				if (l->n_names > l->first) {
+					char * name = l->names[l->n_names - 1];
+					if (!hash_has(l->defined, name)) hash_set(l->defined, name, name);
+				}
+				l->body = true;
+			} else if (l->name) {
+				// a struct, union or enum's tag
+				global.free(l->name);
+				l->name  = NULL;
+				l->typed = true;
+			} else if (!l->typed) {
+				// an old style definition's body, after its parameters' declarations
+				l->keep = true;
+			}
+			break;
+	}
+}
+
+static void closed(linkage_t * l, lex_item.t item) {
+	if (l->depth > 0) l->depth--;
+	if (l->depth > 0) return;
+
+	if (item.value[0] == '}' && (l->body || l->rest)) {
+		end(l);
+	} else if (item.value[0] == ')' && l->parameters && !l->initializer) {
+		l->parameters = false;
+		l->declarator = true;
+	}
+}
+
+/* a token of the module at file scope, in a declaration or between two */
+static void step(linkage_t * l, lex_item.t item) {
+	bool was_declarator = l->declarator;
+	l->declarator = false;
+
+	switch (item.type) {
+		case item_preprocessor:
+			l->keep = true;
+			return;
+
+		case item_id:
+			if (l->initializer) return;
+			if (was_declarator) l->keep = true;
+			if (strcmp(item.value, "extern") == 0) {
+				l->external = true;
+				return;
+			}
+			if (reserved(item.value)) l->keep = true;
+			if (strcmp(item.value, "typedef") == 0) l->type = true;
+			if (l->name) {
+				global.free(l->name);
+				l->typed = true;
+			}
+			l->name = strdup(item.value);
+			return;
+
+		case item_symbol:
+			switch (item.value[0]) {
+				case ';':
+					if (!l->initializer) declare(l, false);
+					end(l);
+					return;
+				case ',':
+					if (!l->initializer) declare(l, false);
+					l->initializer = false;
+					return;
+				case '=':
+					if (l->initializer) return;
+					if (l->name == NULL && !l->typed) l->keep = true;
+					declare(l, false);
+					l->initializer = true;
+					return;
+				case '*':
+					if (l->initializer) return;
+					if (l->name) {
+						global.free(l->name);
+						l->name = NULL;
+					}
+					l->typed = true;
+					return;
+			}
+			// fall through
+		default:
+			if (!l->initializer) l->keep = true;
+	}
+}
+
+/* `item` was just written for `p`'s package */
+export void see(parser.t * p, lex_item.t item) {
+	linkage_t * l = held(p->pkg);
+	if (l == NULL) return;
+
+	switch (item.type) {
+		case item_whitespace:
+		case item_comment:
+		case item_eof:
+		case item_error:
+			return;
+		default:
+			break;
+	}
+
+	if (!l->open) {
+		if (item.type == item_preprocessor) return;
+
+		bool after = l->after;
+		l->after = false;
+		if (after && item.type == item_symbol && is(item, ';')) return;
+
+		begin(l);
+		// an exported function's body or an exported variable's value
+		l->rest = after && (is(item, '{') || is(item, '='));
+		if (l->rest && item.value[0] == '=') {
+			l->initializer = true;
+			return;
+		}
+	}
+
+	switch (item.type) {
+		case item_open_symbol:
+			opened(l, item);
+			return;
+		case item_close_symbol:
+			closed(l, item);
+			return;
+		default:
+			break;
+	}
+
+	if (l->depth > 0) {
+		if (item.type == item_preprocessor) l->keep = true;
+		return;
+	}
+	step(l, item);
+}
+
+/* a keyword statement is next, what it writes is not a declaration of the module's own */
+export void keyword(parser.t * p) {
+	linkage_t * l = held(p->pkg);
+	if (l == NULL) return;
+
+	if (l->open) {
+		l->keep = true;
+		end(l);
+	}
+	l->after = true;
+}
+
+/* an export block, written out as `items`: every name it declares stays as it is */
+export void exported(parser.t * p, lex_item.t * items, size_t n) {
+	linkage_t * l = held(p->pkg);
+	if (l == NULL) return;
+
+	l->after     = false;
+	l->exporting = true;
+	size_t i;
+	for (i = 0; i < n; i++) see(p, items[i]);
+	if (l->open) end(l);
+	l->exporting = false;
+	l->after     = true;
+}
+
+/*
+ * whether `name` is one the module declared so far outside its export blocks, and that
+ * isn't one of its exports: importers don't see its declaration
+ */
+export bool private(parser.t * p, const char * name) {
+	linkage_t * l = held(p->pkg);
+	if (l == NULL || hash_has(p->pkg->symbols, (char *) name)) return false;
+
+	return hash_has(l->declared, (char *) name) && !hash_has(l->shared, (char *) name);
+}
+
+/* marks the declarations that can't be made static as kept */
+static void decide(linkage_t * l, Package.t * pkg) {
+	hash_t * kept = hash_new();
+	size_t i, j;
+
+	hash_each_val(pkg->symbols, {
+		pkg_export.t * exp = (pkg_export.t *) val;
+		if (exp->symbol) hash_set(kept, exp->symbol, NULL);
+	});
+
+	for (i = 0; i < l->n_decls; i++) {
+		decl_t * d = &l->decls[i];
+		if (!d->keep && !d->external) continue;
+		for (j = 0; j < d->n; j++) hash_set(kept, l->names[d->first + j], NULL);
+	}
+
+	// a name kept anywhere keeps every declaration it is in, and the names next to it
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (i = 0; i < l->n_decls; i++) {
+			decl_t * d = &l->decls[i];
+			if (d->keep || d->external) continue;
+
+			for (j = 0; j < d->n; j++) {
+				char * name = l->names[d->first + j];
+				if (!hash_has(l->defined, name) || hash_has(kept, name) || strcmp(name, "main") == 0) break;
+			}
+			if (j == d->n) continue;
+
+			d->keep = changed = true;
+			for (j = 0; j < d->n; j++) hash_set(kept, l->names[d->first + j], NULL);
+		}
+	}
+
+	hash_free(kept);
+}
+
+static void registered(hash_t ** table, const char * name, const char * filename) {
+	if (*table == NULL) *table = hash_new();
+	if (!hash_has(*table, (char *) name)) hash_set(*table, strdup(name), (void *) filename);
+}
+
+/* what this module's names mean for the others', see the comment at the top */
+static void collisions(linkage_t * l, cbuild_ctx.t * ctx) {
+	hash_t * seen = hash_new();
+	size_t i, j;
+	for (i = 0; i < l->n_decls; i++) {
+		decl_t * d = &l->decls[i];
+		if (d->type) continue;
+
+		for (j = 0; j < d->n; j++) {
+			const char * name  = l->names[d->first + j];
+			const char * other = NULL;
+			if (hash_has(seen, (char *) name)) continue;
+			hash_set(seen, (char *) name, NULL);
+
+			if (!d->keep && !d->external) {
+				other = ctx->private_names ? hash_get(ctx->private_names, (char *) name) : NULL;
+				if (other && other != l->filename) {
+					fprintf(stderr, "warning: '%s' is defined in both %s and %s, each now has its own\n",
+							name, other, l->filename);
+				}
+				other = ctx->external_names ? hash_get(ctx->external_names, (char *) name) : NULL;
+				if (other && other != l->filename) {
+					fprintf(stderr, "warning: '%s' is made static in %s, but %s declares it\n",
+							name, l->filename, other);
+				}
+				registered(&ctx->private_names, name, l->filename);
+			} else if (!hash_has(l->defined, (char *) name)) {
+				other = ctx->private_names ? hash_get(ctx->private_names, (char *) name) : NULL;
+				if (other && other != l->filename) {
+					fprintf(stderr, "warning: '%s' is made static in %s, but %s declares it\n",
+							name, other, l->filename);
+				}
+				registered(&ctx->external_names, name, l->filename);
+			}
+		}
+	}
+	hash_free(seen);
+}
+
+/*
+ * Writes what was held for `pkg`, with `static` in front of the declarations that can
+ * have it, and gives the package its own output back. Stops following its declarations.
+ */
+export void release(Package.t * pkg) {
+	linkage_t * l = held(pkg);
+	if (l == NULL) return;
+
+	if (l->open) {
+		l->keep = true;
+		end(l);
+	}
+
+	size_t i;
+	if (l->holding) {
+		// what didn't parse is written as it is, for the compiler to point at
+		stream.t * out = l->out;
+		if (pkg->errors == 0) {
+			decide(l, pkg);
+			collisions(l, pkg->ctx);
+		}
+
+		size_t at = 0;
+		for (i = 0; i < l->n_decls && pkg->errors == 0; i++) {
+			decl_t * d = &l->decls[i];
+			if (d->keep || d->external) continue;
+
+			stream.write(out, l->buf + at, d->offset - at);
+			stream.write(out, "static ", 7);
+			at = d->offset;
+		}
+		stream.write(out, l->buf + at, l->length - at);
+
+		global.free(pkg->out);
+		pkg->out = out;
+	}
+
+	for (i = 0; i < l->n_names; i++) global.free(l->names[i]);
+	global.free(l->names);
+	global.free(l->decls);
+	global.free(l->buf);
+	hash_free(l->defined);
+	hash_free(l->declared);
+	hash_free(l->shared);
+	global.free(l);
+	pkg->linkage = NULL;
+}
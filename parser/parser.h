@@ -17,10 +17,17 @@ typedef struct parser_parser_s {
 	parser_parse_fn       state;
 	lex_item_stack_t      * items;
 	package_t    * pkg;
+	package_t    * waiting;  // the import the next state needs parsed, see await()
+	char         * dir;      // the package's directory, which relative imports start from
+	bool           running;  // resume() is on the stack
 	int            errors;
 } parser_t;
 
-int parser_parse(lex_t * lexer, parser_parse_fn start, package_t * pkg);
+parser_t * parser_new(lex_t * lexer, parser_parse_fn start, package_t * pkg);
+bool parser_ready(parser_t * p);
+bool parser_resume(parser_t * p);
+bool parser_await(parser_t * p, package_t * pkg);
+int parser_finish(parser_t * p);
 
 #include "../lexer/item.h"
 
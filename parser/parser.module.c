@@ -2,6 +2,9 @@ import lex_item from "../lexer/item.module.c";
 import lex      from "../lexer/lex.module.c";
 import stack    from "../lexer/stack.module.c";
 import Package  from "../package/package.module.c";
+import stats    from "../utils/stats.module.c";
+import fs       from "../package/fs.module.c";
+import stream   from "../deps/stream/stream.module.c";
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -17,35 +20,92 @@ export {
 export struct parser_s;
 export typedef void * (*parse_fn)(struct parser_s * lex);
 
+/*
+ * A parser is a task that can be put aside: resume() runs its states until they are
+ * done or one of them waits for an import that is still being parsed. package/index
+ * decides which parser goes on next, so imports don't nest parsers on the C stack.
+ */
 export typedef struct parser_s {
 	lex.t        * lexer;
 	parse_fn       state;
 	stack.t      * items;
 	Package.t    * pkg;
+	Package.t    * waiting;  // the import the next state needs parsed, see await()
+	char         * dir;      // the package's directory, which relative imports start from
+	bool           running;  // resume() is on the stack
 	int            errors;
 } parser_t as t;
 
-export int parse(lex.t * lexer, parse_fn start, Package.t * pkg) {
+export parser_t * new(lex.t * lexer, parse_fn start, Package.t * pkg) {
 	parser_t * p = malloc(sizeof(parser_t));
 	p->lexer     = lexer;
 	p->state     = start;
 	p->items     = stack.new(1);
 	p->pkg       = pkg;
+	p->waiting   = NULL;
+	p->running   = false;
 	p->errors    = 0;
 
-	char * cwd = getcwd(NULL, 0);
+	char * source = strdup(pkg->source_abs);
+	p->dir        = strdup(dirname(source));
+	free(source);
 
-	char * directory = strdup(lexer->filename);
-	chdir(dirname(directory));
-	free(directory);
+	pkg->parser  = p;
+	return p;
+}
+
+static bool blocked(parser_t * p) {
+	return p->waiting != NULL && p->waiting->parser != NULL;
+}
+
+/* whether resume() would get anywhere */
+export bool ready(parser_t * p) {
+	return !p->running && p->state != NULL && !blocked(p);
+}
+
+/*
+ * runs states until `p` is done, which it returns, or has to wait. The working directory
+ * is only moved, and moved back, when it isn't the package's already.
+ */
+export bool resume(parser_t * p) {
+	fs.t * f    = p->pkg->ctx->fs;
+	char * back = NULL;
+	if (strcmp(fs.getcwd(f), p->dir) != 0) {
+		back = strdup(fs.getcwd(f));
+		fs.chdir(f, p->dir);
+	}
+
+	p->running = true;
+	while (p->state != NULL && !blocked(p)) p->state = (parse_fn) p->state(p);
+	p->running = false;
+
+	if (back) fs.chdir(f, back);
+	free(back);
+	return p->state == NULL;
+}
+
+/*
+ * Has `p` wait for `pkg` before its next state, unless `pkg` is already parsed or waits,
+ * by way of its imports, for a parser that is running. A running parser is waiting for
+ * `p` one way or another, so that is a cycle, and the import is used as far as it got,
+ * which is how cycles have always been resolved.
+ */
+export bool await(parser_t * p, Package.t * pkg) {
+	parser_t * q = (parser_t *) pkg->parser;
+	while (q != NULL && !q->running) q = q->waiting ? (parser_t *) q->waiting->parser : NULL;
+	if (pkg->parser == NULL || q != NULL) return false;
 
-	while (p->state != NULL) p->state = (parse_fn) p->state(p);
+	p->waiting = pkg;
+	return true;
+}
 
-	lex.free(lexer);
+/* frees a parser that is done, and returns its number of errors */
+export int finish(parser_t * p) {
+	lex.free(p->lexer);
 	stack.free(p->items);
+	free(p->dir);
+	p->pkg->parser = NULL;
 
-	chdir(cwd);
-	free(cwd);
 	int errors = p->errors;
 	free(p);
 
@@ -64,6 +124,7 @@ export lex_item.t next(parser_t * p) {
 }
 
 export void backup(parser_t *p, lex_item.t item) {
+	STATS_ADD(stat_backups, 1);
 	p->items = stack.push(p->items, item);
 }
 
@@ -138,6 +199,44 @@ export lex_item.t collect(parser_t * p, char ** buf, ssize_t * blen, ...) {
 	return item;
 }
 
+/*
+ * The line starting at `offset` in the module's source, for when the lexer has already
+ * dropped it. The file is read again from the start, which is fine for the odd error.
+ */
+static char * read_line(parser_t * p, size_t offset) {
+	stream.t * in = fs.open_read(p->pkg->ctx->fs, p->pkg->source_abs);
+	if (in->error.code != 0) {
+		stream.close(in);
+		return NULL;
+	}
+
+	char   buf[4096];
+	char * line   = NULL;
+	size_t length = 0;
+	size_t pos    = 0;
+	bool   done   = false;
+
+	ssize_t n;
+	while (!done && (n = stream.read(in, buf, sizeof(buf))) > 0) {
+		size_t from = offset > pos ? offset - pos : 0;
+		size_t to   = from;
+		while (to < (size_t) n && buf[to] != '\n') to++;
+		done = to < (size_t) n;
+		if (done) to++; // keep the newline, verrorf looks for it
+
+		if (from < (size_t) n) {
+			line = realloc(line, length + (to - from) + 1);
+			memcpy(line + length, buf + from, to - from);
+			length += to - from;
+			line[length] = 0;
+		}
+		pos += n;
+	}
+
+	stream.close(in);
+	return line;
+}
+
 export void verrorf(parser_t * p, lex_item.t item, const char * context, const char * fmt, va_list args) {
 	size_t start      = item.start;
 	size_t line       = item.line;
@@ -159,16 +258,20 @@ export void verrorf(parser_t * p, lex_item.t item, const char * context, const c
 		vfprintf(stderr, fmt, args);
 	}
 
-	if (p->lexer->input != NULL && p->lexer->length > line_pos) {
-		char * line_start  = p->lexer->input + line_pos;
-		char * line_end    = strchr(line_start, '\n');
-		int    line_length = line_end == NULL ? col + item.length : line_end - line_start;
+	const char * line_start = lex.at(p->lexer, line_pos);
+	char       * reread     = NULL;
+	if (line_start == NULL && p->lexer->window) line_start = reread = read_line(p, line_pos);
+
+	if (line_start != NULL && *line_start != 0) {
+		const char * line_end    = strchr(line_start, '\n');
+		int          line_length = line_end == NULL ? col + item.length : line_end - line_start;
 
 		fprintf(stderr, RESET "\n%.*s\n", line_length, line_start);
 		fprintf(stderr, GREEN "%*.*s^\n" RESET, col, col, " ");
 	} else {
 		fprintf(stderr, RESET "\n");
 	}
+	free(reread);
 }
 
 export void errorf(parser_t * p, lex_item.t item, const char * context, const char * fmt, ...) {
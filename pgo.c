@@ -0,0 +1,190 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <stdbool.h>
+
+
+#include "profile.h"
+
+/*
+ * Profile guided builds of a profile, with gcc's profiles. Two more profiles are made
+ * from it, each with a directory of its own under the profile's:
+ *
+ *   pgo-gen/  instrumented, every run of the target adds to the .gcda files next to
+ *             its objects
+ *   pgo/      optimized with the .gcda files next to its objects, taken from pgo-gen/
+ *             after training
+ *
+ * gcc looks for an object's profile next to where the object is written, so the ones
+ * pgo-gen/ collected are moved to the same place under pgo/. makefile.object_name() keeps
+ * every object, imports from outside the makefile's directory too, under the directory. A function that changed since
+ * its profile was taken, or a module that has none, is compiled without, so the profiles
+ * stay usable across edits until the next training.
+ */
+
+#define INSTRUMENTED "pgo-gen/"
+#define OPTIMIZED    "pgo/"
+
+typedef struct {
+	profile_t   instrumented;
+	profile_t   optimized;
+	char      * dir;          // the makefile's directory, which the profile directories are under
+} pgo_t;
+
+/* a profile based on `base`, in `sub` under its directory and with `cflags` after its own */
+static void derive(profile_t * p, const profile_t * base, const char * sub, const char * cflags) {
+	char * dir, * flags;
+	asprintf(&dir,   "%s%s", base->dir, sub);
+	asprintf(&flags, "%s %s", base->cflags, cflags);
+
+	*p = *base;
+	p->dir    = dir;
+	p->cflags = flags;
+}
+
+/* profile guided builds of `base`, for the makefile written for `root_module` */
+pgo_t * pgo_new(const profile_t * base, const char * root_module) {
+	char buf[PATH_MAX];
+	if (realpath(root_module, buf) == NULL) return NULL;
+
+	pgo_t * pgo = calloc(1, sizeof(pgo_t));
+	pgo->dir = strdup(dirname(buf));
+
+	// threads would race on the counters without the atomic updates
+	derive(&pgo->instrumented, base, INSTRUMENTED, "-fprofile-generate -fprofile-update=prefer-atomic");
+	derive(&pgo->optimized,    base, OPTIMIZED,
+			"-fprofile-use -fprofile-partial-training -Wno-missing-profile -Wno-coverage-mismatch");
+	return pgo;
+}
+
+static bool ends_with(const char * s, const char * suffix) {
+	size_t length = strlen(s), n = strlen(suffix);
+	return length >= n && strcmp(s + length - n, suffix) == 0;
+}
+
+/*
+ * Every file ending in `suffix` under `from`, moved to the same place under `to`, or
+ * unlinked if `to` is NULL. Returns how many there were.
+ */
+static size_t each(const char * from, const char * to, const char * suffix) {
+	DIR * d = opendir(from);
+	if (d == NULL) return 0;
+	if (to) mkdir(to, 0777);
+
+	size_t n = 0;
+	struct dirent * entry;
+	while ((entry = readdir(d)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+		char * path, * dest = NULL;
+		asprintf(&path, "%s/%s", from, entry->d_name);
+		if (to) asprintf(&dest, "%s/%s", to, entry->d_name);
+
+		struct stat st;
+		if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+			n += each(path, dest, suffix);
+		} else if (ends_with(entry->d_name, suffix)) {
+			if (to ? rename(path, dest) == 0 : unlink(path) == 0) n++;
+		}
+
+		free(path);
+		free(dest);
+	}
+
+	closedir(d);
+	return n;
+}
+
+/* whether there is a file ending in `suffix` anywhere under `dir` */
+static bool any(const char * dir, const char * suffix) {
+	DIR * d = opendir(dir);
+	if (d == NULL) return false;
+
+	bool found = false;
+	struct dirent * entry;
+	while (!found && (entry = readdir(d)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+		char * path;
+		asprintf(&path, "%s/%s", dir, entry->d_name);
+		struct stat st;
+		found = lstat(path, &st) == 0 && (S_ISDIR(st.st_mode) ? any(path, suffix) : ends_with(entry->d_name, suffix));
+		free(path);
+	}
+
+	closedir(d);
+	return found;
+}
+
+static char * in_dir(pgo_t * pgo, const char * sub) {
+	char * path;
+	asprintf(&path, "%s/%s", pgo->dir, sub);
+	return path;
+}
+
+/* whether a training left profiles for the optimized build */
+bool pgo_trained(pgo_t * pgo) {
+	char * optimized = in_dir(pgo, pgo->optimized.dir);
+	bool found = any(optimized, ".gcda");
+	free(optimized);
+	return found;
+}
+
+/*
+ * Runs `command` against the instrumented `target`, already built, with its path in
+ * CBUILD_TARGET, and hands what it collected to the optimized build. The optimized
+ * objects are removed, so make compiles them again with the new profiles. Returns the
+ * command's status, and leaves the old profiles alone if it fails or collects none.
+ */
+int pgo_train(pgo_t * pgo, const char * target, const char * command) {
+	char * instrumented = in_dir(pgo, pgo->instrumented.dir);
+	char * optimized    = in_dir(pgo, pgo->optimized.dir);
+
+	// what an earlier training left would be added to
+	each(instrumented, NULL, ".gcda");
+
+	char * binary;
+	asprintf(&binary, "%s%s", instrumented, target);
+	setenv("CBUILD_TARGET", binary, 1);
+	free(binary);
+
+	printf("%s\n", command);
+	fflush(stdout);
+	int status = system(command);
+
+	if (status == 0 && !any(instrumented, ".gcda")) {
+		fprintf(stderr, "warning: training with '%s' collected no profiles, "
+				"run $CBUILD_TARGET from it\n", command);
+	} else if (status == 0) {
+		each(optimized, NULL, ".gcda");
+		each(instrumented, optimized, ".gcda");
+
+		each(optimized, NULL, ".o");
+		char * linked;
+		asprintf(&linked, "%s%s", optimized, target);
+		unlink(linked);
+		free(linked);
+	}
+
+	free(instrumented);
+	free(optimized);
+	return status;
+}
+
+void pgo_free(pgo_t * pgo) {
+	if (pgo == NULL) return;
+	free((char *) pgo->instrumented.dir);
+	free((char *) pgo->instrumented.cflags);
+	free((char *) pgo->optimized.dir);
+	free((char *) pgo->optimized.cflags);
+	free(pgo->dir);
+	free(pgo);
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef _package_pgo_
+#define _package_pgo_
+
+#include <stdbool.h>
+
+#include "profile.h"
+
+typedef struct {
+	profile_t   instrumented;
+	profile_t   optimized;
+	char      * dir;          // the makefile's directory, which the profile directories are under
+} pgo_t;
+
+pgo_t * pgo_new(const profile_t * base, const char * root_module);
+bool pgo_trained(pgo_t * pgo);
+int pgo_train(pgo_t * pgo, const char * target, const char * command);
+void pgo_free(pgo_t * pgo);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _package_pipeline_
+#define _package_pipeline_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "package/package.h"
+
+typedef struct {
+	pid_t    pid;      // 0 until it is started, -1 once it has been waited for
+	package_t * pkg;
+	char   * object;   // relative to the makefile, as make names it
+	char   * source;
+	char   * flags;    // what it was compiled with
+	bool     ok;
+	FILE   * log;      // the compiler's output, shown once it is known to have succeeded
+	long     estimate; // microseconds of CPU time it is expected to take
+	long     took;     // and did, once it is done
+	int      token;    // from ctx->jobserver, if there is one
+} pipeline_job;
+
+#include "package/context.h"
+#include "profile.h"
+#include "makefile.h"
+
+typedef struct {
+	cbuild_ctx_t * ctx;
+	const char   * root;       // the root module, interned in ctx->paths
+	char         * dir;        // the makefile's directory, where compiles run
+	const profile_t * profile; // NULL for the plain build
+	long           jobs;       // at most this many compiles at once
+	long           running;
+	size_t         n_active;   // the room in `active`
+	pipeline_job        * queue;
+	size_t         length;
+	size_t         capacity;
+	size_t       * waiting;    // indices into queue, a heap with the longest estimate on top
+	size_t         n_waiting;
+	size_t       * active;     // indices into queue of the `running` compiles
+	char         * flags;      // $(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(SHARED_CFLAGS) $(CPPFLAGS) so far, NULL if make has to expand them
+	makefile_assignment_t * assigned; // what the packages' variables add up to so far
+	size_t         variables;  // ctx->n_variables when `assigned` and `flags` were worked out
+	bool           evaluated;
+	char         * times_path;
+	hash_t       * times;      // object -> microseconds it took last time, as an intptr_t
+	double         known_time; // the recorded times of this build's objects
+	double         known_size; // and the sizes of their sources, to guess the others from
+} pipeline_t;
+
+pipeline_t * pipeline_new(cbuild_ctx_t * ctx, const char * root_module, const profile_t * prof, long jobs);
+void pipeline_finish(pipeline_t * p);
+void pipeline_free(pipeline_t * p);
+
+#endif
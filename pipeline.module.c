@@ -0,0 +1,565 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+export {
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+}
+
+build depends "deps/hash/hash.c";
+#include "deps/hash/hash.h"
+
+import Package    from "package/package.module.c";
+import cbuild_ctx from "package/context.module.c";
+import paths      from "package/paths.module.c";
+import makefile   from "makefile.module.c";
+import utils      from "utils/utils.module.c";
+import uring      from "utils/uring.module.c";
+import jobserver  from "utils/jobserver.module.c";
+import profile    from "profile.module.c";
+
+/*
+ * Compiling objects while the rest of the graph is still being generated. A package's
+ * .c is complete, and the headers of its imports written, once index is done with it,
+ * so its object is compiled right away the way the makefile's pattern rule would. make
+ * runs afterwards as it always has and finds those objects up to date; anything that
+ * changed underneath them (a header written again for a cycle, flags appended by a
+ * package parsed later) is newer than the object or removed by finish(), and make
+ * compiles it again.
+ *
+ * Objects only depend on generated headers, never on each other, so the longest path
+ * through the build is the longest compile followed by the link. Of the objects waiting
+ * for a free job the one expected to take longest is started first: the CPU time it took
+ * last time, kept next to the makefile in <root>.times, or for an object never compiled
+ * before a guess from the size of its .c.
+ *
+ * With a build profile the objects go under its directory, with its flags, as make would
+ * compile them, and a shared library's under pic/ below that.
+ *
+ * Under a jobserver every compile holds one of its tokens. This process' own token is
+ * the parse's until finish(), and the first compile's after that.
+ */
+
+#define TIMES_MAGIC "cbuild times 1"
+
+export typedef struct {
+	pid_t    pid;      // 0 until it is started, -1 once it has been waited for
+	Package.t * pkg;
+	char   * object;   // relative to the makefile, as make names it
+	char   * source;
+	char   * flags;    // what it was compiled with
+	bool     ok;
+	FILE   * log;      // the compiler's output, shown once it is known to have succeeded
+	long     estimate; // microseconds of CPU time it is expected to take
+	long     took;     // and did, once it is done
+	int      token;    // from ctx->jobserver, if there is one
+} job_t as job;
+
+export typedef struct {
+	cbuild_ctx.t * ctx;
+	const char   * root;       // the root module, interned in ctx->paths
+	char         * dir;        // the makefile's directory, where compiles run
+	const profile.t * profile; // NULL for the plain build
+	long           jobs;       // at most this many compiles at once
+	long           running;
+	size_t         n_active;   // the room in `active`
+	job_t        * queue;
+	size_t         length;
+	size_t         capacity;
+	size_t       * waiting;    // indices into queue, a heap with the longest estimate on top
+	size_t         n_waiting;
+	size_t       * active;     // indices into queue of the `running` compiles
+	char         * flags;      // $(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(SHARED_CFLAGS) $(CPPFLAGS) so far, NULL if make has to expand them
+	makefile.assignment_t * assigned; // what the packages' variables add up to so far
+	size_t         variables;  // ctx->n_variables when `assigned` and `flags` were worked out
+	bool           evaluated;
+	char         * times_path;
+	hash_t       * times;      // object -> microseconds it took last time, as an intptr_t
+	double         known_time; // the recorded times of this build's objects
+	double         known_size; // and the sizes of their sources, to guess the others from
+} pipeline_t as t;
+
+static Package.t * root_package(pipeline_t * p) {
+	return (Package.t *) hash_get(p->ctx->path_cache, (char *) p->root);
+}
+
+/* the variables' values as the makefile stands so far, worked out again only when they could have changed */
+static makefile.assignment_t * assigned(pipeline_t * p, Package.t * root) {
+	if (p->assigned && p->variables == p->ctx->n_variables) return p->assigned;
+
+	makefile.free_assignment(p->assigned);
+	p->assigned  = makefile.assignment(root);
+	p->variables = p->ctx->n_variables;
+	p->evaluated = false;
+	return p->assigned;
+}
+
+/* what `object`'s object is compiled with, or any object without `build local` variables for NULL */
+static char * evaluate(pipeline_t * p, Package.t * root, Package.t * object) {
+	makefile.assignment_t * vars = assigned(p, root);
+	char * cc       = makefile.lookup(vars, object, "CC");
+	char * cflags   = makefile.lookup(vars, object, "CFLAGS");
+	char * cppflags = makefile.lookup(vars, object, "CPPFLAGS");
+
+	const char * extra  = p->profile ? p->profile->cflags : "";
+	const char * shared = makefile.shared_flags(root, object);
+	char * flags = NULL;
+	if (cc && cflags && cppflags) {
+		asprintf(&flags, "%s %s %s%s%s%s%s", cc, cflags, extra, extra[0] ? " " : "",
+				shared ? shared : "", shared ? " " : "", cppflags);
+	}
+
+	global.free(cc);
+	global.free(cflags);
+	global.free(cppflags);
+	return flags;
+}
+
+/* the compiler and flags as the makefile stands so far, worked out again only when they could have changed */
+static const char * flags(pipeline_t * p) {
+	Package.t * root = root_package(p);
+	assigned(p, root);
+	if (p->evaluated) return p->flags;
+
+	global.free(p->flags);
+	p->flags     = evaluate(p, root, NULL);
+	p->evaluated = true;
+	return p->flags;
+}
+
+/* whether `pkg` is compiled with flags of its own, `build local` ones or a public object's in a shared library */
+static bool own_flags(Package.t * root, Package.t * pkg) {
+	int i;
+	for (i = 0; i < pkg->n_variables; i++) {
+		if (pkg->variables[i].local) return true;
+	}
+
+	const char * shared = makefile.shared_flags(root, pkg);
+	return shared && strcmp(shared, makefile.shared_flags(root, NULL)) != 0;
+}
+
+/* the flags for `job` as the makefile stands so far, NULL if make has to expand them */
+static char * job_flags(pipeline_t * p, job_t * job) {
+	if (own_flags(root_package(p), job->pkg)) return evaluate(p, root_package(p), job->pkg);
+
+	const char * shared = flags(p);
+	return shared ? strdup(shared) : NULL;
+}
+
+/* adds the times <root>.times has for objects `times` doesn't have yet */
+static void read_times(pipeline_t * p) {
+	FILE * in = fopen(p->times_path, "r");
+	if (in == NULL) return;
+
+	char * line = NULL;
+	size_t size = 0;
+	ssize_t n = getline(&line, &size, in);
+	bool valid = n > 0 && strncmp(line, TIMES_MAGIC "\n", n) == 0;
+
+	while (valid && (n = getline(&line, &size, in)) > 0) {
+		if (line[n - 1] == '\n') line[n - 1] = 0;
+		char * tab = strchr(line, '\t');
+		if (tab == NULL) continue;
+		*tab = 0;
+
+		long took = strtol(tab + 1, NULL, 10);
+		if (took > 0 && !hash_has(p->times, line)) hash_set(p->times, strdup(line), (void *) (intptr_t) took);
+	}
+
+	global.free(line);
+	fclose(in);
+}
+
+static void load_times(pipeline_t * p) {
+	p->times = hash_new();
+	read_times(p);
+}
+
+static int by_key(const void * a, const void * b) {
+	return strcmp(*(const char **) a, *(const char **) b);
+}
+
+/*
+ * The times this build measured, and for every object it didn't compile, the up to date
+ * ones and those of other profiles, the time the file has. It is read again, a build with
+ * another profile may have saved its own since this one loaded it.
+ */
+static void save_times(pipeline_t * p) {
+	size_t i;
+	for (i = 0; i < p->length; i++) {
+		job_t * job = &p->queue[i];
+		if (!job->ok) continue;
+
+		if (!hash_has(p->times, job->object)) {
+			hash_set(p->times, strdup(job->object), NULL);
+		}
+		hash_set(p->times, job->object, (void *) (intptr_t) (job->took > 0 ? job->took : 1));
+	}
+	read_times(p);
+
+	const char ** keys = malloc((hash_size(p->times) + 1) * sizeof(char *));
+	size_t n = 0;
+	hash_each_key(p->times, {
+		keys[n++] = key;
+	});
+	qsort(keys, n, sizeof(char *), by_key);
+
+	char * temp;
+	asprintf(&temp, "%s.tmp", p->times_path);
+	FILE * out = fopen(temp, "w");
+	if (out != NULL) {
+		fprintf(out, TIMES_MAGIC "\n");
+		for (i = 0; i < n; i++) {
+			fprintf(out, "%s\t%ld\n", keys[i], (long) (intptr_t) hash_get(p->times, (char *) keys[i]));
+		}
+		if (fclose(out) == 0) rename(temp, p->times_path);
+		else unlink(temp);
+	}
+
+	global.free(temp);
+	global.free(keys);
+}
+
+static char * in_dir(pipeline_t * p, const char * rel) {
+	char * path;
+	asprintf(&path, "%s/%s", p->dir, rel);
+	return path;
+}
+
+/* the directories `job`'s object goes in, as the pattern rule's mkdir makes them */
+static void make_dirs(pipeline_t * p, job_t * job) {
+	char * path = in_dir(p, job->object);
+	char * c = path + strlen(p->dir) + 1;
+	while ((c = strchr(c, '/')) != NULL) {
+		*c = 0;
+		mkdir(path, 0777);
+		*c++ = '/';
+	}
+	global.free(path);
+}
+
+/* what `job` took last time, or what objects of its size took, in microseconds */
+static long estimate(pipeline_t * p, job_t * job) {
+	char * source = in_dir(p, job->source);
+	struct stat st;
+	double size = stat(source, &st) == 0 ? (double) st.st_size : 0;
+	global.free(source);
+
+	if (hash_has(p->times, job->object)) {
+		long took = (long) (intptr_t) hash_get(p->times, job->object);
+		p->known_time += took;
+		p->known_size += size;
+		return took;
+	}
+
+	// with nothing recorded only the order matters, a microsecond a byte keeps it
+	double per_byte = p->known_size > 0 ? p->known_time / p->known_size : 1;
+	return (long) (size * per_byte) + 1;
+}
+
+static bool longer(pipeline_t * p, size_t a, size_t b) {
+	return p->queue[p->waiting[a]].estimate > p->queue[p->waiting[b]].estimate;
+}
+
+static void swap(pipeline_t * p, size_t a, size_t b) {
+	size_t t = p->waiting[a];
+	p->waiting[a] = p->waiting[b];
+	p->waiting[b] = t;
+}
+
+static void push(pipeline_t * p, size_t index) {
+	size_t i = p->n_waiting++;
+	p->waiting[i] = index;
+	while (i > 0 && longer(p, i, (i - 1) / 2)) {
+		swap(p, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static size_t pop(pipeline_t * p) {
+	size_t top = p->waiting[0];
+	p->waiting[0] = p->waiting[--p->n_waiting];
+
+	size_t i = 0;
+	while (true) {
+		size_t child = 2 * i + 1;
+		if (child >= p->n_waiting) break;
+		if (child + 1 < p->n_waiting && longer(p, child + 1, child)) child++;
+		if (!longer(p, child, i)) break;
+		swap(p, i, child);
+		i = child;
+	}
+	return top;
+}
+
+/* starts `index`, which takes `flags` and `token` */
+static void spawn(pipeline_t * p, size_t index, char * flags, int token) {
+	job_t * job = &p->queue[index];
+	job->token = token;
+	char * cmd;
+	asprintf(&cmd, "%s -c -o %s %s", flags, job->object, job->source);
+	job->flags = flags;
+	job->log   = tmpfile();
+	make_dirs(p, job);
+
+	printf("%s\n", cmd);
+	fflush(stdout);
+	fflush(stderr);
+
+	pid_t pid = job->log ? fork() : -1;
+	if (pid == 0) {
+		if (chdir(p->dir) == 0) {
+			dup2(fileno(job->log), STDOUT_FILENO);
+			dup2(fileno(job->log), STDERR_FILENO);
+			execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+		}
+		_exit(127);
+	}
+	global.free(cmd);
+
+	if (pid < 0) {
+		// make compiles it instead
+		job->pid = -1;
+		if (p->ctx->jobserver) jobserver.release(p->ctx->jobserver, token);
+		return;
+	}
+	job->pid = pid;
+
+	if (p->running == p->n_active) {
+		p->n_active = p->n_active ? p->n_active * 2 : 16;
+		p->active   = realloc(p->active, p->n_active * sizeof(size_t));
+	}
+	p->active[p->running++] = index;
+}
+
+static void start(pipeline_t * p) {
+	jobserver.t * js = p->ctx->jobserver;
+	while (p->running < p->jobs && p->n_waiting > 0) {
+		if (flags(p) == NULL) return;
+
+		job_t * job = &p->queue[p->waiting[0]];
+		char * f = job_flags(p, job);
+		if (f == NULL) {
+			// its own flags need make to expand them, it is left to make
+			pop(p);
+			job->pid = -1;
+			continue;
+		}
+
+		int token = 0;
+		if (js && !jobserver.acquire(js, &token)) {
+			global.free(f);
+			return;
+		}
+		spawn(p, pop(p), f, token);
+	}
+}
+
+static void done(pipeline_t * p, job_t * job, int status, struct rusage * usage) {
+	job->pid  = -1;
+	job->ok   = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	job->took = usage->ru_utime.tv_sec * 1000000L + usage->ru_utime.tv_usec
+	          + usage->ru_stime.tv_sec * 1000000L + usage->ru_stime.tv_usec;
+
+	if (job->ok) {
+		// warnings, shown once since make won't compile it again
+		char buf[4096];
+		size_t n;
+		rewind(job->log);
+		while ((n = fread(buf, 1, sizeof(buf), job->log)) > 0) fwrite(buf, 1, n, stderr);
+	} else {
+		// make compiles it again and reports the errors, with the build stopping where it should
+		char * object = in_dir(p, job->object);
+		unlink(object);
+		global.free(object);
+	}
+	fclose(job->log);
+	job->log = NULL;
+
+	if (p->ctx->jobserver) jobserver.release(p->ctx->jobserver, job->token);
+}
+
+/* whether `pid` is one of the running compiles */
+static bool ours(pipeline_t * p, pid_t pid) {
+	long i;
+	for (i = 0; i < p->running; i++) {
+		if (p->queue[p->active[i]].pid == pid) return true;
+	}
+	return false;
+}
+
+/*
+ * waits for one compile to be done, or only checks unless `blocking`. Only the compiles'
+ * pids are waited for, children the embedder started are left to whoever waits for them.
+ */
+static bool reap(pipeline_t * p, bool blocking) {
+	struct timespec pause = { 0, 1000000 };
+	while (p->running > 0) {
+		long i;
+		for (i = 0; i < p->running; i++) {
+			job_t * job = &p->queue[p->active[i]];
+
+			// the compile's CPU time, including the compiler sh ran
+			int status;
+			struct rusage usage;
+			pid_t pid = wait4(job->pid, &status, WNOHANG, &usage);
+			if (pid == 0 || (pid < 0 && errno == EINTR)) continue;
+			if (pid < 0) {
+				// someone else waited for it, make compiles it again
+				status = W_EXITCODE(127, 0);
+				memset(&usage, 0, sizeof(usage));
+			}
+
+			done(p, job, status, &usage);
+			p->active[i] = p->active[--p->running];
+			return true;
+		}
+		if (!blocking) return false;
+
+		// sleeps until some child is done without reaping it, if it isn't a compile its
+		// owner reaps it, meanwhile the compiles are checked again every millisecond
+		siginfo_t info;
+		info.si_pid = 0;
+		if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) < 0 && errno != EINTR) return false;
+		if (info.si_pid != 0 && !ours(p, info.si_pid)) nanosleep(&pause, NULL);
+	}
+	return false;
+}
+
+static void written(cbuild_ctx.t * ctx, void * _pkg) {
+	pipeline_t * p   = (pipeline_t *) ctx->written_ctx;
+	Package.t  * pkg = (Package.t *) _pkg;
+	Package.t  * root = root_package(p);
+	if (root == NULL || pkg->c_file || pkg->errors > 0) return;
+
+	if (p->dir == NULL) {
+		char * buf = strdup(root->generated);
+		p->dir = strdup(dirname(buf));
+		global.free(buf);
+	}
+
+	if (p->length == p->capacity) {
+		p->capacity = p->capacity ? p->capacity * 2 : 64;
+		p->queue    = realloc(p->queue,   p->capacity * sizeof(job_t));
+		p->waiting  = realloc(p->waiting, p->capacity * sizeof(size_t));
+	}
+	job_t * job = &p->queue[p->length];
+	*job = (job_t) {0};
+	job->pkg    = pkg;
+	job->source = utils.relative(root->generated, pkg->generated);
+	char * object = makefile.object_name(root, pkg);
+	asprintf(&job->object, "%s%s", profile.dir(p->profile), object);
+	global.free(object);
+	job->estimate = estimate(p, job);
+	push(p, p->length++);
+
+	while (reap(p, false));
+	// io_uring only puts the files in place at atomic.finish(), until then they wait
+	if (!uring.available(p->ctx->disk.writes.ring)) start(p);
+}
+
+/*
+ * Starts compiling the packages generated in `ctx` from now on, as part of the build of
+ * `root_module` with `prof`, up to `jobs` of them at once, and no more than
+ * ctx->jobserver has tokens for.
+ */
+export pipeline_t * new(cbuild_ctx.t * ctx, const char * root_module, const profile.t * prof, long jobs) {
+	const char * root = paths.realpath(ctx->paths, root_module);
+	if (root == NULL || jobs < 1) return NULL;
+
+	pipeline_t * p = calloc(1, sizeof(pipeline_t));
+	p->ctx    = ctx;
+	p->root   = root;
+	p->jobs   = jobs;
+	p->profile = prof;
+
+	p->times_path = malloc(strlen(root) + strlen("times") + 1);
+	strcpy(p->times_path, root);
+	strcpy(p->times_path + strlen(root) - strlen("module.c"), "times");
+	load_times(p);
+
+	ctx->written     = written;
+	ctx->written_ctx = p;
+	return p;
+}
+
+/*
+ * Compiles what is still waiting, with the flags the finished makefile has, and waits for
+ * all of it. Objects compiled with flags that have changed since are removed, so make
+ * compiles them again. Call after the makefile is written and atomic.finish().
+ */
+export void finish(pipeline_t * p) {
+	if (p == NULL) return;
+	p->ctx->written = NULL;
+
+	Package.t * root = root_package(p);
+	if (root == NULL) return;
+
+	// the graph is complete now, whatever was worked out from part of it is worked out again
+	makefile.free_assignment(p->assigned);
+	p->assigned = NULL;
+	global.free(p->flags);
+	p->flags     = evaluate(p, root, NULL);
+	p->evaluated = true;
+
+	// the parse is done, this process' own token goes to a compile
+	jobserver.set_idle(p->ctx->jobserver, true);
+	do start(p); while (reap(p, true));
+	jobserver.set_idle(p->ctx->jobserver, false);
+
+	size_t i;
+	for (i = 0; i < p->length; i++) {
+		job_t * job = &p->queue[i];
+		if (!job->ok) continue;
+
+		char * final = job_flags(p, job);
+		bool   same  = final && strcmp(job->flags, final) == 0;
+		global.free(final);
+		if (same) continue;
+
+		job->ok = false;
+		char * object = in_dir(p, job->object);
+		unlink(object);
+		global.free(object);
+	}
+
+	save_times(p);
+}
+
+export void free(pipeline_t * p) {
+	if (p == NULL) return;
+	if (p->ctx->written_ctx == p) p->ctx->written = NULL;
+
+	// nothing is left running behind make's back
+	while (reap(p, true));
+
+	size_t i;
+	for (i = 0; i < p->length; i++) {
+		if (p->queue[i].log) fclose(p->queue[i].log);
+		global.free(p->queue[i].object);
+		global.free(p->queue[i].source);
+		global.free(p->queue[i].flags);
+	}
+	hash_each_key(p->times, {
+		global.free((char *) key);
+	});
+	hash_free(p->times);
+
+	global.free(p->queue);
+	global.free(p->waiting);
+	global.free(p->active);
+	global.free(p->flags);
+	makefile.free_assignment(p->assigned);
+	global.free(p->dir);
+	global.free(p->times_path);
+	global.free(p);
+}
@@ -0,0 +1,86 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Named builds of the same makefile. Every package's object, and the target linked from
+ * them, goes under the profile's own directory next to the makefile, so switching from
+ * one profile to another and back finds the objects of each up to date. The makefile
+ * itself doesn't change: the profile is handed to make on its command line as
+ *
+ *   PROFILE_DIR      prefix of every object and the target, with its trailing '/'
+ *   PROFILE_CFLAGS   compiled and linked with, after the packages' CFLAGS
+ *   PROFILE_LDFLAGS  linked with, after the packages' LDFLAGS
+ *   AR               the archiver for a library, unless the environment names one
+ *
+ * and a build without a profile leaves them empty, as it always was.
+ */
+
+typedef struct {
+	const char * name;
+	const char * dir;
+	const char * cflags;
+	const char * ldflags;
+	const char * ar;       // NULL for make's own
+} profile_t;
+
+static const profile_t profiles[] = {
+	{
+		.name    = "debug",
+		.dir     = ".cbuild/debug/",
+		.cflags  = "-O0 -g",
+		.ldflags = "",
+	},
+	{
+		// whole program optimization, the link on as many jobs as the jobserver allows, and what
+		// no function or data reaches dropped
+		.name    = "release",
+		.dir     = ".cbuild/release/",
+		.cflags  = "-O2 -flto -ffunction-sections -fdata-sections",
+		.ldflags = "-flto=auto -Wl,--gc-sections",
+		.ar      = "gcc-ar",
+	},
+};
+
+#define N_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+/* the profile called `name`, NULL if there is none */
+const profile_t * profile_find(const char * name) {
+	size_t i;
+	for (i = 0; i < N_PROFILES; i++) {
+		if (strcmp(profiles[i].name, name) == 0) return &profiles[i];
+	}
+	return NULL;
+}
+
+/* the names of the profiles, separated by ", " for messages */
+char * profile_names() {
+	char * list = strdup("");
+	size_t i;
+	for (i = 0; i < N_PROFILES; i++) {
+		char * next;
+		asprintf(&next, "%s%s%s", list, i ? ", " : "", profiles[i].name);
+		free(list);
+		list = next;
+	}
+	return list;
+}
+
+/* the prefix of the objects and target of `p`, "" without a profile */
+const char * profile_dir(const profile_t * p) {
+	return p ? p->dir : "";
+}
+
+/* the variables to run make with for `p`, "" without a profile */
+char * profile_make_args(const profile_t * p) {
+	if (p == NULL) return strdup("");
+
+	const char * ar = p->ar && getenv("AR") == NULL ? p->ar : NULL;
+
+	char * args;
+	asprintf(&args, "PROFILE_DIR='%s' PROFILE_CFLAGS='%s' PROFILE_LDFLAGS='%s'%s%s",
+			p->dir, p->cflags, p->ldflags, ar ? " AR=" : "", ar ? ar : "");
+	return args;
+}
\ No newline at end of file
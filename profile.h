@@ -0,0 +1,17 @@
+#ifndef _package_profile_
+#define _package_profile_
+
+typedef struct {
+	const char * name;
+	const char * dir;
+	const char * cflags;
+	const char * ldflags;
+	const char * ar;       // NULL for make's own
+} profile_t;
+
+const profile_t * profile_find(const char * name);
+char * profile_names();
+const char * profile_dir(const profile_t * p);
+char * profile_make_args(const profile_t * p);
+
+#endif
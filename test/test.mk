@@ -1,85 +1,243 @@
+OBJECTS_test := \
+	$(PROFILE_DIR)test.o \
+	$(PROFILE_DIR)__/deps/hash/hash.o \
+	$(PROFILE_DIR)__/deps/stream/stream.o \
+	$(PROFILE_DIR)__/lexer/item.o \
+	$(PROFILE_DIR)__/utils/strings.o \
+	$(PROFILE_DIR)__/lexer/lex.o \
+	$(PROFILE_DIR)__/lexer/buffer.o \
+	$(PROFILE_DIR)__/utils/stats.o \
+	$(PROFILE_DIR)__/utils/utils.o \
+	$(PROFILE_DIR)__/lexer/parallel.o \
+	$(PROFILE_DIR)__/lexer/syntax.o \
+	$(PROFILE_DIR)__/makefile.o \
+	$(PROFILE_DIR)__/package/context.o \
+	$(PROFILE_DIR)__/package/fs.o \
+	$(PROFILE_DIR)__/deps/stream/file.o \
+	$(PROFILE_DIR)__/package/atomic-stream.o \
+	$(PROFILE_DIR)__/utils/uring.o \
+	$(PROFILE_DIR)__/package/paths.o \
+	$(PROFILE_DIR)__/utils/jobserver.o \
+	$(PROFILE_DIR)__/package/export.o \
+	$(PROFILE_DIR)__/package/package.o \
+	$(PROFILE_DIR)__/package/import.o \
+	$(PROFILE_DIR)__/profile.o \
+	$(PROFILE_DIR)__/manifest.o \
+	$(PROFILE_DIR)__/package/index.o \
+	$(PROFILE_DIR)__/parser/grammer.o \
+	$(PROFILE_DIR)__/parser/build.o \
+	$(PROFILE_DIR)__/parser/parser.o \
+	$(PROFILE_DIR)__/lexer/stack.o \
+	$(PROFILE_DIR)__/parser/string.o \
+	$(PROFILE_DIR)__/parser/export.o \
+	$(PROFILE_DIR)__/parser/identifier.o \
+	$(PROFILE_DIR)__/parser/linkage.o \
+	$(PROFILE_DIR)__/parser/import.o \
+	$(PROFILE_DIR)__/parser/package.o \
+	$(PROFILE_DIR)__/package/memfs.o \
+	$(PROFILE_DIR)__/pgo.o \
+	$(PROFILE_DIR)string-stream.o
+
+$(PROFILE_DIR)test: $(OBJECTS_test)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(LDFLAGS) $(PROFILE_LDFLAGS) $(OBJECTS_test) -o $@ $(LDLIBS)
+
+CLEAN_test:
+	rm -rf $(PROFILE_DIR)test $(OBJECTS_test)
+
+$(PROFILE_DIR)%.o: %.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
 #dependencies for package 'test.c'
 CFLAGS += -std=c99
 CFLAGS += -D_DEFAULT_SOURCE
 CFLAGS += -D_GNU_SOURCE
 CFLAGS += -g3
 CFLAGS += -DMEM_DEBUG
-test.o: test.c ../deps/stream/stream.h string-stream.h ../lexer/item.h ../package/package.h ../package/export.h ../package/index.h
+CFLAGS += -DCBUILD_STATS
+$(PROFILE_DIR)test.o: test.c ../deps/stream/stream.h ../lexer/item.h ../lexer/lex.h ../lexer/parallel.h ../lexer/syntax.h ../makefile.h ../manifest.h ../package/atomic-stream.h ../package/context.h ../package/export.h ../package/fs.h ../package/index.h ../package/memfs.h ../package/package.h ../package/paths.h ../pgo.h ../profile.h string-stream.h ../utils/stats.h ../utils/uring.h
 
-#dependencies for package '../deps/stream/stream.c'
-../deps/stream/stream.o: ../deps/stream/stream.c
+#dependencies for package '../deps/hash/hash.c'
+$(PROFILE_DIR)__/deps/hash/hash.o: ../deps/hash/hash.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package 'string-stream.c'
-string-stream.o: string-stream.c ../deps/stream/stream.h
+#dependencies for package '../deps/stream/stream.c'
+$(PROFILE_DIR)__/deps/stream/stream.o: ../deps/stream/stream.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
 #dependencies for package '../lexer/item.c'
-../lexer/item.o: ../lexer/item.c ../utils/strings.h
+$(PROFILE_DIR)__/lexer/item.o: ../lexer/item.c ../utils/strings.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
 #dependencies for package '../utils/strings.c'
-../utils/strings.o: ../utils/strings.c
+$(PROFILE_DIR)__/utils/strings.o: ../utils/strings.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../package/package.c'
-../package/package.o: ../package/package.c ../deps/stream/stream.h
+#dependencies for package '../lexer/lex.c'
+$(PROFILE_DIR)__/lexer/lex.o: ../lexer/lex.c ../deps/stream/stream.h ../lexer/buffer.h ../lexer/item.h ../utils/stats.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../deps/hash/hash.c'
-../deps/hash/hash.o: ../deps/hash/hash.c
+#dependencies for package '../lexer/buffer.c'
+$(PROFILE_DIR)__/lexer/buffer.o: ../lexer/buffer.c ../lexer/item.h ../utils/stats.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../package/export.c'
-../package/export.o: ../package/export.c ../deps/stream/stream.h ../utils/utils.h ../utils/strings.h ../package/atomic-stream.h ../package/package.h
+#dependencies for package '../utils/stats.c'
+$(PROFILE_DIR)__/utils/stats.o: ../utils/stats.c ../lexer/item.h ../utils/utils.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
 #dependencies for package '../utils/utils.c'
-../utils/utils.o: ../utils/utils.c
+$(PROFILE_DIR)__/utils/utils.o: ../utils/utils.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../package/atomic-stream.c'
-../package/atomic-stream.o: ../package/atomic-stream.c ../deps/stream/stream.h
+#dependencies for package '../lexer/parallel.c'
+LDLIBS += -lpthread
+$(PROFILE_DIR)__/lexer/parallel.o: ../lexer/parallel.c ../deps/stream/stream.h ../lexer/buffer.h ../lexer/item.h ../lexer/lex.h ../utils/stats.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../package/index.c'
-../package/index.o: ../package/index.c ../deps/stream/stream.h ../utils/utils.h ../parser/grammer.h ../package/export.h ../package/import.h ../package/package.h ../package/atomic-stream.h ../deps/stream/file.h ../parser/parser.h
+#dependencies for package '../lexer/syntax.c'
+$(PROFILE_DIR)__/lexer/syntax.o: ../lexer/syntax.c ../deps/stream/stream.h ../lexer/item.h ../lexer/lex.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../parser/grammer.c'
-../parser/grammer.o: ../parser/grammer.c ../deps/stream/stream.h ../parser/parser.h ../lexer/item.h ../lexer/syntax.h ../parser/import.h ../package/package.h ../parser/package.h ../parser/export.h ../parser/identifier.h ../parser/build.h ../lexer/lex.h
+#dependencies for package '../makefile.c'
+$(PROFILE_DIR)__/makefile.o: ../makefile.c ../deps/stream/stream.h ../package/context.h ../package/export.h ../package/fs.h ../package/import.h ../package/package.h ../profile.h ../utils/stats.h ../utils/utils.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../parser/parser.c'
-../parser/parser.o: ../parser/parser.c ../lexer/stack.h ../lexer/item.h ../package/package.h ../lexer/lex.h
+#dependencies for package '../package/context.c'
+$(PROFILE_DIR)__/package/context.o: ../package/context.c ../package/fs.h ../package/paths.h ../utils/jobserver.h ../utils/stats.h ../utils/uring.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../lexer/stack.c'
-../lexer/stack.o: ../lexer/stack.c ../lexer/item.h
+#dependencies for package '../package/fs.c'
+$(PROFILE_DIR)__/package/fs.o: ../package/fs.c ../deps/stream/file.h ../deps/stream/stream.h ../package/atomic-stream.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../lexer/lex.c'
-../lexer/lex.o: ../lexer/lex.c ../deps/stream/stream.h ../lexer/buffer.h ../lexer/item.h
+#dependencies for package '../deps/stream/file.c'
+$(PROFILE_DIR)__/deps/stream/file.o: ../deps/stream/file.c ../deps/stream/stream.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../lexer/buffer.c'
-../lexer/buffer.o: ../lexer/buffer.c ../lexer/item.h
+#dependencies for package '../package/atomic-stream.c'
+$(PROFILE_DIR)__/package/atomic-stream.o: ../package/atomic-stream.c ../deps/stream/stream.h ../utils/uring.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../lexer/syntax.c'
-../lexer/syntax.o: ../lexer/syntax.c ../lexer/lex.h ../deps/stream/stream.h
+#dependencies for package '../utils/uring.c'
+$(PROFILE_DIR)__/utils/uring.o: ../utils/uring.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../parser/import.c'
-../parser/import.o: ../parser/import.c ../parser/string.h ../utils/utils.h ../lexer/item.h ../utils/strings.h ../package/package.h ../package/import.h ../parser/parser.h
+#dependencies for package '../package/paths.c'
+$(PROFILE_DIR)__/package/paths.o: ../package/paths.c ../deps/stream/stream.h ../package/fs.h ../utils/stats.h ../utils/utils.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../parser/string.c'
-../parser/string.o: ../parser/string.c
+#dependencies for package '../utils/jobserver.c'
+$(PROFILE_DIR)__/utils/jobserver.o: ../utils/jobserver.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../package/export.c'
+$(PROFILE_DIR)__/package/export.o: ../package/export.c ../deps/stream/stream.h ../package/context.h ../package/package.h ../package/paths.h ../utils/stats.h ../utils/strings.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../package/package.c'
+$(PROFILE_DIR)__/package/package.o: ../package/package.c ../deps/stream/stream.h ../package/context.h ../utils/stats.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
 #dependencies for package '../package/import.c'
-../package/import.o: ../package/import.c ../package/package.h ../package/export.h
+$(PROFILE_DIR)__/package/import.o: ../package/import.c ../package/export.h ../package/package.h ../package/paths.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../parser/package.c'
-../parser/package.o: ../parser/package.c ../parser/string.h ../utils/strings.h ../lexer/item.h ../parser/parser.h
+#dependencies for package '../profile.c'
+$(PROFILE_DIR)__/profile.o: ../profile.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../manifest.c'
+$(PROFILE_DIR)__/manifest.o: ../manifest.c ../deps/stream/stream.h ../package/context.h ../package/fs.h ../package/import.h ../package/package.h ../package/paths.h ../utils/stats.h ../utils/utils.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../package/index.c'
+$(PROFILE_DIR)__/package/index.o: ../package/index.c ../deps/stream/stream.h ../package/context.h ../package/export.h ../package/fs.h ../package/import.h ../package/package.h ../package/paths.h ../parser/grammer.h ../parser/linkage.h ../parser/parser.h ../utils/stats.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../parser/grammer.c'
+$(PROFILE_DIR)__/parser/grammer.o: ../parser/grammer.c ../deps/stream/stream.h ../lexer/item.h ../lexer/lex.h ../lexer/parallel.h ../lexer/syntax.h ../package/context.h ../package/package.h ../parser/build.h ../parser/export.h ../parser/identifier.h ../parser/import.h ../parser/linkage.h ../parser/package.h ../parser/parser.h ../utils/jobserver.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../parser/build.c'
+$(PROFILE_DIR)__/parser/build.o: ../parser/build.c ../lexer/item.h ../package/context.h ../package/import.h ../package/package.h ../parser/parser.h ../parser/string.h ../utils/strings.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../parser/parser.c'
+$(PROFILE_DIR)__/parser/parser.o: ../parser/parser.c ../deps/stream/stream.h ../lexer/item.h ../lexer/lex.h ../lexer/stack.h ../package/fs.h ../package/package.h ../utils/stats.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../lexer/stack.c'
+$(PROFILE_DIR)__/lexer/stack.o: ../lexer/stack.c ../lexer/item.h ../utils/stats.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../parser/string.c'
+$(PROFILE_DIR)__/parser/string.o: ../parser/string.c
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
 #dependencies for package '../parser/export.c'
-../parser/export.o: ../parser/export.c ../parser/string.h ../utils/utils.h ../lexer/item.h ../utils/strings.h ../package/package.h ../package/export.h ../parser/identifier.h ../package/import.h ../parser/parser.h
+$(PROFILE_DIR)__/parser/export.o: ../parser/export.c ../lexer/item.h ../package/context.h ../package/export.h ../package/import.h ../package/package.h ../package/paths.h ../parser/identifier.h ../parser/linkage.h ../parser/parser.h ../parser/string.h ../utils/strings.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
 #dependencies for package '../parser/identifier.c'
-../parser/identifier.o: ../parser/identifier.c ../lexer/item.h ../package/package.h ../package/export.h ../lexer/stack.h ../package/import.h ../parser/parser.h
+$(PROFILE_DIR)__/parser/identifier.o: ../parser/identifier.c ../lexer/item.h ../package/context.h ../package/export.h ../package/import.h ../package/package.h ../parser/parser.h ../utils/stats.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../parser/build.c'
-../parser/build.o: ../parser/build.c ../parser/string.h ../utils/strings.h ../lexer/item.h ../package/package.h ../package/import.h ../parser/parser.h
+#dependencies for package '../parser/linkage.c'
+$(PROFILE_DIR)__/parser/linkage.o: ../parser/linkage.c ../deps/stream/stream.h ../lexer/item.h ../package/context.h ../package/export.h ../package/package.h ../package/paths.h ../parser/parser.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-#dependencies for package '../deps/stream/file.c'
-../deps/stream/file.o: ../deps/stream/file.c ../deps/stream/stream.h
+#dependencies for package '../parser/import.c'
+$(PROFILE_DIR)__/parser/import.o: ../parser/import.c ../lexer/item.h ../package/export.h ../package/import.h ../package/package.h ../package/paths.h ../parser/parser.h ../parser/string.h ../utils/strings.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
 
-test: test.o ../deps/stream/stream.o string-stream.o ../lexer/item.o ../utils/strings.o ../package/package.o ../deps/hash/hash.o ../package/export.o ../utils/utils.o ../package/atomic-stream.o ../package/index.o ../parser/grammer.o ../parser/parser.o ../lexer/stack.o ../lexer/lex.o ../lexer/buffer.o ../lexer/syntax.o ../parser/import.o ../parser/string.o ../package/import.o ../parser/package.o ../parser/export.o ../parser/identifier.o ../parser/build.o ../deps/stream/file.o
-	$(CC) $(CFLAGS) $(LDFLAGS)  test.o ../deps/stream/stream.o string-stream.o ../lexer/item.o ../utils/strings.o ../package/package.o ../deps/hash/hash.o ../package/export.o ../utils/utils.o ../package/atomic-stream.o ../package/index.o ../parser/grammer.o ../parser/parser.o ../lexer/stack.o ../lexer/lex.o ../lexer/buffer.o ../lexer/syntax.o ../parser/import.o ../parser/string.o ../package/import.o ../parser/package.o ../parser/export.o ../parser/identifier.o ../parser/build.o ../deps/stream/file.o -o test $(LDLIBS)
+#dependencies for package '../parser/package.c'
+$(PROFILE_DIR)__/parser/package.o: ../parser/package.c ../lexer/item.h ../parser/parser.h ../parser/string.h ../utils/strings.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../package/memfs.c'
+$(PROFILE_DIR)__/package/memfs.o: ../package/memfs.c ../deps/stream/stream.h ../package/fs.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package '../pgo.c'
+$(PROFILE_DIR)__/pgo.o: ../pgo.c ../profile.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(CPPFLAGS) -c -o $@ $<
+
+#dependencies for package 'string-stream.c'
+$(PROFILE_DIR)string-stream.o: string-stream.c ../deps/stream/stream.h
 
-CLEAN_test:
-	rm -rf test test.o ../deps/stream/stream.o string-stream.o ../lexer/item.o ../utils/strings.o ../package/package.o ../deps/hash/hash.o ../package/export.o ../utils/utils.o ../package/atomic-stream.o ../package/index.o ../parser/grammer.o ../parser/parser.o ../lexer/stack.o ../lexer/lex.o ../lexer/buffer.o ../lexer/syntax.o ../parser/import.o ../parser/string.o ../package/import.o ../parser/package.o ../parser/export.o ../parser/identifier.o ../parser/build.o ../deps/stream/file.o
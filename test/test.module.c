@@ -4,6 +4,10 @@ package "main";
 #include <stdbool.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include "../parser/colors.h"
 
 build append CFLAGS "-std=c99";
@@ -12,6 +16,7 @@ build append CFLAGS "-D_GNU_SOURCE";
 build append CFLAGS "-g3";
 // build append CFLAGS "-fsanitize=address"; // unfortunately this does not work on travis yet.
 build append CFLAGS "-DMEM_DEBUG";
+build append CFLAGS "-DCBUILD_STATS";
 
 
 build depends "../deps/hash/hash.c";
@@ -21,8 +26,22 @@ import Pkg        from "../package/index.module.c";
 import Package    from "../package/package.module.c";
 import pkg_export from "../package/export.module.c";
 import lex_item   from "../lexer/item.module.c";
+import lexer      from "../lexer/lex.module.c";
+import syntax     from "../lexer/syntax.module.c";
+import parallel   from "../lexer/parallel.module.c";
 import string     from "./string-stream.module.c";
 import stream     from "../deps/stream/stream.module.c";
+import fs         from "../package/fs.module.c";
+import memfs      from "../package/memfs.module.c";
+import cbuild_ctx from "../package/context.module.c";
+import paths      from "../package/paths.module.c";
+import manifest   from "../manifest.module.c";
+import makefile   from "../makefile.module.c";
+import profile    from "../profile.module.c";
+import pgo        from "../pgo.module.c";
+import atomic_stream from "../package/atomic-stream.module.c";
+import uring      from "../utils/uring.module.c";
+import stats      from "../utils/stats.module.c";
 
 #define LEN(array) (sizeof(array)/sizeof(array[0]))
 
@@ -95,6 +114,16 @@ static bool check_pkg_exports(Package.t * pkg, struct test_case_s c, char * out,
   }
   return true;
 }
+/* the header gets the whole definition, which importers can inline or fold */
+static bool check_header_definition(Package.t * pkg, struct test_case_s c, char * out, char ** error) {
+  pkg_export.t * exp = (pkg_export.t*) hash_get(pkg->exports, (char *) c.data);
+  bool passed = exp && (exp->type == type_inline || exp->type == type_constant)
+    && strcmp(exp->declaration, c.output) == 0;
+
+  if (!passed) asprintf(error, "header declaration: '%s'\n", exp ? exp->declaration : NULL);
+  return passed;
+}
+
 
 static test_case exports[] = {
   {
@@ -137,6 +166,34 @@ static test_case exports[] = {
     .fn     = NULL,
     .errors = 0,
   },
+  {
+    .name   = "export.module.c",
+    .desc   = "It should export an inline function with its body",
+    .input  = "export inline int a(int a1) as b { struct { int a; } s = { a1 }; return s.a; }",
+    .output = "#ifndef _inline_export_b_\n#define _inline_export_b_\n"
+              "static inline int export_b(int a1) { struct { int a; } s = { a1 }; return s.a; }\n#endif",
+    .fn     = check_header_definition,
+    .data   = "b",
+    .errors = 0,
+  },
+  {
+    .name   = "export.module.c",
+    .desc   = "It should export an int constant as an enum",
+    .input  = "export constexpr int a = 4 * 2;",
+    .output = "#ifndef _const_export_a_\n#define _const_export_a_\nenum { export_a = 4 * 2 };\n#endif",
+    .fn     = check_header_definition,
+    .data   = "a",
+    .errors = 0,
+  },
+  {
+    .name   = "export.module.c",
+    .desc   = "It should export other constants as static const",
+    .input  = "export constexpr double a as b = 0.5;",
+    .output = "#ifndef _const_export_b_\n#define _const_export_b_\nstatic const double export_b = 0.5;\n#endif",
+    .fn     = check_header_definition,
+    .data   = "b",
+    .errors = 0,
+  },
   {
     .name   = "export.module.c",
     .desc   = "It should export an enum",
@@ -202,6 +259,14 @@ static test_case exports[] = {
     .fn     = NULL,
     .errors = 0,
   },
+  {
+    .name   = "export.module.c",
+    .desc   = "It should export a struct with an array sized by a constant",
+    .input  = "export struct a { int a[LENGTH]; };",
+    .output = "struct export_a { int a[LENGTH]; };",
+    .fn     = NULL,
+    .errors = 0,
+  },
   {
     .name   = "export.module.c",
     .desc   = "It should export  a typedef of function pointer",
@@ -337,6 +402,1069 @@ static test_case symbols[] = {
   },
 };
 
+typedef bool (*system_fn)(char ** error);
+
+/* a check of more than one module at once, which has no input or output of its own */
+typedef struct {
+  char      * desc;
+  system_fn   fn;
+} system_case;
+
+typedef struct {
+  fs.t         * mem;
+  cbuild_ctx.t * ctx;
+  Package.t    * root;
+  char         * error;
+} fixture_t;
+
+/* a context over an in-memory filesystem holding `files`, pairs of path and source ending in NULL */
+static fixture_t fixture(const char ** files) {
+  fixture_t f = { .mem = memfs.new() };
+  for (; files && files[0]; files += 2) memfs.write(f.mem, files[0], files[1]);
+
+  f.ctx = cbuild_ctx.new();
+  f.ctx->fs = f.mem;
+  return f;
+}
+
+static Package.t * generate(fixture_t * f, const char * module) {
+  f->root = Pkg.new(f->ctx, module, &f->error);
+  return f->root;
+}
+
+/* a new context over the same files, as every run of cbuild is a new process */
+static void rerun(fixture_t * f) {
+  cbuild_ctx.free(f->ctx);
+  f->ctx = cbuild_ctx.new();
+  f->ctx->fs = f->mem;
+  f->root = NULL;
+}
+
+static void free_fixture(fixture_t * f) {
+  cbuild_ctx.free(f->ctx);
+  memfs.free(f->mem);
+}
+
+static bool check_memfs(char ** error) {
+  fixture_t f = fixture((const char * []) {
+    "/src/main.module.c",
+      "package \"main\";\n"
+      "import dep from \"./lib/dep.module.c\";\n"
+      "int main() { return dep.answer(); }\n",
+    "/src/lib/dep.module.c", "export int answer() { return 42; }\n",
+    NULL,
+  });
+  generate(&f, "/src/main.module.c");
+
+  const char * main_c = memfs.read(f.mem, "/src/main.c");
+  const char * dep_h  = memfs.read(f.mem, "/src/lib/dep.h");
+
+  bool passed = f.error == NULL && f.root != NULL
+    && main_c && strstr(main_c, "#include \"lib/dep.h\"") && strstr(main_c, "return dep_answer();")
+    && dep_h  && strstr(dep_h, "int dep_answer();");
+
+  if (!passed) {
+    asprintf(error, "Error: %s\nmain.c: '%s'\ndep.h: '%s'\n", f.error, main_c, dep_h);
+  }
+  free_fixture(&f);
+  return passed;
+}
+
+static bool check_manifest(char ** error) {
+  // generating leaves the makefile an earlier build wrote, older than the sources
+  fixture_t f = fixture((const char * []) {
+    "/m/main.mk", "",
+    "/m/main.module.c",
+      "import dep from \"./lib/dep.module.c\";\n"
+      "int main() { return dep.answer(); }\n",
+    "/m/lib/dep.module.c", "export int answer() { return 42; }\n",
+    NULL,
+  });
+  if (generate(&f, "/m/main.module.c")) manifest.write(f.root, "/m/main.module.c", "main");
+
+  rerun(&f);
+  manifest.t * m = manifest.load(f.ctx, "/m/main.module.c");
+  bool old_makefile = m && m->makefile && !manifest.fresh(m);
+  manifest.free(m);
+
+  // which the next build writes again
+  memfs.write(f.mem, "/m/main.mk", "");
+
+  rerun(&f);
+  m = manifest.load(f.ctx, "/m/main.module.c");
+  bool loaded = m && m->length == 2 && m->target && strcmp(m->target, "main") == 0
+    && m->makefile && strcmp(m->makefile, "/m/main.mk") == 0;
+  bool fresh = m && manifest.fresh(m);
+  manifest.free(m);
+
+  memfs.write(f.mem, "/m/lib/dep.module.c", "export int answer() { return 7; }\n");
+  rerun(&f);
+  m = manifest.load(f.ctx, "/m/main.module.c");
+  bool stale = m && !manifest.fresh(m);
+  if (m) manifest.clean(m);
+  manifest.free(m);
+
+  bool cleaned = !memfs.read(f.mem, "/m/main.c") && !memfs.read(f.mem, "/m/lib/dep.c")
+    && !memfs.read(f.mem, "/m/lib/dep.h") && !memfs.read(f.mem, "/m/main.manifest")
+    && memfs.read(f.mem, "/m/lib/dep.module.c");
+
+  bool passed = f.error == NULL && old_makefile && loaded && fresh && stale && cleaned;
+  if (!passed) {
+    asprintf(error, "Error: %s\nold makefile: %d, loaded: %d, fresh: %d, stale: %d, cleaned: %d\n",
+        f.error, old_makefile, loaded, fresh, stale, cleaned);
+  }
+  free_fixture(&f);
+  return passed;
+}
+
+static bool check_make_variables(char ** error) {
+  fixture_t f = fixture((const char * []) {
+    "/v/main.module.c",
+      "build append CFLAGS \"-a\";\n"
+      "import dep from \"dep.module.c\";\n"
+      "build set CFLAGS \"-c\";\n"
+      "build set default CC \"clang\";\n"
+      "int x;\n",
+    "/v/dep.module.c",
+      "build append CFLAGS \"-b\";\n"
+      "build append CPPFLAGS \"-I$(DIR)\";\n"
+      "export int y;\n",
+    NULL,
+  });
+  Package.t * root = generate(&f, "/v/main.module.c");
+
+  // the root's assignments are all written before its imports', whatever order they were parsed in
+  unsetenv("CC");
+  unsetenv("CFLAGS");
+  unsetenv("LDFLAGS");
+  char * cc       = root ? makefile.variable(root, NULL, "CC")       : NULL;
+  char * cflags   = root ? makefile.variable(root, NULL, "CFLAGS")   : NULL;
+  char * ldflags  = root ? makefile.variable(root, NULL, "LDFLAGS")  : NULL;
+  char * cppflags = root ? makefile.variable(root, NULL, "CPPFLAGS") : NULL;
+
+  bool passed = f.error == NULL
+    && cc && strcmp(cc, "cc") == 0
+    && cflags && strcmp(cflags, "-c -b") == 0
+    && ldflags && strcmp(ldflags, "") == 0
+    && cppflags == NULL;
+
+  if (!passed) {
+    asprintf(error, "Error: %s\nCC: '%s', CFLAGS: '%s', LDFLAGS: '%s', CPPFLAGS: '%s'\n", f.error, cc, cflags, ldflags, cppflags);
+  }
+  free(cc);
+  free(cflags);
+  free(ldflags);
+  free(cppflags);
+  free_fixture(&f);
+  return passed;
+}
+
+static bool check_local_variables(char ** error) {
+  fixture_t f = fixture((const char * []) {
+    "/l/main.module.c",
+      "build append CFLAGS \"-Os\";\n"
+      "import hot from \"hot.module.c\";\n"
+      "int main() { return hot.f(); }\n",
+    "/l/hot.module.c",
+      "build local append CFLAGS \"-O3\";\n"
+      "build local set default CC \"clang\";\n"
+      "export int f() { return 1; }\n",
+    NULL,
+  });
+  Package.t * root = generate(&f, "/l/main.module.c");
+  Package.t * hot  = root ? hash_get(f.ctx->path_cache, "/l/hot.module.c") : NULL;
+
+  unsetenv("CFLAGS");
+  char * shared = hot ? makefile.variable(root, NULL, "CFLAGS") : NULL;
+  char * local  = hot ? makefile.variable(root, hot,  "CFLAGS") : NULL;
+
+  char * mk_name = root ? makefile.write(root, "/l/main.module.c") : NULL;
+  const char * mk = memfs.read(f.mem, "/l/main.mk");
+
+  bool passed = f.error == NULL && hot != NULL
+    && shared && strcmp(shared, "-Os") == 0
+    && local  && strcmp(local,  "-Os -O3") == 0
+    && mk && strstr(mk, "CFLAGS += -Os\n") && strstr(mk, "\n$(PROFILE_DIR)hot.o: CFLAGS += -O3\n")
+    && strstr(mk, "$(PROFILE_DIR)hot.o: CC ?= clang\n") && strstr(mk, "\nCFLAGS += -O3") == NULL;
+
+  if (!passed) {
+    asprintf(error, "Error: %s\nshared: '%s', local: '%s'\nmakefile: '%s'\n", f.error, shared, local, mk);
+  }
+  free(shared);
+  free(local);
+  free(mk_name);
+  free_fixture(&f);
+  return passed;
+}
+
+static void write_file(const char * dir, const char * name, const char * source) {
+  char * path;
+  asprintf(&path, "%s/%s", dir, name);
+  FILE * f = fopen(path, "w");
+  if (f) {
+    fputs(source, f);
+    fclose(f);
+  }
+  free(path);
+}
+
+static bool exists_in(const char * dir, const char * sub, const char * name) {
+  char * path;
+  asprintf(&path, "%s/%s%s", dir, sub, name);
+  bool found = access(path, F_OK) == 0;
+  free(path);
+  return found;
+}
+
+/* sends what is written to `fd` to `to`, or to /dev/null without it, until restore() */
+static int redirect(int fd, FILE * to) {
+  fflush(fd == 1 ? stdout : stderr);
+  int saved = dup(fd);
+  int sink  = to ? dup(fileno(to)) : open("/dev/null", O_WRONLY);
+  dup2(sink, fd);
+  close(sink);
+  return saved;
+}
+
+static void restore(int fd, int saved) {
+  fflush(fd == 1 ? stdout : stderr);
+  dup2(saved, fd);
+  close(saved);
+}
+
+/* app/main.module.c importing ../lib/x.module.c, in a new directory under /tmp, or NULL */
+static char * out_of_root(const char * main_source, const char * x_source) {
+  char * root_dir = strdup("/tmp/cbuild-test-XXXXXX");
+  if (mkdtemp(root_dir) == NULL) {
+    free(root_dir);
+    return NULL;
+  }
+  char * app, * lib;
+  asprintf(&app, "%s/app", root_dir);
+  asprintf(&lib, "%s/lib", root_dir);
+  mkdir(app, 0777);
+  mkdir(lib, 0777);
+  write_file(app, "main.module.c", main_source);
+  write_file(lib, "x.module.c", x_source);
+  free(app);
+  free(lib);
+  return root_dir;
+}
+
+static void remove_tree(const char * root_dir) {
+  char * rm;
+  asprintf(&rm, "rm -rf '%s'", root_dir);
+  system(rm);
+  free(rm);
+}
+
+/* what make would run in `dir` to build `goal` for `p` */
+static char * dry_run(const char * dir, const profile.t * p, const char * goal) {
+  char * args = profile.make_args(p);
+  char * cmd;
+  asprintf(&cmd, "cd '%s' && make -n -f main.mk %s %s%s 2>&1", dir, args, profile.dir(p), goal);
+
+  char * out = NULL;
+  size_t length = 0;
+  FILE * f = open_memstream(&out, &length);
+  FILE * make = popen(cmd, "r");
+  if (make) {
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), make)) > 0) fwrite(buf, 1, n, f);
+    pclose(make);
+  }
+  fclose(f);
+  free(args);
+  free(cmd);
+  return out;
+}
+
+static bool check_profiles(char ** error) {
+  const profile.t * release = profile.find("release");
+  const profile.t * debug   = profile.find("debug");
+
+  unsetenv("AR");
+  char * plain = profile.make_args(NULL);
+  char * args  = profile.make_args(release);
+
+  bool flags = release && debug && profile.find("fast") == NULL
+    && strcmp(plain, "") == 0 && strcmp(profile.dir(NULL), "") == 0
+    && strcmp(profile.dir(release), profile.dir(debug)) != 0
+    && strstr(args, "PROFILE_DIR='.cbuild/release/'") && strstr(args, "-flto")
+    && strstr(args, "--gc-sections") && strstr(args, "AR=gcc-ar");
+
+  // separate directories, so switching profiles finds each one's objects up to date
+  char * root_dir = out_of_root(
+      "import x from \"../lib/x.module.c\";\nint main() { return x.f(); }\n",
+      "export int f() { return 0; }\n");
+  char * app = NULL, * module = NULL, * mk = NULL;
+  char * built[2] = { NULL, NULL };
+  char * e = NULL;
+  cbuild_ctx.t * ctx = cbuild_ctx.new();
+  if (root_dir) {
+    asprintf(&app,    "%s/app", root_dir);
+    asprintf(&module, "%s/main.module.c", app);
+    Package.t * root = Pkg.new(ctx, module, &e);
+    mk = root ? makefile.write(root, module) : NULL;
+  }
+  if (mk) {
+    built[0] = dry_run(app, debug,   "main");
+    built[1] = dry_run(app, release, "main");
+  }
+
+  bool objects = built[0] && built[1]
+    && strstr(built[0], "-c -o .cbuild/debug/main.o main.c") && strstr(built[0], "-O0")
+    && strstr(built[0], "-c -o .cbuild/debug/__/lib/x.o ../lib/x.c")
+    && strstr(built[0], "-o .cbuild/debug/main ")
+    && strstr(built[1], "-c -o .cbuild/release/main.o main.c") && strstr(built[1], "-flto")
+    && strstr(built[1], "-c -o .cbuild/release/__/lib/x.o ../lib/x.c")
+    && strstr(built[1], "-o .cbuild/release/main ")
+    && strstr(built[0], "/../") == NULL && strstr(built[1], "/../") == NULL;
+
+  bool passed = flags && e == NULL && objects;
+  if (!passed) {
+    asprintf(error, "Error: %s in %s\nplain: '%s', release: '%s'\ndebug build: '%s'\nrelease build: '%s'\n",
+        e, root_dir, plain, args, built[0], built[1]);
+  }
+  if (passed) remove_tree(root_dir);
+  free(root_dir);
+  free(app);
+  free(module);
+  free(mk);
+  free(built[0]);
+  free(built[1]);
+  free(plain);
+  free(args);
+  cbuild_ctx.free(ctx);
+  return passed;
+}
+
+static bool check_object_paths(char ** error) {
+  fixture_t f = fixture((const char * []) {
+    "/o/app/main.module.c",
+      "import x from \"../lib/x.module.c\";\n"
+      "int main() { return x.f(); }\n",
+    "/o/lib/x.module.c", "export int f() { return 0; }\n",
+    NULL,
+  });
+  Package.t * root = generate(&f, "/o/app/main.module.c");
+  Package.t * x    = root ? hash_get(f.ctx->path_cache, "/o/lib/x.module.c") : NULL;
+
+  char * mk_name = root ? makefile.write(root, "/o/app/main.module.c") : NULL;
+  const char * mk = memfs.read(f.mem, "/o/app/main.mk");
+
+  // "../" would leave $(PROFILE_DIR), and every profile would share the object
+  char * object = x ? makefile.object_name(root, x) : NULL;
+  char * debug = NULL, * release = NULL;
+  if (object) {
+    asprintf(&debug,   "%s%s", profile.dir(profile.find("debug")),   object);
+    asprintf(&release, "%s%s", profile.dir(profile.find("release")), object);
+  }
+
+  bool passed = f.error == NULL && mk && object
+    && strcmp(object, "__/lib/x.o") == 0
+    && strcmp(debug, ".cbuild/debug/__/lib/x.o") == 0 && strcmp(debug, release) != 0
+    && strstr(mk, "\t$(PROFILE_DIR)__/lib/x.o\n")
+    && strstr(mk, "\n$(PROFILE_DIR)__/lib/x.o: ../lib/x.c\n\t@mkdir -p $(@D)\n")
+    && strstr(mk, "$(PROFILE_DIR)main.o: main.c ../lib/x.h\n")
+    && strstr(mk, "$(PROFILE_DIR)../") == NULL;
+
+  if (!passed) {
+    asprintf(error, "Error: %s\nobject: '%s', debug: '%s', release: '%s'\nmakefile: '%s'\n", f.error, object, debug, release, mk);
+  }
+  free(object);
+  free(debug);
+  free(release);
+  free(mk_name);
+  free_fixture(&f);
+  return passed;
+}
+
+static bool check_pgo(char ** error) {
+  // a real build, with an import from outside the makefile's directory
+  char * root_dir = out_of_root(
+      "import x from \"../lib/x.module.c\";\n"
+      "int main() { return x.f(3) - 6; }\n",
+      "export int f(int a) { int s = 0, i; for (i = 0; i < a; i++) s += 2; return s; }\n");
+  if (root_dir == NULL) {
+    asprintf(error, "cannot make a directory to build in\n");
+    return false;
+  }
+  char * app, * module;
+  asprintf(&app,    "%s/app", root_dir);
+  asprintf(&module, "%s/main.module.c", app);
+
+  cbuild_ctx.t * ctx = cbuild_ctx.new();
+  char * e = NULL;
+  Package.t * root = Pkg.new(ctx, module, &e);
+  char * mk     = root ? makefile.write(root, module) : NULL;
+  char * target = root ? makefile.target_name(root) : NULL;
+
+  const profile.t * release = profile.find("release");
+  pgo.t * guided = pgo.new(release, module);
+
+  bool flags = guided
+    && strcmp(guided->instrumented.dir, ".cbuild/release/pgo-gen/") == 0
+    && strcmp(guided->optimized.dir, ".cbuild/release/pgo/") == 0
+    && strstr(guided->instrumented.cflags, "-fprofile-generate")
+    && strstr(guided->optimized.cflags, "-fprofile-use");
+
+  char * gen = NULL, * use = NULL;
+  if (root && mk && flags) {
+    gen = dry_run(app, &guided->instrumented, "main");
+    use = dry_run(app, &guided->optimized,    "main");
+  }
+  bool objects = gen && use
+    && strstr(gen, "-fprofile-generate") && strstr(gen, "-c -o .cbuild/release/pgo-gen/__/lib/x.o ../lib/x.c")
+    && strstr(gen, "-c -o .cbuild/release/pgo-gen/main.o main.c")
+    && strstr(use, "-fprofile-use") && strstr(use, "-c -o .cbuild/release/pgo/__/lib/x.o ../lib/x.c")
+    && strstr(use, "-c -o .cbuild/release/pgo/main.o main.c")
+    && strstr(gen, "/../") == NULL && strstr(use, "/../") == NULL;
+
+  // each build keeps its objects and profiles under its own directory
+  bool untrained = false, instrumented = false, trained = false, optimized = false;
+  if (objects) {
+    int saved = redirect(1, NULL);
+    // an optimized build from before the training, whose objects make would keep
+    untrained = makefile.make_target(root->ctx, target, &guided->optimized, strdup(mk)) == 0
+      && exists_in(app, guided->optimized.dir, "__/lib/x.o");
+    instrumented = untrained && makefile.make_target(root->ctx, target, &guided->instrumented, strdup(mk)) == 0
+      && exists_in(app, guided->instrumented.dir, "__/lib/x.o");
+    trained = instrumented && pgo.train(guided, target, "$CBUILD_TARGET") == 0
+      && exists_in(app, guided->optimized.dir, "__/lib/x.gcda")
+      && exists_in(app, guided->optimized.dir, "main.gcda")
+      && !exists_in(app, guided->instrumented.dir, "__/lib/x.gcda")
+      && !exists_in(app, guided->optimized.dir, "__/lib/x.o")
+      && !exists_in(app, ".cbuild/release/", "lib");
+    optimized = trained && makefile.make_target(root->ctx, target, &guided->optimized, strdup(mk)) == 0
+      && exists_in(app, guided->optimized.dir, "__/lib/x.o")
+      && exists_in(app, guided->optimized.dir, "main");
+    restore(1, saved);
+  }
+
+  bool passed = e == NULL && flags && objects && untrained && instrumented && trained && optimized;
+  if (!passed) {
+    asprintf(error, "Error: %s in %s\nflags: %d, untrained: %d, instrumented: %d, trained: %d, optimized: %d\n"
+        "instrumented build: '%s'\noptimized build: '%s'\n",
+        e, root_dir, flags, untrained, instrumented, trained, optimized, gen, use);
+  }
+
+  if (passed) remove_tree(root_dir);
+  free(root_dir);
+  free(app);
+  free(module);
+  free(gen);
+  free(use);
+  free(mk);
+  free(target);
+  pgo.free(guided);
+  cbuild_ctx.free(ctx);
+  return passed;
+}
+
+static bool check_shared_library(char ** error) {
+  fixture_t f = fixture((const char * []) {
+    "/s/plug.module.c",
+      "package \"plug\";\n"
+      "import helper from \"helper.module.c\";\n"
+      "import util from \"../util/util.module.c\";\n"
+      "export * from \"api.module.c\";\n"
+      "int counter;\n"
+      "export int run(int x) { return helper.twice(x) + util.one(); }\n"
+      "export int version = 3;\n"
+      "export typedef int plug_int;\n",
+    "/s/helper.module.c",  "export int twice(int x) { return 2 * x; }\n",
+    "/s/api.module.c",     "export int call() { return 42; }\n",
+    "/util/util.module.c", "export int one() { return 1; }\n",
+    NULL,
+  });
+  f.ctx->shared = true;
+  Package.t * root = generate(&f, "/s/plug.module.c");
+
+  char * mk_name = root ? makefile.write(root, "/s/plug.module.c") : NULL;
+  const char * mk  = memfs.read(f.mem, "/s/plug.mk");
+  const char * map = memfs.read(f.mem, "/s/plug.map");
+
+  // only what the root exports, its own and passed through, is dynamic and compiled visible
+  bool passed = f.error == NULL && mk && map
+    && strcmp(map, "{\n\tglobal:\n\t\tapi_call;\n\t\tplug_run;\n\t\tplug_version;\n\tlocal:\n\t\t*;\n};\n") == 0
+    && strstr(mk, "$(PROFILE_DIR)plug.so: $(OBJECTS_plug.so) plug.map\n")
+    && strstr(mk, "SHARED_CFLAGS := -fPIC -fvisibility=hidden\n")
+    && strstr(mk, "$(PROFILE_DIR)pic/plug.o: SHARED_CFLAGS := -fPIC\n")
+    && strstr(mk, "$(PROFILE_DIR)pic/api.o: SHARED_CFLAGS := -fPIC\n")
+    && strstr(mk, "$(PROFILE_DIR)pic/helper.o: SHARED_CFLAGS") == NULL
+    && strstr(mk, "\t$(PROFILE_DIR)pic/__/util/util.o")
+    && strstr(mk, "\n$(PROFILE_DIR)pic/__/util/util.o: ../util/util.c\n\t@mkdir -p $(@D)\n"
+        "\t$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(SHARED_CFLAGS) $(CPPFLAGS) -c -o $@ $<\n")
+    && strstr(mk, "$(PROFILE_DIR)pic/../") == NULL
+    && makefile.same_kind("plug.so", f.ctx) && !makefile.same_kind("plug.a", f.ctx);
+
+  if (!passed) {
+    asprintf(error, "Error: %s\nmakefile: '%s'\nversion script: '%s'\n", f.error, mk, map);
+  }
+  free(mk_name);
+  free_fixture(&f);
+  return passed;
+}
+
+static bool check_internal_linkage(char ** error) {
+  fixture_t f = fixture((const char * []) {
+    "/i/main.module.c",
+      "import dep from \"dep.module.c\";\n"
+      "int helper(int x);\n"
+      "int counter = 0, table[2] = {1, 2};\n"
+      "extern int seen;\n"
+      "int seen;\n"
+      "typedef struct { int x; } point_t;\n"
+      "int helper(int x) { return x + counter + dep.answer(); }\n"
+      "int main() { return helper(table[1]); }\n",
+    "/i/dep.module.c",
+      "export {\n"
+      "extern int shared;\n"
+      "}\n"
+      "int shared = 1;\n"
+      "static int twice(int x) { return 2 * x; }\n"
+      "export int answer() { return twice(shared); }\n",
+    NULL,
+  });
+  f.ctx->internal = true;
+  Package.t * root = generate(&f, "/i/main.module.c");
+
+  const char * main_c = memfs.read(f.mem, "/i/main.c");
+  const char * dep_c  = memfs.read(f.mem, "/i/dep.c");
+
+  // what is declared extern, exported or already static stays as it was
+  bool passed = f.error == NULL && root != NULL && main_c && dep_c
+    && strstr(main_c, "\nstatic int helper(int x);\n")
+    && strstr(main_c, "\nstatic int counter = 0, table[2] = {1, 2};\n")
+    && strstr(main_c, "\nextern int seen;\nint seen;\n")
+    && strstr(main_c, "\ntypedef struct { int x; } point_t;\n")
+    && strstr(main_c, "\nstatic int helper(int x) { return x + counter + dep_answer(); }\n")
+    && strstr(main_c, "\nint main() {")
+    && strstr(dep_c, "\nint shared = 1;\n")
+    && strstr(dep_c, "\nstatic int twice(int x)") && !strstr(dep_c, "static static")
+    && strstr(dep_c, "\nint dep_answer() {")
+    && f.ctx->private_names && hash_has(f.ctx->private_names, "helper") && !hash_has(f.ctx->private_names, "seen");
+
+  if (!passed) {
+    asprintf(error, "Error: %s\nmain.c: '%s'\ndep.c: '%s'\n", f.error, main_c, dep_c);
+  }
+  free_fixture(&f);
+  return passed;
+}
+
+static bool check_inline_private(char ** error) {
+  fixture_t f = fixture((const char * []) {
+    "/n/main.module.c",
+      "import good from \"good.module.c\";\n"
+      "import bad from \"bad.module.c\";\n"
+      "int main() { return good.quad(1) + bad.quad(1); }\n",
+    // what a parameter or local hides, and what importers see declared, can be used
+    "/n/good.module.c",
+      "static int twice(int x) { return 2 * x; }\n"
+      "int counter;\n"
+      "export {\n"
+      "extern int shared;\n"
+      "}\n"
+      "int shared = 1;\n"
+      "export int third(int x) { return twice(x) + x; }\n"
+      "export inline int quad(int twice) { int counter = twice; return shared + third(counter) + twice; }\n",
+    "/n/bad.module.c",
+      "static int twice(int x) { return 2 * x; }\n"
+      "int counter;\n"
+      "typedef int count_t;\n"
+      "export inline int quad(int x) { count_t n = twice(twice(x)); return n + counter; }\n",
+    NULL,
+  });
+  FILE * log = tmpfile();
+  int saved = redirect(2, log);
+  generate(&f, "/n/main.module.c");
+  restore(2, saved);
+
+  char * messages = calloc(1, 4096);
+  rewind(log);
+  fread(messages, 1, 4095, log);
+  fclose(log);
+
+  Package.t * good = hash_get(f.ctx->path_cache, "/n/good.module.c");
+  Package.t * bad  = hash_get(f.ctx->path_cache, "/n/bad.module.c");
+
+  bool passed = good && good->errors == 0 && bad && bad->errors == 4
+    && strstr(messages, "'twice' is not exported") && strstr(messages, "'counter' is not exported")
+    && strstr(messages, "'count_t' is not exported") && strstr(messages, "good.module.c") == NULL;
+
+  if (!passed) {
+    asprintf(error, "Error: %s\nerrors: %zu / %zu\n%s\n", f.error,
+        good ? good->errors : 0, bad ? bad->errors : 0, messages);
+  }
+  free(messages);
+  free_fixture(&f);
+  return passed;
+}
+
+static bool check_imports_queued(char ** error) {
+  // a chain of imports far deeper than parsing them in place would want on the C stack,
+  // closed into a cycle by the last one
+  const int depth = 2000;
+  fixture_t f = fixture(NULL);
+  char path[64], source[256];
+  int i;
+  for (i = 0; i < depth; i++) {
+    snprintf(path, sizeof(path), "/q/m%d.module.c", i);
+    if (i < depth - 1) {
+      snprintf(source, sizeof(source),
+          "package \"m%d\";\nexport int base;\nimport next from \"m%d.module.c\";\n"
+          "export int f%d() { return next.f%d(); }\n", i, i + 1, i, i + 1);
+    } else {
+      snprintf(source, sizeof(source),
+          "package \"m%d\";\nimport first from \"m0.module.c\";\n"
+          "export int f%d() { return first.base; }\n", i, i);
+    }
+    memfs.write(f.mem, path, source);
+  }
+  Package.t * root = generate(&f, "/q/m0.module.c");
+
+  snprintf(path, sizeof(path), "/q/m%d.c", depth - 2);
+  const char * m0   = memfs.read(f.mem, "/q/m0.c");
+  const char * next = memfs.read(f.mem, path);
+  snprintf(path, sizeof(path), "/q/m%d.c", depth - 1);
+  const char * last = memfs.read(f.mem, path);
+  snprintf(source, sizeof(source), "return m%d_f%d();", depth - 1, depth - 1);
+
+  bool passed = f.error == NULL && root != NULL && root->errors == 0 && f.ctx->n_queue == 0
+    && m0 && strstr(m0, "return m1_f1();") && next && strstr(next, source)
+    && last && strstr(last, "#include \"m0.h\"") && strstr(last, "return m0_base;");
+
+  if (!passed) {
+    asprintf(error, "Error: %s, %zu left\nm0.c: '%s'\nlast: '%s'\n", f.error, f.ctx->n_queue, m0, last);
+  }
+  free_fixture(&f);
+  return passed;
+}
+
+/* an io_uring instance this process has open other than `other`, or -1 */
+static int ring_fd(int other) {
+  int found = -1;
+  DIR * d = opendir("/proc/self/fd");
+  struct dirent * entry;
+  while (d && found < 0 && (entry = readdir(d)) != NULL) {
+    char path[300], link[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+    ssize_t n = readlink(path, link, sizeof(link) - 1);
+    if (n < 0) continue;
+    link[n] = 0;
+    if (strcmp(link, "anon_inode:[io_uring]") == 0 && atoi(entry->d_name) != other) found = atoi(entry->d_name);
+  }
+  if (d) closedir(d);
+  return found;
+}
+
+static size_t count_entries(const char * dir) {
+  size_t n = 0;
+  DIR * d = opendir(dir);
+  struct dirent * entry;
+  while (d && (entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] != '.') n++;
+  }
+  if (d) closedir(d);
+  return n;
+}
+
+static bool check_contexts(char ** error) {
+  fixture_t f[2];
+
+  // the same paths with different contents, loaded side by side
+  int i;
+  for (i = 0; i < 2; i++) {
+    f[i] = fixture((const char * []) {
+      "/ws/main.module.c", "import dep from \"dep.module.c\";\nint x = dep.answer;\n",
+      "/ws/dep.module.c",  i == 0 ? "export int answer = 1;\n" : "export int value = 2;\nexport int answer = 2;\n",
+      NULL,
+    });
+  }
+  for (i = 0; i < 2; i++) generate(&f[i], "/ws/main.module.c");
+
+  const char * h0 = memfs.read(f[0].mem, "/ws/dep.h");
+  const char * h1 = memfs.read(f[1].mem, "/ws/dep.h");
+
+  bool passed = f[0].error == NULL && f[1].error == NULL && f[0].root != f[1].root
+    && h0 && strstr(h0, "dep_value") == NULL
+    && h1 && strstr(h1, "dep_value") != NULL;
+
+  if (!passed) asprintf(error, "Error: %s / %s\ndep.h: '%s' / '%s'\n", f[0].error, f[1].error, h0, h1);
+
+  for (i = 0; i < 2; i++) free_fixture(&f[i]);
+  return passed;
+}
+
+/* writes `text` to `name` through `writes`, a NULL `text` leaves it in the directory `away` instead */
+static void write_through(atomic_stream.writes_t * writes, const char * name, const char * text, const char * away) {
+  stream.t * out = atomic_stream.open(name, writes);
+  if (text == NULL) {
+    char * dir = strdup(name);
+    *strrchr(dir, '/') = 0;
+    rename(dir, away);
+    global.free(dir);
+    text = "";
+  }
+  stream.write(out, text, strlen(text));
+  stream.close(out);
+}
+
+static bool check_contexts_state(char ** error) {
+  const char * sources[2] = { "int x;\n", "int x;\nint y;\n" };
+  fixture_t f[2];
+  int i, ring0 = -1;
+  for (i = 0; i < 2; i++) {
+    f[i] = fixture((const char * []) { "/ws/main.module.c", sources[i], NULL });
+    f[i].ctx->stats = stats.start();
+    f[i].ctx->disk.writes.ring = uring.new();
+    if (i == 0) ring0 = ring_fd(-1);
+  }
+
+  // each context's packages are counted in its own stats
+  for (i = 0; i < 2; i++) generate(&f[i], "/ws/main.module.c");
+  stats.registry_t * r[2] = { f[0].ctx->stats, f[1].ctx->stats };
+  bool counted = f[0].error == NULL && f[1].error == NULL && r[0] && r[1];
+  for (i = 0; counted && i < 2; i++) {
+    counted = r[i]->n_all == 2 && r[i]->all[1]->counters[stat_bytes_read] == strlen(sources[i]);
+  }
+
+  // taking the first context's ring away leaves the second's working, and each counts
+  // the closes that failed on its own
+  atomic_stream.writes_t * w[2] = { &f[0].ctx->disk.writes, &f[1].ctx->disk.writes };
+  bool rings = true, available[2] = { false, false };
+  int failed[2] = { 0, 0 };
+  char dir[] = "/tmp/cbuild-rings-XXXXXX";
+  if (w[0]->ring && w[1]->ring && ring0 >= 0 && mkdtemp(dir)) {
+    char kept[64], gone[64], moved[64], lost[80];
+    snprintf(kept,  sizeof(kept),  "%s/kept.c", dir);
+    snprintf(gone,  sizeof(gone),  "%s/gone",   dir);
+    snprintf(moved, sizeof(moved), "%s/moved",  dir);
+    snprintf(lost,  sizeof(lost),  "%s/lost.c", gone);
+    mkdir(gone, 0777);
+
+    int saved = redirect(2, NULL);
+    global.close(ring0);
+    write_through(w[0], kept, "int kept;\n", NULL);
+    write_through(w[1], lost, NULL, moved);
+    for (i = 0; i < 2; i++) {
+      failed[i]    = atomic_stream.finish(w[i]);
+      available[i] = uring.available(w[i]->ring);
+    }
+    restore(2, saved);
+
+    rings = !available[0] && available[1] && failed[0] == 0 && failed[1] == 1 && access(kept, F_OK) == 0;
+    if (rings) remove_tree(dir);
+  }
+
+  bool passed = counted && rings;
+  if (!passed) {
+    asprintf(error, "Error: %s / %s\nstats: %zu / %zu\nin %s: available: %d / %d, failed: %d / %d\n",
+        f[0].error, f[1].error, r[0] ? r[0]->n_all : 0, r[1] ? r[1]->n_all : 0,
+        dir, available[0], available[1], failed[0], failed[1]);
+  }
+
+  for (i = 0; i < 2; i++) free_fixture(&f[i]);
+  return passed;
+}
+
+static bool check_paths(char ** error) {
+  fixture_t f = fixture((const char * []) { "/a/b/x.module.c", "int x;\n", NULL });
+  paths.t * t = f.ctx->paths;
+
+  // two spellings of the same file share one interned canonical path
+  fs.chdir(f.mem, "/a");
+  const char * r1 = paths.realpath(t, "b/x.module.c");
+  fs.chdir(f.mem, "/a/b");
+  const char * r2 = paths.realpath(t, "./x.module.c");
+
+  const char * rel1 = paths.relative(t, "/a/b/x.c", "/a/c/y.h");
+  const char * rel2 = paths.relative(t, "/a/b/z.c", "/a/c/y.h");
+
+  // writing through the table forgets the stale mtime
+  bool stale = paths.newer(t, "/a/b/x.module.c", "/a/b/x.c");
+  stream.close(paths.open_write(t, "/a/b/x.c"));
+  bool fresh = !paths.newer(t, "/a/b/x.module.c", "/a/b/x.c");
+
+  bool passed = r1 && r1 == r2 && strcmp(r1, "/a/b/x.module.c") == 0
+    && rel1 == rel2 && strcmp(rel1, "../c/y.h") == 0
+    && stale && fresh;
+
+  if (!passed) asprintf(error, "realpath: '%s' '%s'\nrelative: '%s' '%s'\nnewer: %d %d\n", r1, r2, rel1, rel2, stale, fresh);
+
+  free_fixture(&f);
+  return passed;
+}
+
+static bool check_uring_disabled(char ** error) {
+  // without io_uring here there is nothing to take away
+  atomic_stream.writes_t writes = { .ring = uring.new() };
+  if (writes.ring == NULL) return true;
+
+  char dir[] = "/tmp/cbuild-uring-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    asprintf(error, "cannot make a directory to write in\n");
+    return false;
+  }
+
+  // more closes than the ring holds, so one of them has to make room after the kernel
+  // has stopped taking work and finds the ring gone
+  const int files = 120;
+  size_t fds = count_entries("/proc/self/fd");
+  int saved = redirect(2, NULL);
+  int i;
+  for (i = 0; i < files; i++) {
+    if (i == 10) global.close(ring_fd(-1));
+
+    char name[32], text[32];
+    snprintf(name, sizeof(name), "%s/f%d.c", dir, i);
+    snprintf(text, sizeof(text), "int f%d;\n", i);
+    stream.t * out = atomic_stream.open(name, &writes);
+    stream.write(out, text, strlen(text));
+    stream.close(out);
+  }
+  int failed = atomic_stream.finish(&writes);
+  restore(2, saved);
+
+  int missing = 0;
+  for (i = 0; i < files; i++) {
+    char name[32], text[32], read[32] = {0};
+    snprintf(name, sizeof(name), "%s/f%d.c", dir, i);
+    snprintf(text, sizeof(text), "int f%d;\n", i);
+    FILE * f = fopen(name, "r");
+    if (f) {
+      fread(read, 1, sizeof(read) - 1, f);
+      fclose(f);
+    }
+    if (strcmp(read, text) != 0) missing++;
+  }
+
+  // every file in place, no temporaries left and no descriptors but the ring's gone
+  size_t left = count_entries(dir);
+  size_t fds_after = count_entries("/proc/self/fd");
+  bool available = uring.available(writes.ring);
+  bool passed = !available && failed == 0 && missing == 0 && left == (size_t) files && fds_after + 1 == fds;
+  if (!passed) {
+    asprintf(error, "in %s: available: %d, failed: %d, missing: %d, files: %zu, descriptors: %zu -> %zu\n",
+        dir, available, failed, missing, left, fds, fds_after);
+  }
+  uring.free(writes.ring);
+  if (passed) remove_tree(dir);
+  return passed;
+}
+
+static bool check_window(char ** error) {
+  // far bigger than one read, with tokens straddling the reads
+  char * source = NULL;
+  size_t length = 0;
+  FILE * text = open_memstream(&source, &length);
+  fprintf(text, "#include <stdio.h>\n");
+  int i;
+  for (i = 0; i < 500; i++) {
+    fprintf(text, "/* comment %d\n * spanning lines */\n#define V%d %d\nexport int value_%d(int x) { return x + \"%d\"[0]; }\n", i, i, i, i, i);
+  }
+  fclose(text);
+
+  const char * generated[2];
+  fixture_t     f[2];
+
+  for (i = 0; i < 2; i++) {
+    f[i] = fixture((const char * []) { "/w/big.module.c", source, NULL });
+    f[i].ctx->window = i == 1;
+    generate(&f[i], "/w/big.module.c");
+    generated[i] = memfs.read(f[i].mem, "/w/big.c");
+  }
+
+  bool passed = f[0].error == NULL && f[1].error == NULL
+    && generated[0] && generated[1] && strcmp(generated[0], generated[1]) == 0
+    && strstr(generated[1], "int big_value_499(int x) {") != NULL;
+
+  if (!passed) asprintf(error, "Error: %s / %s\n", f[0].error, f[1].error);
+
+  for (i = 0; i < 2; i++) free_fixture(&f[i]);
+  free(source);
+  return passed;
+}
+
+static bool check_coarse(char ** error) {
+  const char * dep =
+    "package \"dep\";\n"
+    "export typedef struct { int value; } box;\n"
+    "export int value(box * b) { return b->value; }\n";
+
+  // the places where fewer, larger tokens could change what the grammar sees
+  const char * source =
+    "package \"main\";\n"
+    "import dep from \"./dep.module.c\";\n"
+    "#include <stdlib.h>\n"
+    "export struct   node { int id; };\n"
+    "export int id;\n"
+    "/* a comment\n   ending on the keyword's line */ export int total;\n"
+    "int count(dep.box * b, struct node * n) {\n"
+    "  struct dep.box copy = *b; /* ; { } */\n"
+    "  int n2 = n->id + n -> id + copy.value + n[0].id + 1.5e3;\n"
+    "  global.free(NULL); char * s = \"id . dep.value\"; char q = '.';\n"
+    "  return dep.value(b) + id + (int) sizeof(struct node) + s[0] + q + n2;\n"
+    "}\n"
+    "export int next(void) { return count(NULL, NULL); }\n";
+
+  const char * generated[2];
+  fixture_t     f[2];
+
+  int i;
+  for (i = 0; i < 2; i++) {
+    f[i] = fixture((const char * []) { "/w/dep.module.c", dep, "/w/main.module.c", source, NULL });
+    f[i].ctx->coarse = i == 1;
+    generate(&f[i], "/w/main.module.c");
+    generated[i] = memfs.read(f[i].mem, "/w/main.c");
+  }
+
+  bool passed = f[0].error == NULL && f[1].error == NULL
+    && generated[0] && generated[1] && strcmp(generated[0], generated[1]) == 0
+    && strstr(generated[1], "struct dep_box copy") != NULL
+    && strstr(generated[1], "dep_value(b) + main_id") != NULL;
+
+  if (!passed) asprintf(error, "Error: %s / %s\n%s\n---\n%s\n", f[0].error, f[1].error, generated[0], generated[1]);
+
+  for (i = 0; i < 2; i++) free_fixture(&f[i]);
+  return passed;
+}
+
+static bool check_scan(char ** error) {
+  const char * main_source = "import dep from \"dep.module.c\";\nint x(dep.pair p) { return dep.sum(p) + dep.total; }\n";
+  fixture_t f = fixture((const char * []) {
+    "/s/main.module.c", main_source,
+    "/s/dep.module.c",
+      "package \"dep\";\n"
+      "build append CFLAGS \"-DDEP\";\n"
+      "export typedef struct { int a; int b; } pair;\n"
+      "/*\nexport int hidden;\n*/\n"
+      "export int sum(pair p) {\n"
+      "  const char * s = \"\\nexport int quoted;\";\n"
+      "  return p.a + p.b + s[0]; } export int not_a_keyword;\n"
+      "#include <stdlib.h>\n"
+      "export int total;\n",
+    NULL,
+  });
+
+  // the first generation writes everything, the second only main, dep is scanned
+  const char * generated[2];
+  size_t       exports[2];
+  size_t       variables[2];
+  char       * e[2] = { NULL, NULL };
+  int i;
+  for (i = 0; i < 2; i++) {
+    if (i == 1) {
+      memfs.write(f.mem, "/s/main.module.c", main_source);
+      rerun(&f);
+    }
+    generate(&f, "/s/main.module.c");
+    e[i] = f.error;
+    f.error = NULL;
+
+    Package.t * dep = hash_get(f.ctx->path_cache, "/s/dep.module.c");
+    generated[i] = memfs.read(f.mem, "/s/main.c");
+    exports[i]   = dep ? dep->n_exports   : 0;
+    variables[i] = dep ? dep->n_variables : 0;
+  }
+
+  bool passed = e[0] == NULL && e[1] == NULL && generated[1]
+    && strstr(generated[1], "return dep_sum(p) + dep_total;") != NULL
+    && exports[0] == 3 && exports[1] == exports[0] && variables[1] == variables[0];
+
+  if (!passed) {
+    asprintf(error, "Error: %s / %s\nexports %zu / %zu, variables %zu / %zu\n%s\n",
+        e[0], e[1], exports[0], exports[1], variables[0], variables[1], generated[1]);
+  }
+  free_fixture(&f);
+  return passed;
+}
+
+/* lexes `source` on one thread and in `pieces` at once, and says where the two first differ */
+static bool same_items(const char * name, const char * source, size_t pieces, char ** error) {
+  lexer.t * serial = syntax.new(string.new_reader(source), name, NULL);
+  lexer.t * split  = syntax.new(string.new_reader(source), name, NULL);
+  bool passed = parallel.split(split, pieces, 0);
+  if (!passed) asprintf(error, "%s: not split\n", name);
+
+  lex_item.t a, b;
+  size_t n = 0;
+  do {
+    a = lexer.next_item(serial);
+    b = lexer.next_item(split);
+    n++;
+    bool same = a.type == b.type && a.length == b.length && a.line == b.line
+      && a.line_pos == b.line_pos && a.start == b.start && serial->line == split->line
+      && (a.type == item_error /* messages may differ */ || a.value == b.value || strcmp(a.value, b.value) == 0);
+    if (passed && !same) {
+      passed = false;
+      asprintf(error, "%s: item %zu is %s at %zu:%zu, split %s at %zu:%zu\n", name, n,
+          lex_item.type_names[a.type], a.line, a.start - a.line_pos,
+          lex_item.type_names[b.type], b.line, b.start - b.line_pos);
+    }
+    lex_item.free(a);
+    lex_item.free(b);
+  } while (a.type != item_eof && a.type != item_error);
+
+  lexer.free(serial);
+  lexer.free(split);
+  return passed;
+}
+
+static bool check_parallel(char ** error) {
+  // comments, strings and continued lines that run across where the pieces are cut
+  char * source = NULL;
+  size_t length = 0;
+  FILE * f = open_memstream(&source, &length);
+  int i, j;
+  for (i = 0; i < 60; i++) {
+    fprintf(f, "/* comment %d\n", i);
+    for (j = 0; j < i % 7; j++) fprintf(f, " * \"quoted\" int x%d = '\\''; // not code\n", j);
+    fprintf(f, " */ int v%d = '\"'; char * s%d = \"/* not a comment %d\\\" */\";\n", i, i, i);
+    fprintf(f, "// continued \\\n  still a comment /*\n#define M%d(a) \\\n  ((a) + %d)\n", i, i);
+    if (i == 20) {
+      fprintf(f, "/*\n");
+      for (j = 0; j < 200; j++) fprintf(f, "  \" int long_comment_%d; \n", j);
+      fprintf(f, "*/\n");
+    }
+  }
+  fprintf(f, "*/\n// the end\n");
+  fclose(f);
+
+  bool passed = same_items("adversarial.module.c", source, 7, error);
+  free(source);
+
+  // and every module of this repository
+  glob_t g;
+  glob("../*.module.c",     0,           NULL, &g);
+  glob("../*/*.module.c",   GLOB_APPEND, NULL, &g);
+  glob("../*/*/*.module.c", GLOB_APPEND, NULL, &g);
+  size_t k;
+  for (k = 0; passed && k < g.gl_pathc; k++) {
+    FILE * in = fopen(g.gl_pathv[k], "r");
+    if (in == NULL) continue;
+    char * text = NULL;
+    size_t size = 0;
+    FILE * copy = open_memstream(&text, &size);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, copy);
+    fclose(copy);
+    fclose(in);
+
+    passed = same_items(g.gl_pathv[k], text, 2 + k % 7, error);
+    free(text);
+  }
+  if (passed && g.gl_pathc < 10) {
+    passed = false;
+    asprintf(error, "only found %zu modules\n", (size_t) g.gl_pathc);
+  }
+  globfree(&g);
+  return passed;
+}
+
 static test_case _imports[] = {
   {
     .name   = "import.module.c",
@@ -346,6 +1474,93 @@ static test_case _imports[] = {
     .fn     = NULL,
     .errors = 0,
   },
+  {
+    .name   = "import.module.c",
+    .desc   = "It should resolve an imported type in the base type of an exported typedef",
+    .input  = "import example from \"example.module.c\";export typedef example.b * (*make)(void);",
+    .output = "#include \"example.h\"typedef example_b * (*import_make)(void);",
+    .fn     = NULL,
+    .errors = 0,
+  },
+};
+
+static system_case systems[] = {
+  {
+    .desc = "It should generate a module graph in an in-memory filesystem",
+    .fn   = check_memfs,
+  },
+  {
+    .desc = "It should clean and skip generating from the manifest of the last one",
+    .fn   = check_manifest,
+  },
+  {
+    .desc = "It should work out make variables the way the makefile assigns them",
+    .fn   = check_make_variables,
+  },
+  {
+    .desc = "It should set `build local` variables on the package's object only",
+    .fn   = check_local_variables,
+  },
+  {
+    .desc = "It should give each build profile its own directory and flags",
+    .fn   = check_profiles,
+  },
+  {
+    .desc = "It should keep the objects of sources outside the makefile's directory under the profile's",
+    .fn   = check_object_paths,
+  },
+  {
+    .desc = "It should instrument, train and optimize with objects and profiles under the profile's directory",
+    .fn   = check_pgo,
+  },
+  {
+    .desc = "It should link a shared library with only the root's exports dynamic",
+    .fn   = check_shared_library,
+  },
+  {
+    .desc = "It should make what a module doesn't export static with --internal-linkage",
+    .fn   = check_internal_linkage,
+  },
+  {
+    .desc = "It should reject names importers can't see in an inline export's body",
+    .fn   = check_inline_private,
+  },
+  {
+    .desc = "It should parse imports one after another instead of nested",
+    .fn   = check_imports_queued,
+  },
+  {
+    .desc = "It should keep generations in separate contexts apart",
+    .fn   = check_contexts,
+  },
+  {
+    .desc = "It should keep each context's stats, io_uring ring and failed writes to itself",
+    .fn   = check_contexts_state,
+  },
+  {
+    .desc = "It should resolve, stat and relate each path once per context",
+    .fn   = check_paths,
+  },
+  {
+    .desc = "It should write every file with plain syscalls once io_uring stops taking work",
+    .fn   = check_uring_disabled,
+  },
+  {
+    .desc = "It should generate the same code when lexing through a window",
+    .fn   = check_window,
+  },
+  {
+    .desc = "It should generate the same code from coarse tokens",
+    .fn   = check_coarse,
+  },
+  {
+    .desc = "It should only scan imported modules that are up to date",
+    .fn   = check_scan,
+  },
+  {
+    .desc = "It should lex a module in pieces into the same tokens",
+    .fn   = check_parallel,
+  },
 };
 
 static bool run_test(test_case c) {
@@ -358,14 +1573,16 @@ static bool run_test(test_case c) {
 
   asprintf(&key, "%s/%s", cwd, c.name);
   char * generated = Pkg.generated_name(key);
-  Package.t * p = Pkg.parse(in, out, c.name, key, generated, &error, false, false);
+  cbuild_ctx.t * ctx = cbuild_ctx.new();
+  Package.t * p = Pkg.parse(ctx, in, out, c.name, key, generated, &error);
   lex_item.unfreed();
 
   char * buf = string.get_buffer(out);
   bool desired_output = buf && strcmp(buf, c.output) == 0;
   bool function_test  = c.fn ? c.fn(p, c, buf, &fn_err) : true;
 
-  Pkg.free(p);
+  cbuild_ctx.free(ctx);
+  free(key);
 
   if (error) {
     printf(RED    "%s\n" RESET, error);
@@ -409,6 +1626,39 @@ results_t run_tests(char * group_name, test_case cases[], size_t length) {
   return r;
 }
 
+static bool run_system(system_case c) {
+  printf(BOLD "  %s: \r" RESET, c.desc); fflush(stdout);
+  char * error = NULL;
+
+  if (c.fn(&error)) {
+    printf(GREEN "✓ " RESET BOLD "%s: \n" RESET, c.desc); fflush(stdout);
+    return true;
+  }
+
+  printf(RED "✕ " RESET BOLD "%s: \n\n" RESET, c.desc); fflush(stdout);
+  if (error != NULL) {
+    printf(RED    "%s\n\n" RESET, error);
+  }
+  free(error);
+  return false;
+}
+
+results_t run_systems(char * group_name, system_case cases[], size_t length) {
+  int i;
+  size_t passed = 0;
+  printf(BOLD "\n=== Test group " UNDERLINE "%s" RESET BOLD " ===\n\n" RESET, group_name);
+  for ( i = 0; i < length; i++) {
+    if (run_system(cases[i])) passed ++;
+  }
+  results_t r = {
+    .total  = length,
+    .passed = passed,
+  };
+  printf("%s", passed == length ? GREEN : RED);
+  printf("\n[%s] (%lu/%lu) tests passed\n" RESET, group_name, passed, length);
+  return r;
+}
+
 results_t combine_results(results_t a, results_t b) {
   a.total  += b.total;
   a.passed += b.passed;
@@ -422,6 +1672,7 @@ int main() {
   r = combine_results(run_tests("exports", exports, LEN(exports)), r);
   r = combine_results(run_tests("symbols", symbols, LEN(symbols)), r);
   r = combine_results(run_tests("imports", _imports, LEN(_imports)), r);
+  r = combine_results(run_systems("system", systems, LEN(systems)), r);
 
   printf("%s", r.passed == r.total ? GREEN : RED);
   printf("[all tests] (%lu/%lu) tests passed\n" RESET, r.passed, r.total);
@@ -0,0 +1,21 @@
+#ifndef _package_jobserver_
+#define _package_jobserver_
+
+#include <stdbool.h>
+
+typedef struct {
+	int    read_fd;   // non-blocking, so asking for a token never stalls the parse
+	int    write_fd;
+	bool   owner;     // write_fd was opened, or its pipe created, here
+	bool   own_read;  // read_fd was opened here, apart from the shared one
+	bool   idle;      // this process is done working itself, its implicit token is free
+} jobserver_t;
+
+jobserver_t * jobserver_join();
+jobserver_t * jobserver_new(long jobs);
+void jobserver_set_idle(jobserver_t * js, bool idle);
+bool jobserver_acquire(jobserver_t * js, int * token);
+void jobserver_release(jobserver_t * js, int token);
+void jobserver_free(jobserver_t * js);
+
+#endif
@@ -0,0 +1,179 @@
+package "jobserver";
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+export {
+#include <stdbool.h>
+}
+
+/*
+ * GNU make's jobserver: a pipe (or, since make 4.4, a named fifo) holding one byte per job
+ * that may run besides the ones already running. Every process in the build may run
+ * one job without asking, its implicit token; every job past that reads a byte first and
+ * writes the same byte back once it is done.
+ *
+ * Run from a `make -j` rule, cbuild takes its tokens from that make's jobserver through
+ * MAKEFLAGS. Run by itself, it is the jobserver for what it starts: a pipe with a token
+ * per job past the first, and MAKEFLAGS pointing at it for the make and the compilers.
+ */
+
+#define IMPLICIT 256
+
+export typedef struct {
+	int    read_fd;   // non-blocking, so asking for a token never stalls the parse
+	int    write_fd;
+	bool   owner;     // write_fd was opened, or its pipe created, here
+	bool   own_read;  // read_fd was opened here, apart from the shared one
+	bool   idle;      // this process is done working itself, its implicit token is free
+} jobserver_t as t;
+
+static bool valid(int fd) {
+	return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+}
+
+/*
+ * A descriptor of its own for reading the jobserver, which can be made non-blocking
+ * without changing the pipe for every other process that shares it.
+ */
+static void reopen(jobserver_t * js, int fd) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	int own = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+	js->read_fd  = own >= 0 ? own : fd;
+	js->own_read = own >= 0;
+}
+
+/* the jobserver MAKEFLAGS names, -1 if there is none or it wasn't passed down */
+static int inherit(jobserver_t * js) {
+	const char * flags = getenv("MAKEFLAGS");
+	if (flags == NULL) return -1;
+
+	// the last one wins, as it does for make; --jobserver-fds is what make before 4.2 wrote
+	const char * auth = NULL, * found = flags;
+	while ((found = strstr(found, "--jobserver-")) != NULL) {
+		if (strncmp(found, "--jobserver-auth=", 17) == 0) auth = found + 17;
+		if (strncmp(found, "--jobserver-fds=",  16) == 0) auth = found + 16;
+		found++;
+	}
+	if (auth == NULL) return -1;
+
+	if (strncmp(auth, "fifo:", 5) == 0) {
+		const char * end = strchr(auth, ' ');
+		size_t length = end ? (size_t) (end - auth - 5) : strlen(auth + 5);
+		char * path = strndup(auth + 5, length);
+
+		js->read_fd  = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		js->write_fd = open(path, O_WRONLY | O_CLOEXEC);
+		js->own_read = js->owner = true;
+		global.free(path);
+	} else {
+		int r, w;
+		if (sscanf(auth, "%d,%d", &r, &w) != 2 || !valid(r) || !valid(w)) {
+			fprintf(stderr, "warning: the jobserver in MAKEFLAGS wasn't passed down, "
+					"mark the rule running cbuild with '+' to share it\n");
+			return -1;
+		}
+		reopen(js, r);
+		js->write_fd = w;
+	}
+
+	return valid(js->read_fd) && valid(js->write_fd) ? 0 : -1;
+}
+
+/* a jobserver with `jobs` tokens, the implicit one included, passed on through MAKEFLAGS */
+static int create(jobserver_t * js, long jobs) {
+	int fds[2];
+	if (pipe(fds) != 0) return -1;
+
+	long i;
+	for (i = 1; i < jobs; i++) {
+		if (global.write(fds[1], "+", 1) != 1) break;
+	}
+
+	// fds[0] stays open as it is, for the make and compilers MAKEFLAGS points at it
+	reopen(js, fds[0]);
+	js->write_fd = fds[1];
+	js->owner    = true;
+
+	const char * old = getenv("MAKEFLAGS");
+	char * flags;
+	asprintf(&flags, "%s -j%ld --jobserver-auth=%d,%d", old ? old : "", jobs, fds[0], fds[1]);
+	setenv("MAKEFLAGS", flags, 1);
+	global.free(flags);
+	return 0;
+}
+
+/* the jobserver in MAKEFLAGS, NULL if cbuild wasn't run by a make with one */
+export jobserver_t * join() {
+	jobserver_t * js = calloc(1, sizeof(jobserver_t));
+	js->read_fd = js->write_fd = -1;
+	if (inherit(js) == 0) return js;
+
+	if (js->own_read && js->read_fd >= 0) close(js->read_fd);
+	if (js->owner   && js->write_fd >= 0) close(js->write_fd);
+	global.free(js);
+	return NULL;
+}
+
+/* a new jobserver for `jobs` jobs, NULL for a single one */
+export jobserver_t * new(long jobs) {
+	if (jobs < 2) return NULL;
+
+	jobserver_t * js = calloc(1, sizeof(jobserver_t));
+	if (create(js, jobs) == 0) return js;
+
+	global.free(js);
+	return NULL;
+}
+
+/* hands this process' own token over to jobs, once it has nothing left to do itself */
+export void set_idle(jobserver_t * js, bool idle) {
+	if (js) js->idle = idle;
+}
+
+/* a token for one more job if there is one free right now, false otherwise */
+export bool acquire(jobserver_t * js, int * token) {
+	if (js->idle) {
+		js->idle = false;
+		*token   = IMPLICIT;
+		return true;
+	}
+
+	unsigned char c;
+	ssize_t n;
+	do {
+		// a shared descriptor that couldn't be made non-blocking is polled first
+		struct pollfd pfd = { .fd = js->read_fd, .events = POLLIN };
+		if (poll(&pfd, 1, 0) != 1) return false;
+		n = global.read(js->read_fd, &c, 1);
+	} while (n < 0 && errno == EINTR);
+
+	if (n != 1) return false;
+	*token = c;
+	return true;
+}
+
+/* gives back a token acquire() handed out */
+export void release(jobserver_t * js, int token) {
+	if (token == IMPLICIT) {
+		js->idle = true;
+		return;
+	}
+
+	unsigned char c = (unsigned char) token;
+	while (global.write(js->write_fd, &c, 1) < 0 && errno == EINTR);
+}
+
+export void free(jobserver_t * js) {
+	if (js == NULL) return;
+	// an inherited pipe belongs to the make that passed it down
+	if (js->own_read && js->read_fd >= 0) close(js->read_fd);
+	if (js->owner && js->write_fd >= 0) close(js->write_fd);
+	global.free(js);
+}
@@ -0,0 +1,87 @@
+#ifndef _package_stats_
+#define _package_stats_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "../lexer/item.h"
+
+/*
+ * Hot path counters. They only ever touch `stats_current`: when cbuild is built without
+ * CBUILD_STATS they expand to nothing, and when it is built with them but run without
+ * --stats `stats_current` stays NULL. enter() points it into the registry of the build
+ * context whose work runs next, and it is per thread: --lex-threads workers count into
+ * stats of their own, which add() gives to the package once they are joined.
+ * STATS_BUFFER only counts the token and text buffers of the lexer and the exports' type
+ * strings, not the parser's, the hash tables' or the paths'.
+ */
+#ifdef CBUILD_STATS
+#define STATS_ADD(counter, n)     do { if (stats_current) stats_current->counters[counter] += (n); } while (0)
+#define STATS_TOKEN(type)         do { if (stats_current) stats_current->tokens[type]++; } while (0)
+#define STATS_BUFFER(bytes)       do { STATS_ADD(stat_buffers, 1); STATS_ADD(stat_buffer_bytes, bytes); } while (0)
+#define STATS_LOOKUP(table, hit)  do { STATS_ADD(stat_##table##_lookups, 1); if (!(hit)) STATS_ADD(stat_##table##_misses, 1); } while (0)
+#else
+#define STATS_ADD(counter, n)     do { } while (0)
+#define STATS_TOKEN(type)         do { } while (0)
+#define STATS_BUFFER(bytes)       do { } while (0)
+#define STATS_LOOKUP(table, hit)  do { } while (0)
+#endif
+
+enum stats_counter {
+	stat_bytes_read = 0,
+	stat_backups,
+	stat_symbols_lookups,
+	stat_symbols_misses,
+	stat_exports_lookups,
+	stat_exports_misses,
+	stat_deps_lookups,
+	stat_deps_misses,
+	stat_paths_lookups,
+	stat_paths_misses,
+	stat_buffers,
+	stat_buffer_bytes,
+	stat_files_written,
+	stat_files_skipped,
+	stat_total,
+};
+
+enum stats_phase {
+	phase_parse = 0,
+	phase_headers,
+	phase_makefile,
+	phase_build,
+	phase_total,
+};
+
+typedef struct {
+	char   * name;
+	size_t   counters[stat_total];
+	size_t   tokens[item_total_symbols];
+	double   phases[phase_total];
+} stats_t;
+
+typedef struct {
+	stats_t    ** all;    // all[0] is the build's own, for what no package is charged with
+	size_t        n_all;
+	stats_t     * active; // charged with the time since `mark`
+	enum stats_phase    in;
+	double        mark;
+} stats_registry_t;
+
+typedef struct {
+	stats_registry_t * registry;
+	stats_t    * counting;
+	stats_t    * active;
+	enum stats_phase   in;
+} stats_frame_t;
+
+extern __thread stats_t * stats_current;
+stats_t * stats_new(stats_registry_t * reg, const char * name);
+void stats_add(stats_t * into, const stats_t * from);
+stats_registry_t * stats_start();
+stats_frame_t stats_enter(stats_registry_t * reg, stats_t * s, enum stats_phase p);
+void stats_leave(stats_frame_t previous);
+void stats_report(stats_registry_t * reg, FILE * f);
+void stats_free(stats_registry_t * reg);
+
+#endif
@@ -0,0 +1,251 @@
+package "stats";
+
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+export {
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "../lexer/item.h"
+
+/*
+ * Hot path counters. They only ever touch `stats_current`: when cbuild is built without
+ * CBUILD_STATS they expand to nothing, and when it is built with them but run without
+ * --stats `stats_current` stays NULL. enter() points it into the registry of the build
+ * context whose work runs next, and it is per thread: --lex-threads workers count into
+ * stats of their own, which add() gives to the package once they are joined.
+ * STATS_BUFFER only counts the token and text buffers of the lexer and the exports' type
+ * strings, not the parser's, the hash tables' or the paths'.
+ */
+#ifdef CBUILD_STATS
+#define STATS_ADD(counter, n)     do { if (stats_current) stats_current->counters[counter] += (n); } while (0)
+#define STATS_TOKEN(type)         do { if (stats_current) stats_current->tokens[type]++; } while (0)
+#define STATS_BUFFER(bytes)       do { STATS_ADD(stat_buffers, 1); STATS_ADD(stat_buffer_bytes, bytes); } while (0)
+#define STATS_LOOKUP(table, hit)  do { STATS_ADD(stat_##table##_lookups, 1); if (!(hit)) STATS_ADD(stat_##table##_misses, 1); } while (0)
+#else
+#define STATS_ADD(counter, n)     do { } while (0)
+#define STATS_TOKEN(type)         do { } while (0)
+#define STATS_BUFFER(bytes)       do { } while (0)
+#define STATS_LOOKUP(table, hit)  do { } while (0)
+#endif
+}
+
+import lex_item from "../lexer/item.module.c";
+import utils    from "./utils.module.c";
+
+export enum counter {
+	stat_bytes_read = 0,
+	stat_backups,
+	stat_symbols_lookups,
+	stat_symbols_misses,
+	stat_exports_lookups,
+	stat_exports_misses,
+	stat_deps_lookups,
+	stat_deps_misses,
+	stat_paths_lookups,
+	stat_paths_misses,
+	stat_buffers,
+	stat_buffer_bytes,
+	stat_files_written,
+	stat_files_skipped,
+	stat_total,
+};
+
+export enum phase {
+	phase_parse = 0,
+	phase_headers,
+	phase_makefile,
+	phase_build,
+	phase_total,
+};
+
+static const char * phase_names[phase_total] = {
+	"parse",
+	"headers",
+	"makefile",
+	"build",
+};
+
+export typedef struct {
+	char   * name;
+	size_t   counters[stat_total];
+	size_t   tokens[item_total_symbols];
+	double   phases[phase_total];
+} stats_t as t;
+
+/* the stats of one build, a build context's; only the thread running it touches them */
+export typedef struct {
+	stats_t    ** all;    // all[0] is the build's own, for what no package is charged with
+	size_t        n_all;
+	stats_t     * active; // charged with the time since `mark`
+	enum phase    in;
+	double        mark;
+} registry_t;
+
+export typedef struct {
+	registry_t * registry;
+	stats_t    * counting;
+	stats_t    * active;
+	enum phase   in;
+} frame_t;
+
+export extern __thread stats_t * current;
+__thread stats_t * current = NULL;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* NULL without a registry, the counters of `name` are then dropped */
+export stats_t * new(registry_t * reg, const char * name) {
+	if (reg == NULL) return NULL;
+
+	stats_t * s = calloc(1, sizeof(stats_t));
+	s->name = strdup(name);
+
+	reg->all = realloc(reg->all, sizeof(stats_t *) * (reg->n_all + 1));
+	reg->all[reg->n_all++] = s;
+	return s;
+}
+
+/* adds the counters of `from`, kept by a thread that has been joined, to `into` */
+export void add(stats_t * into, const stats_t * from) {
+	int i;
+	for (i = 0; i < stat_total;         i++) into->counters[i] += from->counters[i];
+	for (i = 0; i < item_total_symbols; i++) into->tokens[i]   += from->tokens[i];
+}
+
+/* a registry for --stats, whose build stats are counted into from now on, or NULL if it is unavailable */
+export registry_t * start() {
+#ifdef CBUILD_STATS
+	registry_t * reg = calloc(1, sizeof(registry_t));
+	reg->active = new(reg, "(build)");
+	reg->in     = phase_parse;
+	reg->mark   = now();
+	current     = reg->active;
+	return reg;
+#else
+	fprintf(stderr, "warning: cbuild was built without CBUILD_STATS, --stats is unavailable\n");
+	return NULL;
+#endif
+}
+
+static void charge(registry_t * reg) {
+	double t = now();
+	if (reg->active) reg->active->phases[reg->in] += t - reg->mark;
+	reg->mark = t;
+}
+
+/*
+ * charges the time since the last switch to the active stats of `reg`, then makes `s`,
+ * or the build's own for NULL, active and counted into. Without a registry nothing is
+ * counted until leave().
+ */
+export frame_t enter(registry_t * reg, stats_t * s, enum phase p) {
+	frame_t previous = { .registry = reg, .counting = current };
+	if (reg == NULL) {
+		current = NULL;
+		return previous;
+	}
+
+	previous.active = reg->active;
+	previous.in     = reg->in;
+	charge(reg);
+
+	if (s == NULL) s = reg->all[0];
+	reg->active = s;
+	reg->in     = p;
+	current     = s;
+	return previous;
+}
+
+export void leave(frame_t previous) {
+	current = previous.counting;
+
+	registry_t * reg = previous.registry;
+	if (reg == NULL) return;
+	charge(reg);
+	reg->active = previous.active;
+	reg->in     = previous.in;
+}
+
+static void print(FILE * f, stats_t * s) {
+	size_t * c = s->counters;
+	size_t tokens = 0;
+	int i;
+
+	for (i = 0; i < item_total_symbols; i++) tokens += s->tokens[i];
+
+	fprintf(f, "%s\n", s->name);
+	fprintf(f, "  input        %zu bytes\n", c[stat_bytes_read]);
+	fprintf(f, "  tokens       %zu", tokens);
+
+	const char * sep = "  (";
+	for (i = 0; i < item_total_symbols; i++) {
+		if (s->tokens[i] == 0) continue;
+		fprintf(f, "%s%s %zu", sep, lex_item.type_names[i], s->tokens[i]);
+		sep = ", ";
+	}
+	fprintf(f, "%s\n", tokens ? ")" : "");
+
+	fprintf(f, "  pushbacks    %zu\n", c[stat_backups]);
+	fprintf(f, "  lookups      symbols %zu (%zu missed), exports %zu (%zu missed), deps %zu (%zu missed), paths %zu (%zu missed)\n",
+			c[stat_symbols_lookups], c[stat_symbols_misses],
+			c[stat_exports_lookups], c[stat_exports_misses],
+			c[stat_deps_lookups],    c[stat_deps_misses],
+			c[stat_paths_lookups],   c[stat_paths_misses]
+	);
+	fprintf(f, "  buffers      %zu token, text and type buffers (%zu bytes)\n", c[stat_buffers], c[stat_buffer_bytes]);
+	fprintf(f, "  files        %zu written, %zu skipped\n", c[stat_files_written], c[stat_files_skipped]);
+	fprintf(f, "  time        ");
+	for (i = 0; i < phase_total; i++) {
+		fprintf(f, "%s %s %.3f ms", i == 0 ? "" : ",", phase_names[i], s->phases[i]);
+	}
+	fprintf(f, "\n\n");
+}
+
+export void report(registry_t * reg, FILE * f) {
+	if (reg == NULL) return;
+	charge(reg);
+
+	stats_t total = { .name = "total" };
+	char * cwd  = getcwd(NULL, 0);
+	char * base = NULL;
+	asprintf(&base, "%s/", cwd);
+
+	size_t i;
+	int j;
+	for (i = 0; i < reg->n_all; i++) {
+		stats_t * s = reg->all[i];
+		for (j = 0; j < stat_total;         j++) total.counters[j] += s->counters[j];
+		for (j = 0; j < item_total_symbols; j++) total.tokens[j]   += s->tokens[j];
+		for (j = 0; j < phase_total;        j++) total.phases[j]   += s->phases[j];
+
+		if (s->name[0] == '/') {
+			char * rel = utils.relative(base, s->name);
+			global.free(s->name);
+			s->name = rel;
+		}
+		print(f, s);
+	}
+	print(f, &total);
+
+	global.free(base);
+	global.free(cwd);
+}
+
+export void free(registry_t * reg) {
+	if (reg == NULL) return;
+
+	size_t i;
+	for (i = 0; i < reg->n_all; i++) {
+		if (current == reg->all[i]) current = NULL;
+		global.free(reg->all[i]->name);
+		global.free(reg->all[i]);
+	}
+	global.free(reg->all);
+	global.free(reg);
+}
@@ -0,0 +1,356 @@
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <stdbool.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+#define URING_MAX_CHAIN 8
+
+
+/*
+ * A small io_uring driver, talking to the kernel directly so cbuild doesn't grow a
+ * dependency on liburing. Each ring belongs to whoever made it with new(), a build
+ * context, so disabling one leaves the others alone.
+ *
+ * Work is queued as chains of linked requests. A chain's completion callback runs
+ * once every request in it has completed, which may be long after the caller has moved
+ * on: nothing is waited for until the ring runs out of room, someone calls wait() on a
+ * specific chain, or drain() is called. new() returns NULL when not on Linux, on old
+ * kernels or under seccomp, and available() is false for a NULL ring, so callers use
+ * plain syscalls instead. If the kernel refuses the ring later on, it is disabled: what
+ * it hadn't taken yet is run with plain syscalls and available() turns false. Only new(),
+ * available(), drain() and free() exist outside of Linux.
+ *
+ * Sources are read with plain syscalls. Imports are only known one at a time as the
+ * parser reaches them, so a read through the ring had to be waited for right away, and
+ * that measured slower than read(2).
+ */
+
+#define RING_SIZE   256
+
+typedef struct ring_s uring_t;
+typedef void (*uring_done_fn)(void * ctx, int * results, int n);
+
+typedef struct {
+	uring_done_fn   done;
+	void    * ctx;
+	int       n;
+	int       pending;
+	int       results[URING_MAX_CHAIN];
+} uring_chain_t;
+
+#ifdef __linux__
+
+typedef struct io_uring_sqe uring_sqe_t;
+
+struct ring_s {
+	int        fd;
+	int        state;    // 1: usable, -1: disabled
+	char     * mem;      // the rings, mapped once
+	size_t     mem_len;
+
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned   sq_entries;
+	unsigned   queued;   // prepared but not yet handed to the kernel
+	struct io_uring_sqe * sqes;
+
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	unsigned   cq_entries;
+	unsigned   inflight; // handed to the kernel but not yet reaped
+	struct io_uring_cqe * cqes;
+};
+
+static const int required_ops[] = {
+	IORING_OP_WRITE,
+	IORING_OP_FSYNC,
+	IORING_OP_CLOSE,
+	IORING_OP_LINKAT,
+	IORING_OP_RENAMEAT,
+};
+
+static bool probe(int fd) {
+	size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe * p = calloc(1, len);
+
+	bool ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, p, 256) == 0;
+	int i;
+	for (i = 0; ok && i < sizeof(required_ops) / sizeof(required_ops[0]); i++) {
+		int op = required_ops[i];
+		ok = op <= p->last_op && (p->ops[op].flags & IO_URING_OP_SUPPORTED);
+	}
+
+	free(p);
+	return ok;
+}
+
+static bool setup(uring_t * ring) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = syscall(__NR_io_uring_setup, RING_SIZE, &params);
+	if (fd < 0) return false;
+
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !probe(fd)) {
+		close(fd);
+		return false;
+	}
+
+	size_t sq_len   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_len   = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+	size_t ring_len = sq_len > cq_len ? sq_len : cq_len;
+
+	char * r = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (r == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	struct io_uring_sqe * sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		munmap(r, ring_len);
+		close(fd);
+		return false;
+	}
+
+	ring->fd         = fd;
+	ring->mem        = r;
+	ring->mem_len    = ring_len;
+	ring->sq_tail    = (unsigned *)(r + params.sq_off.tail);
+	ring->sq_mask    = (unsigned *)(r + params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+	ring->sqes       = sqes;
+	ring->cq_head    = (unsigned *)(r + params.cq_off.head);
+	ring->cq_tail    = (unsigned *)(r + params.cq_off.tail);
+	ring->cq_mask    = (unsigned *)(r + params.cq_off.ring_mask);
+	ring->cq_entries = params.cq_entries;
+	ring->cqes       = (struct io_uring_cqe *)(r + params.cq_off.cqes);
+
+	// sqes are used in ring order, so the indirection array is fixed
+	unsigned * array = (unsigned *)(r + params.sq_off.array);
+	unsigned i;
+	for (i = 0; i < ring->sq_entries; i++) array[i] = i;
+
+	return true;
+}
+
+/* the request `user_data` names completed with `res`, its chain's callback runs once all of them have */
+static void complete(uint64_t user_data, int res) {
+	uring_chain_t * c    = (uring_chain_t *)(uintptr_t)(user_data & ~(uint64_t)7);
+	int       step = user_data & 7;
+
+	c->results[step] = res;
+	if (--c->pending == 0 && c->done) c->done(c->ctx, c->results, c->n);
+}
+
+static void reap(uring_t * r) {
+	unsigned head = *r->cq_head;
+	while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe * cqe = &r->cqes[head & *r->cq_mask];
+		uint64_t user_data = cqe->user_data;
+		int      res       = cqe->res;
+		r->inflight--;
+
+		// release the slot before the callback, it may queue more work
+		__atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+		complete(user_data, res);
+		head = *r->cq_head;
+	}
+}
+
+/* what the kernel would have done for `sqe`, with plain syscalls */
+static int run(uring_sqe_t * sqe) {
+	const char * from = (const char *)(uintptr_t) sqe->addr;
+	const char * to   = (const char *)(uintptr_t) sqe->addr2;
+	int e;
+	switch (sqe->opcode) {
+		case IORING_OP_WRITE:
+			e = pwrite(sqe->fd, from, sqe->len, sqe->off);
+			break;
+		case IORING_OP_FSYNC:
+			e = fsync(sqe->fd);
+			break;
+		case IORING_OP_LINKAT:
+			e = linkat(sqe->fd, from, sqe->len, to, sqe->hardlink_flags);
+			break;
+		case IORING_OP_RENAMEAT:
+			e = renameat(sqe->fd, from, sqe->len, to);
+			break;
+		case IORING_OP_CLOSE:
+			e = close(sqe->fd);
+			break;
+		default:
+			errno = EINVAL;
+			e     = -1;
+	}
+	return e < 0 ? -errno : e;
+}
+
+/*
+ * The kernel refused `r` with `error`. The `queued` requests it didn't take are run here
+ * in order, with a link's failure cancelling the rest of its chain as it would have, and
+ * the ones it took are waited for, then nothing goes through `r` anymore.
+ */
+static void disable(uring_t * r, int error, unsigned queued) {
+	fprintf(stderr, "warning: io_uring failed (%s), using plain syscalls\n", strerror(error));
+	r->state = -1;
+
+	unsigned tail = *r->sq_tail;
+	unsigned i;
+	bool cancelled = false;
+	for (i = tail - queued; i != tail; i++) {
+		uring_sqe_t * sqe = &r->sqes[i & *r->sq_mask];
+		int res = cancelled ? -ECANCELED : run(sqe);
+		bool failed = res < 0 || (sqe->opcode == IORING_OP_WRITE && res != sqe->len);
+
+		if (!(sqe->flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK))) {
+			cancelled = false;
+		} else if (failed && !(sqe->flags & IOSQE_IO_HARDLINK)) {
+			cancelled = true;
+		}
+		complete(sqe->user_data, res);
+	}
+	r->queued = 0;
+
+	// the kernel still completes them, the syscalls in between let it deliver them
+	struct timespec pause = { 0, 1000000 };
+	reap(r);
+	while (r->inflight) {
+		nanosleep(&pause, NULL);
+		reap(r);
+	}
+}
+
+static void enter(uring_t * r, unsigned min_complete) {
+	unsigned submit = r->queued;
+	if (submit) __atomic_store_n(r->sq_tail, *r->sq_tail + submit, __ATOMIC_RELEASE);
+
+	while (true) {
+		int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+		int e = syscall(__NR_io_uring_enter, r->fd, submit, min_complete, flags, NULL, 0);
+		if (e >= 0) {
+			r->inflight += submit;
+			r->queued    = 0;
+			break;
+		}
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			disable(r, errno, submit);
+			return;
+		}
+		reap(r);
+	}
+	reap(r);
+}
+
+/* hands everything queued so far to the kernel without waiting for it */
+void uring_submit(uring_t * r) {
+	if (r->state == 1 && r->queued) enter(r, 0);
+}
+
+/*
+ * starts a chain of up to `n` requests, making sure they will all fit in one submission.
+ * Returns false if the ring was disabled while making room, the caller has to do the
+ * work with plain syscalls then.
+ */
+bool uring_begin(uring_t * r, uring_chain_t * c, int n, uring_done_fn done, void * ctx) {
+	while (r->state == 1 && (r->queued + n > r->sq_entries || r->inflight + r->queued + n > r->cq_entries)) {
+		enter(r, r->inflight ? 1 : 0);
+	}
+
+	c->done    = done;
+	c->ctx     = ctx;
+	c->n       = 0;
+	c->pending = 0;
+	return r->state == 1;
+}
+
+/*
+ * the next request of `c`, `flags` should include IOSQE_IO_LINK on all but the last one.
+ * NULL once the ring is disabled, which only begin() can have done.
+ */
+uring_sqe_t * uring_push(uring_t * r, uring_chain_t * c, int opcode, int flags) {
+	if (r->state != 1) return NULL;
+
+	unsigned index = (*r->sq_tail + r->queued++) & *r->sq_mask;
+	uring_sqe_t * sqe = &r->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode    = opcode;
+	sqe->flags     = flags;
+	sqe->user_data = (uint64_t)(uintptr_t) c | c->n;
+
+	c->results[c->n++] = 0;
+	c->pending++;
+	return sqe;
+}
+
+void uring_wait(uring_t * r, uring_chain_t * c) {
+	while (r->state == 1 && c->pending) enter(r, 1);
+}
+
+#endif
+
+/* waits for everything that has been queued so far on `r` */
+void uring_drain(uring_t * r) {
+#ifdef __linux__
+	if (r == NULL) return;
+	while (r->state == 1 && (r->queued || r->inflight)) enter(r, r->inflight ? 1 : 0);
+#endif
+}
+
+bool uring_available(uring_t * r) {
+#ifdef __linux__
+	return r != NULL && r->state == 1;
+#else
+	return false;
+#endif
+}
+
+/*
+ * io_uring is opt in: with a single core the kernel workers that run opens, links and
+ * renames compete with the parser, which costs more than the saved syscalls. Returns
+ * NULL if it can't be used here.
+ */
+uring_t * uring_new() {
+#ifdef __linux__
+	uring_t * r = calloc(1, sizeof(uring_t));
+	if (r == NULL) return NULL;
+	if (!setup(r)) {
+		free(r);
+		return NULL;
+	}
+	r->state = 1;
+	return r;
+#else
+	return NULL;
+#endif
+}
+
+/* waits for what `r` still has queued and releases it */
+void uring_free(uring_t * r) {
+	if (r == NULL) return;
+#ifdef __linux__
+	uring_drain(r);
+	munmap(r->sqes, r->sq_entries * sizeof(struct io_uring_sqe));
+	munmap(r->mem, r->mem_len);
+	close(r->fd);
+#endif
+	free(r);
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef _package_uring_
+#define _package_uring_
+
+#include <stdbool.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+#define URING_MAX_CHAIN 8
+
+typedef struct ring_s uring_t;
+typedef void (*uring_done_fn)(void * ctx, int * results, int n);
+
+typedef struct {
+	uring_done_fn   done;
+	void    * ctx;
+	int       n;
+	int       pending;
+	int       results[URING_MAX_CHAIN];
+} uring_chain_t;
+
+typedef struct io_uring_sqe uring_sqe_t;
+
+void uring_submit(uring_t * r);
+bool uring_begin(uring_t * r, uring_chain_t * c, int n, uring_done_fn done, void * ctx);
+uring_sqe_t * uring_push(uring_t * r, uring_chain_t * c, int opcode, int flags);
+void uring_wait(uring_t * r, uring_chain_t * c);
+void uring_drain(uring_t * r);
+bool uring_available(uring_t * r);
+uring_t * uring_new();
+void uring_free(uring_t * r);
+
+#endif